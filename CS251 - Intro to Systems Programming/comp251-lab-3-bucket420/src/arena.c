@@ -0,0 +1,65 @@
+#include "arena.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define ARENA_ALIGN 8
+
+// Slab header; the slab's memory follows it.
+typedef struct slab_t {
+  struct slab_t *next; // previously filled slab
+  size_t size;         // bytes of memory following the header
+  size_t used;         // bytes handed out so far
+} slab_t;
+
+struct arena_t {
+  slab_t *slabs;    // current slab, followed by older ones
+  size_t slab_size; // size of a regular slab
+  uint64_t bytes;   // total bytes of all slabs, including headers
+};
+
+arena_t *arena_create(size_t slab_size) {
+  arena_t *arena = calloc(1, sizeof(arena_t));
+  assert(arena);
+  arena->slab_size = slab_size;
+  return arena;
+}
+
+// Pushes a new slab with room for at least size bytes.
+static void arena_grow(arena_t *arena, size_t size) {
+  if (size < arena->slab_size)
+    size = arena->slab_size;
+  slab_t *slab = malloc(sizeof(slab_t) + size);
+  assert(slab);
+  slab->size = size;
+  slab->used = 0;
+  slab->next = arena->slabs;
+  arena->slabs = slab;
+  arena->bytes += sizeof(slab_t) + size;
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+  size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+  slab_t *slab = arena->slabs;
+  if (!slab || slab->size - slab->used < size) {
+    arena_grow(arena, size);
+    slab = arena->slabs;
+  }
+  void *p = (char *)(slab + 1) + slab->used;
+  slab->used += size;
+  return p;
+}
+
+void arena_free(arena_t **arena) {
+  slab_t *slab = (*arena)->slabs;
+  while (slab) {
+    slab_t *next = slab->next;
+    free(slab);
+    slab = next;
+  }
+  free(*arena);
+  *arena = NULL;
+}
+
+uint64_t arena_bytes(arena_t *arena) { return arena->bytes; }
@@ -0,0 +1,42 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Bump allocator. Memory is carved out of large slabs and is only released all
+// at once, by arena_free.
+//
+// Usage:
+//
+//  arena_t *arena = arena_create(slab_size);
+//  char *p = arena_alloc(arena, n);
+//  arena_free(&arena);
+
+// Forward declaration of arena type.
+typedef struct arena_t arena_t;
+
+// Creates an arena that allocates slabs of slab_size bytes. Requests larger
+// than a slab get a slab of their own.
+//
+// Caller owns returned pointer; must be freed with arena_free.
+arena_t *arena_create(size_t slab_size);
+
+// Allocates size bytes, aligned to 8 bytes. Never returns NULL.
+void *arena_alloc(arena_t *arena, size_t size);
+
+// Frees every slab and the arena. arena will be NULL upon return.
+void arena_free(arena_t **arena);
+
+// Returns the number of bytes reserved by the arena's slabs.
+uint64_t arena_bytes(arena_t *arena);
+
+// Estimated heap footprint of a plain malloc(size), for comparison with arena
+// storage. Assumes a glibc-style allocator: an 8-byte chunk header, 16-byte
+// alignment and 32-byte minimum chunks.
+static inline uint64_t malloc_footprint(size_t size) {
+  size_t chunk = (size + 8 + 15) & ~(size_t)15;
+  return chunk < 32 ? 32 : chunk;
+}
+
+#endif
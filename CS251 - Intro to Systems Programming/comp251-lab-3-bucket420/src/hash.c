@@ -0,0 +1,151 @@
+#include "hash.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+// Constants from wyhash; any odd 64-bit constants with mixed bits would do.
+#define WIDE_K0 0xa0761d6478bd642full
+#define WIDE_K1 0xe7037ed1a0b428dbull
+#define WIDE_K2 0x8ebc6af09c88c6e3ull
+
+// Multiplier for the final avalanche of the CRC hash.
+#define CRC_MUL 0x9e3779b97f4a7c15ull
+
+// Reads 8 bytes (little-endian on x86) without alignment requirements.
+static inline uint64_t load64(const char *p) {
+  uint64_t w;
+  memcpy(&w, p, sizeof(w));
+  return w;
+}
+
+// Reads the last len < 8 bytes into the low bytes of a word.
+static inline uint64_t load_tail(const char *p, size_t len) {
+  uint64_t w = 0;
+  memcpy(&w, p, len);
+  return w;
+}
+
+uint64_t hash_fnv64(const char *key, size_t len) {
+  // fnv64 from fnv64.h, bounded by len instead of a null terminator.
+  int64_t h = 0xcbf29ce484222325;
+  for (size_t i = 0; i < len; i++) {
+    h = h + (h << 1) + (h << 4) + (h << 5) + (h << 7) + (h << 8) + (h << 40);
+    h = h ^ key[i];
+  }
+  return h;
+}
+
+// Multiplies a and b and folds the 128-bit product into 64 bits.
+static inline uint64_t mix(uint64_t a, uint64_t b) {
+  unsigned __int128 r = (unsigned __int128)a * b;
+  return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+uint64_t hash_wide(const char *key, size_t len) {
+  uint64_t h = WIDE_K0 ^ len;
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    h = mix(load64(key + i) ^ WIDE_K1, load64(key + i + 8) ^ h);
+  }
+  uint64_t a = 0, b = 0;
+  if (len - i >= 8) {
+    a = load64(key + i);
+    b = load_tail(key + i + 8, len - i - 8);
+  } else {
+    a = load_tail(key + i, len - i);
+  }
+  h = mix(a ^ WIDE_K1, b ^ h);
+  return mix(h ^ WIDE_K2, len ^ WIDE_K1);
+}
+
+// Byte-at-a-time CRC32C (Castagnoli) table, filled in once on first use.
+static uint32_t crc_table[256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+static void crc_table_init() {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k++) {
+      c = c & 1 ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+    }
+    crc_table[i] = c;
+  }
+}
+
+static inline uint32_t crc32c_word_sw(uint32_t crc, uint64_t w) {
+  for (int k = 0; k < 8; k++) {
+    crc = crc_table[(crc ^ w) & 0xff] ^ (crc >> 8);
+    w >>= 8;
+  }
+  return crc;
+}
+
+// Runs both CRC chains over the key. The second chain sees each word rotated
+// by 32 bits, so that the two halves of the result are not equal.
+static uint64_t crc32c_sw(const char *key, size_t len) {
+  pthread_once(&crc_table_once, crc_table_init);
+  uint32_t a = 0, b = 0xffffffff;
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t w = load64(key + i);
+    a = crc32c_word_sw(a, w);
+    b = crc32c_word_sw(b, (w >> 32) | (w << 32));
+  }
+  uint64_t w = load_tail(key + i, len - i) ^ len;
+  a = crc32c_word_sw(a, w);
+  b = crc32c_word_sw(b, (w >> 32) | (w << 32));
+  return ((uint64_t)a << 32) | b;
+}
+
+__attribute__((target("sse4.2"))) static uint64_t crc32c_hw(const char *key,
+                                                              size_t len) {
+  uint64_t a = 0, b = 0xffffffff;
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t w = load64(key + i);
+    a = __builtin_ia32_crc32di(a, w);
+    b = __builtin_ia32_crc32di(b, (w >> 32) | (w << 32));
+  }
+  uint64_t w = load_tail(key + i, len - i) ^ len;
+  a = __builtin_ia32_crc32di(a, w);
+  b = __builtin_ia32_crc32di(b, (w >> 32) | (w << 32));
+  return (a << 32) | b;
+}
+
+uint64_t hash_crc32c(const char *key, size_t len) {
+  uint64_t crc = __builtin_cpu_supports("sse4.2") ? crc32c_hw(key, len)
+                                                  : crc32c_sw(key, len);
+  // CRCs are linear; multiply so every output bit depends on every input bit.
+  crc *= CRC_MUL;
+  return crc ^ (crc >> 29);
+}
+
+// Known hash functions, by name.
+static const struct {
+  const char *name;
+  hash_fn_t fn;
+} hashes[] = {
+    {"fnv64", hash_fnv64},
+    {"wide", hash_wide},
+    {"crc32c", hash_crc32c},
+};
+
+int hash_parse(const char *name, hash_fn_t *fn) {
+  for (int i = 0; i < sizeof(hashes) / sizeof(hashes[0]); i++) {
+    if (strcmp(name, hashes[i].name) == 0) {
+      *fn = hashes[i].fn;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+const char *hash_name(hash_fn_t fn) {
+  for (int i = 0; i < sizeof(hashes) / sizeof(hashes[0]); i++) {
+    if (fn == hashes[i].fn) {
+      return hashes[i].name;
+    }
+  }
+  return "custom";
+}
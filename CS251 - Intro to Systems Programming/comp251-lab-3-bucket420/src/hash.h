@@ -0,0 +1,33 @@
+#ifndef __HASH_H__
+#define __HASH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// String hash functions for the map.
+//
+// Every function hashes the len bytes at key (key does not need to be
+// null-terminated). They can be passed to the map as map_config_t.hash.
+//
+// - hash_fnv64:  the original fnv64, one byte per iteration.
+// - hash_wide:   reads 16 bytes per iteration and mixes them with 64x64->128
+//                bit multiplies.
+// - hash_crc32c: two interleaved CRC32C chains over 8-byte words. Uses the
+//                SSE4.2 crc32 instruction when the CPU has it and a table
+//                otherwise; both give the same result.
+
+// Hash function signature.
+typedef uint64_t (*hash_fn_t)(const char *key, size_t len);
+
+uint64_t hash_fnv64(const char *key, size_t len);
+uint64_t hash_wide(const char *key, size_t len);
+uint64_t hash_crc32c(const char *key, size_t len);
+
+// Parses a hash name ("fnv64", "wide" or "crc32c"), as used by the test
+// programs' command line flags. Returns nonzero on success.
+int hash_parse(const char *name, hash_fn_t *fn);
+
+// Returns the name of a hash function, or "custom" for unknown functions.
+const char *hash_name(hash_fn_t fn);
+
+#endif
@@ -0,0 +1,189 @@
+// Hash Bench. Compares the hash functions in hash.h.
+//
+// Reads the words of the given files (normalized like word_count does) and,
+// for each hash function, reports:
+//
+// - raw hashing throughput over every word, in ns per word and MB/s;
+// - the time to count the words with a chaining map of fixed size using the
+//   hash; and
+// - the max_depth and probes/lookup of that map, as a measure of how evenly
+//   the hash spreads real keys over buckets.
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hash.h"
+#include "map.h"
+#include "strip.h"
+
+#define MAX_TOKEN_LEN 1024
+#define MAP_SIZE 1024
+#define DEFAULT_REPS 20
+
+// Hash functions to compare, by name.
+static const char *hash_names[] = {"fnv64", "wide", "crc32c"};
+
+// All words, stored back to back with their null terminators.
+typedef struct words_t {
+  char *buf;       // word storage
+  size_t buf_len;  // bytes used in buf
+  size_t buf_cap;  // size of buf
+  size_t *offs;    // offset of each word in buf
+  uint32_t *lens;  // length of each word
+  size_t n;        // number of words
+  size_t cap;      // size of offs and lens
+} words_t;
+
+void usage() {
+  printf("Usage: hash_bench [-s <size>] [-n <reps>] <file>...\n"
+         "Options:\n"
+         "\t-s <size>  Size of the map used to measure max_depth\n"
+         "\t-n <reps>  Passes over the words when timing raw hashing\n");
+}
+
+// Returns the current time in seconds.
+double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void add_word(words_t *w, const char *word) {
+  size_t len = strlen(word);
+  if (w->n == w->cap) {
+    w->cap = w->cap ? w->cap * 2 : 1024;
+    w->offs = realloc(w->offs, w->cap * sizeof(size_t));
+    w->lens = realloc(w->lens, w->cap * sizeof(uint32_t));
+    assert(w->offs && w->lens);
+  }
+  while (w->buf_len + len + 1 > w->buf_cap) {
+    w->buf_cap = w->buf_cap ? w->buf_cap * 2 : 64 * 1024;
+    w->buf = realloc(w->buf, w->buf_cap);
+    assert(w->buf);
+  }
+  memcpy(w->buf + w->buf_len, word, len + 1);
+  w->offs[w->n] = w->buf_len;
+  w->lens[w->n] = len;
+  w->buf_len += len + 1;
+  w->n++;
+}
+
+void read_words(words_t *w, const char *fname) {
+  char buff[MAX_TOKEN_LEN];
+  FILE *f = fopen(fname, "r");
+  if (!f) {
+    perror(fname);
+    exit(1);
+  }
+  while (fscanf(f, "%1023s", buff) != EOF) {
+    lower_and_strip(buff);
+    if (strlen(buff)) {
+      add_word(w, buff);
+    }
+  }
+  fclose(f);
+}
+
+// Times reps passes of hashing every word. Returns seconds per pass.
+double time_hash(words_t *w, hash_fn_t hash, int reps) {
+  volatile uint64_t sink = 0;
+  double start = now();
+  for (int r = 0; r < reps; r++) {
+    uint64_t acc = 0;
+    for (size_t i = 0; i < w->n; i++) {
+      acc ^= hash(w->buf + w->offs[i], w->lens[i]);
+    }
+    sink ^= acc;
+  }
+  (void)sink;
+  return (now() - start) / reps;
+}
+
+// Counts the words with a fixed-size chaining map using hash. Returns the time
+// taken and leaves the map's metrics in *out.
+double count_words(words_t *w, hash_fn_t hash, uint32_t size,
+                   map_metrics_t *out) {
+  map_config_t config = {size, MAP_BACKEND_CHAINING, 0, 0, hash};
+  map_t *map = map_create_with(config);
+  double start = now();
+  for (size_t i = 0; i < w->n; i++) {
+    const char *word = w->buf + w->offs[i];
+    void *ptr;
+    map_get(map, word, &ptr);
+    map_put(map, word, (void *)((uint64_t)ptr + 1));
+  }
+  double elapsed = now() - start;
+  map_metrics_t *metrics = map_metrics(map);
+  *out = *metrics;
+  free(metrics);
+  map_free(&map);
+  return elapsed;
+}
+
+int main(int argc, char **argv) {
+  uint32_t size = MAP_SIZE;
+  int reps = DEFAULT_REPS;
+  char c;
+
+  while ((c = getopt(argc, argv, "s:n:")) != EOF) {
+    switch (c) {
+    case 's':
+      errno = 0;
+      size = strtol(optarg, NULL, 10);
+      if (errno || size == 0) {
+        printf("-s <size>; size must be positive: %s\n", optarg);
+        exit(1);
+      }
+      break;
+    case 'n':
+      reps = atoi(optarg);
+      if (reps <= 0) {
+        printf("-n <reps>; reps must be positive: %s\n", optarg);
+        exit(1);
+      }
+      break;
+    default:
+      usage();
+      exit(1);
+    }
+  }
+  if (optind == argc) {
+    usage();
+    exit(1);
+  }
+
+  words_t words = {0};
+  for (int i = optind; i < argc; i++) {
+    read_words(&words, argv[i]);
+  }
+  size_t bytes = words.buf_len - words.n; // without terminators
+  printf("%zu words, %.1f bytes/word, map size %u\n\n", words.n,
+         (double)bytes / words.n, size);
+
+  printf("%-8s %10s %10s %12s %10s %14s\n", "hash", "ns/word", "MB/s",
+         "count (s)", "max_depth", "probes/lookup");
+  for (int h = 0; h < sizeof(hash_names) / sizeof(hash_names[0]); h++) {
+    hash_fn_t hash;
+    if (!hash_parse(hash_names[h], &hash)) {
+      fprintf(stderr, "Unknown hash: %s\n", hash_names[h]);
+      exit(1);
+    }
+    double per_pass = time_hash(&words, hash, reps);
+    map_metrics_t metrics;
+    double count_time = count_words(&words, hash, size, &metrics);
+    printf("%-8s %10.2f %10.1f %12.3f %10u %14.3f\n", hash_names[h],
+           per_pass * 1e9 / words.n, bytes / per_pass / 1e6, count_time,
+           metrics.max_depth,
+           metrics.lookups ? (double)metrics.probes / metrics.lookups : 0);
+  }
+
+  free(words.buf);
+  free(words.offs);
+  free(words.lens);
+}
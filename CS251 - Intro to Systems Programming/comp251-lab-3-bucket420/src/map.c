@@ -7,7 +7,9 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include "fnv64.h"
+#include "arena.h"
+#include "hash.h"
+#include "map_rh.h"
 
 // Forward declarations. Types follow.
 typedef struct entry_t entry_t;
@@ -38,32 +40,86 @@ typedef struct map_t map_t;
 #endif
 
 // Entry struct.
+//
+// klen and prefix are kept inline so that lookups can reject most entries with
+// a different key without touching the key buffer. depth is only kept up to
+// date in the first entry of a chain, so that chain lengths can be tracked in
+// constant time.
 typedef struct entry_t {
   struct entry_t *next; // next entry in linked list
   struct entry_t *prev; // previous entry
   char *key;            // string key
   uint64_t hkey;        // 64-bit hash of key
+  uint32_t klen;        // length of key
+  uint32_t prefix;      // first 4 bytes of key, zero-padded (see key_prefix)
+  uint32_t depth;       // length of the chain, if this entry is its head
   void *value;          // value stored for the key
 } entry_t;
 
+// Number of old buckets migrated to the new table by each map operation while
+// an incremental resize is in progress.
+#define MIGRATE_BUCKETS_PER_OP 8
+// Size of the slabs that hold entries and keys when keys are interned.
+#define MAP_SLAB_SIZE (64 * 1024)
+
 // Map struct.
+//
+// While the map grows, entries are migrated incrementally from old_entries to
+// entries. Buckets of old_entries with index >= migrate_idx have not been
+// migrated yet and are still where lookups for their keys go.
+//
+// When keys are interned, each entry and its key are allocated together from
+// arena. Removed entries are only unlinked; their space is reclaimed when
+// map_resize copies the live entries to a fresh arena and frees old_arena.
+// Automatic growth relinks entries where they are, so they never move.
+//
+// hist counts the buckets of both tables (only the unmigrated ones of
+// old_entries) by chain length, and is updated whenever a chain changes.
 struct map_t {
-  entry_t **entries; // array of pointers to entries
-  uint32_t n;        // size of entries array
+  map_config_t config;    // copy of the map config
+  entry_t **entries;      // array of pointers to entries
+  uint32_t n;             // size of entries array
+  entry_t **old_entries;  // table being migrated from, or NULL
+  uint32_t old_n;         // size of old_entries array
+  uint32_t migrate_idx;   // next bucket of old_entries to migrate
+  uint32_t num_entries;   // number of entries in both tables
+  arena_t *arena;         // storage for entries and keys, if interned
+  arena_t *old_arena;     // storage for entries of old_entries, if compacting
+  uint64_t key_bytes;     // estimated malloc footprint of keys, if not interned
+  rh_table_t *rh;         // table used instead of entries by Robin Hood maps
+  uint64_t lookups;       // number of get/put/remove calls
+  uint64_t probes;        // number of entries compared during lookups
+  uint32_t resizes;       // number of resizes started
+  uint32_t hist[MAP_HIST_BINS]; // buckets by chain length
 };
 
 // Helper functions
-entry_t *find_key_in_chain(entry_t *curr, uint64_t hkey) {
+uint32_t key_prefix(const char *key, size_t len) {
+  uint32_t prefix = 0;
+  memcpy(&prefix, key, len < sizeof(prefix) ? len : sizeof(prefix));
+  return prefix;
+}
+
+// Returns the entry in the chain starting at curr whose key is key (of length
+// len), or NULL. Entries are compared on hash, length and prefix first, and
+// only then on the full key.
+entry_t *find_key_in_chain(map_t *map, entry_t *curr, const char *key,
+                           size_t len, uint64_t hkey) {
+  uint32_t prefix = key_prefix(key, len);
+  map->lookups++;
   while (curr) {
-    if (curr->hkey == hkey)
+    map->probes++;
+    if (curr->hkey == hkey && curr->klen == len && curr->prefix == prefix &&
+        memcmp(curr->key, key, len) == 0)
       return curr;
     curr = curr->next;
   }
   return NULL;
 }
 
-void entries_free(entry_t **entries, uint32_t size) {
-  for (int i = 0; i < size; i++) {
+// Frees a table. Entries are freed too, unless they live in an arena.
+void entries_free(map_t *map, entry_t **entries, uint32_t size) {
+  for (int i = 0; i < size && !map->arena; i++) {
     entry_t *curr = entries[i];
     while (curr) {
       free(curr->key);
@@ -75,119 +131,472 @@ void entries_free(entry_t **entries, uint32_t size) {
   free(entries);
 }
 
-void set_entry(entry_t *entry, entry_t *next, entry_t *prev, const char *key,
-               uint64_t hkey, void *new_value) {
-  entry->next = next;
-  entry->prev = prev;
-  entry->key = malloc((strlen(key) + 1) * sizeof(char));
-  strncpy(entry->key, key, strlen(key) + 1);
+// Hashes key with the configured hash function and stores its length in *len,
+// so that callers only have to scan the key once.
+uint64_t hash_key(map_t *map, const char *key, size_t *len) {
+  *len = strlen(key);
+  return map->config.hash(key, *len);
+}
+
+// Allocates an entry holding a copy of key, which is keylen bytes long. When
+// keys are interned, the entry and key are carved out of the map's arena in one
+// piece.
+entry_t *new_entry(map_t *map, const char *key, size_t keylen, uint64_t hkey,
+                   void *new_value) {
+  size_t len = keylen + 1;
+  entry_t *entry;
+  if (map->arena) {
+    entry = arena_alloc(map->arena, sizeof(entry_t) + len);
+    entry->key = (char *)(entry + 1);
+  } else {
+    entry = malloc(sizeof(entry_t));
+    entry->key = malloc(len);
+    map->key_bytes += malloc_footprint(len);
+  }
+  memcpy(entry->key, key, len);
+  entry->next = NULL;
+  entry->prev = NULL;
   entry->hkey = hkey;
+  entry->klen = keylen;
+  entry->prefix = key_prefix(key, keylen);
   entry->value = new_value;
+  return entry;
+}
+
+// Frees an entry that has been unlinked. Interned entries are left in place
+// until their arena is freed.
+void free_entry(map_t *map, entry_t *entry) {
+  if (map->arena)
+    return;
+  map->key_bytes -= malloc_footprint(entry->klen + 1);
+  free(entry->key);
+  free(entry);
+}
+
+static inline uint32_t hist_bin(uint32_t depth) {
+  return depth < MAP_HIST_BINS - 1 ? depth : MAP_HIST_BINS - 1;
+}
+
+// Records that a chain went from from entries to to entries.
+void hist_move(map_t *map, uint32_t from, uint32_t to) {
+  map->hist[hist_bin(from)]--;
+  map->hist[hist_bin(to)]++;
+}
+
+static inline uint32_t chain_depth(entry_t *head) {
+  return head ? head->depth : 0;
+}
+
+// Pushes entry onto the front of the chain at bucket.
+void push_entry(map_t *map, entry_t **bucket, entry_t *entry) {
+  entry->depth = chain_depth(*bucket) + 1;
+  hist_move(map, entry->depth - 1, entry->depth);
+  entry->prev = NULL;
+  entry->next = *bucket;
+  if (*bucket)
+    (*bucket)->prev = entry;
+  *bucket = entry;
+}
+
+// Returns the bucket that holds hkey (or would hold it, if it is new).
+entry_t **bucket_of(map_t *map, uint64_t hkey) {
+  if (map->old_entries) {
+    uint32_t i = hkey % map->old_n;
+    if (i >= map->migrate_idx)
+      return &map->old_entries[i];
+  }
+  return &map->entries[hkey % map->n];
+}
+
+// Moves up to nbuckets buckets from the old table to the new one, reusing the
+// entries and their keys. While compacting, interned entries are copied to the
+// new arena instead, which leaves removed entries behind. Frees the old table
+// (and arena) when it is empty.
+void migrate(map_t *map, uint32_t nbuckets) {
+  if (!map->old_entries)
+    return;
+  uint32_t end = map->migrate_idx + nbuckets;
+  if (end > map->old_n || end < map->migrate_idx)
+    end = map->old_n;
+  for (; map->migrate_idx < end; map->migrate_idx++) {
+    entry_t *curr = map->old_entries[map->migrate_idx];
+    map->old_entries[map->migrate_idx] = NULL;
+    // the old bucket is no longer counted.
+    map->hist[hist_bin(chain_depth(curr))]--;
+    while (curr) {
+      entry_t *next = curr->next;
+      if (map->old_arena) {
+        curr = new_entry(map, curr->key, curr->klen, curr->hkey,
+                         curr->value);
+      }
+      push_entry(map, &map->entries[curr->hkey % map->n], curr);
+      curr = next;
+    }
+  }
+  if (map->migrate_idx == map->old_n) {
+    DEBUG_PRINT("migration to %u buckets done\n", map->n);
+    free(map->old_entries);
+    if (map->old_arena)
+      arena_free(&map->old_arena);
+    map->old_entries = NULL;
+    map->old_n = 0;
+    map->migrate_idx = 0;
+  }
+}
+
+// Starts migrating all entries to a new table with new_size buckets. Any
+// migration already in progress is finished first. If compact is set, interned
+// entries are copied to a fresh arena as they migrate.
+void start_migration(map_t *map, uint32_t new_size, int compact) {
+  migrate(map, UINT32_MAX);
+  map->old_entries = map->entries;
+  map->old_n = map->n;
+  if (map->arena && compact) {
+    map->old_arena = map->arena;
+    map->arena = arena_create(MAP_SLAB_SIZE);
+  }
+  map->migrate_idx = 0;
+  map->entries = calloc(new_size, sizeof(entry_t *));
+  assert(map->entries);
+  map->n = new_size;
+  map->hist[0] += new_size;
+  map->resizes++;
+}
+
+// Starts doubling the table if the load factor is above the configured limit.
+void maybe_grow(map_t *map) {
+  if (map->config.max_load <= 0 || map->old_entries)
+    return;
+  if (map->num_entries > map->config.max_load * map->n) {
+    DEBUG_PRINT("load %u/%u, growing\n", map->num_entries, map->n);
+    start_migration(map, map->n * 2, 0);
+  }
 }
 
 map_t *map_create(uint32_t init_size) {
-  map_t *map = malloc(sizeof(map_t));
-  map->entries = calloc(init_size, sizeof(entry_t *));
-  map->n = init_size;
+  map_config_t config = {init_size, MAP_BACKEND_CHAINING, 0, 0, NULL};
+  return map_create_with(config);
+}
+
+map_t *map_create_with(map_config_t config) {
+  map_t *map = calloc(1, sizeof(map_t));
+  if (!config.hash)
+    config.hash = hash_fnv64;
+  map->config = config;
+  if (config.backend == MAP_BACKEND_ROBIN_HOOD) {
+    map->rh = rh_create(config.init_size, config.max_load, config.intern_keys);
+    return map;
+  }
+  if (config.intern_keys)
+    map->arena = arena_create(MAP_SLAB_SIZE);
+  map->entries = calloc(config.init_size, sizeof(entry_t *));
+  map->n = config.init_size;
+  map->hist[0] = config.init_size;
   return map;
 }
 
+int map_backend_parse(const char *name, map_backend_t *backend) {
+  if (strcmp(name, "chain") == 0) {
+    *backend = MAP_BACKEND_CHAINING;
+  } else if (strcmp(name, "rh") == 0) {
+    *backend = MAP_BACKEND_ROBIN_HOOD;
+  } else {
+    return 0;
+  }
+  return 1;
+}
+
+// Returns the length of the longest chain of entries[start...end).
+uint32_t chain_max_depth(entry_t **entries, uint32_t start, uint32_t end) {
+  uint32_t max_depth = 0;
+  for (uint32_t i = start; i < end; i++) {
+    if (chain_depth(entries[i]) > max_depth)
+      max_depth = chain_depth(entries[i]);
+  }
+  return max_depth;
+}
+
+void map_metrics_read(map_t *map, map_metrics_t *stats) {
+  memset(stats, 0, sizeof(map_metrics_t));
+  if (map->rh) {
+    rh_metrics_read(map->rh, stats);
+  } else {
+    stats->lookups = map->lookups;
+    stats->probes = map->probes;
+    stats->num_entries = map->num_entries;
+    stats->curr_size = map->n;
+    stats->load_factor = (double)map->num_entries / map->n;
+    stats->resizes = map->resizes;
+    stats->bytes_buckets = (uint64_t)(map->n + map->old_n) * sizeof(entry_t *);
+    if (map->arena) {
+      uint64_t slabs = arena_bytes(map->arena);
+      if (map->old_arena)
+        slabs += arena_bytes(map->old_arena);
+      stats->bytes_entries = (uint64_t)map->num_entries * sizeof(entry_t);
+      stats->bytes_keys = slabs - stats->bytes_entries;
+    } else {
+      stats->bytes_entries =
+          (uint64_t)map->num_entries * malloc_footprint(sizeof(entry_t));
+      stats->bytes_keys = map->key_bytes;
+    }
+    memcpy(stats->depth_hist, map->hist, sizeof(map->hist));
+    uint32_t buckets = map->n;
+    if (map->old_entries) {
+      stats->migrate_done = map->migrate_idx;
+      stats->migrate_total = map->old_n;
+      buckets += map->old_n - map->migrate_idx;
+    }
+    uint32_t chains = buckets - map->hist[0];
+    stats->avg_depth = chains ? (double)map->num_entries / chains : 0;
+  }
+  stats->bytes =
+      stats->bytes_buckets + stats->bytes_entries + stats->bytes_keys;
+  stats->bytes_per_entry =
+      stats->num_entries ? (double)stats->bytes / stats->num_entries : 0;
+  for (uint32_t d = 1; d < MAP_HIST_BINS; d++) {
+    if (stats->depth_hist[d])
+      stats->max_depth = d;
+  }
+}
+
 map_metrics_t *map_metrics(map_t *map) {
   map_metrics_t *stats = malloc(sizeof(map_metrics_t));
-  stats->num_entries = 0;
-  stats->max_depth = 0;
-  stats->curr_size = map->n;
-  int depth = 0;
-  for (int i = 0; i < map->n; i++) {
-    entry_t *curr = map->entries[i];
-    while (curr) {
-      depth += 1;
-      curr = curr->next;
+  map_metrics_read(map, stats);
+  if (map->rh) {
+    stats->max_depth = rh_max_depth(map->rh);
+  } else {
+    stats->max_depth = chain_max_depth(map->entries, 0, map->n);
+    if (map->old_entries) {
+      uint32_t old_depth =
+          chain_max_depth(map->old_entries, map->migrate_idx, map->old_n);
+      if (old_depth > stats->max_depth)
+        stats->max_depth = old_depth;
     }
-    if (depth > stats->max_depth)
-      stats->max_depth = depth;
-    stats->num_entries += depth;
-    depth = 0;
   }
   return stats;
 }
 
 void map_free(map_t **map) {
-  entries_free((*map)->entries, (*map)->n);
+  if ((*map)->rh) {
+    rh_free((*map)->rh);
+  } else {
+    entries_free(*map, (*map)->entries, (*map)->n);
+    if ((*map)->old_entries)
+      entries_free(*map, (*map)->old_entries, (*map)->old_n);
+    if ((*map)->arena)
+      arena_free(&(*map)->arena);
+    if ((*map)->old_arena)
+      arena_free(&(*map)->old_arena);
+  }
   free(*map);
   *map = NULL;
 }
 
-int map_put(map_t *map, const char *key, void *new_value) {
-  uint64_t hkey = fnv64(key);
-  uint64_t index = hkey % map->n;
-  if (!map->entries[index]) {
-    map->entries[index] = malloc(sizeof(entry_t));
-    set_entry(map->entries[index], NULL, NULL, key, hkey, new_value);
-    return 1;
+void **map_upsert(map_t *map, const char *key, int *is_new) {
+  size_t len;
+  uint64_t hkey = hash_key(map, key, &len);
+  if (map->rh) {
+    return rh_upsert(map->rh, key, hkey, is_new);
   }
-  entry_t *found = find_key_in_chain(map->entries[index], hkey);
-  if (found) {
-    found->value = new_value;
-    return 0;
-  } else {
-    entry_t *new_entry = malloc(sizeof(entry_t));
-    set_entry(new_entry, map->entries[index], NULL, key, hkey, new_value);
-    (map->entries[index])->prev = new_entry;
-    map->entries[index] = new_entry;
-    return 1;
+  migrate(map, MIGRATE_BUCKETS_PER_OP);
+  entry_t **bucket = bucket_of(map, hkey);
+  entry_t *found = find_key_in_chain(map, *bucket, key, len, hkey);
+  *is_new = !found;
+  if (!found) {
+    found = new_entry(map, key, len, hkey, NULL);
+    push_entry(map, bucket, found);
+    map->num_entries++;
+    // growing only allocates the new table; found is not moved until the next
+    // operation migrates its bucket.
+    maybe_grow(map);
   }
+  return &found->value;
+}
+
+int map_put(map_t *map, const char *key, void *new_value) {
+  int is_new;
+  *map_upsert(map, key, &is_new) = new_value;
+  return is_new;
+}
+
+int map_get_or_put(map_t *map, const char *key, void **value_ptr, void *zero) {
+  int is_new;
+  void **slot = map_upsert(map, key, &is_new);
+  if (is_new)
+    *slot = zero;
+  *value_ptr = *slot;
+  return !is_new;
 }
 
 int map_remove(map_t *map, const char *key) {
-  uint64_t hkey = fnv64(key);
-  uint64_t index = hkey % map->n;
-  entry_t *found = find_key_in_chain(map->entries[index], hkey);
+  size_t len;
+  uint64_t hkey = hash_key(map, key, &len);
+  if (map->rh) {
+    return rh_remove(map->rh, key, hkey);
+  }
+  migrate(map, MIGRATE_BUCKETS_PER_OP);
+  entry_t **bucket = bucket_of(map, hkey);
+  entry_t *found = find_key_in_chain(map, *bucket, key, len, hkey);
   if (found) {
+    uint32_t depth = (*bucket)->depth;
     if (found->next)
       found->next->prev = found->prev;
     if (found->prev)
       found->prev->next = found->next;
     else
-      map->entries[index] = found->next;
-    free(found->key);
-    free(found);
+      *bucket = found->next;
+    if (*bucket)
+      (*bucket)->depth = depth - 1;
+    hist_move(map, depth, depth - 1);
+    free_entry(map, found);
+    map->num_entries--;
     return 1;
   }
   return 0;
 }
 
 int map_get(map_t *map, const char *key, void **value_ptr) {
-  uint64_t hkey = fnv64(key);
-  uint64_t index = hkey % map->n;
-  entry_t *found = find_key_in_chain(map->entries[index], hkey);
+  size_t len;
+  uint64_t hkey = hash_key(map, key, &len);
+  if (map->rh) {
+    return rh_get(map->rh, key, hkey, value_ptr);
+  }
+  migrate(map, MIGRATE_BUCKETS_PER_OP);
+  entry_t *found = find_key_in_chain(map, *bucket_of(map, hkey), key, len,
+                                     hkey);
   if (found) {
     if (value_ptr)
       *value_ptr = found->value;
     return 1;
   }
-  *value_ptr = NULL;
+  if (value_ptr)
+    *value_ptr = NULL;
   return 0;
 }
 
+void map_advance(map_t *map, uint64_t ops) {
+  if (map->rh)
+    return;
+  // UINT32_MAX buckets is enough to finish any migration.
+  migrate(map, ops > UINT32_MAX / MIGRATE_BUCKETS_PER_OP
+                   ? UINT32_MAX
+                   : ops * MIGRATE_BUCKETS_PER_OP);
+}
+
 void map_resize(map_t *map, uint32_t new_size) {
-  entry_t **old_entries = map->entries;
-  uint32_t old_n = map->n;
-  map->entries = calloc(new_size, sizeof(entry_t));
-  map->n = new_size;
-  for (int i = 0; i < old_n; i++) {
-    entry_t *curr = old_entries[i];
-    while (curr) {
-      map_put(map, curr->key, curr->value);
-      curr = curr->next;
+  if (map->rh) {
+    rh_resize(map->rh, new_size);
+    return;
+  }
+  // an explicit resize happens all at once, but still moves entries instead of
+  // copying them, except to compact interned ones.
+  start_migration(map, new_size, 1);
+  migrate(map, UINT32_MAX);
+}
+
+void map_iter_init(map_t *map, map_iter_t *it) {
+  // chaining maps visit the unmigrated old buckets first, like map_apply.
+  it->table = 0;
+  it->idx = map->old_entries ? map->migrate_idx : 0;
+  it->entry = NULL;
+}
+
+size_t map_iter_next(map_t *map, map_iter_t *it, map_pair_t *pairs,
+                     size_t max) {
+  if (map->rh) {
+    return rh_iter_next(map->rh, &it->idx, pairs, max);
+  }
+  size_t n = 0;
+  while (n < max) {
+    entry_t *curr = it->entry;
+    if (!curr) {
+      // move on to the next non-empty bucket.
+      entry_t **table = it->table == 0 ? map->old_entries : map->entries;
+      uint32_t size = it->table == 0 ? map->old_n : map->n;
+      if (it->table > 1)
+        break;
+      if (it->idx >= size) {
+        it->table++;
+        it->idx = 0;
+        continue;
+      }
+      curr = table[it->idx++];
+      if (!curr)
+        continue;
     }
+    pairs[n].key = curr->key;
+    pairs[n].value = curr->value;
+    n++;
+    it->entry = curr->next;
   }
-  entries_free(old_entries, old_n);
+  return n;
 }
 
-void map_debug(map_t *map) {
-  for (int i = 0; i < map->n; i++) {
-    entry_t *curr = map->entries[i];
+uint32_t map_num_entries(map_t *map) {
+  return map->rh ? rh_num_entries(map->rh) : map->num_entries;
+}
+
+// Swaps two pairs.
+static inline void pairs_swap(map_pair_t *a, map_pair_t *b) {
+  map_pair_t tmp = *a;
+  *a = *b;
+  *b = tmp;
+}
+
+// Partitions smaller than this are insertion sorted.
+#define SORT_CUTOFF 16
+
+// Sorts pairs[0...n), all of whose keys share their first d characters.
+void pairs_mkqsort(map_pair_t *pairs, size_t n, size_t d) {
+  while (n > SORT_CUTOFF) {
+    pairs_swap(&pairs[0], &pairs[n / 2]);
+    int v = (unsigned char)pairs[0].key[d];
+    // three-way partition on character d: [0, lt) < v, [lt, gt) == v and
+    // [gt, n) > v.
+    size_t lt = 0, i = 1, gt = n;
+    while (i < gt) {
+      int c = (unsigned char)pairs[i].key[d];
+      if (c < v)
+        pairs_swap(&pairs[lt++], &pairs[i++]);
+      else if (c > v)
+        pairs_swap(&pairs[i], &pairs[--gt]);
+      else
+        i++;
+    }
+    pairs_mkqsort(pairs, lt, d);
+    // keys equal at d share one more character, unless they all ended.
+    if (v)
+      pairs_mkqsort(pairs + lt, gt - lt, d + 1);
+    pairs += gt;
+    n -= gt;
+  }
+  for (size_t i = 1; i < n; i++) {
+    map_pair_t p = pairs[i];
+    size_t j = i;
+    for (; j > 0 && strcmp(pairs[j - 1].key + d, p.key + d) > 0; j--) {
+      pairs[j] = pairs[j - 1];
+    }
+    pairs[j] = p;
+  }
+}
+
+void map_pairs_sort(map_pair_t *pairs, size_t n) {
+  pairs_mkqsort(pairs, n, 0);
+}
+
+size_t map_export(map_t *map, map_pair_t *pairs, int sorted) {
+  map_iter_t it;
+  map_iter_init(map, &it);
+  size_t n = map_iter_next(map, &it, pairs, SIZE_MAX);
+  if (sorted)
+    map_pairs_sort(pairs, n);
+  return n;
+}
+
+// Prints the chains of entries[start...end).
+void chain_debug(entry_t **entries, uint32_t start, uint32_t end) {
+  for (uint32_t i = start; i < end; i++) {
+    entry_t *curr = entries[i];
     printf("%d ", i);
     while (curr) {
       printf("(%s, %s) -> ", curr->key, (char *)curr->value);
@@ -197,14 +606,56 @@ void map_debug(map_t *map) {
   }
 }
 
-void map_apply(map_t *map, void *apply_fn(const char *key, void *value)) {
+void map_debug(map_t *map) {
+  if (map->rh) {
+    rh_debug(map->rh);
+    return;
+  }
+  if (map->old_entries) {
+    printf("old table (migrated %u/%u):\n", map->migrate_idx, map->old_n);
+    chain_debug(map->old_entries, map->migrate_idx, map->old_n);
+    printf("new table:\n");
+  }
+  chain_debug(map->entries, 0, map->n);
+}
+
+// Applies apply_fn to the chains of entries[start...end).
+void chain_apply(entry_t **entries, uint32_t start, uint32_t end,
+                 void *apply_fn(const char *key, void *value, void *arg),
+                 void *arg) {
   // For each table entry.
-  for (int i = 0; i < map->n; i++) {
-    entry_t *cur = map->entries[i];
+  for (uint32_t i = start; i < end; i++) {
+    entry_t *cur = entries[i];
     // Traverse the entries at i, calling apply_fn.
     while (cur) {
-      cur->value = apply_fn(cur->key, cur->value);
+      cur->value = apply_fn(cur->key, cur->value, arg);
       cur = cur->next;
     }
   }
 }
+
+// Passes the function given to map_apply through map_apply_arg.
+typedef struct apply_adapter_t {
+  void *(*apply_fn)(const char *key, void *value);
+} apply_adapter_t;
+
+void *apply_adapter(const char *key, void *value, void *arg) {
+  return ((apply_adapter_t *)arg)->apply_fn(key, value);
+}
+
+void map_apply(map_t *map, void *apply_fn(const char *key, void *value)) {
+  apply_adapter_t adapter = {apply_fn};
+  map_apply_arg(map, apply_adapter, &adapter);
+}
+
+void map_apply_arg(map_t *map,
+                   void *apply_fn(const char *key, void *value, void *arg),
+                   void *arg) {
+  if (map->rh) {
+    rh_apply(map->rh, apply_fn, arg);
+    return;
+  }
+  if (map->old_entries)
+    chain_apply(map->old_entries, map->migrate_idx, map->old_n, apply_fn, arg);
+  chain_apply(map->entries, 0, map->n, apply_fn, arg);
+}
@@ -1,13 +1,21 @@
 #ifndef __MAP_H__
 #define __MAP_H__
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include "hash.h"
+
 // Implementation of a hash map with chaining.
 // Usage:
 //
 //  map_t *map = map_create(init_size);
 //
+//  // or, to pick a backend:
+//  map_config_t config = {init_size, MAP_BACKEND_ROBIN_HOOD, max_load, 0,
+//                         hash_crc32c};
+//  map_t *map = map_create_with(config);
+//
 //  is_new = map_put(string_key, value_ptr);
 //
 //  was_in = map_remove(map, string_key);
@@ -16,6 +24,15 @@
 //  is_in = map_get(map, &val_ptr);
 //  // *val_ptr is value if is_in is nonzero.
 //
+//  void **slot = map_upsert(map, string_key, &is_new);
+//  *slot = new_value; // *slot is NULL if is_new is nonzero.
+//
+//  map_pair_t pairs[64];
+//  map_iter_t it;
+//  map_iter_init(map, &it);
+//  while ((n = map_iter_next(map, &it, pairs, 64)))
+//    ...; // pairs[0...n) hold the next n entries.
+//
 //  map_metrics_t metrics = map_metrics(map);
 //  map_resize(map, new_size);
 //
@@ -24,31 +41,164 @@
 // Forward declaration of Map type.
 typedef struct map_t map_t;
 
+// Map backends. Every backend implements the full API below.
+//
+// - MAP_BACKEND_CHAINING:   an array of buckets, each holding a linked list of
+//                           heap-allocated entries. This is the default.
+// - MAP_BACKEND_ROBIN_HOOD: a flat open-addressing table using Robin Hood
+//                           linear probing. Hashes are stored inline in the
+//                           table and removal uses backward-shift deletion, so
+//                           there are no tombstones. The table grows by itself
+//                           when it gets too full, and its size is always a
+//                           power of two.
+//
+// Automatic growth:
+//
+//   When max_load is positive, the map doubles its size once the load factor
+//   (entries / size) goes above max_load. Chaining maps grow incrementally:
+//   every get/put/remove migrates a few buckets to the new table, so that no
+//   single operation pays for rehashing the whole map. Robin Hood maps always
+//   grow (max_load defaults to 0.9 and must be below 1), and rebuild their flat
+//   table in one pass.
+//
+// Hash functions:
+//
+//   Keys are hashed with config.hash, which is called once per operation with
+//   the key and its length. Any of the functions in hash.h can be used, or a
+//   custom one.
+//
+// Key interning:
+//
+//   When intern_keys is set, keys (and chaining entries) are bump-allocated
+//   from large slabs owned by the map instead of being malloc'd one at a time.
+//   map_free releases the slabs wholesale. map_remove only unlinks the entry;
+//   its space stays allocated until map_resize copies the live entries to
+//   fresh slabs. Automatic growth reuses the entries and keys where they are.
+typedef enum map_backend_t {
+  MAP_BACKEND_CHAINING,
+  MAP_BACKEND_ROBIN_HOOD,
+} map_backend_t;
+
+// A key and its value, as filled in by map_iter_next and map_export.
+typedef struct map_pair_t {
+  const char *key; // the map's copy of the key
+  void *value;     // value stored for the key
+} map_pair_t;
+
+// Iteration cursor. Set up with map_iter_init; the fields are internal.
+typedef struct map_iter_t {
+  uint32_t table; // which table is being walked
+  uint32_t idx;   // next bucket or slot of the table
+  void *entry;    // next entry of the current chain, if any
+} map_iter_t;
+
+// Map construction parameters.
+typedef struct map_config_t {
+  uint32_t init_size;    // initial number of buckets/slots
+  map_backend_t backend; // which backend to use
+  double max_load;       // grow when load factor exceeds this; 0 = never
+  int intern_keys;       // nonzero to keep keys in map-owned slabs
+  hash_fn_t hash;        // key hash function (see hash.h); NULL = hash_fnv64
+} map_config_t;
+
+// Number of bins in map_metrics_t.depth_hist.
+#define MAP_HIST_BINS 16
+
 // Metrics type.
-// Used to collect statistics about map entries. Returned by map_metrics().
+// Used to collect statistics about map entries. Returned by map_metrics() and
+// filled in by map_metrics_read().
+//
+// lookups counts every get/put/remove; probes counts the stored entries that
+// were compared against a key during those lookups. probes / lookups is the
+// average probe length.
+//
+// While a chaining map is growing, migrate_done of migrate_total old buckets
+// have been moved to the new table; both are 0 otherwise.
+//
+// bytes is the memory held by the map's tables, entries and keys, and is the
+// sum of bytes_buckets, bytes_entries and bytes_keys. Individually malloc'd
+// entries and keys are counted with an estimate of the allocator's per-chunk
+// overhead.
+// Interned entries and keys share slabs; bytes_entries counts the live entries
+// and bytes_keys the rest of the slabs, including space not yet reclaimed from
+// removed entries. Robin Hood maps keep their entries in the table, so their
+// bytes_entries is 0.
+//
+// depth_hist[d] is the number of chains of length d (chaining) or of slots
+// whose entry is found after d probes (Robin Hood; empty slots have depth 0).
+// The last bin also counts everything deeper. avg_depth is the average length
+// of non-empty chains, or the average probe length of the entries. resizes
+// counts explicit and automatic resizes.
 typedef struct map_metrics_t {
   uint32_t max_depth;
   uint32_t num_entries;
   uint32_t curr_size;
+  uint64_t lookups;
+  uint64_t probes;
+  double load_factor;
+  uint32_t migrate_done;
+  uint32_t migrate_total;
+  uint64_t bytes;
+  double bytes_per_entry;
+  uint64_t bytes_buckets;
+  uint64_t bytes_entries;
+  uint64_t bytes_keys;
+  double avg_depth;
+  uint32_t resizes;
+  uint32_t depth_hist[MAP_HIST_BINS];
 } map_metrics_t;
 
-// Creates a map with the given initial size.
+// Creates a map with the given initial size, using the chaining backend.
 //
 // Caller owns returned pointer; must be freed with free_map.
 // Must be freed with map_free.
 map_t *map_create(uint32_t init_size);
 
+// Creates a map with the given configuration.
+//
+// Caller owns returned pointer; must be freed with map_free.
+map_t *map_create_with(map_config_t config);
+
+// Parses a backend name ("chain" or "rh"), as used by the test programs'
+// command line flags. Returns nonzero on success.
+int map_backend_parse(const char *name, map_backend_t *backend);
+
 // Get metrics about the current map state.
 //
+// Walks the whole table to find the exact max_depth.
+//
 // Caller owns returned pointer.
 map_metrics_t *map_metrics(map_t *map);
 
+// Reads metrics about the current map state into stats, without allocating.
+//
+// Every field is maintained as the map changes, so this takes constant time.
+// The one exception is max_depth, which is derived from depth_hist: it is exact
+// unless some chain is deeper than the histogram, in which case it is
+// MAP_HIST_BINS - 1.
+void map_metrics_read(map_t *map, map_metrics_t *stats);
+
 // Frees a map.
 //
 // Frees any entry metadata (including keys) and m. m will be NULL upon return.
 void map_free(map_t **map);
 
+// Does the background work that ops get/put/remove calls would have done,
+// without looking anything up.
+//
+// While a chaining map grows, every operation migrates a few buckets, so the
+// order of entries (and of map_apply) depends on how many operations ran
+// between inserts. Code that replays a batch of inserts (see word_count's
+// parallel mode) calls this to keep the map identical to one built by the
+// original sequence of operations. Does nothing for Robin Hood maps.
+void map_advance(map_t *map, uint64_t ops);
+
 // Resizes the map to the given size.
+//
+// Unlike automatic growth, this happens all at once. Entries and keys are moved
+// to the new table, not copied, except that interned ones are compacted into
+// fresh slabs, reclaiming the space of removed entries. Robin Hood maps round
+// the size up to a power of two that can hold the current entries.
 void map_resize(map_t *map, uint32_t new_size);
 
 // Puts entry into map.
@@ -60,6 +210,25 @@ void map_resize(map_t *map, uint32_t new_size);
 // map_apply(). Internal key is freed when map is destroyed.
 int map_put(map_t *map, const char *key, void *new_value);
 
+// Finds or inserts key, hashing it and searching for it only once.
+//
+// Returns a pointer to the value stored for key, and sets *is_new to nonzero if
+// the key was not present. New entries start with a NULL value. The caller can
+// read and update the value through the returned pointer until the next call
+// that modifies the map (put, upsert, remove or resize), which may move it.
+// Reads, including the migration work done by map_get and map_advance, never
+// move it.
+//
+// Makes a copy of key as map_put does.
+void **map_upsert(map_t *map, const char *key, int *is_new);
+
+// Retrieves or adds a value to a map, in a single lookup.
+//
+// Sets value_ptr to the stored value and returns nonzero if key was present. In
+// this case, zero is ignored. If key was not present, stores zero for it, sets
+// value_ptr to zero and returns 0.
+int map_get_or_put(map_t *map, const char *key, void **value_ptr, void *zero);
+
 // Removes entry from map.
 //
 // Returns nonzero if key was removed. Returns 0 if key was not present. Frees
@@ -81,6 +250,43 @@ int map_get(map_t *map, const char *key, void **value_ptr);
 // of previous value.
 void map_apply(map_t *map, void *apply_fn(const char *key, void *value));
 
+// Apply a function to each value in the map, modifying its value.
+//
+// This variant accepts an additional parameter that is passed to apply_fn.
+//
+// Applies apply_fn to each value in the map and replaces the map value with the
+// returned value. If apply_fn replaces the value, apply_fn must take ownership
+// of previous value.
+void map_apply_arg(map_t *map,
+                   void *apply_fn(const char *key, void *value, void *arg),
+                   void *arg);
+
+// Starts an iteration over the map.
+//
+// Entries are visited in the same order as map_apply. The map must not be
+// modified until the iteration is over.
+void map_iter_init(map_t *map, map_iter_t *it);
+
+// Copies the next (at most max) entries of the iteration into pairs.
+//
+// Returns the number of pairs filled in, which is 0 once every entry has been
+// visited.
+size_t map_iter_next(map_t *map, map_iter_t *it, map_pair_t *pairs, size_t max);
+
+// Returns the number of entries in the map.
+uint32_t map_num_entries(map_t *map);
+
+// Copies every entry into pairs, which must have room for map_num_entries(map)
+// pairs. If sorted is nonzero, the pairs are sorted by key (in strcmp order).
+//
+// Returns the number of pairs filled in.
+size_t map_export(map_t *map, map_pair_t *pairs, int sorted);
+
+// Sorts pairs by key, in strcmp order, using multikey quicksort: keys are
+// partitioned one character at a time, so common prefixes are only compared
+// once.
+void map_pairs_sort(map_pair_t *pairs, size_t n);
+
 // Debug function.
 //
 // This is a free function for you to define however you want in order to debug
@@ -0,0 +1,332 @@
+#include "map_rh.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+// Smallest table we will allocate.
+#define RH_MIN_SIZE 8
+// The table grows once it is more than this full, unless configured otherwise.
+#define RH_DEFAULT_MAX_LOAD 0.9
+
+// Size of the slabs that hold keys when keys are interned.
+#define RH_SLAB_SIZE (64 * 1024)
+
+// Multiplier for Fibonacci hashing; spreads the hash over the high bits so that
+// the slot index depends on every bit of the hash.
+#define RH_GOLDEN 0x9e3779b97f4a7c15ull
+
+// Slot struct. A slot is empty iff hkey is 0; stored hashes are never 0.
+typedef struct rh_slot_t {
+  uint64_t hkey; // 64-bit hash of key, stored inline
+  char *key;     // string key
+  void *value;   // value stored for the key
+} rh_slot_t;
+
+// Table struct.
+//
+// When keys are interned they live in arena; removed keys are reclaimed when
+// rh_resize rebuilds the table.
+//
+// hist counts slots by the depth of their entry (its distance from home + 1, or
+// 0 if empty) and depth_sum is the sum of the entries' depths. Both are updated
+// whenever an entry is placed or moved.
+struct rh_table_t {
+  rh_slot_t *slots;   // array of slots
+  uint32_t cap;       // size of slots array, a power of two
+  uint32_t mask;      // cap - 1
+  uint32_t shift;     // 64 - log2(cap), for Fibonacci hashing
+  uint32_t count;     // number of occupied slots
+  double max_load;    // grow when count / cap exceeds this
+  arena_t *arena;     // storage for keys, if interned
+  uint64_t key_bytes; // estimated malloc footprint of keys, if not interned
+  uint64_t lookups;   // number of get/put/remove calls
+  uint64_t probes;    // number of occupied slots compared during lookups
+  uint32_t resizes;   // number of times the table was rebuilt
+  uint64_t depth_sum; // sum of the depths of all entries
+  uint32_t hist[MAP_HIST_BINS]; // slots by depth
+};
+
+// Helper functions
+static uint64_t rh_stored_hash(uint64_t hkey) { return hkey ? hkey : 1; }
+
+static uint32_t rh_home(rh_table_t *t, uint64_t hkey) {
+  return (uint32_t)((hkey * RH_GOLDEN) >> t->shift);
+}
+
+// Distance of the entry in slot i from its home slot.
+static uint32_t rh_dib(rh_table_t *t, uint32_t i) {
+  return (i - rh_home(t, t->slots[i].hkey)) & t->mask;
+}
+
+// Depth of the entry in slot i, or 0 if it is empty.
+static uint32_t rh_depth(rh_table_t *t, uint32_t i) {
+  return t->slots[i].hkey ? rh_dib(t, i) + 1 : 0;
+}
+
+// Records that a slot went from holding an entry of depth from to one of depth
+// to (0 meaning empty).
+static void rh_hist_move(rh_table_t *t, uint32_t from, uint32_t to) {
+  t->hist[from < MAP_HIST_BINS - 1 ? from : MAP_HIST_BINS - 1]--;
+  t->hist[to < MAP_HIST_BINS - 1 ? to : MAP_HIST_BINS - 1]++;
+  t->depth_sum += (uint64_t)to - from;
+}
+
+static int rh_too_full(rh_table_t *t, uint32_t count, uint32_t cap) {
+  return count > t->max_load * cap;
+}
+
+// Returns the smallest power of two >= size that can hold count entries.
+static uint32_t rh_capacity_for(rh_table_t *t, uint32_t size, uint32_t count) {
+  uint32_t cap = RH_MIN_SIZE;
+  while (cap < size || rh_too_full(t, count, cap)) {
+    cap <<= 1;
+  }
+  return cap;
+}
+
+static void rh_alloc_slots(rh_table_t *t, uint32_t cap) {
+  t->slots = calloc(cap, sizeof(rh_slot_t));
+  assert(t->slots);
+  t->cap = cap;
+  t->mask = cap - 1;
+  t->shift = 64 - __builtin_ctz(cap);
+  memset(t->hist, 0, sizeof(t->hist));
+  t->hist[0] = cap;
+  t->depth_sum = 0;
+}
+
+// Places an entry that is known not to be in the table. Steals slots from
+// richer entries (those closer to home) as it probes. Returns the slot index
+// where the entry ended up.
+static uint32_t rh_insert(rh_table_t *t, rh_slot_t carry) {
+  uint32_t i = rh_home(t, carry.hkey);
+  uint32_t d = 0;
+  int64_t placed = -1;
+  while (t->slots[i].hkey) {
+    uint32_t sd = rh_dib(t, i);
+    if (sd < d) {
+      rh_slot_t tmp = t->slots[i];
+      t->slots[i] = carry;
+      rh_hist_move(t, sd + 1, d + 1);
+      carry = tmp;
+      d = sd;
+      if (placed < 0)
+        placed = i;
+    }
+    i = (i + 1) & t->mask;
+    d++;
+  }
+  t->slots[i] = carry;
+  rh_hist_move(t, 0, d + 1);
+  t->count++;
+  return placed < 0 ? i : placed;
+}
+
+// Returns the slot index holding key, or -1 if it is not present. Stops as soon
+// as it reaches an entry that is closer to its home than key would be.
+static int64_t rh_find(rh_table_t *t, const char *key, uint64_t hkey) {
+  uint32_t i = rh_home(t, hkey);
+  uint32_t d = 0;
+  t->lookups++;
+  while (t->slots[i].hkey && rh_dib(t, i) >= d) {
+    t->probes++;
+    if (t->slots[i].hkey == hkey && strcmp(t->slots[i].key, key) == 0) {
+      return i;
+    }
+    i = (i + 1) & t->mask;
+    d++;
+  }
+  return -1;
+}
+
+// Returns a copy of key, in the arena if keys are interned.
+static char *rh_copy_key(rh_table_t *t, const char *key) {
+  size_t len = strlen(key) + 1;
+  char *copy;
+  if (t->arena) {
+    copy = arena_alloc(t->arena, len);
+  } else {
+    copy = malloc(len);
+    assert(copy);
+    t->key_bytes += malloc_footprint(len);
+  }
+  memcpy(copy, key, len);
+  return copy;
+}
+
+// Rebuilds the table with the given capacity, moving (not copying) keys. If
+// compact is set, interned keys are copied to a new arena, dropping removed
+// keys.
+static void rh_rehash(rh_table_t *t, uint32_t cap, int compact) {
+  rh_slot_t *old = t->slots;
+  uint32_t old_cap = t->cap;
+  arena_t *old_arena = compact ? t->arena : NULL;
+  if (old_arena)
+    t->arena = arena_create(RH_SLAB_SIZE);
+  rh_alloc_slots(t, cap);
+  t->count = 0;
+  t->resizes++;
+  for (uint32_t i = 0; i < old_cap; i++) {
+    if (old[i].hkey) {
+      if (old_arena)
+        old[i].key = rh_copy_key(t, old[i].key);
+      rh_insert(t, old[i]);
+    }
+  }
+  free(old);
+  if (old_arena)
+    arena_free(&old_arena);
+}
+
+rh_table_t *rh_create(uint32_t init_size, double max_load, int intern_keys) {
+  rh_table_t *t = calloc(1, sizeof(rh_table_t));
+  assert(t);
+  t->max_load = max_load > 0 && max_load < 1 ? max_load : RH_DEFAULT_MAX_LOAD;
+  if (intern_keys)
+    t->arena = arena_create(RH_SLAB_SIZE);
+  rh_alloc_slots(t, rh_capacity_for(t, init_size, 0));
+  return t;
+}
+
+void rh_free(rh_table_t *t) {
+  if (t->arena) {
+    arena_free(&t->arena);
+  } else {
+    for (uint32_t i = 0; i < t->cap; i++) {
+      if (t->slots[i].hkey) {
+        free(t->slots[i].key);
+      }
+    }
+  }
+  free(t->slots);
+  free(t);
+}
+
+void rh_metrics_read(rh_table_t *t, map_metrics_t *stats) {
+  stats->num_entries = t->count;
+  stats->curr_size = t->cap;
+  stats->lookups = t->lookups;
+  stats->probes = t->probes;
+  stats->load_factor = (double)t->count / t->cap;
+  stats->resizes = t->resizes;
+  stats->bytes_buckets = (uint64_t)t->cap * sizeof(rh_slot_t);
+  stats->bytes_keys = t->arena ? arena_bytes(t->arena) : t->key_bytes;
+  stats->avg_depth = t->count ? (double)t->depth_sum / t->count : 0;
+  memcpy(stats->depth_hist, t->hist, sizeof(t->hist));
+}
+
+uint32_t rh_max_depth(rh_table_t *t) {
+  uint32_t max_depth = 0;
+  for (uint32_t i = 0; i < t->cap; i++) {
+    // depth is the number of slots probed to reach the entry.
+    if (rh_depth(t, i) > max_depth) {
+      max_depth = rh_depth(t, i);
+    }
+  }
+  return max_depth;
+}
+
+uint32_t rh_num_entries(rh_table_t *t) { return t->count; }
+
+void rh_resize(rh_table_t *t, uint32_t new_size) {
+  uint32_t cap = rh_capacity_for(t, new_size, t->count);
+  // interned keys are compacted even if the capacity stays the same.
+  if (cap != t->cap || t->arena) {
+    rh_rehash(t, cap, 1);
+  }
+}
+
+void **rh_upsert(rh_table_t *t, const char *key, uint64_t hkey, int *is_new) {
+  hkey = rh_stored_hash(hkey);
+  int64_t found = rh_find(t, key, hkey);
+  *is_new = found < 0;
+  if (found < 0) {
+    if (rh_too_full(t, t->count + 1, t->cap)) {
+      rh_rehash(t, t->cap << 1, 0);
+    }
+    rh_slot_t carry = {hkey, rh_copy_key(t, key), NULL};
+    found = rh_insert(t, carry);
+  }
+  return &t->slots[found].value;
+}
+
+int rh_remove(rh_table_t *t, const char *key, uint64_t hkey) {
+  hkey = rh_stored_hash(hkey);
+  int64_t found = rh_find(t, key, hkey);
+  if (found < 0) {
+    return 0;
+  }
+  if (!t->arena) {
+    t->key_bytes -= malloc_footprint(strlen(t->slots[found].key) + 1);
+    free(t->slots[found].key);
+  }
+  // backward-shift deletion: pull each following entry that is not at its
+  // home slot back by one, until we hit an empty slot or a home entry.
+  uint32_t i = found;
+  uint32_t j = (i + 1) & t->mask;
+  while (t->slots[j].hkey && rh_dib(t, j) > 0) {
+    rh_hist_move(t, rh_depth(t, i), rh_depth(t, j) - 1);
+    t->slots[i] = t->slots[j];
+    i = j;
+    j = (j + 1) & t->mask;
+  }
+  rh_hist_move(t, rh_depth(t, i), 0);
+  memset(&t->slots[i], 0, sizeof(rh_slot_t));
+  t->count--;
+  return 1;
+}
+
+int rh_get(rh_table_t *t, const char *key, uint64_t hkey, void **value_ptr) {
+  int64_t found = rh_find(t, key, rh_stored_hash(hkey));
+  if (found >= 0) {
+    if (value_ptr)
+      *value_ptr = t->slots[found].value;
+    return 1;
+  }
+  if (value_ptr)
+    *value_ptr = NULL;
+  return 0;
+}
+
+void rh_apply(rh_table_t *t,
+              void *apply_fn(const char *key, void *value, void *arg),
+              void *arg) {
+  for (uint32_t i = 0; i < t->cap; i++) {
+    rh_slot_t *s = &t->slots[i];
+    if (s->hkey) {
+      s->value = apply_fn(s->key, s->value, arg);
+    }
+  }
+}
+
+// Copies entries from slot *idx on into pairs, advancing *idx.
+size_t rh_iter_next(rh_table_t *t, uint32_t *idx, map_pair_t *pairs,
+                    size_t max) {
+  size_t n = 0;
+  for (; *idx < t->cap && n < max; (*idx)++) {
+    rh_slot_t *s = &t->slots[*idx];
+    if (s->hkey) {
+      pairs[n].key = s->key;
+      pairs[n].value = s->value;
+      n++;
+    }
+  }
+  return n;
+}
+
+void rh_debug(rh_table_t *t) {
+  for (uint32_t i = 0; i < t->cap; i++) {
+    rh_slot_t *s = &t->slots[i];
+    if (s->hkey) {
+      printf("%u (%s, %s) dib=%u\n", i, s->key, (char *)s->value,
+             rh_dib(t, i));
+    } else {
+      printf("%u X\n", i);
+    }
+  }
+}
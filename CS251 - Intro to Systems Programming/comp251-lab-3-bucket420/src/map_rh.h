@@ -0,0 +1,31 @@
+#ifndef __MAP_RH_H__
+#define __MAP_RH_H__
+
+#include <stdint.h>
+
+#include "map.h"
+
+// Robin Hood open-addressing table. Internal to the map; use map.h instead.
+//
+// All functions take the 64-bit hash of the key (computed by the caller) in
+// addition to the key itself.
+
+typedef struct rh_table_t rh_table_t;
+
+rh_table_t *rh_create(uint32_t init_size, double max_load, int intern_keys);
+void rh_free(rh_table_t *t);
+void rh_metrics_read(rh_table_t *t, map_metrics_t *stats);
+uint32_t rh_max_depth(rh_table_t *t);
+uint32_t rh_num_entries(rh_table_t *t);
+void rh_resize(rh_table_t *t, uint32_t new_size);
+void **rh_upsert(rh_table_t *t, const char *key, uint64_t hkey, int *is_new);
+int rh_remove(rh_table_t *t, const char *key, uint64_t hkey);
+int rh_get(rh_table_t *t, const char *key, uint64_t hkey, void **value_ptr);
+void rh_apply(rh_table_t *t,
+              void *apply_fn(const char *key, void *value, void *arg),
+              void *arg);
+size_t rh_iter_next(rh_table_t *t, uint32_t *idx, map_pair_t *pairs,
+                    size_t max);
+void rh_debug(rh_table_t *t);
+
+#endif
@@ -1,7 +1,10 @@
 #include <assert.h>
+#include <math.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -17,22 +20,347 @@
 // 2^32 is 10 digits
 #define BUFF_SIZE 11
 
+// Number of distinct hash values produced by colliding_hash; 0 if -c is unset.
+uint32_t collide_classes = 0;
+
 void usage() {
   printf("Usage: stress_test [-s <size>] [-k <keys>] [-r <prob>] [-i <iters>] "
-         "[-m <ops>]\n"
+         "[-m <ops>] [-b <backend>] [-l <load>] [-H <hash>] [-c <classes>] "
+         "[-a]\n"
+         "       stress_test -B [-x <mix>] [-z <zipf>] [-S <seed>] [-C] "
+         "[map and size options]\n"
          "Options:\n"
+         "\t-b <backend> map backend: chain (default) or rh (Robin Hood)\n"
+         "\t-l <load>    grow the map when its load factor exceeds <load>\n"
+         "\t-H <hash>    hash function: fnv64 (default), wide or crc32c\n"
+         "\t-c <classes> adversarial mode: hash every key to one of "
+         "<classes>\n"
+         "\t             values, and check every result against a shadow "
+         "copy\n"
+         "\t-a           intern keys in map-owned slabs\n"
          "\t-r <prob>    probability of resize (0-100)\n"
          "\t-s <size>    size of map\n"
          "\t-i <iters>   iterations\n"
          "\t-m <ops>     operations per key\n"
-         "\t-k <keys>    number of keys\n");
+         "\t-k <keys>    number of keys\n"
+         "Benchmark mode:\n"
+         "\t-B           run a reproducible benchmark instead (no per-op "
+         "output)\n"
+         "\t-x <mix>     operation weights get,put,remove,resize "
+         "(default 50,40,10,0)\n"
+         "\t-z <zipf>    Zipf exponent of key popularity; 0 = uniform "
+         "(default)\n"
+         "\t-S <seed>    PRNG seed (default 1)\n"
+         "\t-C           print results as CSV\n");
+}
+
+// Hash for the adversarial mode. Distinct keys share full 64-bit hashes, so the
+// map can only tell them apart by comparing the keys themselves.
+uint64_t colliding_hash(const char *key, size_t len) {
+  return hash_fnv64(key, len) % collide_classes;
+}
+
+// Exits if the map's value for key differs from the shadow copy's.
+void check_key(map_t *map, const char *key, char *expected) {
+  void *value;
+  int is_in = map_get(map, key, &value);
+  if (is_in != (expected != NULL) || value != expected) {
+    printf("\nMISMATCH: key %s: map has %s, expected %s\n", key,
+           is_in ? (char *)value : "nothing", expected ? expected : "nothing");
+    exit(1);
+  }
+}
+
+// Returns the current time in seconds.
+double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Benchmark mode
+// --------------
+//
+// Runs a reproducible sequence of operations: the keys and operations are
+// generated up front from a seeded PRNG, so generating them is not timed and
+// every run with the same flags does the same work. The map is filled with
+// every key before the timed loop. Reports throughput, the latency of a sample
+// of operations, the peak max_depth and the peak RSS, optionally as CSV.
+//
+// Throughput and latency are measured in separate passes over the same
+// operations, each on a freshly filled map, so that the clock reads around the
+// sampled operations do not count against throughput.
+
+// Every BENCH_LATENCY_EVERY-th operation of the latency pass is timed on its
+// own.
+#define BENCH_LATENCY_EVERY 8
+// Number of times max_depth is sampled during a run (outside the timed loop).
+#define BENCH_DEPTH_SAMPLES 64
+
+typedef enum bench_op_t { OP_GET, OP_PUT, OP_REMOVE, OP_RESIZE } bench_op_t;
+
+// One pre-generated operation.
+typedef struct bench_step_t {
+  uint32_t op;  // a bench_op_t
+  uint32_t arg; // key index, or new size for OP_RESIZE
+} bench_step_t;
+
+// Benchmark parameters.
+typedef struct bench_t {
+  double mix[4];  // relative weight of each bench_op_t
+  double zipf;    // Zipf exponent of the key distribution; 0 = uniform
+  uint64_t seed;  // PRNG seed
+  int csv;        // nonzero to print CSV rows
+} bench_t;
+
+// splitmix64.
+uint64_t bench_rand(uint64_t *state) {
+  uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+// Returns a random double in [0...1).
+double bench_rand1(uint64_t *state) {
+  return (bench_rand(state) >> 11) * (1.0 / (1ull << 53));
 }
 
-void print_stats(map_t *map) {
+// Parses "get,put,remove,resize" weights into mix. Returns nonzero on success.
+int bench_parse_mix(const char *arg, double mix[4]) {
+  double total = 0;
+  if (sscanf(arg, "%lf,%lf,%lf,%lf", &mix[0], &mix[1], &mix[2], &mix[3]) != 4)
+    return 0;
+  for (int i = 0; i < 4; i++) {
+    if (mix[i] < 0)
+      return 0;
+    total += mix[i];
+  }
+  if (total <= 0)
+    return 0;
+  for (int i = 0; i < 4; i++) {
+    mix[i] /= total;
+  }
+  return 1;
+}
+
+// Generates nsteps operations over keys keys.
+bench_step_t *bench_generate(bench_t *b, uint32_t keys, uint32_t nsteps,
+                             uint32_t size) {
+  uint64_t state = b->seed;
+  // cumulative distribution of key ranks; rank i has weight 1/(i+1)^zipf.
+  double *cdf = malloc(sizeof(double) * keys);
+  double total = 0;
+  for (uint32_t i = 0; i < keys; i++) {
+    total += b->zipf > 0 ? pow(i + 1, -b->zipf) : 1;
+    cdf[i] = total;
+  }
+  // ranks are mapped to keys through a random permutation, so that the hot
+  // keys are not all small numbers.
+  uint32_t *perm = malloc(sizeof(uint32_t) * keys);
+  for (uint32_t i = 0; i < keys; i++) {
+    perm[i] = i;
+  }
+  for (uint32_t i = keys - 1; i > 0; i--) {
+    uint32_t j = bench_rand(&state) % (i + 1);
+    uint32_t tmp = perm[i];
+    perm[i] = perm[j];
+    perm[j] = tmp;
+  }
+
+  bench_step_t *steps = malloc(sizeof(bench_step_t) * nsteps);
+  for (uint32_t s = 0; s < nsteps; s++) {
+    double r = bench_rand1(&state);
+    uint32_t op = OP_GET;
+    while (op < OP_RESIZE && r >= b->mix[op]) {
+      r -= b->mix[op];
+      op++;
+    }
+    steps[s].op = op;
+    if (op == OP_RESIZE) {
+      steps[s].arg = bench_rand1(&state) * (size * 2) + 1;
+    } else {
+      double u = bench_rand1(&state) * total;
+      uint32_t lo = 0, hi = keys - 1;
+      while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (cdf[mid] <= u)
+          lo = mid + 1;
+        else
+          hi = mid;
+      }
+      steps[s].arg = perm[lo];
+    }
+  }
+  free(perm);
+  free(cdf);
+  return steps;
+}
+
+int cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Creates a map holding every key, as each benchmark pass starts from.
+map_t *bench_map(map_config_t config, char **vals, uint32_t keys) {
+  map_t *map = map_create_with(config);
+  for (uint32_t k = 0; k < keys; k++) {
+    map_put(map, vals[k], vals[k]);
+  }
+  return map;
+}
+
+// Applies one benchmark step to the map.
+static inline void bench_apply(map_t *map, bench_step_t step, char **vals,
+                               void **sink) {
+  switch (step.op) {
+  case OP_GET:
+    map_get(map, vals[step.arg], sink);
+    break;
+  case OP_PUT:
+    map_put(map, vals[step.arg], vals[step.arg]);
+    break;
+  case OP_REMOVE:
+    map_remove(map, vals[step.arg]);
+    break;
+  case OP_RESIZE:
+    map_resize(map, step.arg);
+    break;
+  }
+}
+
+// Runs the benchmark iterations times. vals[i] is both the key string and the
+// value for key i.
+void run_benchmark(bench_t *b, map_config_t config, char **vals, uint32_t keys,
+                   uint32_t nsteps, uint32_t iterations) {
+  const char *backend =
+      config.backend == MAP_BACKEND_ROBIN_HOOD ? "rh" : "chain";
+  bench_step_t *steps = bench_generate(b, keys, nsteps, config.init_size);
+  uint64_t *lat = malloc(sizeof(uint64_t) * (nsteps / BENCH_LATENCY_EVERY + 1));
+  uint32_t sample_every = nsteps / BENCH_DEPTH_SAMPLES + 1;
+
+  if (b->csv) {
+    printf("backend,hash,intern,max_load,size,keys,ops,get,put,remove,resize,"
+           "zipf,seed,iteration,ops_per_sec,p50_ns,p99_ns,peak_max_depth,"
+           "max_rss_kb\n");
+  }
+  for (uint32_t it = 0; it < iterations; it++) {
+    // throughput pass: only whole segments are timed.
+    map_t *map = bench_map(config, vals, keys);
+    uint32_t peak_depth = 0;
+    uint64_t elapsed = 0;
+    void *sink = NULL;
+    for (uint32_t s = 0; s < nsteps;) {
+      // sample max_depth between timed segments.
+      map_metrics_t *metrics = map_metrics(map);
+      if (metrics->max_depth > peak_depth)
+        peak_depth = metrics->max_depth;
+      free(metrics);
+
+      uint32_t end = s + sample_every < nsteps ? s + sample_every : nsteps;
+      uint64_t start = now_ns();
+      for (; s < end; s++) {
+        bench_apply(map, steps[s], vals, &sink);
+      }
+      elapsed += now_ns() - start;
+    }
+    map_metrics_t *metrics = map_metrics(map);
+    if (metrics->max_depth > peak_depth)
+      peak_depth = metrics->max_depth;
+    free(metrics);
+    map_free(&map);
+
+    // latency pass: the same operations on a fresh map, timing a sample.
+    map = bench_map(config, vals, keys);
+    size_t nlat = 0;
+    for (uint32_t s = 0; s < nsteps; s++) {
+      if (s % BENCH_LATENCY_EVERY == 0) {
+        uint64_t op_start = now_ns();
+        bench_apply(map, steps[s], vals, &sink);
+        lat[nlat++] = now_ns() - op_start;
+      } else {
+        bench_apply(map, steps[s], vals, &sink);
+      }
+    }
+    map_free(&map);
+
+    qsort(lat, nlat, sizeof(uint64_t), cmp_u64);
+    uint64_t p50 = nlat ? lat[nlat / 2] : 0;
+    uint64_t p99 = nlat ? lat[nlat * 99 / 100] : 0;
+    double ops_per_sec = elapsed ? nsteps / (elapsed / 1e9) : 0;
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    if (b->csv) {
+      printf("%s,%s,%d,%.3f,%u,%u,%u,%.3f,%.3f,%.3f,%.3f,%.3f,%lu,%u,%.0f,%lu,"
+             "%lu,%u,%ld\n",
+             backend, hash_name(config.hash), config.intern_keys,
+             config.max_load, config.init_size, keys, nsteps, b->mix[OP_GET],
+             b->mix[OP_PUT], b->mix[OP_REMOVE], b->mix[OP_RESIZE], b->zipf,
+             b->seed, it, ops_per_sec, p50, p99, peak_depth, usage.ru_maxrss);
+    } else {
+      printf("-------------------------------------\n"
+             "    Benchmark %u / %u\n"
+             "-------------------------------------\n",
+             it, iterations);
+      printf("config:\t\t%s, %s hash, size %u, max_load %.2f%s\n", backend,
+             hash_name(config.hash), config.init_size, config.max_load,
+             config.intern_keys ? ", interned" : "");
+      printf("ops:\t\t%u (get %.0f%%, put %.0f%%, remove %.0f%%, resize "
+             "%.0f%%)\n",
+             nsteps, b->mix[OP_GET] * 100, b->mix[OP_PUT] * 100,
+             b->mix[OP_REMOVE] * 100, b->mix[OP_RESIZE] * 100);
+      if (b->zipf > 0)
+        printf("keys:\t\t%u (zipf %.2f, seed %lu)\n", keys, b->zipf, b->seed);
+      else
+        printf("keys:\t\t%u (uniform, seed %lu)\n", keys, b->seed);
+      printf("ops/sec:\t%.0f\n", ops_per_sec);
+      printf("p50 latency:\t%lu ns\n", p50);
+      printf("p99 latency:\t%lu ns\n", p99);
+      printf("peak max_depth:\t%u\n", peak_depth);
+      printf("max rss:\t%ld KiB\n", usage.ru_maxrss);
+    }
+  }
+  free(lat);
+  free(steps);
+}
+
+// Prints the nonzero bins of a depth histogram on one line.
+void print_depth_hist(map_metrics_t *metrics) {
+  printf("depth_hist:\t");
+  for (int d = 0; d < MAP_HIST_BINS; d++) {
+    if (metrics->depth_hist[d]) {
+      printf("%d%s:%u ", d, d == MAP_HIST_BINS - 1 ? "+" : "",
+             metrics->depth_hist[d]);
+    }
+  }
+  printf("\n");
+}
+
+void print_stats(map_t *map, double elapsed) {
   map_metrics_t *metrics = map_metrics(map);
   printf("num_entries:\t%d\n", metrics->num_entries);
   printf("max_depth:\t%d\n", metrics->max_depth);
   printf("size:\t\t%d\n", metrics->curr_size);
+  printf("load_factor:\t%.3f\n", metrics->load_factor);
+  printf("bytes:\t\t%lu (%.1f per entry)\n", metrics->bytes,
+         metrics->bytes_per_entry);
+  printf("  buckets:\t%lu\n", metrics->bytes_buckets);
+  printf("  entries:\t%lu\n", metrics->bytes_entries);
+  printf("  keys:\t\t%lu\n", metrics->bytes_keys);
+  printf("avg_depth:\t%.3f\n", metrics->avg_depth);
+  print_depth_hist(metrics);
+  printf("resizes:\t%u\n", metrics->resizes);
+  printf("probes/lookup:\t%.3f\n",
+         metrics->lookups ? (double)metrics->probes / metrics->lookups : 0);
+  printf("time:\t\t%.3f s\n", elapsed);
   free(metrics);
 }
 
@@ -42,6 +370,12 @@ int main(int argc, char **argv) {
   uint32_t keys = DEFAULT_KEYS;
   uint32_t iterations = DEFAULT_ITERATIONS;
   uint32_t ops = DEFAULT_OPERATION_MULTIPLIER;
+  map_backend_t backend = MAP_BACKEND_CHAINING;
+  double max_load = 0;
+  int intern = 0;
+  hash_fn_t hash = hash_fnv64;
+  int benchmark = 0;
+  bench_t bench = {{0.5, 0.4, 0.1, 0}, 0, 1, 0};
   char c;
   srand(time(NULL));
 
@@ -49,7 +383,7 @@ int main(int argc, char **argv) {
 
   map_t *map = NULL;
 
-  while ((c = getopt(argc, argv, "hr:s:k:i:m:")) != EOF) {
+  while ((c = getopt(argc, argv, "har:s:k:i:m:b:l:H:c:Bx:z:S:C")) != EOF) {
     switch (c) {
     case 'r':
       resize_probability = atoi(optarg) / 100.0;
@@ -66,6 +400,51 @@ int main(int argc, char **argv) {
     case 'i':
       iterations = atoi(optarg);
       break;
+    case 'a':
+      intern = 1;
+      break;
+    case 'l':
+      max_load = atof(optarg);
+      break;
+    case 'c':
+      collide_classes = atoi(optarg);
+      if (collide_classes == 0) {
+        printf("-c <classes>; classes must be positive: %s\n", optarg);
+        exit(1);
+      }
+      hash = colliding_hash;
+      break;
+    case 'H':
+      if (!hash_parse(optarg, &hash)) {
+        printf("-H <hash>; unknown hash: %s\n", optarg);
+        exit(1);
+      }
+      break;
+    case 'b':
+      if (!map_backend_parse(optarg, &backend)) {
+        printf("-b <backend>; unknown backend: %s\n", optarg);
+        exit(1);
+      }
+      break;
+    case 'B':
+      benchmark = 1;
+      break;
+    case 'x':
+      if (!bench_parse_mix(optarg, bench.mix)) {
+        printf("-x <mix>; expected get,put,remove,resize weights: %s\n",
+               optarg);
+        exit(1);
+      }
+      break;
+    case 'z':
+      bench.zipf = atof(optarg);
+      break;
+    case 'S':
+      bench.seed = strtoull(optarg, NULL, 10);
+      break;
+    case 'C':
+      bench.csv = 1;
+      break;
     case 'h': // fallthrough intentional
     default:
       usage();
@@ -86,6 +465,19 @@ int main(int argc, char **argv) {
     sprintf(vals[i], "%d", i);
   }
 
+  if (benchmark) {
+    map_config_t config = {size, backend, max_load, intern, hash};
+    run_benchmark(&bench, config, vals, keys, test_iters, iterations);
+    for (int i = 0; i < keys; i++) {
+      free(vals[i]);
+    }
+    free(vals);
+    return 0;
+  }
+
+  // in adversarial mode, shadow[i] is the value the map should hold for key i.
+  char **shadow = collide_classes ? malloc(sizeof(char *) * keys) : NULL;
+
   // run n iterations of the stress test
   for (int i = 0; i < iterations; i++) {
     printf("-------------------------------------\n"
@@ -93,7 +485,11 @@ int main(int argc, char **argv) {
            "-------------------------------------\n",
            i, iterations, test_iters);
     // first, allocate the map.
-    map = map_create(size);
+    map_config_t config = {size, backend, max_load, intern, hash};
+    map = map_create_with(config);
+    if (shadow)
+      memset(shadow, 0, sizeof(char *) * keys);
+    double start = now();
 
     for (int ii = 0; ii < test_iters; ii++) {
       // pick a key.
@@ -104,10 +500,38 @@ int main(int argc, char **argv) {
       // put it or remove it.
       if (rand1() < 0.2) {
         printf("r");
-        map_remove(map, buff);
+        int was_in = map_remove(map, buff);
+        if (shadow) {
+          if (was_in != (shadow[key] != NULL)) {
+            printf("\nMISMATCH: remove of key %s returned %d\n", buff, was_in);
+            exit(1);
+          }
+          shadow[key] = NULL;
+        }
       } else {
         printf("p");
-        map_put(map, buff, val);
+        int is_new = map_put(map, buff, val);
+        if (shadow) {
+          if (is_new != (shadow[key] == NULL)) {
+            printf("\nMISMATCH: put of key %s returned %d\n", buff, is_new);
+            exit(1);
+          }
+          shadow[key] = val;
+        }
+      }
+      if (shadow)
+        check_key(map, buff, shadow[key]);
+
+      // the key's slot must survive reads, even ones that finish a migration.
+      if (shadow && shadow[key] && rand1() < resize_probability) {
+        printf("a");
+        int is_new;
+        void **slot = map_upsert(map, buff, &is_new);
+        map_advance(map, UINT64_MAX);
+        if (*slot != shadow[key]) {
+          printf("\nMISMATCH: slot of key %s moved during reads\n", buff);
+          exit(1);
+        }
       }
 
       // try a resize.
@@ -117,9 +541,18 @@ int main(int argc, char **argv) {
       }
     }
 
+    double elapsed = now() - start;
     printf("...done.\n");
 
-    print_stats(map);
+    if (shadow) {
+      for (int k = 0; k < keys; k++) {
+        sprintf(buff, "%d", k);
+        check_key(map, buff, shadow[k]);
+      }
+      printf("verified %u keys in %u hash classes\n", keys, collide_classes);
+    }
+
+    print_stats(map, elapsed);
 
     // finally, free it.
     map_free(&map);
@@ -131,4 +564,5 @@ int main(int argc, char **argv) {
     free(vals[i]);
   }
   free(vals);
+  free(shadow);
 }
@@ -0,0 +1,26 @@
+#ifndef __STRIP_H__
+#define __STRIP_H__
+
+#include <assert.h>
+#include <ctype.h>
+
+// Convert a string to lower case and strip whitespace and punctuation.
+//
+// Resizes string by nulling the unused suffix.
+extern inline void lower_and_strip(char *str) {
+  char *t = str;
+  char *c = str;
+  for (; *c; c++) {
+    if (isalnum(*c)) {
+      assert(t <= c);
+      *t = tolower(*c); // t is lte c
+      t++;
+    }
+  }
+  // c is null terminator; cut end of string after alnum chars.
+  while (t < c) {
+    *(t++) = '\0';
+  }
+}
+
+#endif
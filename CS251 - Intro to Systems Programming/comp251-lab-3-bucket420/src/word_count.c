@@ -1,52 +1,58 @@
 // Word Count. Tests map insert, replace, and resize operations.
 //
-// Counts words in the file specified with -f.
+// Counts words in the file specified with -f. With -t, counts them with several
+// threads (see word_count_parallel); the output is the same.
 
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
 
 #include "map.h"
 #include "rand1.h"
+#include "strip.h"
 
 #define MAX_TOKEN_LEN 1024
 #define MAP_SIZE 1024
+#define CHUNK_SIZE (1024 * 1024)
+// Number of entries fetched from the map at a time when printing results.
+#define PRINT_BATCH 256
 
 int resize_count = 0;
 
 void usage() {
-  printf("Usage: word_count -f <file> [-s <size>] [-d] [-r]\n"
+  printf("Usage: word_count -f <file> [-s <size>] [-b <backend>] [-l <load>] "
+         "[-H <hash>] [-t <threads> [-c <chunk>]] [-a] [-o] [-d] [-r]\n"
          "Options:\n"
-         "\t-f <file>  Count words in <file>\n"
-         "\t-s <size>  Size of map\n"
-         "\t-d         Print map debug stats\n"
-         "\t-r         Periodically resize between 1 and 8k entries (stress "
-         "test)\n");
+         "\t-f <file>     Count words in <file>\n"
+         "\t-s <size>     Size of map\n"
+         "\t-b <backend>  Map backend: chain (default) or rh (Robin Hood)\n"
+         "\t-l <load>     Grow the map when its load factor exceeds <load>\n"
+         "\t-H <hash>     Hash function: fnv64 (default), wide or crc32c\n"
+         "\t-t <threads>  Count with <threads> threads over the mmap'd file\n"
+         "\t-c <chunk>    Bytes of the file per task with -t (default 1 MiB)\n"
+         "\t-a            Intern keys in map-owned slabs\n"
+         "\t-o            Print words in sorted order\n"
+         "\t-d            Print map debug stats and timing\n"
+         "\t-r            Periodically resize between 1 and 8k entries "
+         "(stress test)\n");
 }
 
-// Convert a string to lower case and strip whitespace and punctuation.
-//
-// Resizes string by nulling the unused suffix.
-void lower_and_strip(char *str) {
-  char *t = str;
-  char *c = str;
-  for (; *c; c++) {
-    if (isalnum(*c)) {
-      assert(t <= c);
-      *t = tolower(*c); // t is lte c
-      t++;
-    }
-  }
-  // c is null terminator; cut end of string after alnum chars.
-  while (t < c) {
-    *(t++) = '\0';
-  }
+// Returns the current time in seconds.
+double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
 }
 
 void maybe_resize(map_t *map) {
@@ -61,11 +67,13 @@ void maybe_resize(map_t *map) {
   }
 }
 
-// Run word count on the file, saving results to m.
+// Run word count on the file, saving results to m. Returns the number of words
+// counted.
 //
 // Here we abuse the void* to treat it as a uint64_t. Not portable!
-void word_count(FILE *fd, map_t *m, int do_resize) {
+uint64_t word_count(FILE *fd, map_t *m, int do_resize) {
   char buff[MAX_TOKEN_LEN];
+  uint64_t tokens = 0;
   while (fscanf(fd, "%s", buff) != EOF) {
     // read one word and normalize it.
     lower_and_strip(buff);
@@ -74,36 +82,295 @@ void word_count(FILE *fd, map_t *m, int do_resize) {
       continue;
     }
 
-    // insert or update, keeping track of whether the key exists. validates
-    // invariants with asserts.
-    void *ptr;
-    int exists_get = map_get(m, buff, &ptr);
-
-    // exists_get -> ptr
-    assert(!exists_get || ptr);
-    // ptr -> exists_get
-    assert(!ptr || exists_get);
-
-    // if value is new, ptr should be NULL (0). otherwise it will be the last
-    // value.
-    uint64_t val = (uint64_t)ptr;
-    // increment and store back.
-    val++;
-    int new_put = map_put(m, buff, (void *)val);
-
-    // exists_get -> !new_put
-    assert(!exists_get || !new_put);
+    // insert or update with a single lookup, incrementing the count in place.
+    // validates invariants with asserts.
+    int is_new;
+    void **slot = map_upsert(m, buff, &is_new);
+
+    // if value is new, it should be NULL (0). otherwise it is the last count,
+    // which is never 0.
+    assert(is_new == (*slot == NULL));
+    *slot = (void *)((uint64_t)*slot + 1);
+    tokens++;
+
     // try resize
     if (do_resize) {
       maybe_resize(m);
     }
   }
+  return tokens;
 }
 
-// Apply function to print word counts.
-void *print_result(const char *word, void *count) {
-  printf("%-*lu %s\n", 10, (uint64_t)count, word);
-  return count; // do not modify value
+// Parallel word count
+// -------------------
+//
+// The file is mmap'd and split into chunks that end on whitespace, so that
+// every word lies in exactly one chunk. Worker threads claim chunks in order
+// and count their words into thread-local maps. Each local entry also records
+// where its word first appeared (chunk and word index within the chunk).
+//
+// The local maps are then merged with map_apply_arg, and the merged words are
+// inserted into the final map in order of first appearance, with map_advance
+// standing in for the updates between inserts. This gives a map identical to
+// the one the serial count builds, so the output is the same.
+
+// Per-word record of a thread-local map. The map value is its index + 1.
+typedef struct wc_word_t {
+  uint64_t count; // occurrences in this thread's chunks
+  uint32_t chunk; // chunk of the first occurrence
+  uint64_t index; // index of the first occurrence among the chunk's words
+} wc_word_t;
+
+// Merged record for a word.
+typedef struct wc_merged_t {
+  const char *key; // key, owned by one of the thread-local maps
+  uint64_t count;  // total occurrences
+  uint64_t pos;    // index of the first occurrence among all words
+} wc_merged_t;
+
+// State shared by the worker threads.
+typedef struct wc_job_t {
+  const char *data;       // mmap'd file
+  size_t *bounds;         // chunk i is data[bounds[i]...bounds[i + 1])
+  uint32_t nchunks;       // number of chunks
+  atomic_uint next_chunk; // next chunk to claim
+  uint64_t *chunk_words;  // number of words in each chunk
+  map_config_t config;    // config for thread-local maps
+} wc_job_t;
+
+// A worker thread and its local results.
+typedef struct wc_worker_t {
+  pthread_t thread;
+  wc_job_t *job;
+  map_t *map;       // thread-local word map
+  wc_word_t *words; // records for the words in map
+  size_t nwords;    // number of records
+  size_t cap;       // size of words
+} wc_worker_t;
+
+// State for merging the thread-local maps.
+typedef struct wc_merge_t {
+  wc_worker_t *worker;  // worker whose map is being merged
+  uint64_t *chunk_base; // index of the first word of each chunk
+  map_t *map;           // merged map; value is index + 1 into merged
+  wc_merged_t *merged;  // merged records
+  size_t nmerged;       // number of merged records
+  size_t cap;           // size of merged
+} wc_merge_t;
+
+// Counts the words of data[start...end), which is chunk number chunk.
+uint64_t count_chunk(wc_worker_t *w, const char *data, size_t start,
+                     size_t end, uint32_t chunk) {
+  char buff[MAX_TOKEN_LEN];
+  uint64_t index = 0;
+  size_t i = start;
+  while (i < end) {
+    // read one word like fscanf("%s") and normalize it.
+    while (i < end && isspace((unsigned char)data[i]))
+      i++;
+    size_t len = 0;
+    while (i < end && !isspace((unsigned char)data[i])) {
+      if (len < MAX_TOKEN_LEN - 1)
+        buff[len++] = data[i];
+      i++;
+    }
+    buff[len] = '\0';
+    lower_and_strip(buff);
+    if (!strlen(buff)) {
+      continue;
+    }
+
+    int is_new;
+    void **slot = map_upsert(w->map, buff, &is_new);
+    if (is_new) {
+      if (w->nwords == w->cap) {
+        w->cap = w->cap ? w->cap * 2 : 1024;
+        w->words = realloc(w->words, w->cap * sizeof(wc_word_t));
+        assert(w->words);
+      }
+      wc_word_t word = {0, chunk, index};
+      w->words[w->nwords++] = word;
+      *slot = (void *)w->nwords;
+    }
+    w->words[(uint64_t)*slot - 1].count++;
+    index++;
+  }
+  return index;
+}
+
+void *wc_worker(void *arg) {
+  wc_worker_t *w = arg;
+  wc_job_t *job = w->job;
+  w->map = map_create_with(job->config);
+  uint32_t chunk;
+  while ((chunk = atomic_fetch_add(&job->next_chunk, 1)) < job->nchunks) {
+    job->chunk_words[chunk] = count_chunk(w, job->data, job->bounds[chunk],
+                                          job->bounds[chunk + 1], chunk);
+  }
+  return NULL;
+}
+
+// Merges one entry of a thread-local map into the merged map.
+void *merge_word(const char *key, void *value, void *arg) {
+  wc_merge_t *m = arg;
+  wc_word_t *word = &m->worker->words[(uint64_t)value - 1];
+  uint64_t pos = m->chunk_base[word->chunk] + word->index;
+  int is_new;
+  void **slot = map_upsert(m->map, key, &is_new);
+  if (is_new) {
+    if (m->nmerged == m->cap) {
+      m->cap = m->cap ? m->cap * 2 : 1024;
+      m->merged = realloc(m->merged, m->cap * sizeof(wc_merged_t));
+      assert(m->merged);
+    }
+    wc_merged_t merged = {key, 0, pos};
+    m->merged[m->nmerged++] = merged;
+    *slot = (void *)m->nmerged;
+  }
+  wc_merged_t *merged = &m->merged[(uint64_t)*slot - 1];
+  merged->count += word->count;
+  if (pos < merged->pos)
+    merged->pos = pos;
+  return value;
+}
+
+int merged_cmp(const void *a, const void *b) {
+  uint64_t pa = ((const wc_merged_t *)a)->pos;
+  uint64_t pb = ((const wc_merged_t *)b)->pos;
+  return pa < pb ? -1 : pa > pb;
+}
+
+// Returns the end of the chunk that should start at or after start: the first
+// position at or after start that follows whitespace (or the end of the file).
+size_t chunk_end(const char *data, size_t size, size_t start) {
+  if (start >= size)
+    return size;
+  while (start < size && !isspace((unsigned char)data[start - 1]))
+    start++;
+  return start;
+}
+
+// Counts the words of the file with the given number of threads and chunk
+// size, saving results to m. Returns the number of words counted, and the
+// number of chunks and the merge time in *nchunks and *merge_time.
+uint64_t word_count_parallel(const char *fname, map_t *m, map_config_t config,
+                             int threads, size_t chunk_size,
+                             uint32_t *nchunks, double *merge_time) {
+  int fd = open(fname, O_RDONLY);
+  if (fd < 0) {
+    perror(fname);
+    exit(1);
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    perror(fname);
+    exit(1);
+  }
+  size_t size = st.st_size;
+  const char *data = "";
+  if (size) {
+    data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      perror(fname);
+      exit(1);
+    }
+    madvise((void *)data, size, MADV_SEQUENTIAL);
+  }
+
+  // split the file into chunks that end on whitespace.
+  wc_job_t job = {data};
+  job.bounds = malloc(sizeof(size_t) * (size / chunk_size + 2));
+  job.bounds[0] = 0;
+  while (job.bounds[job.nchunks] < size) {
+    job.bounds[job.nchunks + 1] =
+        chunk_end(data, size, job.bounds[job.nchunks] + chunk_size);
+    job.nchunks++;
+  }
+  job.chunk_words = calloc(job.nchunks + 1, sizeof(uint64_t));
+  // thread-local maps always grow, since the map size given with -s is meant
+  // for the whole file.
+  job.config = config;
+  if (job.config.max_load <= 0)
+    job.config.max_load = 1;
+
+  wc_worker_t *workers = calloc(threads, sizeof(wc_worker_t));
+  for (int i = 0; i < threads; i++) {
+    workers[i].job = &job;
+    // pthread_create returns the error instead of setting errno.
+    errno = pthread_create(&workers[i].thread, NULL, wc_worker, &workers[i]);
+    if (errno != 0) {
+      perror("pthread_create");
+      exit(1);
+    }
+  }
+  for (int i = 0; i < threads; i++) {
+    pthread_join(workers[i].thread, NULL);
+  }
+
+  // merge the local maps, turning per-chunk word indexes into global ones.
+  double start = now();
+  wc_merge_t merge = {0};
+  merge.chunk_base = malloc(sizeof(uint64_t) * (job.nchunks + 1));
+  merge.chunk_base[0] = 0;
+  for (uint32_t i = 0; i < job.nchunks; i++) {
+    merge.chunk_base[i + 1] = merge.chunk_base[i] + job.chunk_words[i];
+  }
+  uint64_t total = merge.chunk_base[job.nchunks];
+  map_config_t merge_config = {MAP_SIZE, MAP_BACKEND_CHAINING, 1, 0,
+                               config.hash};
+  merge.map = map_create_with(merge_config);
+  for (int i = 0; i < threads; i++) {
+    merge.worker = &workers[i];
+    map_apply_arg(workers[i].map, merge_word, &merge);
+  }
+
+  // replay the first occurrences into m, in order.
+  qsort(merge.merged, merge.nmerged, sizeof(wc_merged_t), merged_cmp);
+  uint64_t next = 0; // index of the next word the serial count would see
+  for (size_t i = 0; i < merge.nmerged; i++) {
+    wc_merged_t *merged = &merge.merged[i];
+    map_advance(m, merged->pos - next);
+    int is_new;
+    *map_upsert(m, merged->key, &is_new) = (void *)merged->count;
+    next = merged->pos + 1;
+  }
+  map_advance(m, total - next);
+  *merge_time = now() - start;
+  *nchunks = job.nchunks;
+
+  map_free(&merge.map);
+  free(merge.merged);
+  free(merge.chunk_base);
+  for (int i = 0; i < threads; i++) {
+    map_free(&workers[i].map);
+    free(workers[i].words);
+  }
+  free(workers);
+  free(job.chunk_words);
+  free(job.bounds);
+  if (size)
+    munmap((void *)data, size);
+  close(fd);
+  return total;
+}
+
+// Prints the nonzero bins of a depth histogram on one line.
+void print_depth_hist(map_metrics_t *metrics) {
+  printf("depth_hist:\t");
+  for (int d = 0; d < MAP_HIST_BINS; d++) {
+    if (metrics->depth_hist[d]) {
+      printf("%d%s:%u ", d, d == MAP_HIST_BINS - 1 ? "+" : "",
+             metrics->depth_hist[d]);
+    }
+  }
+  printf("\n");
+}
+
+// Prints word counts.
+void print_results(map_pair_t *pairs, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    printf("%-*lu %s\n", 10, (uint64_t)pairs[i].value, pairs[i].key);
+  }
 }
 
 int main(int argc, char **argv) {
@@ -111,15 +378,28 @@ int main(int argc, char **argv) {
   int debug = 0;
   int resize = 0;
   uint64_t size = MAP_SIZE;
+  map_backend_t backend = MAP_BACKEND_CHAINING;
+  double max_load = 0;
+  int intern = 0;
+  hash_fn_t hash = hash_fnv64;
+  int threads = 0;
+  int sorted = 0;
+  size_t chunk_size = CHUNK_SIZE;
   char c;
   fname[0] = '\0';
 
   // parse args and validate.
-  while ((c = getopt(argc, argv, "rdf:s:")) != EOF) {
+  while ((c = getopt(argc, argv, "aordf:s:b:l:H:t:c:")) != EOF) {
     switch (c) {
     case 'f':
       strncpy(fname, optarg, MAX_TOKEN_LEN);
       break;
+    case 'a':
+      intern = 1;
+      break;
+    case 'o':
+      sorted = 1;
+      break;
     case 'd':
       debug = 1;
       break;
@@ -127,6 +407,39 @@ int main(int argc, char **argv) {
       resize = 1;
       srand(time(NULL));
       break;
+    case 'b':
+      if (!map_backend_parse(optarg, &backend)) {
+        printf("-b <backend>; unknown backend: %s\n", optarg);
+        exit(1);
+      }
+      break;
+    case 'H':
+      if (!hash_parse(optarg, &hash)) {
+        printf("-H <hash>; unknown hash: %s\n", optarg);
+        exit(1);
+      }
+      break;
+    case 't':
+      threads = atoi(optarg);
+      if (threads <= 0) {
+        printf("-t <threads>; threads must be positive: %s\n", optarg);
+        exit(1);
+      }
+      break;
+    case 'c':
+      chunk_size = strtoul(optarg, NULL, 10);
+      if (chunk_size == 0) {
+        printf("-c <chunk>; chunk size must be positive: %s\n", optarg);
+        exit(1);
+      }
+      break;
+    case 'l':
+      max_load = strtod(optarg, NULL);
+      if (max_load <= 0) {
+        printf("-l <load>; load must be positive: %s\n", optarg);
+        exit(1);
+      }
+      break;
     case 's':
       errno = 0;
       size = strtol(optarg, NULL, 10);
@@ -147,16 +460,46 @@ int main(int argc, char **argv) {
     usage();
     exit(1);
   }
+  if (threads && resize) {
+    printf("-r cannot be combined with -t\n");
+    exit(1);
+  }
 
   // run the word count on the specified file.
-  map_t *map = map_create(size);
-  FILE *f = fopen(fname, "r");
-  assert(f);
-  word_count(f, map, resize);
-  fclose(f);
+  map_config_t config = {size, backend, max_load, intern, hash};
+  map_t *map = map_create_with(config);
+  uint64_t tokens;
+  uint32_t nchunks = 0;
+  double merge_time = 0;
+  double start = now();
+  if (threads) {
+    tokens = word_count_parallel(fname, map, config, threads, chunk_size,
+                                 &nchunks, &merge_time);
+  } else {
+    FILE *f = fopen(fname, "r");
+    assert(f);
+    tokens = word_count(f, map, resize);
+    fclose(f);
+  }
+  double elapsed = now() - start;
 
-  // print word count results
-  map_apply(map, print_result);
+  // print word count results, in map order or sorted by word.
+  start = now();
+  if (sorted) {
+    map_pair_t *pairs = malloc(sizeof(map_pair_t) * map_num_entries(map));
+    print_results(pairs, map_export(map, pairs, 1));
+    free(pairs);
+  } else {
+    map_pair_t pairs[PRINT_BATCH];
+    map_iter_t it;
+    size_t n;
+    map_iter_init(map, &it);
+    while ((n = map_iter_next(map, &it, pairs, PRINT_BATCH))) {
+      print_results(pairs, n);
+    }
+  }
+  fflush(stdout);
+  double print_time = now() - start;
 
   // print debug info.
   if (debug) {
@@ -164,9 +507,34 @@ int main(int argc, char **argv) {
            "Map Stats:\n"
            "----------------------------------\n");
     map_metrics_t *metrics = map_metrics(map);
+    printf("hash:\t\t%s\n", hash_name(hash));
     printf("num_entries:\t%d\n", metrics->num_entries);
     printf("max_depth:\t%d\n", metrics->max_depth);
     printf("size:\t\t%d\n", metrics->curr_size);
+    printf("load_factor:\t%.3f\n", metrics->load_factor);
+    if (metrics->migrate_total) {
+      printf("migrating:\t%u/%u buckets\n", metrics->migrate_done,
+             metrics->migrate_total);
+    }
+    printf("bytes:\t\t%lu (%.1f per entry)\n", metrics->bytes,
+           metrics->bytes_per_entry);
+    printf("  buckets:\t%lu\n", metrics->bytes_buckets);
+    printf("  entries:\t%lu\n", metrics->bytes_entries);
+    printf("  keys:\t\t%lu\n", metrics->bytes_keys);
+    printf("avg_depth:\t%.3f\n", metrics->avg_depth);
+    print_depth_hist(metrics);
+    printf("resizes:\t%u\n", metrics->resizes);
+    printf("lookups:\t%lu\n", metrics->lookups);
+    printf("probes/lookup:\t%.3f\n",
+           metrics->lookups ? (double)metrics->probes / metrics->lookups : 0);
+    if (threads) {
+      printf("threads:\t%d\n", threads);
+      printf("chunk_size:\t%zu (%u chunks)\n", chunk_size, nchunks);
+      printf("merge time:\t%.3f s\n", merge_time);
+    }
+    printf("time:\t\t%.3f s\n", elapsed);
+    printf("tokens/sec:\t%.0f\n", tokens / elapsed);
+    printf("output time:\t%.3f s\n", print_time);
     free(metrics);
   }
   if (resize) {
@@ -5,6 +5,7 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "../topology.h"
 #include "ii.h"
 
 #define DEFAULT_WORD_FILTER "apps/oec_word_filter.txt"
@@ -14,7 +15,8 @@
 
 void usage(char *arg0) {
   printf("Usage: %s -d <input dir> [-o <output dir>] [-e <extension list>] [-s "
-         "<shards>] [-m <map size>] [-p <parallelism>]\n",
+         "<shards>] [-F <text|binary>] [-m <map size>] [-p <parallelism>] "
+         "[-a <cpu list|cores>] [-N]\n",
          arg0);
   printf("Description: Builds and optionally outputs an inverted index of a "
          "text corpus.\n");
@@ -25,8 +27,11 @@ void usage(char *arg0) {
       "   -e <extension list>     list of file extensions to read (defaults to '.txt')\n"
       "   -f <word filter file>   file containing words to filter, one per line\n"
       "   -s <shards>             number of output shards for the index (defaults to 1)\n"
+      "   -F <text|binary>        format of the output shards (defaults to text)\n"
       "   -m <map size>           change number of entries in hash table backing the index (default 1)\n"
-      "   -p <parallelism>        max number of threads (default 1)\n");
+      "   -p <parallelism>        max number of threads (default 1)\n"
+      "   -a <cpu list|cores>     pin threads to a list of CPUs, e.g. 0-3,8, or one per physical core\n"
+      "   -N                      group threads by NUMA node\n");
   // clang-format on
 }
 
@@ -38,10 +43,15 @@ int main(int argc, char **argv) {
   int map_size = DEFAULT_MAP_SIZE;
   int parallelism = DEFAULT_PARALLELISM;
   int shards = DEFAULT_SHARDS;
+  enum ii_format format = II_FORMAT_TEXT;
+  enum threadpool_affinity affinity = THREADPOOL_AFFINITY_NONE;
+  int *cpus = NULL;
+  int ncpus = 0;
+  int numa = 0;
   int n_ext;
   int c;
   opterr = 0;
-  while ((c = getopt(argc, argv, "d:e:m:p:o:s:h")) != -1) {
+  while ((c = getopt(argc, argv, "d:e:m:p:o:s:F:a:Nh")) != -1) {
     switch (c) {
     case 'd':
       dir = optarg;
@@ -74,6 +84,16 @@ int main(int argc, char **argv) {
         exit(1);
       }
       break;
+    case 'F':
+      if (strcmp(optarg, "text") == 0) {
+        format = II_FORMAT_TEXT;
+      } else if (strcmp(optarg, "binary") == 0) {
+        format = II_FORMAT_BINARY;
+      } else {
+        printf("Option -F requires 'text' or 'binary'.\n");
+        exit(1);
+      }
+      break;
     case 'm':
       errno = 0;
       map_size = strtol(optarg, NULL, 10);
@@ -90,6 +110,23 @@ int main(int argc, char **argv) {
         exit(1);
       }
       break;
+    case 'a':
+      if (strcmp(optarg, "cores") == 0) {
+        affinity = THREADPOOL_AFFINITY_CORES;
+        break;
+      }
+      affinity = THREADPOOL_AFFINITY_CPUS;
+      ncpus = topology_parse_cpus(optarg, NULL, 0);
+      if (ncpus <= 0) {
+        printf("Option -a requires a CPU list or 'cores'.\n");
+        exit(1);
+      }
+      cpus = realloc(cpus, ncpus * sizeof(int));
+      topology_parse_cpus(optarg, cpus, ncpus);
+      break;
+    case 'N':
+      numa = 1;
+      break;
     case 'h':
       usage(argv[0]);
       exit(1);
@@ -143,17 +180,20 @@ int main(int argc, char **argv) {
     extensions = TEXT_EXTENSIONS;
   }
   char **files = list_files(dir, extensions);
-  free(extensions);
+  if (extensions != TEXT_EXTENSIONS) {
+    free(extensions);
+  }
 
   printf("Creating ii with files:\n");
   for (char **file = files; *file; file++) {
     printf("> %s\n", *file);
   }
 
+  set_ii_placement(affinity, cpus, ncpus, numa);
   build_ii(files, filter_list, parallelism, map_size);
 
   if (outdir != NULL) {
-    dump_ii(outdir, shards, parallelism);
+    dump_ii(outdir, shards, parallelism, format);
   }
 
   free_ii();
@@ -165,4 +205,5 @@ int main(int argc, char **argv) {
     free(*filter);
   }
   free(filter_list);
+  free(cpus);
 }
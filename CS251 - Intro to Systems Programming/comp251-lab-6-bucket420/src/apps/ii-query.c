@@ -0,0 +1,163 @@
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ii.h"
+#include "query.h"
+#include "shard.h"
+
+#define DEFAULT_MAP_SIZE 4096
+#define DEFAULT_PARALLELISM 1
+#define DEFAULT_TOP_K 10
+#define MAX_QUERY_LEN 4096
+
+void usage(char *arg0) {
+  printf("Usage: %s (-i <index dir> | -d <input dir> [-m <map size>] "
+         "[-p <parallelism>]) [-k <top k>] [query ...]\n",
+         arg0);
+  printf("Description: Runs queries against an inverted index, read from the "
+         "command line or, if there are none, one per line from stdin.\n");
+  // clang-format off
+  printf("Arguments: \n"
+      "   -i <index dir>          directory holding binary shards written by ii-main -F binary\n"
+      "   -d <input dir>          build the index of the .txt files of a directory in memory instead\n"
+      "   -m <map size>           number of entries in hash table backing the index built with -d\n"
+      "   -p <parallelism>        max number of threads building the index with -d (default 1)\n"
+      "   -k <top k>              number of best matching files to print (default 10)\n"
+      "Queries: \n"
+      "   a b                     files with both a and b\n"
+      "   a OR b                  files with a or b\n"
+      "   a -b, a NOT b           files with a but not b\n"
+      "   \"a b\"                   files with a line holding both a and b\n");
+  // clang-format on
+}
+
+// Returns the current time in ms.
+double now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Parses and runs a query, printing its best k files and how long it took.
+void run_query(const char *text, const query_source_t *src, query_hit_t *top,
+               int k) {
+  printf("> %s\n", text);
+  double start = now_ms();
+  query_t *q = query_parse(text);
+  if (!q) {
+    printf("Invalid query: it needs a word, and quotes must be closed.\n");
+    return;
+  }
+  int n = query_run(q, src, top, k);
+  double ms = now_ms() - start;
+  query_free(q);
+  printf("%d files matched in %.3f ms\n", n, ms);
+  for (int i = 0; i < n && i < k; i++) {
+    const char *file = src->file(src->arg, top[i].file);
+    printf("%8ld  %s\n", top[i].score, file ? file : "?");
+  }
+}
+
+// Returns an integer option of at least min, or exits.
+int int_arg(int opt, const char *arg, int min) {
+  errno = 0;
+  char *end;
+  long v = strtol(arg, &end, 10);
+  if (errno != 0 || *end || v < min || v > INT_MAX) {
+    printf("Option -%c requires a number of at least %d.\n", opt, min);
+    exit(1);
+  }
+  return v;
+}
+
+int main(int argc, char **argv) {
+  char *index_dir = NULL;
+  char *dir = NULL;
+  int map_size = DEFAULT_MAP_SIZE;
+  int parallelism = DEFAULT_PARALLELISM;
+  int k = DEFAULT_TOP_K;
+  int c;
+  opterr = 0;
+  while ((c = getopt(argc, argv, "i:d:m:p:k:h")) != -1) {
+    switch (c) {
+    case 'i':
+      index_dir = optarg;
+      break;
+    case 'd':
+      dir = optarg;
+      break;
+    case 'm':
+      map_size = int_arg(c, optarg, 1);
+      break;
+    case 'p':
+      parallelism = int_arg(c, optarg, 1);
+      break;
+    case 'k':
+      k = int_arg(c, optarg, 0);
+      break;
+    case '?':
+      printf("Unknown option or missing argument `-%c'.\n", optopt);
+      usage(argv[0]);
+      exit(1);
+    default:
+      usage(argv[0]);
+      exit(1);
+    }
+  }
+  if (!index_dir == !dir) {
+    printf("Exactly one of -i and -d is required.\n");
+    usage(argv[0]);
+    exit(1);
+  }
+
+  query_source_t src;
+  shard_index_t *idx = NULL;
+  char **files = NULL;
+  double start = now_ms();
+  if (index_dir) {
+    idx = shard_index_open(index_dir);
+    if (!idx) {
+      perror(index_dir);
+      exit(1);
+    }
+    query_source_shards(&src, idx);
+  } else {
+    files = list_files(dir, TEXT_EXTENSIONS);
+    build_ii(files, NULL, parallelism, map_size);
+    ii_query_source(&src);
+  }
+  printf("Loaded index of %d files in %.3f ms\n", src.n_files,
+         now_ms() - start);
+
+  query_hit_t *top = malloc((k ? k : 1) * sizeof(query_hit_t));
+  if (optind < argc) {
+    for (int i = optind; i < argc; i++) {
+      run_query(argv[i], &src, top, k);
+    }
+  } else {
+    char buff[MAX_QUERY_LEN];
+    while (fgets(buff, MAX_QUERY_LEN, stdin)) {
+      buff[strcspn(buff, "\n")] = '\0';
+      if (*buff) {
+        run_query(buff, &src, top, k);
+      }
+    }
+  }
+  free(top);
+
+  if (idx) {
+    shard_index_close(idx);
+  } else {
+    free_ii();
+    for (char **file = files; *file; file++) {
+      free(*file);
+    }
+    free(files);
+  }
+}
@@ -8,9 +8,12 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "../graph.h"
 #include "../map/map.h"
 #include "../thread_pool.h"
 #include "../util.h"
+#include "postings.h"
+#include "shard.h"
 
 #define MAX_LINE_LEN 1024
 #define PER_FILE_MAP_SIZE 1024
@@ -19,9 +22,17 @@ char *TEXT_EXTENSIONS[] = {".txt", NULL};
 
 map_t *ii = NULL;           // the ii
 map_t *file_aliases = NULL; // filename -> alias
+char **ii_files = NULL;     // files of the ii, by alias; owned by the caller
+                            // of build_ii
+int n_ii_files = 0;         // number of files of the ii
 
 char **filter_list = NULL; // words to filter; only used during call to
                            // build_ii
+threadpool_t pool = NULL;  // pool shared by build_ii and dump_ii; stopped and
+                           // destroyed by free_ii
+int pool_threads = 0;      // number of workers of pool
+threadpool_config_t pool_config; // placement of the pool's workers; set by
+                                 // set_ii_placement
 
 // convert a string to lower case and strip all non-alphanumeric characters.
 int lower_and_strip(char *str) {
@@ -45,64 +56,109 @@ int lower_and_strip(char *str) {
 // entry for a word, may be shared by several threads. relies on thread safe
 // implementation of map.
 struct word_entry {
-  char *word;   // word
-  map_t *files; // map of filename->file_entry
+  posting_list_t postings; // lines the word appears on, by file
 };
 
-// entry for a word within a file.
-struct file_entry {
-  int n;          // number of appearances
-  int *v;         // list of ints, the line numbers the word appears on
-  const char *fn; // the filename
+// a partial index, built by a single worker from the files it processed and
+// split by merge partition. each part maps word -> word_entry for the words of
+// one partition.
+struct partial {
+  map_t **parts;
 };
 
-// given a word, either get the existing word entry or create a new word entry
-// and initalize the file map for the word.
-struct word_entry *put_or_get(const char *word) {
-  struct word_entry *z = malloc(sizeof(struct word_entry));
-  assert(z);
-  z->files = map_create(PER_FILE_MAP_SIZE);
-  struct word_entry *old;
-  int exists = map_get_or_put(ii, word, (void **)&old, z);
-  if (exists) {
-    map_free(&z->files);
-    free(z);
-  } else {
-    // first insert copies the word to the entry.
-    old->word = malloc(strlen(word) + 1);
-    assert(old->word);
-    strcpy(old->word, word);
-  }
-  return old;
-}
-
-// load word/file list into ii
-void *bulk_load_apply_fn(const char *key, void *value) {
-  struct word_entry *e = put_or_get(key);
-  struct file_entry *v = value;
-  map_put(e->files, v->fn, v);
-  return value;
+// globals for building the ii; only used during the call to build_ii.
+char **input_files = NULL;       // files to index, by alias
+struct partial *partials = NULL; // partial index of each worker
+int n_partitions = 0;            // number of merge partitions
+
+// return the merge partition of a word. the maps pick a row from the low bits
+// of their own FNV-1a hash, so the partition is picked from the high bits
+// so as not to leave most rows of each part empty.
+int partition(const char *word) {
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (const char *c = word; *c; c++) {
+    h ^= (unsigned char)*c;
+    h *= 0x100000001b3ull;
+  }
+  return (h >> 32) % n_partitions;
 }
 
-// load the per-file file entry into the ii by updating the file map for the
-// word.
-void bulk_load(const char *file, map_t *fm) {
-  map_apply(fm, bulk_load_apply_fn);
+// create a word entry without postings.
+struct word_entry *create_word_entry() {
+  struct word_entry *e = malloc(sizeof(struct word_entry));
+  assert(e);
+  posting_list_init(&e->postings);
+  return e;
 }
 
-// create/update the file entry for the file/line for a given word.
-void put_entry(const char *file, int line, const char *word, map_t *fm) {
-  struct file_entry *values;
-  int exists = map_get(fm, word, (void **)&values);
-  if (!exists) {
-    values = calloc(1, sizeof(struct file_entry));
-    values->fn = file;
+// argument for loading a file into a partial index
+struct bulk_load_arg {
+  struct partial *p; // partial index of the calling worker
+  int file;          // alias of the file
+};
+
+// load word/line list into a partial index, encoding the lines into a posting.
+// only the worker that owns the partial index uses it, so words are looked up
+// before an entry is created.
+void *bulk_load_apply_fn(const char *key, void *value, void *arg) {
+  struct bulk_load_arg *bla = arg;
+  map_t *part = bla->p->parts[partition(key)];
+  struct word_entry *e;
+  if (!map_get(part, key, (void **)&e)) {
+    e = create_word_entry();
+    map_put(part, key, e);
   }
-  values->n++;
-  values->v = realloc(values->v, sizeof(int) * values->n);
-  assert(values->v);
-  values->v[values->n - 1] = line;
-  map_put(fm, word, values);
+  line_list_t *lines = value;
+  posting_list_add(&e->postings, posting_encode(bla->file, lines));
+  line_list_free(lines);
+  free(lines);
+  return NULL;
+}
+
+// load the per-file line lists into the partial index of the calling worker.
+void bulk_load(int file, map_t *fm) {
+  int id = threadpool_worker_id(pool);
+  assert(id >= 0);
+  struct bulk_load_arg arg = {&partials[id], file};
+  map_apply_arg(fm, bulk_load_apply_fn, &arg);
+}
+
+// merge a word entry of a partial index into the ii. a word belongs to a single
+// partition, and only its merger puts it, so there is no race between the
+// lookup and the put.
+void *merge_apply_fn(const char *key, void *value) {
+  struct word_entry *partial = value;
+  struct word_entry *e;
+  if (!map_get(ii, key, (void **)&e)) {
+    map_put(ii, key, partial);
+    return value;
+  }
+  // each file was loaded into a single partial index, so files never collide.
+  posting_list_merge(&e->postings, &partial->postings);
+  free(partial);
+  return NULL;
+}
+
+// merge one partition of every partial index into the ii.
+void *merge_partition(void *arg) {
+  long m = (long)arg;
+  for (int i = 0; i < pool_threads; i++) {
+    map_apply(partials[i].parts[m], merge_apply_fn);
+    map_free(&partials[i].parts[m]);
+  }
+  return NULL;
+}
+
+// append the line to the line list of a given word.
+void put_entry(int line, const char *word, map_t *fm) {
+  line_list_t *lines;
+  if (!map_get(fm, word, (void **)&lines)) {
+    lines = malloc(sizeof(line_list_t));
+    assert(lines);
+    line_list_init(lines);
+    map_put(fm, word, lines);
+  }
+  line_list_append(lines, line);
 }
 
 int in_filter(const char *word, int len) {
@@ -114,8 +170,8 @@ int in_filter(const char *word, int len) {
   return 0;
 }
 
-// process a line from the file, updating the file entry for each word.
-void process_line(const char *file, int l_no, char *line, map_t *fm) {
+// process a line from the file, updating the line list of each word.
+void process_line(int l_no, char *line, map_t *fm) {
   char *save;
   int len;
   for (char *word = strtok_r(line, " ", &save); word;
@@ -124,12 +180,15 @@ void process_line(const char *file, int l_no, char *line, map_t *fm) {
     if (!len || (filter_list && in_filter(word, len))) {
       continue;
     }
-    put_entry(file, l_no, word, fm);
+    put_entry(l_no, word, fm);
   }
 }
 
-// update the ii for the given file.
-void process_file(char *file) {
+// update the partial index of the calling worker for the file with the given
+// alias.
+void *process_file(void *arg) {
+  int alias = (long)arg;
+  char *file = input_files[alias];
   char buff[MAX_LINE_LEN];
   printf("> Processing %s...\n", file);
   FILE *f = fopen(file, "r");
@@ -137,19 +196,19 @@ void process_file(char *file) {
     perror("fopen");
     exit(1);
   }
-  // store a map of word -> lines for this file, then bulk update the global
-  // map.
+  // store a map of word -> lines for this file, then bulk update the partial
+  // index.
   map_t *fm = map_create(PER_FILE_MAP_SIZE);
   int line = 0;
   while (fgets(buff, MAX_LINE_LEN, f)) {
-    process_line(file, line, buff, fm);
+    process_line(line, buff, fm);
     line++;
   }
   fclose(f);
-  // bulk load results into ii.
-  bulk_load(file, fm);
+  bulk_load(alias, fm);
   map_free(&fm);
   printf("> Processing %s done!\n", file);
+  return NULL;
 }
 
 // helper fn to calculate the length of a null-terminated list.
@@ -160,42 +219,104 @@ int len(char **lst) {
   return i;
 }
 
-// free each file entry in a map file->file_entry
-void *free_apply_fn_fm(const char *key, void *value) {
-  if (!value) {
-    printf("wtf fm %s\n", key);
-  }
-  struct file_entry *e = value;
-  free(e->v);
-  // filename is owned by caller. free(e->fn);
-  free(e);
-  return NULL;
-}
-
 // free the per-word entry in the ii
 void *free_apply_fn_ii(const char *key, void *value) {
   if (!value) {
     printf("wtf ii %s\n", key);
   }
   struct word_entry *e = value;
-  map_apply(e->files, free_apply_fn_fm);
-  free(e->word);
-  map_free(&e->files);
+  posting_list_free(&e->postings);
   free(e);
   return NULL;
 }
 
+// memory footprint of the ii's postings
+struct footprint {
+  unsigned long words;    // number of words
+  unsigned long postings; // number of (word, file) postings
+  unsigned long lines;    // number of (word, file, line) entries
+  unsigned long bytes;    // bytes held by word entries and postings
+};
+
+// add a word entry of the ii to the footprint given as arg
+void *footprint_apply_fn(const char *key, void *value, void *arg) {
+  struct footprint *fp = arg;
+  struct word_entry *e = value;
+  fp->words++;
+  fp->postings += e->postings.n;
+  for (int i = 0; i < e->postings.n; i++) {
+    fp->lines += e->postings.v[i]->n;
+  }
+  fp->bytes += sizeof(struct word_entry) + posting_list_size(&e->postings);
+  return value;
+}
+
+// print the memory footprint of the ii's postings
+void print_footprint() {
+  struct footprint fp = {0};
+  map_apply_arg(ii, footprint_apply_fn, &fp);
+  printf("Index: %lu words, %lu postings, %lu lines in %lu bytes (%.2f bytes "
+         "per line)\n",
+         fp.words, fp.postings, fp.lines, fp.bytes,
+         fp.lines ? (double)fp.bytes / fp.lines : 0);
+}
+
+// print where each worker of the pool ran and how much of the time it was busy.
+void print_pool_stats() {
+  threadpool_stats_t *stats = threadpool_stats(pool);
+  for (int i = 0; i < stats->nthreads; i++) {
+    threadpool_worker_stats_t *w = &stats->workers[i];
+    unsigned long total = w->busy_ns + w->idle_ns;
+    printf("> Worker %d (cpu %d, node %d): %lu items, %.1f ms busy (%.0f%%)\n",
+           i, w->cpu, w->node, w->completed_work, w->busy_ns / 1e6,
+           total ? 100.0 * w->busy_ns / total : 0);
+  }
+  threadpool_stats_free(stats);
+}
+
 // free the ii
 void free_ii() {
+  if (pool) {
+    threadpool_stop(pool, THREADPOOL_STOP_DRAIN);
+    print_pool_stats();
+    threadpool_destroy(pool);
+    pool = NULL;
+  }
   map_apply(ii, free_apply_fn_ii);
   map_free(&ii);
   map_free(&file_aliases);
+  ii_files = NULL;
+  n_ii_files = 0;
 }
 
-// match the signature for the threadpool
-void *process_file_wrapper(void *file) {
-  process_file((char *)file);
-  return NULL;
+// return a graph on the shared pool, creating and starting the pool with the
+// given parallelism on first use. the pool keeps running after the graph
+// completes so that later graphs reuse its threads.
+graph_t create_graph(int max_parallelism) {
+  if (!pool) {
+    threadpool_config_t cfg = pool_config;
+    cfg.nthreads = max_parallelism;
+    pool = threadpool_create(cfg);
+    pool_threads = max_parallelism;
+    threadpool_start(pool);
+  }
+  return graph_create(pool);
+}
+
+// run the graph, wait for all of its tasks to complete and free it.
+void run_graph(graph_t g) {
+  graph_run(g);
+  graph_wait(g);
+  graph_free(g);
+}
+
+// set the placement of the pool's workers
+void set_ii_placement(enum threadpool_affinity affinity, const int *cpus,
+                      int ncpus, int numa) {
+  pool_config.affinity = affinity;
+  pool_config.cpus = cpus;
+  pool_config.ncpus = ncpus;
+  pool_config.numa = numa;
 }
 
 // build an inverted index by processing words in parallel
@@ -205,6 +326,8 @@ void build_ii(char **files, char **filter, int max_parallelism, int map_size) {
   ii = map_create(map_size);
   file_aliases = map_create(map_size);
   int n = len(files);
+  ii_files = files;
+  n_ii_files = n;
   // build aliases for files -- assign an integer to each file
   for (long i = 0; i < n; i++) {
     map_put(file_aliases, files[i], (void *)i);
@@ -212,25 +335,72 @@ void build_ii(char **files, char **filter, int max_parallelism, int map_size) {
   }
   printf("Processing %d files with %d threads...\n", n, max_parallelism);
   // Use a threadpool to limit parallelism.
-  threadpool_config_t cfg;
-  cfg.nthreads = max_parallelism;
-  threadpool_t tp = threadpool_create(cfg);
-  threadpool_start(tp);
-
-  // Create bulk work -- one work item per file
-  threadpool_work_t work;
+  // Each worker builds a partial index of the files it processes, so workers
+  // never contend on hot words. Once every file is done, the partial indexes
+  // are merged into the ii in parallel, each merger owning a partition of the
+  // words.
+  graph_t g = create_graph(max_parallelism);
+  n_partitions = pool_threads;
+  partials = malloc(pool_threads * sizeof(struct partial));
+  assert(partials);
+  for (int i = 0; i < pool_threads; i++) {
+    partials[i].parts = malloc(n_partitions * sizeof(map_t *));
+    assert(partials[i].parts);
+    for (int m = 0; m < n_partitions; m++) {
+      partials[i].parts[m] = map_create(max(map_size / n_partitions, 1));
+    }
+  }
+  int *processed = malloc(n * sizeof(int));
+  assert(processed);
+  input_files = files;
+  for (long i = 0; i < n; i++) {
+    threadpool_work_t work = {process_file, (void *)i};
+    processed[i] = graph_add(g, work, NULL, 0);
+  }
+  for (long m = 0; m < n_partitions; m++) {
+    threadpool_work_t work = {merge_partition, (void *)m};
+    graph_add(g, work, processed, n);
+  }
+  // Wait for work to complete; the pool stays up for dump_ii.
+  run_graph(g);
+  free(processed);
+  for (int i = 0; i < pool_threads; i++) {
+    free(partials[i].parts);
+  }
+  free(partials);
+  partials = NULL;
+  input_files = NULL;
+  print_footprint();
+}
 
-  work.fn = process_file_wrapper;
-  work.cb = NULL; // no callback necessary
-  for (int i = 0; i < n; i++) {
-    work.work = files[i];
-    threadpool_add(tp, work);
+// look up a word of the ii for a query.
+int ii_lookup(void *unused, const char *word, query_list_t *list) {
+  struct word_entry *we;
+  if (!map_get(ii, word, (void **)&we)) {
+    return 0;
   }
+  query_list_init(list, we->postings.n);
+  for (int i = 0; i < we->postings.n; i++) {
+    const posting_t *p = we->postings.v[i];
+    list->files[i] = p->file;
+    list->counts[i] = p->n;
+    list->lines[i] = p->data;
+  }
+  return 1;
+}
 
-  // Drain the pool and wait for work to complete.
-  threadpool_stop(tp, THREADPOOL_STOP_DRAIN);
-  // Drain should be complete; there should be no pending work.
-  threadpool_destroy(tp);
+// return the name of a file of the ii for a query.
+const char *ii_file(void *unused, int alias) {
+  return alias >= 0 && alias < n_ii_files ? ii_files[alias] : NULL;
+}
+
+// fill in a query source for the ii in memory.
+void ii_query_source(query_source_t *src) {
+  assert(ii);
+  src->lookup = ii_lookup;
+  src->file = ii_file;
+  src->n_files = n_ii_files;
+  src->arg = NULL;
 }
 
 // list files in a directory, filtered by a list of extensions. if extensions is
@@ -277,37 +447,16 @@ char **list_files(char *dir, char **extensions) {
   return flist;
 }
 
-// globals for dumping the ii
-const char **keys = NULL;
-unsigned int n_keys = 0;
-unsigned int keys_len = 0;
-
-// apply_fn to create a list of all keys
-void *key_aggregate_fn(const char *key, void *value) {
-  n_keys++;
-  // grow list if necessary
-  if (n_keys > keys_len) {
-    keys_len = keys_len > 0 ? keys_len * 2 : 256;
-    keys = realloc(keys, keys_len * sizeof(char *));
-    assert(keys);
-  }
-  keys[n_keys - 1] = key;
-  return value;
-}
-
-// match qsort desired compare function signature; code from qsort manual
-static int cmpstr(const void *p1, const void *p2) {
-  return strcmp(*(char *const *)p1, *(char *const *)p2);
-}
+// globals for dumping the ii: every word and its entry, sorted by word.
+map_pair_t *keys = NULL;
+uint32_t n_keys = 0;
 
 // argument for a writer thread
 struct writer_thread_arg {
   char *dir;
-  unsigned int start;
-  unsigned int stride;
-  unsigned int max;
   unsigned int id;
-  unsigned int shards;
+  unsigned int shards; // shards requested; capped at n_keys when writing
+  enum ii_format format;
 };
 
 // argument for apply fn that writes words to files
@@ -315,21 +464,16 @@ struct writer_per_word_apply_arg {
   FILE *f;
 };
 
-// write an entry for a given word (a single line)
-void *writer_per_word_apply_fn(const char *fname, void *value, void *arg) {
-  struct writer_per_word_apply_arg *aa = arg;
-  struct file_entry *fe = value;
-  // look up filename
-  char buff[8];
-  void *val;
-  assertz(!map_get(file_aliases, fname, &val));
-  snprintf(buff, 8, "%ld", (long)val);
-  fprintf(aa->f, "%s(", buff);
-  for (int i = 0; i < fe->n - 1; i++) {
-    fprintf(aa->f, "%d,", fe->v[i]);
-  }
-  fprintf(aa->f, "%d);", fe->v[fe->n - 1]);
-  return value;
+// write the entry for a given word and file, decoding its lines.
+void write_posting(FILE *f, const posting_t *p) {
+  posting_iter_t it;
+  posting_iter_init(&it, p);
+  int line;
+  fprintf(f, "%d(", p->file);
+  for (int i = 0; posting_iter_next(&it, &line); i++) {
+    fprintf(f, i ? ",%d" : "%d", line);
+  }
+  fprintf(f, ");");
 }
 
 // return the number of digits in a number with the given base
@@ -343,33 +487,75 @@ int digits(unsigned int num, unsigned int base) {
   return digits;
 }
 
-// thread to write an output shard
+// populate the key list, sorted.
+void *sort_keys(void *unused) {
+  keys = map_export(ii, &n_keys, /*sorted=*/1);
+  return NULL;
+}
+
+// write the words keys[start..end) and their postings as a binary shard.
+void write_binary_shard(const char *fname, unsigned int start,
+                        unsigned int end) {
+  const char **terms = malloc((end - start) * sizeof(char *));
+  assert(terms);
+  const posting_list_t **postings =
+      malloc((end - start) * sizeof(posting_list_t *));
+  assert(postings);
+  for (unsigned int idx = start; idx < end; idx++) {
+    struct word_entry *we = keys[idx].value;
+    terms[idx - start] = keys[idx].key;
+    postings[idx - start] = &we->postings;
+  }
+  if (shard_write(fname, terms, postings, end - start)) {
+    char err[PATH_MAX + 50];
+    snprintf(err, PATH_MAX + 50, "error writing %s", fname);
+    perror(err);
+    exit(1);
+  }
+  free(terms);
+  free(postings);
+}
+
+// thread to write an output shard, once the keys are sorted
 void *writer_thread(void *arg) {
   struct writer_thread_arg *wta = arg;
-  const char *start_word = keys[wta->start];
-  // the last shard should not go over.
-  unsigned int max_idx =
-      wta->id == wta->shards - 1 ? wta->max : wta->start + wta->stride;
-  const char *end_word = keys[max_idx - 1];
-  struct word_entry *we;
+  // cap shards at number of keys
+  unsigned int shards = min(wta->shards, n_keys);
+  if (wta->id >= shards) {
+    return NULL;
+  }
+  // the first n_keys % shards shards pick up the remainder.
+  unsigned int stride = n_keys / shards;
+  unsigned int rem = n_keys % shards;
+  unsigned int start = wta->id * stride + min(wta->id, rem);
+  unsigned int max_idx = start + stride + (wta->id < rem);
+  const char *start_word = keys[start].key;
+  const char *end_word = keys[max_idx - 1].key;
   char fname[PATH_MAX];
   char fmt[64];
   // create format string for file name based on max number of digits -- e.g.,
   // 0000_1024
   // 0123_1024
   // 1024_1024
-  snprintf(fmt, 64, "%%s/%%0%dd-%%0%dd_%%s-%%s.idx", digits(wta->shards, 10),
-           digits(wta->shards, 10));
-  snprintf(fname, PATH_MAX, fmt, wta->dir, wta->id, wta->shards, start_word,
-           end_word);
+  snprintf(fmt, 64, "%%s/%%0%dd-%%0%dd_%%s-%%s%%s", digits(shards, 10),
+           digits(shards, 10));
+  snprintf(fname, PATH_MAX, fmt, wta->dir, wta->id, shards, start_word,
+           end_word,
+           wta->format == II_FORMAT_BINARY ? SHARD_EXTENSION : ".idx");
   printf("> Writing shard %d...\n", wta->id);
+  if (wta->format == II_FORMAT_BINARY) {
+    write_binary_shard(fname, start, max_idx);
+    printf("> Writing shard %d done!\n", wta->id);
+    return NULL;
+  }
   FILE *f = fopen(fname, "w");
-  struct writer_per_word_apply_arg aarg = {f};
-  for (int idx = wta->start; idx < max_idx; idx++) {
+  for (int idx = start; idx < max_idx; idx++) {
     // process word, printing one word per line.
-    fprintf(f, "%s:", keys[idx]);
-    map_get(ii, keys[idx], (void **)&we);
-    map_apply_arg(we->files, writer_per_word_apply_fn, &aarg);
+    struct word_entry *we = keys[idx].value;
+    fprintf(f, "%s:", keys[idx].key);
+    for (int i = 0; i < we->postings.n; i++) {
+      write_posting(f, we->postings.v[i]);
+    }
     fprintf(f, "\n");
   }
   fclose(f);
@@ -400,70 +586,59 @@ void write_index(char *dir, unsigned int shards) {
   printf("> Writing index %s done!n", fname);
 }
 
+// argument for the index writer task
+struct index_arg {
+  char *dir;
+  unsigned int shards;
+};
+
+// match the signature for the threadpool
+void *write_index_wrapper(void *arg) {
+  struct index_arg *ia = arg;
+  write_index(ia->dir, ia->shards);
+  return NULL;
+}
+
 // output the index to files in the target directory, using the given number of
-// shards.
-void dump_ii(char *dir, unsigned int shards, int max_parallelism) {
+// shards in the given format.
+void dump_ii(char *dir, unsigned int shards, int max_parallelism,
+             enum ii_format format) {
   assert(ii);
-  // Write index file, then write shards of output
-  write_index(dir, shards);
-  // First, we get a list of sorted keys.
-  // Then, we sample from the list to divide the output into n shards, selecting
-  // key boundaries. Hot keys will skew the shard sizes.
-  // Finally, we write the n output shards.
+  // The index file is written alongside the shards. For the shards, we get a
+  // list of sorted keys. Then, we sample from the list to divide the output
+  // into n shards, selecting key boundaries. Hot keys will skew the shard
+  // sizes. Finally, we write the n output shards, which start as soon as the
+  // keys are sorted.
   if (keys != NULL) {
     // no-op, we've done this.
+    write_index(dir, shards);
     return;
   }
 
   keys = NULL;
   n_keys = 0;
-  keys_len = 0;
-
-  // populate key list and sort it.
-  map_apply(ii, key_aggregate_fn);
-  qsort(keys, n_keys, sizeof(char *), cmpstr);
 
   // TODO: calculate key weights during apply and shard based on weights of keys
   //       in order to generate more even splits.
-  // cap shards at number of keys
-  shards = min(shards, n_keys);
-  // round up to cover the remainder.
-  unsigned int stride = n_keys / shards;
-  unsigned int rem = n_keys % shards;
-  // create an use a threadpool to write files in parallel.
-  threadpool_config_t cfg = {max(shards / 2, max_parallelism)};
-  threadpool_t tp = threadpool_create(cfg);
-  threadpool_start(tp);
-
-  // create writer threads
+  // write files in parallel, reusing the pool from build_ii.
+  graph_t g = create_graph(max_parallelism);
+  struct index_arg iarg = {dir, shards};
+  threadpool_work_t index = {write_index_wrapper, &iarg};
+  graph_add(g, index, NULL, 0);
+  threadpool_work_t sort = {sort_keys};
+  int sorted = graph_add(g, sort, NULL, 0);
+  // create writer threads; those past the number of keys write nothing.
   struct writer_thread_arg *args =
       malloc(shards * sizeof(struct writer_thread_arg));
-  threadpool_work_t work;
-  work.fn = writer_thread;
-  work.cb = NULL; // no need for a callback
+  assert(args);
   for (int i = 0; i < shards; i++) {
-    // make shards pick up the remainder
-    // TODO: this is a mess and is more easily directly calculable. Threads can
-    //       easily calculate this themselves, as well.
-    int start, wstride;
-    if (i < rem) {
-      wstride = stride + 1;
-      start = i * wstride;
-    } else {
-      wstride = stride;
-      start = rem * (wstride + 1) + (i - rem) * wstride;
-    }
     args[i].dir = dir;
-    args[i].start = start;
-    args[i].stride = wstride;
-    args[i].max = n_keys;
     args[i].id = i;
     args[i].shards = shards;
-    work.work = &args[i];
-    threadpool_add(tp, work);
+    args[i].format = format;
+    threadpool_work_t work = {writer_thread, &args[i]};
+    graph_add(g, work, &sorted, 1);
   }
-
-  // wait for threadpool to drain.
-  threadpool_stop(tp, THREADPOOL_STOP_DRAIN);
-  threadpool_destroy(tp);
+  run_graph(g);
+  free(args);
 }
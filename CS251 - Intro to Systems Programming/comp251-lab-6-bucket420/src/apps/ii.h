@@ -1,24 +1,51 @@
 #ifndef __II_H__
 #define __II_H__
 
+#include "../thread_pool.h"
+#include "query.h"
+
 // Default extensions for text files. Use as a default argument for list_files.
 extern char *TEXT_EXTENSIONS[];
 
+// Place the worker threads of the thread pool created by build_ii or dump_ii;
+// see the affinity, cpus and numa fields of threadpool_config_t. Must be called
+// before build_ii. cpus must stay valid until free_ii.
+void set_ii_placement(enum threadpool_affinity affinity, const int *cpus,
+                      int ncpus, int numa);
+
 // Build an inverted index by processing words in parallel.
 //
 // Files should be an array of paths to files to scan; filter is a disallow list
 // of words to ignore (e.g., and, of, the, ...). The max_parallelism controls
 // how many threads will be used to build the index, and map_size is the initial
 // size of the hash table used to store the ii.
+//
+// The thread pool created here is kept running and reused by dump_ii until
+// free_ii is called.
 void build_ii(char **files, char **filter, int max_parallelism, int map_size);
 
-// Free the inverted index.
+// Free the inverted index and stop the thread pool shared by build_ii and
+// dump_ii, printing where each worker ran and how busy it was.
 void free_ii();
 
+// Fill in a source that answers queries (see query.h) from the index in memory.
+// The source, and the files passed to build_ii, must stay valid until free_ii.
+void ii_query_source(query_source_t *src);
+
+// Formats of the shards written by dump_ii.
+enum ii_format {
+  II_FORMAT_TEXT,   // one "word:alias(line,...);..." line per word (.idx)
+  II_FORMAT_BINARY, // mappable binary shards (.iib); see shard.h
+};
+
 // Output the index to files in the target directory, using the given number of
-// shards.
-// TODO: provide load functionality
-void dump_ii(char *dir, unsigned int shards, int max_parallelism);
+// shards in the given format. max_parallelism is only used if build_ii has not
+// already created the thread pool.
+//
+// Binary shards are loaded with shard_index_open, which maps them and decodes
+// only the postings of the terms that are looked up.
+void dump_ii(char *dir, unsigned int shards, int max_parallelism,
+             enum ii_format format);
 
 // List files in a directory, filtered by a list of extensions. If extensions is
 // NULL, lists all files.
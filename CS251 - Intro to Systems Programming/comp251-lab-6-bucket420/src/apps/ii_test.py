@@ -5,6 +5,8 @@ import subprocess
 import argparse
 import tempfile
 import shutil
+import struct
+import time
 import traceback
 
 from random import randint
@@ -12,6 +14,11 @@ from random import randint
 OUTDIR = 'ii-test-out'
 INDIR = 'ii-test-in'
 
+# binary shard layout; see apps/shard.h
+SHARD_MAGIC = b'IISHARD1'
+SHARD_HEADER = struct.Struct('=8sIIIIQQQ')
+SHARD_ENTRY = struct.Struct('=QII')
+
 def word(args):
     return str(randint(0, args.words))
 
@@ -57,7 +64,8 @@ def list_ii_files(idx_dir):
     files = []
     alias_fname = None
     for dirpath, dirname, filenames in os.walk(idx_dir): 
-        files.extend([f for f in filenames if f.endswith('.idx')])
+        files.extend([f for f in filenames
+            if f.endswith('.idx') or f.endswith('.iib')])
         for f in filenames:
             if f.endswith('.aliases'):
                 alias_fname = f
@@ -65,6 +73,55 @@ def list_ii_files(idx_dir):
     return (files, alias_fname)
 
 
+def read_varint(data, pos):
+    """Decode the varint at pos, returning it and the position after it."""
+    v = 0
+    shift = 0
+    while data[pos] & 0x80:
+        v |= (data[pos] & 0x7f) << shift
+        shift += 7
+        pos += 1
+    return v | (data[pos] << shift), pos + 1
+
+def read_binary_shard(fname):
+    """Decode a binary shard into the lines of the equivalent text shard."""
+    with open(fname, 'rb') as f:
+        data = f.read()
+    magic, n_terms, _, _, _, strings, postings, size = \
+        SHARD_HEADER.unpack_from(data)
+    if magic != SHARD_MAGIC or size != len(data):
+        raise ValueError('{} is not a binary shard'.format(fname))
+    lines = []
+    for i in range(n_terms):
+        block, term, n_files = SHARD_ENTRY.unpack_from(
+            data, SHARD_HEADER.size + i * SHARD_ENTRY.size)
+        start = strings + term
+        word = data[start:data.index(b'\0', start)].decode()
+        pos = postings + block
+        alias = 0
+        appearances = []
+        for _ in range(n_files):
+            delta, pos = read_varint(data, pos)
+            alias += delta
+            n, pos = read_varint(data, pos)
+            _, pos = read_varint(data, pos)
+            nums = []
+            num = 0
+            for _ in range(n):
+                delta, pos = read_varint(data, pos)
+                num += delta
+                nums.append(str(num))
+            appearances.append('{}({});'.format(alias, ','.join(nums)))
+        lines.append('{}:{}\n'.format(word, ''.join(appearances)))
+    return lines
+
+def read_shard(fname):
+    """Return the lines of a text shard, decoding it first if it is binary."""
+    if fname.endswith('.iib'):
+        return read_binary_shard(fname)
+    with open(fname, 'r') as f:
+        return f.readlines()
+
 def validate(args, idx, indir, outdir, result):
     """Validate program output."""
     # check output
@@ -100,8 +157,7 @@ def validate(args, idx, indir, outdir, result):
     line = ''
     try:
         for file in files:
-            f = open(file, 'r')
-            for line in f:
+            for line in read_shard(file):
                 line = line.rstrip()
                 word, flist = line.split(':')
                 if word not in idx:
@@ -134,7 +190,6 @@ def validate(args, idx, indir, outdir, result):
                 if len(idx[word]) > 0:
                     errs.append('file {} word {}: missing files {}'.format(file, word, idx[word]))
                 del idx[word]
-            f.close()
         if len(idx):
             errs.append('missing words {}'.format([k for k in idx]))
     except Exception as e:
@@ -152,11 +207,18 @@ def run(args, idx, indir, outdir):
             '-p', str(args.parallelism),
             '-o', outdir,
             '-s', str(args.shards),
-            '-m', str(args.mapsize)]
+            '-m', str(args.mapsize),
+            '-F', args.format]
+    if args.affinity:
+        cmd.extend(['-a', args.affinity])
+    if args.numa:
+        cmd.append('-N')
     print('Executing {}'.format(cmd))
     result = None
     try:
+        start = time.monotonic()
         result = subprocess.run(cmd, timeout=args.timeout)
+        print('Executed in {:.3f}s'.format(time.monotonic() - start))
     except subprocess.SubprocessError as e:
         print('Failed to execute {}: {}'.format(cmd, e))
     # validate
@@ -197,6 +259,12 @@ def main():
             help='output shards')
     parser.add_argument('-m', '--mapsize', dest='mapsize', default=8192, type=int,
             help='map size')
+    parser.add_argument('-F', '--format', dest='format', default='text',
+            choices=['text', 'binary'], help='format of the output shards')
+    parser.add_argument('-a', '--affinity', dest='affinity', default=None,
+            help='pin threads to a CPU list (e.g. 0-3,8) or to cores')
+    parser.add_argument('-N', '--numa', dest='numa', action='store_true',
+            help='group threads by NUMA node')
     parser.add_argument('-k', '--keep-failed-files', dest='keep_failed',
             action='store_true', help='keep input/output files on failed runs')
     parser.add_argument('-t', '--timeout', dest='timeout', type=int,
@@ -0,0 +1,229 @@
+#include "postings.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../util.h"
+
+// Lines in the first chunk of a line list.
+#define FIRST_CHUNK 8
+
+// A chunk of lines.
+struct line_chunk {
+  struct line_chunk *next; // next chunk, twice the size of this one
+  int cap;                 // lines the chunk can hold
+  int len;                 // lines in the chunk
+  int v[];                 // lines
+};
+
+void line_list_init(line_list_t *l) {
+  l->n = 0;
+  l->head = NULL;
+  l->tail = NULL;
+}
+
+void line_list_append(line_list_t *l, int line) {
+  if (l->n < LINE_LIST_INLINE) {
+    l->v[l->n++] = line;
+    return;
+  }
+  struct line_chunk *c = l->tail;
+  if (!c || c->len == c->cap) {
+    int cap = c ? c->cap * 2 : FIRST_CHUNK;
+    struct line_chunk *next =
+        malloc(sizeof(struct line_chunk) + cap * sizeof(int));
+    assert(next);
+    next->next = NULL;
+    next->cap = cap;
+    next->len = 0;
+    if (c) {
+      c->next = next;
+    } else {
+      l->head = next;
+    }
+    l->tail = c = next;
+  }
+  c->v[c->len++] = line;
+  l->n++;
+}
+
+void line_list_free(line_list_t *l) {
+  struct line_chunk *c = l->head;
+  while (c) {
+    struct line_chunk *next = c->next;
+    free(c);
+    c = next;
+  }
+  l->head = NULL;
+  l->tail = NULL;
+}
+
+int varint_put(uint8_t *buf, uint32_t v) {
+  int i = 0;
+  while (v >= 0x80) {
+    buf[i++] = (v & 0x7f) | 0x80;
+    v >>= 7;
+  }
+  buf[i++] = v;
+  return i;
+}
+
+uint32_t varint_get(const uint8_t **p) {
+  uint32_t v = 0;
+  int shift = 0;
+  const uint8_t *b = *p;
+  while (*b & 0x80) {
+    v |= (uint32_t)(*b++ & 0x7f) << shift;
+    shift += 7;
+  }
+  v |= (uint32_t)*b++ << shift;
+  *p = b;
+  return v;
+}
+
+int varint_read(const uint8_t **p, const uint8_t *end, uint32_t *v) {
+  const uint8_t *b = *p;
+  uint32_t r = 0;
+  for (int shift = 0; b < end && shift < 35; shift += 7) {
+    r |= (uint32_t)(*b & 0x7f) << shift;
+    if (!(*b++ & 0x80)) {
+      *p = b;
+      *v = r;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int varint_len(uint32_t v) {
+  int len = 1;
+  while (v >= 0x80) {
+    v >>= 7;
+    len++;
+  }
+  return len;
+}
+
+// Calls fn with each line of a line list and the line before it (0 for the
+// first), passing arg along.
+void line_list_each(const line_list_t *l, void (*fn)(int, int, void *),
+                    void *arg) {
+  int prev = 0;
+  for (int i = 0; i < min(l->n, LINE_LIST_INLINE); i++) {
+    fn(l->v[i], prev, arg);
+    prev = l->v[i];
+  }
+  for (struct line_chunk *c = l->head; c; c = c->next) {
+    for (int i = 0; i < c->len; i++) {
+      fn(c->v[i], prev, arg);
+      prev = c->v[i];
+    }
+  }
+}
+
+// Adds the varint length of the line's delta to the length given as arg.
+void add_len(int line, int prev, void *arg) {
+  *(uint32_t *)arg += varint_len(line - prev);
+}
+
+// Writes the line's delta to the buffer position given as arg.
+void put_delta(int line, int prev, void *arg) {
+  uint8_t **p = arg;
+  *p += varint_put(*p, line - prev);
+}
+
+posting_t *posting_encode(int file, const line_list_t *l) {
+  // size the posting first, so that it takes a single allocation.
+  uint32_t len = 0;
+  line_list_each(l, add_len, &len);
+  posting_t *p = malloc(sizeof(posting_t) + len);
+  assert(p);
+  p->file = file;
+  p->n = l->n;
+  p->len = len;
+  uint8_t *data = p->data;
+  line_list_each(l, put_delta, &data);
+  return p;
+}
+
+size_t posting_size(const posting_t *p) { return sizeof(posting_t) + p->len; }
+
+void posting_iter_init(posting_iter_t *it, const posting_t *p) {
+  posting_iter_init_data(it, p->data, p->n);
+}
+
+void posting_iter_init_data(posting_iter_t *it, const uint8_t *data, int n) {
+  it->p = data;
+  it->left = n;
+  it->line = 0;
+}
+
+int posting_iter_next(posting_iter_t *it, int *line) {
+  if (!it->left) {
+    return 0;
+  }
+  it->line += varint_get(&it->p);
+  it->left--;
+  *line = it->line;
+  return 1;
+}
+
+void posting_list_init(posting_list_t *l) {
+  l->n = 0;
+  l->cap = 0;
+  l->v = NULL;
+}
+
+void posting_list_add(posting_list_t *l, posting_t *p) {
+  if (l->n == l->cap) {
+    l->cap = l->cap ? l->cap * 2 : 2;
+    l->v = realloc(l->v, l->cap * sizeof(posting_t *));
+    assert(l->v);
+  }
+  // postings mostly arrive in file order, so search from the end.
+  int i = l->n;
+  while (i > 0 && l->v[i - 1]->file > p->file) {
+    i--;
+  }
+  memmove(&l->v[i + 1], &l->v[i], (l->n - i) * sizeof(posting_t *));
+  l->v[i] = p;
+  l->n++;
+}
+
+void posting_list_merge(posting_list_t *l, posting_list_t *from) {
+  int n = l->n + from->n;
+  if (n > l->cap) {
+    l->cap = max(n, l->cap * 2);
+    l->v = realloc(l->v, l->cap * sizeof(posting_t *));
+    assert(l->v);
+  }
+  // merge from the back, so that the postings of l move at most once.
+  int i = l->n - 1;
+  int j = from->n - 1;
+  for (int k = n - 1; j >= 0; k--) {
+    if (i >= 0 && l->v[i]->file > from->v[j]->file) {
+      l->v[k] = l->v[i--];
+    } else {
+      l->v[k] = from->v[j--];
+    }
+  }
+  l->n = n;
+  free(from->v);
+  posting_list_init(from);
+}
+
+void posting_list_free(posting_list_t *l) {
+  for (int i = 0; i < l->n; i++) {
+    free(l->v[i]);
+  }
+  free(l->v);
+  posting_list_init(l);
+}
+
+size_t posting_list_size(const posting_list_t *l) {
+  size_t size = l->cap * sizeof(posting_t *);
+  for (int i = 0; i < l->n; i++) {
+    size += posting_size(l->v[i]);
+  }
+  return size;
+}
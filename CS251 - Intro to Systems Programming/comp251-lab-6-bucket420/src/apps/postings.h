@@ -0,0 +1,115 @@
+#ifndef __POSTINGS_H__
+#define __POSTINGS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Posting lists of the inverted index.
+//
+// While a file is parsed, the lines a word appears on are appended to a
+// line_list: the first few are stored inline, and the rest in chunks that
+// double in size, so appending never copies and allocates O(log n) times.
+//
+// Once the file is done, its line list is encoded into a posting: a single
+// allocation holding the lines as varints of the difference from the previous
+// line (the first from 0). Lines are appended in order, so the differences are
+// small and most take a single byte.
+//
+// A word's postings, one per file, are kept in a posting_list sorted by file.
+
+// Lines stored in a line_list itself.
+#define LINE_LIST_INLINE 4
+
+struct line_chunk;
+
+// Lines of a word in a file, in the order they were appended.
+typedef struct line_list {
+  int n;                         // number of lines
+  int v[LINE_LIST_INLINE];       // first lines
+  struct line_chunk *head;       // chunks holding the later lines
+  struct line_chunk *tail;       // chunk being appended to
+} line_list_t;
+
+// Lines of a word in one file, delta-encoded as varints.
+typedef struct posting {
+  int file;       // alias of the file
+  int n;          // number of lines
+  uint32_t len;   // bytes in data
+  uint8_t data[]; // encoded lines
+} posting_t;
+
+// A word's postings, sorted by file.
+typedef struct posting_list {
+  int n;         // number of postings
+  int cap;       // allocated length of v
+  posting_t **v; // postings
+} posting_list_t;
+
+// Decodes the lines of a posting in order.
+typedef struct posting_iter {
+  const uint8_t *p; // next encoded line
+  int left;         // lines not yet decoded
+  int line;         // last decoded line
+} posting_iter_t;
+
+// Initialize an empty line list.
+void line_list_init(line_list_t *l);
+
+// Append a line, which must not be less than the last line appended.
+void line_list_append(line_list_t *l, int line);
+
+// Free the chunks of a line list; the list itself is owned by the caller.
+void line_list_free(line_list_t *l);
+
+// Encode the lines of a line list into a new posting for the given file. The
+// posting must be freed with free.
+posting_t *posting_encode(int file, const line_list_t *l);
+
+// Return the size of a posting in bytes.
+size_t posting_size(const posting_t *p);
+
+// Start decoding the lines of a posting.
+void posting_iter_init(posting_iter_t *it, const posting_t *p);
+
+// Start decoding n lines encoded as a posting's data are.
+void posting_iter_init_data(posting_iter_t *it, const uint8_t *data, int n);
+
+// Set line to the next line of the posting and return 1, or return 0 if every
+// line has been decoded.
+int posting_iter_next(posting_iter_t *it, int *line);
+
+// Initialize an empty posting list.
+void posting_list_init(posting_list_t *l);
+
+// Add a posting, taking ownership of it. No posting for the same file may be
+// in the list.
+void posting_list_add(posting_list_t *l, posting_t *p);
+
+// Move every posting of from into l, taking ownership of them, and leave from
+// empty. No file may have a posting in both lists. Takes time linear in the
+// lengths of the lists.
+void posting_list_merge(posting_list_t *l, posting_list_t *from);
+
+// Free the postings of a posting list; the list itself is owned by the caller.
+void posting_list_free(posting_list_t *l);
+
+// Return the bytes held by the postings of a list, counting the list's array
+// but not the list itself.
+size_t posting_list_size(const posting_list_t *l);
+
+// Write v as a varint to buf, which must have room for 5 bytes. Returns the
+// number of bytes written.
+int varint_put(uint8_t *buf, uint32_t v);
+
+// Returns the number of bytes of v as a varint.
+int varint_len(uint32_t v);
+
+// Read a varint from *p and advance *p past it.
+uint32_t varint_get(const uint8_t **p);
+
+// Read a varint from *p into v and advance *p past it, like varint_get, if it
+// ends before end and is at most 5 bytes long. Returns 1, or 0 without moving
+// *p if it is not.
+int varint_read(const uint8_t **p, const uint8_t *end, uint32_t *v);
+
+#endif
@@ -0,0 +1,535 @@
+#include "query.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../util.h"
+#include "postings.h"
+
+// An item of a clause: a word, or the words of a quoted item.
+struct item {
+  int neg;      // whether the item is negated
+  int n;        // number of words
+  char **words; // normalized words
+};
+
+// Items that must all match a file.
+struct clause {
+  int n;              // number of items
+  struct item *items; // items
+};
+
+struct query {
+  int n;                  // number of clauses
+  struct clause *clauses; // clauses, any of which may match a file
+};
+
+// Files matching part of a query, sorted, with their scores.
+struct matches {
+  int n;        // number of files
+  int *files;   // aliases of the files, sorted
+  long *scores; // score of each file
+};
+
+// Returns a copy of the len characters at s, lower-cased and stripped of
+// anything but letters and digits as words are when indexed, or NULL if
+// nothing is left.
+char *normalize(const char *s, int len) {
+  char *word = malloc(len + 1);
+  assert(word);
+  int n = 0;
+  for (int i = 0; i < len; i++) {
+    if (isalnum((unsigned char)s[i])) {
+      word[n++] = tolower((unsigned char)s[i]);
+    }
+  }
+  word[n] = '\0';
+  if (!n) {
+    free(word);
+    return NULL;
+  }
+  return word;
+}
+
+// Adds the word of the len characters at s to an item, unless it normalizes to
+// nothing.
+void add_word(struct item *it, const char *s, int len) {
+  char *word = normalize(s, len);
+  if (!word) {
+    return;
+  }
+  it->words = realloc(it->words, (it->n + 1) * sizeof(char *));
+  assert(it->words);
+  it->words[it->n++] = word;
+}
+
+// Adds an item to a clause if it has any words, or frees it.
+void add_item(struct clause *c, struct item it) {
+  if (!it.n) {
+    free(it.words);
+    return;
+  }
+  c->items = realloc(c->items, (c->n + 1) * sizeof(struct item));
+  assert(c->items);
+  c->items[c->n++] = it;
+}
+
+// Returns a new empty clause at the end of a query.
+struct clause *add_clause(query_t *q) {
+  q->clauses = realloc(q->clauses, (q->n + 1) * sizeof(struct clause));
+  assert(q->clauses);
+  struct clause *c = &q->clauses[q->n++];
+  c->n = 0;
+  c->items = NULL;
+  return c;
+}
+
+query_t *query_parse(const char *text) {
+  query_t *q = calloc(1, sizeof(query_t));
+  assert(q);
+  struct clause *c = add_clause(q);
+  int neg = 0;
+  const char *p = text;
+  while (*p) {
+    if (isspace((unsigned char)*p)) {
+      p++;
+    } else if (*p == '-') {
+      neg = 1;
+      p++;
+    } else if (*p == '"') {
+      const char *end = strchr(p + 1, '"');
+      if (!end) {
+        query_free(q);
+        return NULL;
+      }
+      struct item it = {neg, 0, NULL};
+      for (p++; p < end;) {
+        int len = 0;
+        while (p + len < end && !isspace((unsigned char)p[len])) {
+          len++;
+        }
+        add_word(&it, p, len);
+        for (p += len; p < end && isspace((unsigned char)*p); p++) {
+        }
+      }
+      add_item(c, it);
+      neg = 0;
+      p = end + 1;
+    } else {
+      int len = 0;
+      while (p[len] && !isspace((unsigned char)p[len]) && p[len] != '"') {
+        len++;
+      }
+      if (len == 2 && !strncmp(p, "OR", 2)) {
+        // empty clauses are dropped, so "a OR OR b" is "a OR b".
+        if (c->n) {
+          c = add_clause(q);
+        }
+        neg = 0;
+      } else if (len == 3 && !strncmp(p, "NOT", 3)) {
+        neg = 1;
+      } else if (len != 3 || strncmp(p, "AND", 3)) {
+        struct item it = {neg, 0, NULL};
+        add_word(&it, p, len);
+        add_item(c, it);
+        neg = 0;
+      }
+      p += len;
+    }
+  }
+  if (!c->n) {
+    q->n--;
+  }
+  if (!q->n) {
+    query_free(q);
+    return NULL;
+  }
+  return q;
+}
+
+void query_free(query_t *q) {
+  for (int i = 0; i < q->n; i++) {
+    struct clause *c = &q->clauses[i];
+    for (int j = 0; j < c->n; j++) {
+      for (int w = 0; w < c->items[j].n; w++) {
+        free(c->items[j].words[w]);
+      }
+      free(c->items[j].words);
+    }
+    free(c->items);
+  }
+  free(q->clauses);
+  free(q);
+}
+
+void query_list_init(query_list_t *l, int n) {
+  l->n = n;
+  l->files = malloc(n * sizeof(int));
+  l->counts = malloc(n * sizeof(int));
+  l->lines = malloc(n * sizeof(uint8_t *));
+  assert(l->files && l->counts && l->lines);
+}
+
+void query_list_free(query_list_t *l) {
+  free(l->files);
+  free(l->counts);
+  free(l->lines);
+}
+
+// Returns the first index i of v[lo..n) with v[i] >= x, or n if there is none.
+// Steps of 1, 2, 4, ... from lo bound the index, which a binary search then
+// finds, so the search costs O(log d) for an index d past lo.
+int gallop(const int *v, int lo, int n, int x) {
+  int hi = lo;
+  for (int step = 1; hi < n && v[hi] < x; step *= 2) {
+    lo = hi + 1;
+    hi += step;
+  }
+  hi = min(hi, n);
+  // v[lo - 1] < x, and v[hi] >= x unless hi is n.
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (v[mid] < x) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+// Allocates matches for up to n files.
+void matches_init(struct matches *m, int n) {
+  m->n = 0;
+  m->files = malloc(max(n, 1) * sizeof(int));
+  m->scores = malloc(max(n, 1) * sizeof(long));
+  assert(m->files && m->scores);
+}
+
+void matches_free(struct matches *m) {
+  free(m->files);
+  free(m->scores);
+}
+
+// Appends a file to matches with room for it.
+void matches_add(struct matches *m, int file, long score) {
+  m->files[m->n] = file;
+  m->scores[m->n] = score;
+  m->n++;
+}
+
+// Keeps the files of a that are also in b, adding b's scores to them.
+void matches_and(struct matches *a, const struct matches *b) {
+  int n = 0;
+  int pos = 0;
+  for (int i = 0; i < a->n && pos < b->n; i++) {
+    pos = gallop(b->files, pos, b->n, a->files[i]);
+    if (pos < b->n && b->files[pos] == a->files[i]) {
+      a->files[n] = a->files[i];
+      a->scores[n] = a->scores[i] + b->scores[pos];
+      n++;
+    }
+  }
+  a->n = n;
+}
+
+// Drops the files of a that are in b.
+void matches_not(struct matches *a, const struct matches *b) {
+  int n = 0;
+  int pos = 0;
+  for (int i = 0; i < a->n; i++) {
+    pos = gallop(b->files, pos, b->n, a->files[i]);
+    if (pos == b->n || b->files[pos] != a->files[i]) {
+      a->files[n] = a->files[i];
+      a->scores[n] = a->scores[i];
+      n++;
+    }
+  }
+  a->n = n;
+}
+
+// Merges the files of b into a, adding the scores of files in both.
+void matches_or(struct matches *a, const struct matches *b) {
+  struct matches m;
+  matches_init(&m, a->n + b->n);
+  int i = 0;
+  int j = 0;
+  while (i < a->n || j < b->n) {
+    if (j == b->n || (i < a->n && a->files[i] < b->files[j])) {
+      matches_add(&m, a->files[i], a->scores[i]);
+      i++;
+    } else if (i == a->n || b->files[j] < a->files[i]) {
+      matches_add(&m, b->files[j], b->scores[j]);
+      j++;
+    } else {
+      matches_add(&m, a->files[i], a->scores[i] + b->scores[j]);
+      i++;
+      j++;
+    }
+  }
+  matches_free(a);
+  *a = m;
+}
+
+// Decodes the distinct lines of posting i of a list into *buf, growing it as
+// needed. Returns the number of lines.
+int decode_lines(const query_list_t *l, int i, int **buf, int *cap) {
+  if (l->counts[i] > *cap) {
+    *cap = l->counts[i];
+    *buf = realloc(*buf, *cap * sizeof(int));
+    assert(*buf);
+  }
+  posting_iter_t it;
+  posting_iter_init_data(&it, l->lines[i], l->counts[i]);
+  int n = 0;
+  int line;
+  while (posting_iter_next(&it, &line)) {
+    // a word appearing twice on a line lists the line twice.
+    if (!n || (*buf)[n - 1] != line) {
+      (*buf)[n++] = line;
+    }
+  }
+  return n;
+}
+
+// Keeps the lines of a that are also in b. Returns the number left.
+int intersect_lines(int *a, int na, const int *b, int nb) {
+  int n = 0;
+  int pos = 0;
+  for (int i = 0; i < na && pos < nb; i++) {
+    pos = gallop(b, pos, nb, a[i]);
+    if (pos < nb && b[pos] == a[i]) {
+      a[n++] = a[i];
+    }
+  }
+  return n;
+}
+
+// Orders posting lists by length.
+int cmp_lists(const void *p1, const void *p2) {
+  return ((const query_list_t *)p1)->n - ((const query_list_t *)p2)->n;
+}
+
+// Finds the files with a line in all of n posting lists, scored by the number
+// of such lines. The files of the shortest list are searched for in the
+// others, and only the lines of the files in all of them are decoded.
+void phrase_intersect(query_list_t *lists, int nlists, struct matches *m) {
+  qsort(lists, nlists, sizeof(query_list_t), cmp_lists);
+  matches_init(m, lists[0].n);
+  int *pos = calloc(nlists, sizeof(int));
+  assert(pos);
+  int *common = NULL;
+  int *other = NULL;
+  int common_cap = 0;
+  int other_cap = 0;
+  for (int i = 0; i < lists[0].n; i++) {
+    int file = lists[0].files[i];
+    int j = 1;
+    for (; j < nlists; j++) {
+      pos[j] = gallop(lists[j].files, pos[j], lists[j].n, file);
+      if (pos[j] == lists[j].n || lists[j].files[pos[j]] != file) {
+        break;
+      }
+    }
+    if (j < nlists) {
+      continue;
+    }
+    int n = decode_lines(&lists[0], i, &common, &common_cap);
+    for (j = 1; n && j < nlists; j++) {
+      int no = decode_lines(&lists[j], pos[j], &other, &other_cap);
+      n = intersect_lines(common, n, other, no);
+    }
+    if (n) {
+      matches_add(m, file, n);
+    }
+  }
+  free(common);
+  free(other);
+  free(pos);
+}
+
+// Finds the files with a line holding every word of an item.
+void phrase_matches(const struct item *it, const query_source_t *src,
+                    struct matches *m) {
+  query_list_t *lists = malloc(it->n * sizeof(query_list_t));
+  assert(lists);
+  int found = 0;
+  while (found < it->n &&
+         src->lookup(src->arg, it->words[found], &lists[found])) {
+    found++;
+  }
+  if (found < it->n) {
+    matches_init(m, 0);
+  } else {
+    phrase_intersect(lists, it->n, m);
+  }
+  for (int i = 0; i < found; i++) {
+    query_list_free(&lists[i]);
+  }
+  free(lists);
+}
+
+// Finds the files matching an item, ignoring its negation.
+void item_matches(const struct item *it, const query_source_t *src,
+                  struct matches *m) {
+  if (it->n > 1) {
+    phrase_matches(it, src, m);
+    return;
+  }
+  query_list_t l;
+  if (!src->lookup(src->arg, it->words[0], &l)) {
+    matches_init(m, 0);
+    return;
+  }
+  matches_init(m, l.n);
+  for (int i = 0; i < l.n; i++) {
+    matches_add(m, l.files[i], l.counts[i]);
+  }
+  query_list_free(&l);
+}
+
+// Orders matches by number of files.
+int cmp_matches(const void *p1, const void *p2) {
+  return ((const struct matches *)p1)->n - ((const struct matches *)p2)->n;
+}
+
+// Finds the files matching a clause. The files of the item with the fewest are
+// intersected with the other items in order of size, so the candidates shrink
+// as fast as they can.
+void clause_matches(const struct clause *c, const query_source_t *src,
+                    struct matches *m) {
+  struct matches *pos = malloc(c->n * sizeof(struct matches));
+  struct matches *neg = malloc(c->n * sizeof(struct matches));
+  assert(pos && neg);
+  int npos = 0;
+  int nneg = 0;
+  for (int i = 0; i < c->n; i++) {
+    if (c->items[i].neg) {
+      item_matches(&c->items[i], src, &neg[nneg++]);
+    } else {
+      item_matches(&c->items[i], src, &pos[npos++]);
+    }
+  }
+  if (npos) {
+    qsort(pos, npos, sizeof(struct matches), cmp_matches);
+    *m = pos[0];
+    for (int i = 1; i < npos; i++) {
+      matches_and(m, &pos[i]);
+      matches_free(&pos[i]);
+    }
+  } else {
+    matches_init(m, src->n_files);
+    for (int file = 0; file < src->n_files; file++) {
+      matches_add(m, file, 0);
+    }
+  }
+  for (int i = 0; i < nneg; i++) {
+    matches_not(m, &neg[i]);
+    matches_free(&neg[i]);
+  }
+  free(pos);
+  free(neg);
+}
+
+// Returns whether hit a ranks before hit b.
+int better(const query_hit_t *a, const query_hit_t *b) {
+  return a->score > b->score || (a->score == b->score && a->file < b->file);
+}
+
+// Orders hits best first.
+int cmp_hits(const void *p1, const void *p2) {
+  return better(p2, p1) - better(p1, p2);
+}
+
+// Restores the heap property of a heap of n hits, worst at the root, after
+// hit i got better.
+void sift_down(query_hit_t *h, int n, int i) {
+  while (1) {
+    int worst = i;
+    for (int c = 2 * i + 1; c <= 2 * i + 2 && c < n; c++) {
+      if (better(&h[worst], &h[c])) {
+        worst = c;
+      }
+    }
+    if (worst == i) {
+      return;
+    }
+    query_hit_t t = h[i];
+    h[i] = h[worst];
+    h[worst] = t;
+    i = worst;
+  }
+}
+
+// Restores the heap property of a heap of hits, worst at the root, after hit i
+// was added.
+void sift_up(query_hit_t *h, int i) {
+  while (i > 0 && better(&h[(i - 1) / 2], &h[i])) {
+    query_hit_t t = h[i];
+    h[i] = h[(i - 1) / 2];
+    h[(i - 1) / 2] = t;
+    i = (i - 1) / 2;
+  }
+}
+
+int query_run(const query_t *q, const query_source_t *src, query_hit_t *top,
+              int k) {
+  struct matches m;
+  clause_matches(&q->clauses[0], src, &m);
+  for (int i = 1; i < q->n; i++) {
+    struct matches c;
+    clause_matches(&q->clauses[i], src, &c);
+    matches_or(&m, &c);
+    matches_free(&c);
+  }
+  // keep the best k files in a heap whose root is the worst of them, so each
+  // file costs O(log k) rather than sorting every match.
+  int n = 0;
+  for (int i = 0; i < m.n && k > 0; i++) {
+    query_hit_t hit = {m.files[i], m.scores[i]};
+    if (n < k) {
+      top[n] = hit;
+      sift_up(top, n++);
+    } else if (better(&hit, &top[0])) {
+      top[0] = hit;
+      sift_down(top, n, 0);
+    }
+  }
+  qsort(top, n, sizeof(query_hit_t), cmp_hits);
+  int matched = m.n;
+  matches_free(&m);
+  return matched;
+}
+
+// Looks up a word in the shards of the index given as arg.
+int shards_lookup(void *arg, const char *word, query_list_t *list) {
+  shard_postings_t sp;
+  if (!shard_index_lookup(arg, word, &sp)) {
+    return 0;
+  }
+  query_list_init(list, sp.left);
+  int file;
+  posting_iter_t lines;
+  int i = 0;
+  for (; shard_postings_next(&sp, &file, &lines); i++) {
+    list->files[i] = file;
+    list->counts[i] = lines.left;
+    list->lines[i] = lines.p;
+  }
+  // a corrupt block ends the list early.
+  list->n = i;
+  return 1;
+}
+
+// Returns the name of a file of the index given as arg.
+const char *shards_file(void *arg, int alias) {
+  return shard_index_file(arg, alias);
+}
+
+void query_source_shards(query_source_t *src, const shard_index_t *idx) {
+  src->lookup = shards_lookup;
+  src->file = shards_file;
+  src->n_files = shard_index_n_files(idx);
+  src->arg = (void *)idx;
+}
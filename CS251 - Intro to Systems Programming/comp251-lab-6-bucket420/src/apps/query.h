@@ -0,0 +1,99 @@
+#ifndef __QUERY_H__
+#define __QUERY_H__
+
+#include <stdint.h>
+
+#include "shard.h"
+
+// Boolean queries against the inverted index.
+//
+// A query is one or more clauses separated by OR. A clause is a list of items
+// that must all match a file (AND), each of which is either
+//
+//     word            the file contains the word
+//     "w1 w2 ..."     some line of the file contains every word
+//     -item           the file does not match the item; NOT item also works
+//
+// so `thread pool -"dead lock" OR mutex` finds the files that contain thread
+// and pool but no line with both dead and lock, plus the files with mutex.
+// Words are lower-cased and stripped of anything but letters and digits, as
+// they are when indexed; words that strip to nothing are dropped. A clause
+// with only negated items matches every file without them.
+//
+// Matching files are scored by term frequency: the number of lines the
+// clause's words appear on in the file, counting a line once per appearance
+// of the word and a quoted item's lines once, summed over the clauses the file
+// matches. query_run returns the top k files by score.
+//
+// The index is read through a query_source, so the same query runs against
+// the index in memory (see ii_query_source in ii.h) or against binary shards
+// mapped from a dump (query_source_shards). Posting lists are sorted by file,
+// and lists are intersected by galloping: each file of the shortest list is
+// searched for in the others with an exponential then a binary search, so
+// intersecting a short list with a long one reads few of the long one's
+// postings.
+//
+// Typical usage
+// -------------
+//
+//     query_source_t src;
+//     query_source_shards(&src, shard_index_open(dir));
+//     query_t *q = query_parse("thread -process");
+//     query_hit_t top[10];
+//     int n = query_run(q, &src, top, 10);
+//     for (int i = 0; i < min(n, 10); i++) {
+//       printf("%ld %s\n", top[i].score, src.file(src.arg, top[i].file));
+//     }
+//     query_free(q);
+
+// The postings of a word, sorted by file.
+typedef struct query_list {
+  int n;                  // number of postings
+  int *files;             // file of each posting
+  int *counts;            // lines of each posting
+  const uint8_t **lines;  // encoded lines of each posting; see posting_iter
+} query_list_t;
+
+// An index that queries are run against.
+typedef struct query_source {
+  // Fill in the postings of a word and return 1, or return 0 if the word is
+  // not in the index. The list's arrays are freed with query_list_free.
+  int (*lookup)(void *arg, const char *word, query_list_t *list);
+  // Return the name of the file with the given alias, or NULL.
+  const char *(*file)(void *arg, int alias);
+  int n_files; // files are aliased 0 to n_files - 1
+  void *arg;   // passed to lookup and file
+} query_source_t;
+
+// A file matching a query.
+typedef struct query_hit {
+  int file;   // alias of the file
+  long score; // term frequency of the query's words in the file
+} query_hit_t;
+
+typedef struct query query_t;
+
+// Parse a query. Returns NULL if the query has no words or an unterminated
+// quote.
+query_t *query_parse(const char *text);
+
+// Free a parsed query.
+void query_free(query_t *q);
+
+// Run a query, writing the (at most) k best matching files to top by
+// decreasing score, ties broken by alias. Returns the number of matching
+// files.
+int query_run(const query_t *q, const query_source_t *src, query_hit_t *top,
+              int k);
+
+// Allocate the arrays of a list of n postings.
+void query_list_init(query_list_t *l, int n);
+
+// Free the arrays of a list of postings.
+void query_list_free(query_list_t *l);
+
+// Fill in a source that answers queries from the shards of idx, which must
+// stay open while the source is used.
+void query_source_shards(query_source_t *src, const shard_index_t *idx);
+
+#endif
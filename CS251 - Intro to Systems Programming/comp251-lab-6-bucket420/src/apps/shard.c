@@ -0,0 +1,401 @@
+#include "shard.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../util.h"
+
+// A mapped shard.
+struct shard {
+  const uint8_t *base;             // mapping of the file
+  size_t size;                     // size of the mapping
+  const struct shard_header *hdr;  // header, at base
+  const struct shard_entry *dict;  // dictionary, after the header
+  const char *strings;             // strings
+  const uint8_t *postings;         // postings
+};
+
+// The shards of a dump, sorted by key range, and its file aliases.
+struct shard_index {
+  shard_t **shards; // shards, sorted by first term
+  int n_shards;     // number of shards
+  char **files;     // file names, indexed by alias; NULL for unused aliases
+  int n_files;      // length of files
+};
+
+// Returns the size of a term's block in the postings.
+uint64_t block_size(const posting_list_t *l) {
+  uint64_t size = 0;
+  int prev = 0;
+  for (int i = 0; i < l->n; i++) {
+    const posting_t *p = l->v[i];
+    size += varint_len(p->file - prev) + varint_len(p->n) +
+            varint_len(p->len) + p->len;
+    prev = p->file;
+  }
+  return size;
+}
+
+// Writes a term's block.
+void write_block(FILE *f, const posting_list_t *l) {
+  uint8_t buf[15];
+  int prev = 0;
+  for (int i = 0; i < l->n; i++) {
+    const posting_t *p = l->v[i];
+    int len = varint_put(buf, p->file - prev);
+    len += varint_put(buf + len, p->n);
+    len += varint_put(buf + len, p->len);
+    fwrite(buf, 1, len, f);
+    fwrite(p->data, 1, p->len, f);
+    prev = p->file;
+  }
+}
+
+int shard_write(const char *path, const char **terms,
+                const posting_list_t **postings, int n) {
+  // every offset is known before anything is written: the dictionary is a
+  // fixed size, and the strings and blocks are sized up front.
+  struct shard_entry *dict = malloc((n + 1) * sizeof(struct shard_entry));
+  assert(dict);
+  uint64_t strings = 0;
+  uint64_t blocks = 0;
+  for (int i = 0; i < n; i++) {
+    dict[i].postings = blocks;
+    dict[i].term = strings;
+    dict[i].n_files = postings[i]->n;
+    strings += strlen(terms[i]) + 1;
+    blocks += block_size(postings[i]);
+  }
+  dict[n] = (struct shard_entry){blocks, strings, 0};
+  if (strings > UINT32_MAX) {
+    free(dict);
+    errno = EFBIG;
+    return -1;
+  }
+
+  struct shard_header hdr = {0};
+  memcpy(hdr.magic, SHARD_MAGIC, sizeof(hdr.magic));
+  hdr.n_terms = n;
+  hdr.first = n ? dict[0].term : 0;
+  hdr.last = n ? dict[n - 1].term : 0;
+  hdr.strings = sizeof(hdr) + (n + 1) * sizeof(struct shard_entry);
+  hdr.postings = hdr.strings + strings;
+  hdr.size = hdr.postings + blocks;
+
+  FILE *f = fopen(path, "w");
+  if (!f) {
+    free(dict);
+    return -1;
+  }
+  fwrite(&hdr, sizeof(hdr), 1, f);
+  fwrite(dict, sizeof(struct shard_entry), n + 1, f);
+  free(dict);
+  for (int i = 0; i < n; i++) {
+    fwrite(terms[i], 1, strlen(terms[i]) + 1, f);
+  }
+  for (int i = 0; i < n; i++) {
+    write_block(f, postings[i]);
+  }
+  // fwrite errors stick to the stream, so checking once covers them all.
+  int err = ferror(f);
+  if (fclose(f) || err) {
+    return -1;
+  }
+  return 0;
+}
+
+// Returns whether a shard's header, dictionary and sentinel agree with the size
+// of its mapping.
+int shard_valid(const shard_t *s) {
+  const struct shard_header *h = s->hdr;
+  if (s->size < sizeof(*h) || memcmp(h->magic, SHARD_MAGIC, 8) ||
+      h->size != s->size) {
+    return 0;
+  }
+  uint64_t dict_size = ((uint64_t)h->n_terms + 1) * sizeof(struct shard_entry);
+  if (h->strings != sizeof(*h) + dict_size || h->postings < h->strings ||
+      h->postings > h->size) {
+    return 0;
+  }
+  // the sentinel sizes the strings and postings, and the strings end in a NUL.
+  const struct shard_entry *end = &s->dict[h->n_terms];
+  uint64_t strings = h->postings - h->strings;
+  if (end->term != strings || end->postings != h->size - h->postings ||
+      (strings && s->strings[strings - 1])) {
+    return 0;
+  }
+  // every term starts in the strings, and every block ends where the next
+  // one starts, so blocks never run backwards or past the sentinel. A
+  // posting takes at least 3 bytes, which bounds n_files.
+  for (uint32_t i = 0; i < h->n_terms; i++) {
+    const struct shard_entry *e = &s->dict[i];
+    if (e->term >= strings || e->postings > e[1].postings ||
+        (uint64_t)e->n_files * 3 > e[1].postings - e->postings) {
+      return 0;
+    }
+  }
+  return !h->n_terms || (h->first < strings && h->last < strings);
+}
+
+shard_t *shard_open(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st)) {
+    close(fd);
+    return NULL;
+  }
+  if (st.st_size < sizeof(struct shard_header)) {
+    close(fd);
+    errno = EINVAL;
+    return NULL;
+  }
+  void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping holds its own reference to the file.
+  close(fd);
+  if (base == MAP_FAILED) {
+    return NULL;
+  }
+  shard_t *s = malloc(sizeof(shard_t));
+  assert(s);
+  s->base = base;
+  s->size = st.st_size;
+  s->hdr = base;
+  s->dict = (const struct shard_entry *)(s->base + sizeof(*s->hdr));
+  s->strings = (const char *)s->base + s->hdr->strings;
+  s->postings = s->base + s->hdr->postings;
+  if (!shard_valid(s)) {
+    shard_close(s);
+    errno = EINVAL;
+    return NULL;
+  }
+  return s;
+}
+
+void shard_close(shard_t *s) {
+  munmap((void *)s->base, s->size);
+  free(s);
+}
+
+int shard_n_terms(const shard_t *s) { return s->hdr->n_terms; }
+
+const char *shard_term(const shard_t *s, int i) {
+  return s->strings + s->dict[i].term;
+}
+
+int shard_find(const shard_t *s, const char *term) {
+  int lo = 0;
+  int hi = s->hdr->n_terms;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    int cmp = strcmp(term, shard_term(s, mid));
+    if (!cmp) {
+      return mid;
+    }
+    if (cmp < 0) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+  return -1;
+}
+
+void shard_postings(const shard_t *s, int i, shard_postings_t *sp) {
+  sp->p = s->postings + s->dict[i].postings;
+  sp->end = s->postings + s->dict[i + 1].postings;
+  sp->left = s->dict[i].n_files;
+  sp->file = 0;
+}
+
+// Returns whether data[0..len) holds n whole varints.
+int lines_valid(const uint8_t *data, uint32_t len, uint32_t n) {
+  // a varint ends at a byte without the continuation bit, so n of them fit
+  // if n such bytes do; the last byte must end one, too.
+  if (n > len || (len && data[len - 1] & 0x80)) {
+    return 0;
+  }
+  uint32_t ends = 0;
+  for (uint32_t i = 0; i < len && ends < n; i++) {
+    ends += !(data[i] & 0x80);
+  }
+  return ends >= n;
+}
+
+int shard_postings_next(shard_postings_t *sp, int *file,
+                        posting_iter_t *lines) {
+  if (!sp->left) {
+    return 0;
+  }
+  uint32_t delta, n, len;
+  if (!varint_read(&sp->p, sp->end, &delta) ||
+      !varint_read(&sp->p, sp->end, &n) ||
+      !varint_read(&sp->p, sp->end, &len) || len > sp->end - sp->p ||
+      delta > INT_MAX - sp->file || !lines_valid(sp->p, len, n)) {
+    sp->left = 0;
+    return 0;
+  }
+  sp->file += delta;
+  posting_iter_init_data(lines, sp->p, n);
+  sp->p += len;
+  sp->left--;
+  *file = sp->file;
+  return 1;
+}
+
+// Returns whether name ends with ext.
+int has_extension(const char *name, const char *ext) {
+  size_t n = strlen(name);
+  size_t e = strlen(ext);
+  return n >= e && !strcmp(name + n - e, ext);
+}
+
+// Orders shards by their first term.
+int cmp_shards(const void *p1, const void *p2) {
+  const shard_t *s1 = *(shard_t *const *)p1;
+  const shard_t *s2 = *(shard_t *const *)p2;
+  return strcmp(s1->strings + s1->hdr->first, s2->strings + s2->hdr->first);
+}
+
+// Reads an aliases file, with one "name;alias" line per file, into idx.
+int read_aliases(shard_index_t *idx, const char *path) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    return -1;
+  }
+  char line[PATH_MAX + 32];
+  while (fgets(line, sizeof(line), f)) {
+    // names may hold a ';', so split at the last one.
+    char *sep = strrchr(line, ';');
+    if (!sep) {
+      continue;
+    }
+    *sep = '\0';
+    int alias = atoi(sep + 1);
+    if (alias < 0) {
+      continue;
+    }
+    if (alias >= idx->n_files) {
+      int n = max(alias + 1, idx->n_files * 2);
+      idx->files = realloc(idx->files, n * sizeof(char *));
+      assert(idx->files);
+      memset(&idx->files[idx->n_files], 0,
+             (n - idx->n_files) * sizeof(char *));
+      idx->n_files = n;
+    }
+    free(idx->files[alias]);
+    idx->files[alias] = strdup(line);
+  }
+  fclose(f);
+  return 0;
+}
+
+shard_index_t *shard_index_open(const char *dir) {
+  DIR *d = opendir(dir);
+  if (!d) {
+    return NULL;
+  }
+  shard_index_t *idx = calloc(1, sizeof(shard_index_t));
+  assert(idx);
+  char path[PATH_MAX];
+  struct dirent *ent;
+  int err = 0;
+  while (!err && (ent = readdir(d))) {
+    snprintf(path, PATH_MAX, "%s/%s", dir, ent->d_name);
+    if (has_extension(ent->d_name, ".aliases")) {
+      err = read_aliases(idx, path) ? errno : 0;
+    } else if (has_extension(ent->d_name, SHARD_EXTENSION)) {
+      shard_t *s = shard_open(path);
+      if (!s) {
+        err = errno;
+      } else if (!shard_n_terms(s)) {
+        shard_close(s);
+      } else {
+        idx->shards =
+            realloc(idx->shards, (idx->n_shards + 1) * sizeof(shard_t *));
+        assert(idx->shards);
+        idx->shards[idx->n_shards++] = s;
+      }
+    }
+  }
+  closedir(d);
+  if (!err && !idx->n_shards) {
+    err = ENOENT;
+  }
+  if (err) {
+    shard_index_close(idx);
+    errno = err;
+    return NULL;
+  }
+  qsort(idx->shards, idx->n_shards, sizeof(shard_t *), cmp_shards);
+  return idx;
+}
+
+void shard_index_close(shard_index_t *idx) {
+  for (int i = 0; i < idx->n_shards; i++) {
+    shard_close(idx->shards[i]);
+  }
+  free(idx->shards);
+  for (int i = 0; i < idx->n_files; i++) {
+    free(idx->files[i]);
+  }
+  free(idx->files);
+  free(idx);
+}
+
+int shard_index_lookup(const shard_index_t *idx, const char *term,
+                       shard_postings_t *sp) {
+  // key ranges do not overlap, so the term can only be in the first shard
+  // whose last term is not before it.
+  int lo = 0;
+  int hi = idx->n_shards;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    const shard_t *s = idx->shards[mid];
+    if (strcmp(s->strings + s->hdr->last, term) < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo == idx->n_shards) {
+    return 0;
+  }
+  const shard_t *s = idx->shards[lo];
+  if (strcmp(term, s->strings + s->hdr->first) < 0) {
+    return 0;
+  }
+  int i = shard_find(s, term);
+  if (i < 0) {
+    return 0;
+  }
+  shard_postings(s, i, sp);
+  return 1;
+}
+
+int shard_index_n_files(const shard_index_t *idx) {
+  // the aliases array grows by doubling, so trim its unused tail.
+  int n = idx->n_files;
+  while (n > 0 && !idx->files[n - 1]) {
+    n--;
+  }
+  return n;
+}
+
+const char *shard_index_file(const shard_index_t *idx, int alias) {
+  if (alias < 0 || alias >= idx->n_files) {
+    return NULL;
+  }
+  return idx->files[alias];
+}
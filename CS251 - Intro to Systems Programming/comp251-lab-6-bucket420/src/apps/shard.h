@@ -0,0 +1,142 @@
+#ifndef __SHARD_H__
+#define __SHARD_H__
+
+#include <stdint.h>
+
+#include "postings.h"
+
+// Binary shards of the inverted index.
+//
+// dump_ii can write each shard as a binary file (.iib) instead of text. The
+// loader maps a shard into memory and answers lookups from the mapping
+// directly: finding a term is a binary search of the shard's dictionary, and
+// only that term's postings are ever decoded.
+//
+// Layout
+// ------
+//
+// All integers are in host byte order; offsets are in bytes.
+//
+//     header      struct shard_header
+//     dictionary  n_terms + 1 struct shard_entry, sorted by term
+//     strings     the terms, each terminated by a NUL
+//     postings    one block per term
+//
+// Entry i of the dictionary gives the offset of term i in the strings and of
+// its block in the postings, plus the number of files it appears in. The last
+// entry is a sentinel holding the size of the strings and of the postings, so
+// a term's block ends where the next one starts. The header repeats the first
+// and last term of the shard, which is its key range.
+//
+// A block is the term's postings in file order, each as three varints (see
+// postings.h) followed by the posting's encoded lines:
+//
+//     file - previous file (the first from 0)
+//     number of lines
+//     bytes of encoded lines
+//
+// Typical usage
+// -------------
+//
+//     shard_index_t *idx = shard_index_open(dir);
+//     shard_postings_t sp;
+//     if (shard_index_lookup(idx, "word", &sp)) {
+//       int file;
+//       posting_iter_t lines;
+//       while (shard_postings_next(&sp, &file, &lines)) {
+//         ...
+//       }
+//     }
+//     shard_index_close(idx);
+
+// First bytes of every shard.
+#define SHARD_MAGIC "IISHARD1"
+
+// Extension of shard file names.
+#define SHARD_EXTENSION ".iib"
+
+// Start of a shard file.
+struct shard_header {
+  char magic[8];         // SHARD_MAGIC, without its NUL
+  uint32_t n_terms;      // terms in the shard
+  uint32_t first;        // offset of the first term in the strings
+  uint32_t last;         // offset of the last term in the strings
+  uint32_t reserved;     // 0
+  uint64_t strings;      // offset of the strings in the file
+  uint64_t postings;     // offset of the postings in the file
+  uint64_t size;         // size of the file
+};
+
+// A term of the dictionary.
+struct shard_entry {
+  uint64_t postings;     // offset of the term's block in the postings
+  uint32_t term;         // offset of the term in the strings
+  uint32_t n_files;      // files the term appears in
+};
+
+typedef struct shard shard_t;
+typedef struct shard_index shard_index_t;
+
+// Decodes the postings of a term in file order.
+typedef struct shard_postings {
+  const uint8_t *p;   // next encoded posting
+  const uint8_t *end; // end of the term's block
+  int left;           // postings not yet decoded
+  int file;           // file of the last decoded posting
+} shard_postings_t;
+
+// Write a shard of n terms, which must be sorted and distinct, with their
+// posting lists to path. Returns 0, or -1 with errno set.
+int shard_write(const char *path, const char **terms,
+                const posting_list_t **postings, int n);
+
+// Map the shard at path. Returns NULL with errno set if it cannot be read, or
+// with errno EINVAL if it is not a valid shard: its header, or any entry of its
+// dictionary, points outside the strings or the postings. Blocks are only
+// checked as they are decoded.
+shard_t *shard_open(const char *path);
+
+// Unmap a shard.
+void shard_close(shard_t *s);
+
+// Return the number of terms in a shard.
+int shard_n_terms(const shard_t *s);
+
+// Return term i of a shard, in sorted order.
+const char *shard_term(const shard_t *s, int i);
+
+// Return the index of a term in a shard, or -1 if it is not there.
+int shard_find(const shard_t *s, const char *term);
+
+// Start decoding the postings of term i of a shard.
+void shard_postings(const shard_t *s, int i, shard_postings_t *sp);
+
+// Set file and lines to the next posting of a term and return 1, or return 0
+// if every posting has been decoded. lines decodes the posting's lines as a
+// posting_iter does, and stays valid until the shard is closed.
+//
+// Decoding never reads past the term's block. If the rest of the block is
+// corrupt, returns 0 as if there were no more postings.
+int shard_postings_next(shard_postings_t *sp, int *file, posting_iter_t *lines);
+
+// Map every shard in a directory written by dump_ii, and read its file
+// aliases. Returns NULL with errno set if the directory cannot be read, a
+// shard is invalid, or there are no shards.
+shard_index_t *shard_index_open(const char *dir);
+
+// Unmap the shards of an index and free it.
+void shard_index_close(shard_index_t *idx);
+
+// Start decoding the postings of a term and return 1, or return 0 if the
+// term is not in the index. Only the shard whose key range holds the term is
+// searched.
+int shard_index_lookup(const shard_index_t *idx, const char *term,
+                       shard_postings_t *sp);
+
+// Return one more than the largest file alias of an index.
+int shard_index_n_files(const shard_index_t *idx);
+
+// Return the name of the file with the given alias, or NULL if there is none.
+const char *shard_index_file(const shard_index_t *idx, int alias);
+
+#endif
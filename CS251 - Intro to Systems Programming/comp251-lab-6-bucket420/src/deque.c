@@ -0,0 +1,155 @@
+#include "deque.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "util.h"
+
+// Circular array of elements.
+struct deque_array {
+  long size;                 // number of slots, a power of two
+  struct deque_array *prev;  // outgrown array, freed with the deque
+  _Atomic(void *) slots[];   // elements, indexed modulo size
+};
+
+// Deque implementation.
+//
+// Elements live in slots [top, bottom) of array. Thieves advance top with a
+// CAS; only the owner writes bottom. top and bottom live on separate cache
+// lines so that thieves bumping top do not invalidate the owner's bottom.
+struct deque {
+  _Alignas(CACHE_LINE) atomic_long top;
+  _Alignas(CACHE_LINE) atomic_long bottom;
+  _Atomic(struct deque_array *) array;
+  int in_place; // whether the deque and its first array live in caller memory
+};
+
+static struct deque_array *array_create(long size) {
+  struct deque_array *a =
+      malloc(sizeof(struct deque_array) + size * sizeof(void *));
+  assert(a);
+  a->size = size;
+  a->prev = NULL;
+  return a;
+}
+
+static void *array_get(struct deque_array *a, long i) {
+  return atomic_load_explicit(&a->slots[i & (a->size - 1)],
+                              memory_order_relaxed);
+}
+
+static void array_put(struct deque_array *a, long i, void *x) {
+  atomic_store_explicit(&a->slots[i & (a->size - 1)], x, memory_order_relaxed);
+}
+
+// Copy the live elements [t, b) into an array twice the size. Owner only.
+static struct deque_array *array_grow(struct deque_array *a, long t, long b) {
+  struct deque_array *g = array_create(a->size * 2);
+  for (long i = t; i < b; i++) {
+    array_put(g, i, array_get(a, i));
+  }
+  g->prev = a;
+  return g;
+}
+
+struct deque *deque_create(int log_size) {
+  struct deque *d = aligned_alloc(CACHE_LINE, sizeof(struct deque));
+  assert(d);
+  atomic_init(&d->top, 0);
+  atomic_init(&d->bottom, 0);
+  atomic_init(&d->array, array_create(1l << log_size));
+  d->in_place = 0;
+  return d;
+}
+
+size_t deque_bytes(int log_size) {
+  size_t size = sizeof(struct deque) + sizeof(struct deque_array) +
+                (1l << log_size) * sizeof(void *);
+  return (size + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+}
+
+struct deque *deque_init(void *mem, int log_size) {
+  // the first array follows the deque, which is a whole number of lines.
+  struct deque *d = mem;
+  struct deque_array *a = (struct deque_array *)(d + 1);
+  a->size = 1l << log_size;
+  a->prev = NULL;
+  atomic_init(&d->top, 0);
+  atomic_init(&d->bottom, 0);
+  atomic_init(&d->array, a);
+  d->in_place = 1;
+  return d;
+}
+
+void deque_free(struct deque *d) {
+  struct deque_array *a = atomic_load(&d->array);
+  while (a) {
+    struct deque_array *prev = a->prev;
+    // the first array is the only one without a prev.
+    if (prev || !d->in_place) {
+      free(a);
+    }
+    a = prev;
+  }
+  if (!d->in_place) {
+    free(d);
+  }
+}
+
+void deque_push(struct deque *d, void *x) {
+  long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+  long t = atomic_load_explicit(&d->top, memory_order_acquire);
+  struct deque_array *a = atomic_load_explicit(&d->array, memory_order_relaxed);
+  if (b - t > a->size - 1) {
+    a = array_grow(a, t, b);
+    atomic_store_explicit(&d->array, a, memory_order_release);
+  }
+  array_put(a, b, x);
+  // publish the element (and whatever it points to) to thieves.
+  atomic_store_explicit(&d->bottom, b + 1, memory_order_release);
+}
+
+void *deque_pop(struct deque *d) {
+  long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+  struct deque_array *a = atomic_load_explicit(&d->array, memory_order_relaxed);
+  atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  long t = atomic_load_explicit(&d->top, memory_order_relaxed);
+  if (t > b) {
+    // empty; restore bottom.
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    return NULL;
+  }
+  void *x = array_get(a, b);
+  if (t == b) {
+    // last element; race thieves for it.
+    if (!atomic_compare_exchange_strong_explicit(
+            &d->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed)) {
+      x = NULL;
+    }
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+  }
+  return x;
+}
+
+void *deque_steal(struct deque *d) {
+  long t = atomic_load_explicit(&d->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  long b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+  if (t >= b) {
+    return NULL;
+  }
+  struct deque_array *a = atomic_load_explicit(&d->array, memory_order_acquire);
+  void *x = array_get(a, t);
+  if (!atomic_compare_exchange_strong_explicit(
+          &d->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed)) {
+    return NULL;
+  }
+  return x;
+}
+
+long deque_size(struct deque *d) {
+  long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+  long t = atomic_load_explicit(&d->top, memory_order_relaxed);
+  return b > t ? b - t : 0;
+}
@@ -0,0 +1,54 @@
+#ifndef __DEQUE_H__
+#define __DEQUE_H__
+
+// Chase-Lev work-stealing deque of pointers.
+//
+// A deque has a single owner thread that pushes and pops at the bottom, and any
+// number of thief threads that steal from the top. The owner never takes a lock
+// and only contends with thieves when the deque holds a single element.
+//
+// The deque grows as needed. Arrays that are outgrown are kept until the deque
+// is freed, since a thief may still be reading from one.
+//
+// See "Correct and Efficient Work-Stealing for Weak Memory Models" (Le et al.,
+// PPoPP 2013) for the algorithm and its memory orderings.
+
+#include <stddef.h>
+
+struct deque;
+
+// Create a deque with room for 2^log_size elements before it grows.
+struct deque *deque_create(int log_size);
+
+// Return the bytes deque_init needs for a deque with room for 2^log_size
+// elements, a multiple of the cache line size.
+size_t deque_bytes(int log_size);
+
+// Create a deque like deque_create, but in mem, which must hold
+// deque_bytes(log_size) bytes and be aligned to a cache line. Lets the caller
+// decide where the deque's memory lives. The deque does not own mem, which
+// must outlive it; arrays it grows into are still malloc'd.
+struct deque *deque_init(void *mem, int log_size);
+
+// Free the deque. No other thread may be using it.
+void deque_free(struct deque *d);
+
+// Push an element at the bottom. Owner only. x must not be NULL.
+void deque_push(struct deque *d, void *x);
+
+// Pop the most recently pushed element. Owner only.
+//
+// Returns NULL if the deque is empty.
+void *deque_pop(struct deque *d);
+
+// Steal the least recently pushed element. May be called from any thread.
+//
+// Returns NULL if the deque is empty or if another thread took the element
+// first; callers that need to tell these apart should check deque_size.
+void *deque_steal(struct deque *d);
+
+// Return the number of elements in the deque. The value is only a snapshot when
+// other threads are using the deque.
+long deque_size(struct deque *d);
+
+#endif
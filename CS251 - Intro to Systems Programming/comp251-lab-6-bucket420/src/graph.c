@@ -0,0 +1,191 @@
+#include "graph.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "util.h"
+
+// Initial number of tasks and successors allocated.
+#define INITIAL_LEN 16
+// Most released tasks added to the pool at once.
+#define RELEASE_BATCH 16
+
+// A task of a graph.
+struct task {
+  threadpool_work_t work; // the task's work
+  void *result;           // result of work.fn, set when it returns
+  int npred;              // number of predecessors
+  atomic_int pending;     // predecessors that have not completed
+  int *succ;              // ids of the tasks that depend on this one
+  int nsucc;              // number of successors
+  int succ_len;           // allocated length of succ
+  struct graph *g;        // the graph of the task
+};
+
+// Graph implementation.
+//
+// Tasks and their successor lists only change before the graph runs; while it
+// runs, a completing task decrements the pending count of each successor and
+// releases those that reach zero, so no lock is taken between tasks.
+struct graph {
+  threadpool_t pool;
+  struct task *tasks;   // tasks, by id
+  int n;                // number of tasks
+  int len;              // allocated length of tasks
+  int running;          // set by graph_run
+  atomic_int completed; // number of completed tasks
+  pthread_mutex_t mu;
+  pthread_cond_t done;  // signaled when finished is set
+  int finished;         // set when the last task completes; guarded by mu
+};
+
+graph_t graph_create(threadpool_t tp) {
+  struct graph *g = calloc(1, sizeof(struct graph));
+  assert(g);
+  g->pool = tp;
+  assertz(pthread_mutex_init(&g->mu, NULL));
+  assertz(pthread_cond_init(&g->done, NULL));
+  return g;
+}
+
+void graph_free(graph_t g) {
+  pthread_mutex_lock(&g->mu);
+  assert(!g->running || g->finished);
+  pthread_mutex_unlock(&g->mu);
+  for (int i = 0; i < g->n; i++) {
+    free(g->tasks[i].succ);
+  }
+  free(g->tasks);
+  assertz(pthread_mutex_destroy(&g->mu));
+  assertz(pthread_cond_destroy(&g->done));
+  free(g);
+}
+
+// Adds id to the successors of t.
+void add_successor(struct task *t, int id) {
+  if (t->nsucc == t->succ_len) {
+    t->succ_len = t->succ_len ? t->succ_len * 2 : 2;
+    t->succ = realloc(t->succ, t->succ_len * sizeof(int));
+    assert(t->succ);
+  }
+  t->succ[t->nsucc++] = id;
+}
+
+int graph_add(graph_t g, threadpool_work_t work, const int *deps, int n) {
+  assert(!g->running);
+  assert(work.fn);
+  if (g->n == g->len) {
+    g->len = g->len ? g->len * 2 : INITIAL_LEN;
+    g->tasks = realloc(g->tasks, g->len * sizeof(struct task));
+    assert(g->tasks);
+  }
+  int id = g->n++;
+  struct task *t = &g->tasks[id];
+  t->work = work;
+  t->result = NULL;
+  t->npred = n;
+  atomic_init(&t->pending, n);
+  t->succ = NULL;
+  t->nsucc = 0;
+  t->succ_len = 0;
+  t->g = g;
+  for (int i = 0; i < n; i++) {
+    assert(deps[i] >= 0 && deps[i] < id);
+    add_successor(&g->tasks[deps[i]], id);
+  }
+  return id;
+}
+
+void *run_task(void *arg);
+
+// Returns the pool work that runs task t.
+threadpool_work_t task_work(struct task *t) {
+  threadpool_work_t w = {run_task, t, NULL, t->work.priority};
+  return w;
+}
+
+// Adds n released tasks to the pool.
+void release(struct graph *g, threadpool_work_t *batch, int n) {
+  int added = threadpool_add_batch(g->pool, batch, n);
+  assert(added == n);
+}
+
+// Runs a task, then releases each successor it was the last predecessor of.
+void *run_task(void *arg) {
+  struct task *t = arg;
+  struct graph *g = t->g;
+  // the graph may be freed once every task has been counted, so nothing of it
+  // is read after this task is.
+  int ntasks = g->n;
+  t->result = t->work.fn(t->work.work);
+  if (t->work.cb) {
+    t->work.cb(t->result);
+  }
+  threadpool_work_t batch[RELEASE_BATCH];
+  int n = 0;
+  for (int i = 0; i < t->nsucc; i++) {
+    struct task *s = &g->tasks[t->succ[i]];
+    // acq_rel so that the last predecessor's release carries every
+    // predecessor's writes to the successor.
+    if (atomic_fetch_sub_explicit(&s->pending, 1, memory_order_acq_rel) == 1) {
+      batch[n++] = task_work(s);
+      if (n == RELEASE_BATCH) {
+        release(g, batch, n);
+        n = 0;
+      }
+    }
+  }
+  if (n) {
+    release(g, batch, n);
+  }
+  if (atomic_fetch_add(&g->completed, 1) + 1 == ntasks) {
+    // waiters check finished rather than completed so that they return, and
+    // the graph may be freed, only after this thread is done with it.
+    pthread_mutex_lock(&g->mu);
+    g->finished = 1;
+    pthread_cond_broadcast(&g->done);
+    pthread_mutex_unlock(&g->mu);
+  }
+  return NULL;
+}
+
+void graph_run(graph_t g) {
+  assert(!g->running);
+  g->running = 1;
+  if (g->n == 0) {
+    g->finished = 1;
+    return;
+  }
+  threadpool_work_t batch[RELEASE_BATCH];
+  int n = 0;
+  for (int i = 0; i < g->n; i++) {
+    // check npred rather than pending, which tasks released earlier in the
+    // loop may already have brought to zero.
+    if (g->tasks[i].npred) {
+      continue;
+    }
+    batch[n++] = task_work(&g->tasks[i]);
+    if (n == RELEASE_BATCH) {
+      release(g, batch, n);
+      n = 0;
+    }
+  }
+  if (n) {
+    release(g, batch, n);
+  }
+}
+
+void graph_wait(graph_t g) {
+  assert(g->running);
+  pthread_mutex_lock(&g->mu);
+  while (!g->finished) {
+    pthread_cond_wait(&g->done, &g->mu);
+  }
+  pthread_mutex_unlock(&g->mu);
+}
+
+void *graph_result(graph_t g, int id) {
+  assert(id >= 0 && id < g->n);
+  return g->tasks[id].result;
+}
@@ -0,0 +1,63 @@
+#ifndef __GRAPH_H__
+#define __GRAPH_H__
+
+#include "thread_pool.h"
+
+// Task graphs run on a thread pool.
+//
+// A graph is a set of tasks, each a work item that may depend on tasks added
+// before it. A task is added to the pool the moment the last of its
+// predecessors completes, so multi-stage pipelines (e.g. parse -> merge ->
+// write) overlap across stages instead of waiting for every task of one stage
+// before starting the next.
+//
+// Typical usage
+// -------------
+//
+//     graph_t g = graph_create(tp);
+//     int parse = graph_add(g, parse_work, NULL, 0);
+//     int load = graph_add(g, load_work, &parse, 1);
+//     ...
+//     graph_run(g);
+//     graph_wait(g);
+//     void *r = graph_result(g, load);
+//     graph_free(g);
+//
+// Tasks are numbered in the order they are added, starting at 0, and a task
+// may only depend on tasks added before it, so graphs have no cycles. A task
+// completes once its work function and then its callback have returned; its
+// successors see everything it wrote, and may read its result with
+// graph_result.
+//
+// The work of a task is added to the pool with the task's priority, as with
+// threadpool_add_batch. The pool must not have a ring with the
+// THREADPOOL_FULL_FAIL policy, since released tasks have nowhere else to go.
+// Tasks run only while the pool is RUNNING; a graph run on a stopped pool
+// waits for it to start.
+
+typedef struct graph *graph_t;
+
+// Create an empty graph whose tasks run on the given pool.
+graph_t graph_create(threadpool_t tp);
+
+// Free a graph. It must not be running, i.e. graph_run must not have been
+// called or graph_wait must have returned.
+void graph_free(graph_t g);
+
+// Add a task that runs work once the n tasks in deps have completed. deps may
+// be NULL if n is 0. Tasks may only be added before graph_run.
+//
+// Returns the id of the task.
+int graph_add(graph_t g, threadpool_work_t work, const int *deps, int n);
+
+// Run the graph, adding every task without predecessors to the pool. A graph
+// runs once.
+void graph_run(graph_t g);
+
+// Block until every task of a running graph has completed.
+void graph_wait(graph_t g);
+
+// Return the result of the work function of a completed task.
+void *graph_result(graph_t g, int id);
+
+#endif
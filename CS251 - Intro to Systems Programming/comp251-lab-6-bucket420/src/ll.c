@@ -5,9 +5,21 @@
 #include "thread_pool.h"
 #include "util.h"
 
+// Smallest block of nodes allocated by a store.
+#define LL_BLOCK_SIZE 64
+
+// A block of nodes allocated by a store.
+struct ll_block {
+  struct ll_block *next;
+  struct ll nodes[];
+};
+
 struct ll *ll_add(struct ll *h, threadpool_work_t work) {
+  return ll_add_node(h, malloc(sizeof(struct ll)), work);
+}
+
+struct ll *ll_add_node(struct ll *h, struct ll *n, threadpool_work_t work) {
   // add at head
-  struct ll *n = malloc(sizeof(struct ll));
   n->work = work;
   n->tail = n;
   n->next = NULL;
@@ -23,21 +35,30 @@ struct ll *ll_add(struct ll *h, threadpool_work_t work) {
 }
 
 struct ll *ll_take(struct ll *h, threadpool_work_t *work) {
+  struct ll *tail;
+  h = ll_take_node(h, &tail);
+  if (tail) {
+    *work = tail->work;
+    free(tail);
+  }
+  return h;
+}
+
+struct ll *ll_take_node(struct ll *h, struct ll **n) {
   // take at tail
   if (!h) {
+    *n = NULL;
     return NULL;
   }
 
   struct ll *tail = h->tail;
-  *work = tail->work;
+  *n = tail;
   if (!tail->next) {
     assert(tail == h);
-    free(tail);
     return NULL;
   }
   h->tail = tail->next;
   h->n -= 1;
-  free(tail);
   return h;
 }
 
@@ -75,3 +96,49 @@ int ll_poll(struct ll *h) {
   }
   return r;
 }
+
+void ll_store_init(struct ll_store *s) {
+  s->spare = NULL;
+  s->blocks = NULL;
+}
+
+void ll_store_reserve(struct ll_store *s, int n) {
+  struct ll *c = s->spare;
+  for (; c && n > 0; c = c->next) {
+    n--;
+  }
+  if (n <= 0) {
+    return;
+  }
+  n = max(n, LL_BLOCK_SIZE);
+  struct ll_block *b = malloc(sizeof(struct ll_block) + n * sizeof(struct ll));
+  assert(b);
+  b->next = s->blocks;
+  s->blocks = b;
+  for (int i = 0; i < n; i++) {
+    ll_store_put(s, &b->nodes[i]);
+  }
+}
+
+struct ll *ll_store_get(struct ll_store *s) {
+  if (!s->spare) {
+    ll_store_reserve(s, 1);
+  }
+  struct ll *n = s->spare;
+  s->spare = n->next;
+  return n;
+}
+
+void ll_store_put(struct ll_store *s, struct ll *n) {
+  n->next = s->spare;
+  s->spare = n;
+}
+
+void ll_store_free(struct ll_store *s) {
+  while (s->blocks) {
+    struct ll_block *next = s->blocks->next;
+    free(s->blocks);
+    s->blocks = next;
+  }
+  s->spare = NULL;
+}
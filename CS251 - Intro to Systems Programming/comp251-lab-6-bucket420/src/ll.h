@@ -7,17 +7,32 @@
 struct ll {
   int n; // count of work
   threadpool_work_t work;
+  long queued_ns; // when the work was queued; set and used by the thread pool
   struct ll *next;
   struct ll *tail; // head pointer is guaranteed to point to tail
 };
 
+// Storage for list nodes. Nodes are allocated in blocks and recycled, so that
+// adding and taking work does not call malloc and free. Not thread-safe.
+struct ll_store {
+  struct ll *spare;        // free nodes, linked through next
+  struct ll_block *blocks; // all blocks allocated by the store
+};
+
 // Add an element to the linked list, returning the new list.
 struct ll *ll_add(struct ll *h, threadpool_work_t work);
 
+// Add an element using the caller's node n, returning the new list.
+struct ll *ll_add_node(struct ll *h, struct ll *n, threadpool_work_t work);
+
 // Take a single value from the linked list's tail, populating work and
 // returning the new list.
 struct ll *ll_take(struct ll *h, threadpool_work_t *work);
 
+// Take the tail node without freeing it, setting n to the node (or NULL if the
+// list is empty) and returning the new list. The work is in (*n)->work.
+struct ll *ll_take_node(struct ll *h, struct ll **n);
+
 // Join two linked lists, returning a pointer to the new list.
 struct ll *ll_join(struct ll *h0, struct ll *h1);
 
@@ -27,4 +42,20 @@ void ll_free(struct ll *h);
 // Return the number of elemnts in the linked list.
 int ll_poll(struct ll *h);
 
+// Initialize an empty node store.
+void ll_store_init(struct ll_store *s);
+
+// Make sure at least n spare nodes are available, allocating any shortfall as a
+// single block.
+void ll_store_reserve(struct ll_store *s, int n);
+
+// Get a node from the store.
+struct ll *ll_store_get(struct ll_store *s);
+
+// Return a node to the store. Nodes must come from the same store.
+void ll_store_put(struct ll_store *s, struct ll *n);
+
+// Free all memory held by the store, including nodes still in lists.
+void ll_store_free(struct ll_store *s);
+
 #endif
@@ -0,0 +1,592 @@
+#include "map.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../util.h"
+
+// Most stripes a map has; smaller maps have fewer (see map_create).
+#define MAX_STRIPES 64
+// Buckets per stripe below which a map has fewer stripes.
+#define BUCKETS_PER_STRIPE 64
+// A map grows to twice its size once it has more than this many entries per
+// bucket.
+#define MAX_LOAD 2
+// Number of reader slots; threads share them when there are more threads.
+#define READER_SLOTS 16
+// Retired things kept before a writer tries to free some of them.
+#define RECLAIM_BATCH 64
+
+// Entry struct.
+//
+// An entry's key and hash never change. Readers walk chains without a lock, so
+// next and value are atomic, and entries are retired rather than freed when
+// they leave the table.
+typedef struct entry_t {
+  _Atomic(struct entry_t *) next; // next entry in the chain
+  char *key;                      // string key, shared by copies of the entry
+  uint64_t hkey;                  // 64-bit hash of key
+  _Atomic(void *) value;          // value stored for the key
+} entry_t;
+
+// A table of buckets. Resizing copies the entries into a new table, so a
+// table's chains only change through puts and removes.
+typedef struct table_t {
+  uint32_t n;                   // number of buckets
+  _Atomic(entry_t *) buckets[]; // chains of entries, by hash modulo n
+} table_t;
+
+// Something removed from the map that readers may still be using.
+typedef struct retired_t {
+  void *ptr;              // an entry, or a table if is_table is set
+  int is_table;           // ptr is a table; its entries were copied, so are
+                          //  freed without their keys
+  uint64_t epoch;         // map epoch when it was retired
+  struct retired_t *next; // next in the map's retired list
+} retired_t;
+
+// A stripe lock, on its own cache line.
+typedef struct stripe_t {
+  _Alignas(CACHE_LINE) pthread_mutex_t mu;
+} stripe_t;
+
+// Readers currently in each epoch, by epoch modulo 3, on its own cache line.
+typedef struct reader_slot_t {
+  _Alignas(CACHE_LINE) atomic_ulong active[3];
+} reader_slot_t;
+
+// Map struct.
+//
+// Writers lock the stripe of the key's bucket; bucket i of the current table
+// belongs to stripe i % nstripes, so the number of stripes does not change as
+// the table grows. A resize takes every stripe lock, copies the entries into a
+// new table and publishes it, while readers keep using the old one. Readers
+// take no lock at all.
+//
+// Retired entries and tables are reclaimed with epochs. A lock-free reader
+// counts itself in the current epoch of its thread's slot for as long as it
+// holds pointers into the table. The epoch only advances from e to e + 1 once
+// no reader is left in e - 1, so once it reaches r + 2 every reader that could
+// have seen something retired in epoch r is done, and it can be freed.
+// Writers try to advance the epoch and free what they can every RECLAIM_BATCH
+// retirements.
+struct map_t {
+  _Atomic(table_t *) table;      // the current table
+  atomic_uint num_entries;       // number of entries in the current table
+  _Atomic(retired_t *) retired;  // things readers may still be using
+  atomic_uint num_retired;       // length of retired
+  atomic_ulong epoch;            // current epoch
+  pthread_mutex_t reclaim_mu;    // held while freeing retired things
+  uint64_t reclaimed_epoch;      // epoch of the last reclaim; needs reclaim_mu
+  reader_slot_t readers[READER_SLOTS]; // readers by epoch
+  uint32_t nstripes;             // number of stripes
+  stripe_t stripes[];            // stripe locks
+};
+
+// Reader slot of the calling thread, plus one; 0 until the thread first reads.
+static __thread uint32_t reader_id;
+// Number of threads that have been given a reader slot.
+static atomic_uint num_readers;
+
+// FNV-1a hash of a string.
+uint64_t hash(const char *key) {
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (const char *c = key; *c; c++) {
+    h ^= (unsigned char)*c;
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+
+table_t *table_create(uint32_t n) {
+  table_t *t = calloc(1, sizeof(table_t) + n * sizeof(entry_t *));
+  assert(t);
+  t->n = n;
+  return t;
+}
+
+// Returns the head of the chain for hkey in t.
+_Atomic(entry_t *) *bucket(table_t *t, uint64_t hkey) {
+  return &t->buckets[hkey % t->n];
+}
+
+// Returns the entry of t whose key is key, or NULL. Takes no lock.
+entry_t *find(table_t *t, const char *key, uint64_t hkey) {
+  entry_t *e = atomic_load_explicit(bucket(t, hkey), memory_order_acquire);
+  while (e) {
+    if (e->hkey == hkey && strcmp(e->key, key) == 0) {
+      return e;
+    }
+    e = atomic_load_explicit(&e->next, memory_order_acquire);
+  }
+  return NULL;
+}
+
+// Frees the entries of a table, and their keys if free_keys is set, and then
+// the table.
+void table_free(table_t *t, int free_keys) {
+  for (uint32_t i = 0; i < t->n; i++) {
+    entry_t *e = atomic_load_explicit(&t->buckets[i], memory_order_relaxed);
+    while (e) {
+      entry_t *next = atomic_load_explicit(&e->next, memory_order_relaxed);
+      if (free_keys) {
+        free(e->key);
+      }
+      free(e);
+      e = next;
+    }
+  }
+  free(t);
+}
+
+// Counts the calling thread as a reader in the current epoch, and returns the
+// counter to pass to read_end.
+atomic_ulong *read_begin(map_t *map) {
+  if (!reader_id) {
+    reader_id = atomic_fetch_add(&num_readers, 1) + 1;
+  }
+  reader_slot_t *slot = &map->readers[(reader_id - 1) % READER_SLOTS];
+  for (;;) {
+    uint64_t e = atomic_load(&map->epoch);
+    atomic_ulong *active = &slot->active[e % 3];
+    atomic_fetch_add(active, 1);
+    // if the epoch moved on in between, a writer may not have seen us.
+    if (atomic_load(&map->epoch) == e) {
+      return active;
+    }
+    atomic_fetch_sub(active, 1);
+  }
+}
+
+// Stops counting the calling thread as a reader.
+void read_end(atomic_ulong *active) {
+  atomic_fetch_sub_explicit(active, 1, memory_order_release);
+}
+
+// Frees a retired thing.
+void retired_free(retired_t *r) {
+  if (r->is_table) {
+    table_free(r->ptr, 0);
+  } else {
+    entry_t *e = r->ptr;
+    free(e->key);
+    free(e);
+  }
+  free(r);
+}
+
+// Advances the epoch if no reader is left in the previous one, and frees what
+// was retired two or more epochs ago. Does nothing if another thread is
+// already reclaiming.
+void reclaim(map_t *map) {
+  if (pthread_mutex_trylock(&map->reclaim_mu)) {
+    return;
+  }
+  uint64_t e = atomic_load(&map->epoch);
+  uint64_t readers = 0;
+  for (int i = 0; i < READER_SLOTS; i++) {
+    readers += atomic_load(&map->readers[i].active[(e + 2) % 3]);
+  }
+  if (!readers) {
+    atomic_compare_exchange_strong(&map->epoch, &e, e + 1);
+    e = atomic_load(&map->epoch);
+  }
+  // nothing new is safe to free until the epoch advances.
+  if (e == map->reclaimed_epoch) {
+    pthread_mutex_unlock(&map->reclaim_mu);
+    return;
+  }
+  map->reclaimed_epoch = e;
+  retired_t *r = atomic_exchange(&map->retired, NULL);
+  retired_t *keep = NULL;
+  retired_t **tail = &keep;
+  uint32_t freed = 0;
+  while (r) {
+    retired_t *next = r->next;
+    if (r->epoch + 2 <= e) {
+      retired_free(r);
+      freed++;
+    } else {
+      *tail = r;
+      tail = &r->next;
+    }
+    r = next;
+  }
+  // put back what is kept, ahead of anything retired in the meantime.
+  *tail = atomic_load_explicit(&map->retired, memory_order_relaxed);
+  while (keep && !atomic_compare_exchange_weak_explicit(
+                     &map->retired, tail, keep, memory_order_relaxed,
+                     memory_order_relaxed)) {
+  }
+  atomic_fetch_sub(&map->num_retired, freed);
+  pthread_mutex_unlock(&map->reclaim_mu);
+}
+
+// Adds p to the things to free once no reader can be using it. p must already
+// be unreachable from the current table.
+void retire(map_t *map, void *p, int is_table) {
+  retired_t *r = malloc(sizeof(retired_t));
+  assert(r);
+  r->ptr = p;
+  r->is_table = is_table;
+  // readers that count themselves in a later epoch cannot reach p.
+  atomic_thread_fence(memory_order_seq_cst);
+  r->epoch = atomic_load(&map->epoch);
+  r->next = atomic_load_explicit(&map->retired, memory_order_relaxed);
+  while (!atomic_compare_exchange_weak_explicit(&map->retired, &r->next, r,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed)) {
+  }
+  if (atomic_fetch_add(&map->num_retired, 1) + 1 >= RECLAIM_BATCH) {
+    reclaim(map);
+  }
+}
+
+// Locks the stripe of hkey's bucket in the current table, which is returned
+// and does not change until mu is unlocked.
+table_t *lock_bucket(map_t *map, uint64_t hkey, pthread_mutex_t **mu) {
+  // t may be retired before its stripe is locked, so read it as a reader.
+  atomic_ulong *active = read_begin(map);
+  for (;;) {
+    table_t *t = atomic_load_explicit(&map->table, memory_order_acquire);
+    *mu = &map->stripes[(hkey % t->n) % map->nstripes].mu;
+    pthread_mutex_lock(*mu);
+    // a resize holds every stripe lock, so the table cannot change now.
+    if (atomic_load_explicit(&map->table, memory_order_relaxed) == t) {
+      read_end(active);
+      return t;
+    }
+    pthread_mutex_unlock(*mu);
+  }
+}
+
+void lock_all(map_t *map) {
+  for (uint32_t i = 0; i < map->nstripes; i++) {
+    pthread_mutex_lock(&map->stripes[i].mu);
+  }
+}
+
+void unlock_all(map_t *map) {
+  for (uint32_t i = 0; i < map->nstripes; i++) {
+    pthread_mutex_unlock(&map->stripes[i].mu);
+  }
+}
+
+map_t *map_create(uint32_t init_size) {
+  assert(init_size > 0);
+  uint32_t nstripes = 1;
+  while (nstripes < MAX_STRIPES &&
+         nstripes * 2 * BUCKETS_PER_STRIPE <= init_size) {
+    nstripes *= 2;
+  }
+  size_t size = sizeof(map_t) + nstripes * sizeof(stripe_t);
+  map_t *map = aligned_alloc(CACHE_LINE, size);
+  assert(map);
+  memset(map, 0, size);
+  map->nstripes = nstripes;
+  for (uint32_t i = 0; i < nstripes; i++) {
+    assertz(pthread_mutex_init(&map->stripes[i].mu, NULL));
+  }
+  assertz(pthread_mutex_init(&map->reclaim_mu, NULL));
+  atomic_init(&map->table, table_create(init_size));
+  return map;
+}
+
+map_metrics_t *map_metrics(map_t *map) {
+  map_metrics_t *m = calloc(1, sizeof(map_metrics_t));
+  assert(m);
+  atomic_ulong *active = read_begin(map);
+  table_t *t = atomic_load_explicit(&map->table, memory_order_acquire);
+  for (uint32_t i = 0; i < t->n; i++) {
+    uint32_t depth = 0;
+    entry_t *e = atomic_load_explicit(&t->buckets[i], memory_order_acquire);
+    for (; e; e = atomic_load_explicit(&e->next, memory_order_acquire)) {
+      depth++;
+    }
+    m->max_depth = max(m->max_depth, depth);
+  }
+  m->num_entries = atomic_load(&map->num_entries);
+  m->curr_size = t->n;
+  read_end(active);
+  m->num_retired = atomic_load(&map->num_retired);
+  return m;
+}
+
+void map_free(map_t **map) {
+  map_t *m = *map;
+  table_free(atomic_load(&m->table), 1);
+  retired_t *r = atomic_load(&m->retired);
+  while (r) {
+    retired_t *next = r->next;
+    retired_free(r);
+    r = next;
+  }
+  for (uint32_t i = 0; i < m->nstripes; i++) {
+    assertz(pthread_mutex_destroy(&m->stripes[i].mu));
+  }
+  assertz(pthread_mutex_destroy(&m->reclaim_mu));
+  free(m);
+  *map = NULL;
+}
+
+// Copies the entries into a new table of the given size. Every stripe lock
+// must be held.
+void resize_locked(map_t *map, uint32_t new_size) {
+  table_t *old = atomic_load_explicit(&map->table, memory_order_relaxed);
+  table_t *t = table_create(new_size);
+  for (uint32_t i = 0; i < old->n; i++) {
+    entry_t *e = atomic_load_explicit(&old->buckets[i], memory_order_relaxed);
+    for (; e; e = atomic_load_explicit(&e->next, memory_order_relaxed)) {
+      entry_t *copy = malloc(sizeof(entry_t));
+      assert(copy);
+      copy->key = e->key;
+      copy->hkey = e->hkey;
+      atomic_init(&copy->value,
+                  atomic_load_explicit(&e->value, memory_order_relaxed));
+      _Atomic(entry_t *) *head = bucket(t, e->hkey);
+      entry_t *next = atomic_load_explicit(head, memory_order_relaxed);
+      atomic_init(&copy->next, next);
+      atomic_init(head, copy);
+    }
+  }
+  // readers that load the new table see its entries.
+  atomic_store_explicit(&map->table, t, memory_order_release);
+  retire(map, old, 1);
+}
+
+void map_resize(map_t *map, uint32_t new_size) {
+  assert(new_size > 0);
+  lock_all(map);
+  resize_locked(map, new_size);
+  unlock_all(map);
+}
+
+// Doubles the size of the map if it is still over MAX_LOAD once every stripe
+// lock is held; other writers may have grown it first.
+void grow(map_t *map) {
+  lock_all(map);
+  table_t *t = atomic_load_explicit(&map->table, memory_order_relaxed);
+  if (atomic_load(&map->num_entries) > (uint64_t)t->n * MAX_LOAD) {
+    resize_locked(map, t->n * 2);
+  }
+  unlock_all(map);
+}
+
+// Adds an entry for key with the given value to t, whose stripe lock for hkey
+// must be held.
+void insert_locked(map_t *map, table_t *t, const char *key, uint64_t hkey,
+                   void *value) {
+  entry_t *e = malloc(sizeof(entry_t));
+  assert(e);
+  e->key = malloc(strlen(key) + 1);
+  assert(e->key);
+  strcpy(e->key, key);
+  e->hkey = hkey;
+  atomic_init(&e->value, value);
+  _Atomic(entry_t *) *head = bucket(t, hkey);
+  atomic_init(&e->next, atomic_load_explicit(head, memory_order_relaxed));
+  // readers that find the entry see its key and value.
+  atomic_store_explicit(head, e, memory_order_release);
+}
+
+// Grows the map if inserting into a table of n buckets brought it over
+// MAX_LOAD.
+void maybe_grow(map_t *map, unsigned int num_entries, uint32_t n) {
+  if (num_entries > (uint64_t)n * MAX_LOAD) {
+    grow(map);
+  }
+}
+
+int map_put(map_t *map, const char *key, void *new_value) {
+  uint64_t hkey = hash(key);
+  pthread_mutex_t *mu;
+  table_t *t = lock_bucket(map, hkey, &mu);
+  entry_t *e = find(t, key, hkey);
+  if (e) {
+    atomic_store_explicit(&e->value, new_value, memory_order_release);
+    pthread_mutex_unlock(mu);
+    return 0;
+  }
+  insert_locked(map, t, key, hkey, new_value);
+  unsigned int n = atomic_fetch_add(&map->num_entries, 1) + 1;
+  // t may be freed once the lock is released.
+  uint32_t buckets = t->n;
+  pthread_mutex_unlock(mu);
+  maybe_grow(map, n, buckets);
+  return 1;
+}
+
+int map_remove(map_t *map, const char *key) {
+  uint64_t hkey = hash(key);
+  pthread_mutex_t *mu;
+  table_t *t = lock_bucket(map, hkey, &mu);
+  _Atomic(entry_t *) *prev = bucket(t, hkey);
+  entry_t *e = atomic_load_explicit(prev, memory_order_relaxed);
+  while (e && (e->hkey != hkey || strcmp(e->key, key) != 0)) {
+    prev = &e->next;
+    e = atomic_load_explicit(prev, memory_order_relaxed);
+  }
+  if (e) {
+    // readers at e still find the rest of the chain through its next.
+    atomic_store_explicit(
+        prev, atomic_load_explicit(&e->next, memory_order_relaxed),
+        memory_order_release);
+    atomic_fetch_sub(&map->num_entries, 1);
+    retire(map, e, 0);
+  }
+  pthread_mutex_unlock(mu);
+  return e != NULL;
+}
+
+int map_get(map_t *map, const char *key, void **value_ptr) {
+  uint64_t hkey = hash(key);
+  atomic_ulong *active = read_begin(map);
+  table_t *t = atomic_load_explicit(&map->table, memory_order_acquire);
+  entry_t *e = find(t, key, hkey);
+  int found = e != NULL;
+  if (value_ptr) {
+    *value_ptr =
+        e ? atomic_load_explicit(&e->value, memory_order_acquire) : NULL;
+  }
+  read_end(active);
+  return found;
+}
+
+int map_get_or_put(map_t *map, const char *key, void **value_ptr, void *zero) {
+  uint64_t hkey = hash(key);
+  // most calls find the key, so look for it without a lock first.
+  atomic_ulong *active = read_begin(map);
+  table_t *t = atomic_load_explicit(&map->table, memory_order_acquire);
+  entry_t *e = find(t, key, hkey);
+  if (e) {
+    *value_ptr = atomic_load_explicit(&e->value, memory_order_acquire);
+    read_end(active);
+    return 1;
+  }
+  read_end(active);
+  pthread_mutex_t *mu;
+  t = lock_bucket(map, hkey, &mu);
+  e = find(t, key, hkey);
+  if (e) {
+    *value_ptr = atomic_load_explicit(&e->value, memory_order_relaxed);
+    pthread_mutex_unlock(mu);
+    return 1;
+  }
+  insert_locked(map, t, key, hkey, zero);
+  unsigned int n = atomic_fetch_add(&map->num_entries, 1) + 1;
+  uint32_t buckets = t->n;
+  pthread_mutex_unlock(mu);
+  *value_ptr = zero;
+  maybe_grow(map, n, buckets);
+  return 0;
+}
+
+void map_apply_arg(map_t *map,
+                   void *apply_fn(const char *key, void *value, void *arg),
+                   void *arg) {
+  lock_all(map);
+  table_t *t = atomic_load_explicit(&map->table, memory_order_relaxed);
+  for (uint32_t i = 0; i < t->n; i++) {
+    entry_t *e = atomic_load_explicit(&t->buckets[i], memory_order_relaxed);
+    for (; e; e = atomic_load_explicit(&e->next, memory_order_relaxed)) {
+      void *v = atomic_load_explicit(&e->value, memory_order_relaxed);
+      atomic_store_explicit(&e->value, apply_fn(e->key, v, arg),
+                            memory_order_release);
+    }
+  }
+  unlock_all(map);
+}
+
+// Adapts an apply_fn without an argument to map_apply_arg.
+void *apply_no_arg(const char *key, void *value, void *arg) {
+  void *(**fn)(const char *, void *) = arg;
+  return (*fn)(key, value);
+}
+
+void map_apply(map_t *map, void *apply_fn(const char *key, void *value)) {
+  map_apply_arg(map, apply_no_arg, &apply_fn);
+}
+
+map_pair_t *map_export(map_t *map, uint32_t *n, int sorted) {
+  lock_all(map);
+  table_t *t = atomic_load_explicit(&map->table, memory_order_relaxed);
+  *n = atomic_load(&map->num_entries);
+  map_pair_t *pairs = malloc(max(*n, 1) * sizeof(map_pair_t));
+  assert(pairs);
+  uint32_t i = 0;
+  for (uint32_t b = 0; b < t->n; b++) {
+    entry_t *e = atomic_load_explicit(&t->buckets[b], memory_order_relaxed);
+    for (; e; e = atomic_load_explicit(&e->next, memory_order_relaxed)) {
+      pairs[i].key = e->key;
+      pairs[i].value = atomic_load_explicit(&e->value, memory_order_relaxed);
+      i++;
+    }
+  }
+  assert(i == *n);
+  unlock_all(map);
+  if (sorted) {
+    map_pairs_sort(pairs, *n);
+  }
+  return pairs;
+}
+
+static inline void pairs_swap(map_pair_t *a, map_pair_t *b) {
+  map_pair_t tmp = *a;
+  *a = *b;
+  *b = tmp;
+}
+
+// Partitions smaller than this are insertion sorted.
+#define SORT_CUTOFF 16
+
+// Sorts pairs[0...n), all of whose keys share their first d characters.
+void pairs_mkqsort(map_pair_t *pairs, size_t n, size_t d) {
+  while (n > SORT_CUTOFF) {
+    pairs_swap(&pairs[0], &pairs[n / 2]);
+    int v = (unsigned char)pairs[0].key[d];
+    // three-way partition on character d: [0, lt) < v, [lt, gt) == v and
+    // [gt, n) > v.
+    size_t lt = 0, i = 1, gt = n;
+    while (i < gt) {
+      int c = (unsigned char)pairs[i].key[d];
+      if (c < v) {
+        pairs_swap(&pairs[lt++], &pairs[i++]);
+      } else if (c > v) {
+        pairs_swap(&pairs[i], &pairs[--gt]);
+      } else {
+        i++;
+      }
+    }
+    pairs_mkqsort(pairs, lt, d);
+    // keys equal at d share one more character, unless they all ended.
+    if (v) {
+      pairs_mkqsort(pairs + lt, gt - lt, d + 1);
+    }
+    pairs += gt;
+    n -= gt;
+  }
+  for (size_t i = 1; i < n; i++) {
+    map_pair_t p = pairs[i];
+    size_t j = i;
+    for (; j > 0 && strcmp(pairs[j - 1].key + d, p.key + d) > 0; j--) {
+      pairs[j] = pairs[j - 1];
+    }
+    pairs[j] = p;
+  }
+}
+
+void map_pairs_sort(map_pair_t *pairs, size_t n) {
+  pairs_mkqsort(pairs, n, 0);
+}
+
+void map_debug(map_t *map) {
+  map_metrics_t *m = map_metrics(map);
+  fprintf(stderr, "map %p: %u entries, %u buckets, %u stripes, max depth %u\n",
+          (void *)map, m->num_entries, m->curr_size, map->nstripes,
+          m->max_depth);
+  free(m);
+}
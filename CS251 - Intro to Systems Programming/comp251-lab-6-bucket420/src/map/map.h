@@ -1,6 +1,7 @@
 #ifndef __MAP_H__
 #define __MAP_H__
 
+#include <stddef.h>
 #include <stdint.h>
 
 // Implementation of a hash map with chaining.
@@ -18,6 +19,11 @@
 //  is_in = map_get(map, &val_ptr);
 //  // *val_ptr is value if is_in is nonzero.
 //
+//  uint32_t n;
+//  map_pair_t *pairs = map_export(map, &n, /*sorted=*/1);
+//  // pairs[0...n) hold every entry, sorted by key.
+//  free(pairs);
+//
 //  map_metrics_t metrics = map_metrics(map);
 //  map_resize(map, new_size);
 //
@@ -26,14 +32,31 @@
 // Thread safety:
 // --------------
 //
-//   Maps are threadsafe; there is a global mutex that protects the underlying
-//   hashtable's global state (number of entries, etc.) and each row has a
-//   per-row mutex for row-wise mutations (get/put/remove/etc.).
+//   Maps are threadsafe. Rows are guarded by a fixed set of striped mutexes
+//   (row i belongs to stripe i modulo the number of stripes), so the number of
+//   locks does not grow with the map. Puts and removes lock the stripe of
+//   their row; gets take no lock at all, and see either the old or the new
+//   value of a concurrent put.
 //
 //   A map supports a get/put operation that allows a user to either retrieve
 //   or put a new entry when no such element exists. This allows for a user to
 //   query the map and conditionally put a new entry in the map as a single
-//   atomic operation.
+//   atomic operation. When the entry exists, it is found without a lock.
+//
+//   A map doubles its size once it holds more than two entries per row.
+//   Resizing, whether automatic or through map_resize, blocks puts and
+//   removes while the entries are copied to a new table, but not gets, which
+//   keep using the old table until the new one is in place.
+//
+//   Removed entries and old tables may still be in use by gets, so they are
+//   reclaimed with epochs rather than freed right away. Each get (and each
+//   lock-free lookup of get/put) counts itself in a per-thread slot for its
+//   duration, which costs two atomic adds on a cache line shared by the
+//   threads of that slot. Puts and removes free what no get can still be
+//   using in batches. Until then, a removed entry or an old table (with a copy
+//   of every entry) stays allocated, so a map holds up to a batch of retired
+//   things plus whatever was retired while a get was running. The number of
+//   retired things not yet freed is reported by map_metrics.
 
 // Forward declaration of Map type.
 typedef struct map_t map_t;
@@ -44,8 +67,15 @@ typedef struct map_metrics_t {
   uint32_t max_depth;
   uint32_t num_entries;
   uint32_t curr_size;
+  uint32_t num_retired; // removed entries and old tables not yet freed
 } map_metrics_t;
 
+// A key and its value, as filled in by map_export.
+typedef struct map_pair_t {
+  const char *key; // the map's copy of the key
+  void *value;     // value stored for the key
+} map_pair_t;
+
 // Creates a map with the given initial size.
 //
 // Caller owns returned pointer; must be freed with free_map.
@@ -100,6 +130,9 @@ int map_get_or_put(map_t *map, const char *key, void **value_ptr, void *zero);
 // Applies apply_fn to each value in the map and replaces the map value with the
 // returned value. If apply_fn replaces the value, apply_fn must take ownership
 // of previous value.
+//
+// Puts and removes block until the apply is done, so apply_fn must not put to
+// or remove from the map; it may get from it.
 void map_apply(map_t *map, void *apply_fn(const char *key, void *value));
 
 // Apply a function to each value in the map, modifying its value.
@@ -114,6 +147,19 @@ void map_apply_arg(map_t *map,
                    void *apply_fn(const char *key, void *value, void *arg),
                    void *arg);
 
+// Copies every entry of the map into a new array and sets n to its length. If
+// sorted is nonzero, the pairs are sorted by key (in strcmp order).
+//
+// Puts and removes block while the entries are copied, as for map_apply, but
+// not while they are sorted. The keys belong to the map and are valid until
+// their entry is removed or the map is freed. Caller owns returned array.
+map_pair_t *map_export(map_t *map, uint32_t *n, int sorted);
+
+// Sorts pairs by key, in strcmp order, using multikey quicksort: keys are
+// partitioned one character at a time, so common prefixes are only compared
+// once.
+void map_pairs_sort(map_pair_t *pairs, size_t n);
+
 // Debug function.
 //
 // This is a free function for you to define however you want in order to debug
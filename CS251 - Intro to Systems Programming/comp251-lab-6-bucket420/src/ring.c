@@ -0,0 +1,113 @@
+#include "ring.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "util.h"
+
+// A cell of the ring. For the cell at index i (modulo the capacity), seq is i
+// when the cell is free for the producer at position i, and i + 1 when it holds
+// the work for the consumer at position i.
+struct cell {
+  atomic_ulong seq;
+  threadpool_work_t work;
+  long queued_ns; // when the work was pushed, for queue waits
+};
+
+// Ring implementation. The producer and consumer positions live on separate
+// cache lines so that pushes and pops do not invalidate each other.
+struct ring {
+  _Alignas(CACHE_LINE) atomic_ulong tail;  // next position to push
+  _Alignas(CACHE_LINE) atomic_ulong head;  // next position to pop
+  _Alignas(CACHE_LINE) unsigned long mask; // capacity - 1
+  struct cell *cells;
+};
+
+struct ring *ring_create(unsigned int capacity) {
+  unsigned long size = 1;
+  while (size < capacity) {
+    size <<= 1;
+  }
+  struct ring *r = aligned_alloc(CACHE_LINE, sizeof(struct ring));
+  assert(r);
+  r->cells = malloc(size * sizeof(struct cell));
+  assert(r->cells);
+  for (unsigned long i = 0; i < size; i++) {
+    atomic_init(&r->cells[i].seq, i);
+  }
+  r->mask = size - 1;
+  atomic_init(&r->tail, 0);
+  atomic_init(&r->head, 0);
+  return r;
+}
+
+void ring_free(struct ring *r) {
+  free(r->cells);
+  free(r);
+}
+
+int ring_push(struct ring *r, threadpool_work_t work, long queued_ns) {
+  unsigned long pos = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  struct cell *c;
+  while (1) {
+    c = &r->cells[pos & r->mask];
+    unsigned long seq = atomic_load_explicit(&c->seq, memory_order_acquire);
+    long diff = (long)(seq - pos);
+    if (diff == 0) {
+      // the cell is free; claim it.
+      if (atomic_compare_exchange_weak_explicit(&r->tail, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      // the cell still holds work from the previous lap; the ring is full.
+      return 0;
+    } else {
+      // another producer claimed the cell; retry at the current tail.
+      pos = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    }
+  }
+  c->work = work;
+  c->queued_ns = queued_ns;
+  // publish the work to the consumer at pos.
+  atomic_store_explicit(&c->seq, pos + 1, memory_order_release);
+  return 1;
+}
+
+int ring_pop(struct ring *r, threadpool_work_t *work, long *queued_ns) {
+  unsigned long pos = atomic_load_explicit(&r->head, memory_order_relaxed);
+  struct cell *c;
+  while (1) {
+    c = &r->cells[pos & r->mask];
+    unsigned long seq = atomic_load_explicit(&c->seq, memory_order_acquire);
+    long diff = (long)(seq - (pos + 1));
+    if (diff == 0) {
+      // the cell holds work; claim it.
+      if (atomic_compare_exchange_weak_explicit(&r->head, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      // the cell has not been filled yet; the ring is empty.
+      return 0;
+    } else {
+      // another consumer took the cell; retry at the current head.
+      pos = atomic_load_explicit(&r->head, memory_order_relaxed);
+    }
+  }
+  *work = c->work;
+  *queued_ns = c->queued_ns;
+  // free the cell for the producer one lap ahead.
+  atomic_store_explicit(&c->seq, pos + r->mask + 1, memory_order_release);
+  return 1;
+}
+
+long ring_size(struct ring *r) {
+  unsigned long tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  unsigned long head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  return tail > head ? tail - head : 0;
+}
+
+long ring_capacity(struct ring *r) { return r->mask + 1; }
@@ -0,0 +1,41 @@
+#ifndef __RING_H__
+#define __RING_H__
+
+#include "thread_pool.h"
+
+// Bounded multi-producer, multi-consumer queue of work.
+//
+// Work is stored inline in a fixed array of cells, along with the time it was
+// queued, so adding and taking work never allocates. Any number of threads may
+// push and pop concurrently without locking; each operation claims a cell with
+// a single CAS on the shared head or tail position, and each cell carries a
+// sequence number that tells producers and consumers whether it is free or
+// full.
+//
+// See Dmitry Vyukov's "Bounded MPMC queue" for the algorithm.
+
+struct ring;
+
+// Create a ring that holds at least capacity work items. The capacity is
+// rounded up to a power of two.
+struct ring *ring_create(unsigned int capacity);
+
+// Free the ring. No other thread may be using it.
+void ring_free(struct ring *r);
+
+// Add work, queued at time queued_ns, to the ring. Returns 1 on success or 0 if
+// the ring is full.
+int ring_push(struct ring *r, threadpool_work_t work, long queued_ns);
+
+// Take the oldest work from the ring, copying it to work and the time it was
+// queued to queued_ns. Returns 1 on success or 0 if the ring is empty.
+int ring_pop(struct ring *r, threadpool_work_t *work, long *queued_ns);
+
+// Return the number of work items in the ring. The value is only a snapshot
+// when other threads are using the ring.
+long ring_size(struct ring *r);
+
+// Return the number of work items the ring can hold.
+long ring_capacity(struct ring *r);
+
+#endif
@@ -0,0 +1,173 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "../deque.h"
+#include "test_utils.h"
+
+// elements are small integers; 0 is NULL, so start at 1.
+#define ELEM(i) ((void *)(long)(i))
+#define VAL(x) ((long)(x))
+
+int test_empty() {
+  struct deque *d = deque_create(4);
+  EXPECT_NULL(deque_pop(d));
+  EXPECT_NULL(deque_steal(d));
+  EXPECT_LONG_EQ(0l, deque_size(d));
+  deque_free(d);
+  return 0;
+}
+
+int test_push_pop() {
+  struct deque *d = deque_create(4);
+  for (long i = 1; i <= 10; i++) {
+    deque_push(d, ELEM(i));
+  }
+  EXPECT_LONG_EQ(10l, deque_size(d));
+  // the owner takes the newest element first.
+  for (long i = 10; i >= 1; i--) {
+    EXPECT_LONG_EQ(i, VAL(deque_pop(d)));
+  }
+  EXPECT_NULL(deque_pop(d));
+  deque_free(d);
+  return 0;
+}
+
+int test_steal() {
+  struct deque *d = deque_create(4);
+  for (long i = 1; i <= 10; i++) {
+    deque_push(d, ELEM(i));
+  }
+  // thieves take the oldest element first.
+  for (long i = 1; i <= 10; i++) {
+    EXPECT_LONG_EQ(i, VAL(deque_steal(d)));
+  }
+  EXPECT_NULL(deque_steal(d));
+  deque_free(d);
+  return 0;
+}
+
+int test_pop_and_steal() {
+  struct deque *d = deque_create(4);
+  for (long i = 1; i <= 4; i++) {
+    deque_push(d, ELEM(i));
+  }
+  EXPECT_LONG_EQ(1l, VAL(deque_steal(d)));
+  EXPECT_LONG_EQ(4l, VAL(deque_pop(d)));
+  EXPECT_LONG_EQ(2l, VAL(deque_steal(d)));
+  EXPECT_LONG_EQ(3l, VAL(deque_pop(d)));
+  EXPECT_NULL(deque_pop(d));
+  EXPECT_NULL(deque_steal(d));
+  // the deque is reusable once empty.
+  deque_push(d, ELEM(5));
+  EXPECT_LONG_EQ(5l, VAL(deque_steal(d)));
+  deque_free(d);
+  return 0;
+}
+
+int test_grow() {
+  // start with room for 2 elements and grow many times, with the live
+  // elements wrapped around the array.
+  struct deque *d = deque_create(1);
+  long next = 1;
+  long oldest = 1;
+  for (int round = 0; round < 10; round++) {
+    for (int i = 0; i < 100; i++) {
+      deque_push(d, ELEM(next++));
+    }
+    for (int i = 0; i < 50; i++) {
+      EXPECT_LONG_EQ(oldest++, VAL(deque_steal(d)));
+    }
+  }
+  EXPECT_LONG_EQ(next - oldest, deque_size(d));
+  while (next > oldest) {
+    EXPECT_LONG_EQ(--next, VAL(deque_pop(d)));
+  }
+  EXPECT_NULL(deque_pop(d));
+  deque_free(d);
+  return 0;
+}
+
+int test_init() {
+  // a deque in caller memory grows out of it like any other, and freeing it
+  // leaves the memory to the caller.
+  size_t bytes = deque_bytes(1);
+  EXPECT_INT_EQ(0, (int)(bytes % 64));
+  void *mem = aligned_alloc(64, bytes);
+  struct deque *d = deque_init(mem, 1);
+  EXPECT_NULL(deque_pop(d));
+  for (long i = 1; i <= 100; i++) {
+    deque_push(d, ELEM(i));
+  }
+  EXPECT_LONG_EQ(1l, VAL(deque_steal(d)));
+  EXPECT_LONG_EQ(100l, VAL(deque_pop(d)));
+  EXPECT_LONG_EQ(98l, deque_size(d));
+  deque_free(d);
+  free(mem);
+  return 0;
+}
+
+#define RACE_ELEMS 200000
+#define RACE_THIEVES 4
+
+struct race {
+  struct deque *d;
+  atomic_int done;                  // set when the owner is finished
+  atomic_char seen[RACE_ELEMS + 1]; // times each element was taken
+};
+
+void *thief(void *arg) {
+  struct race *r = arg;
+  while (1) {
+    void *x = deque_steal(r->d);
+    if (x) {
+      r->seen[VAL(x)]++;
+    } else if (r->done && deque_size(r->d) == 0) {
+      return NULL;
+    }
+  }
+}
+
+int test_concurrent() {
+  // the owner pushes everything and pops some of it back while thieves steal;
+  // every element must be taken exactly once.
+  struct race *r = calloc(1, sizeof(struct race));
+  r->d = deque_create(2);
+  pthread_t thieves[RACE_THIEVES];
+  for (int i = 0; i < RACE_THIEVES; i++) {
+    pthread_create(&thieves[i], NULL, thief, r);
+  }
+  for (long i = 1; i <= RACE_ELEMS; i++) {
+    deque_push(r->d, ELEM(i));
+    if (i % 3 == 0) {
+      void *x = deque_pop(r->d);
+      if (x) {
+        r->seen[VAL(x)]++;
+      }
+    }
+  }
+  r->done = 1;
+  for (int i = 0; i < RACE_THIEVES; i++) {
+    pthread_join(thieves[i], NULL);
+  }
+  int bad = 0;
+  for (long i = 1; i <= RACE_ELEMS; i++) {
+    bad += r->seen[i] != 1;
+  }
+  EXPECT_INT_EQ(0, bad);
+  deque_free(r->d);
+  free(r);
+  return 0;
+}
+
+int main() {
+  ADD_TEST(test_empty);
+  ADD_TEST(test_push_pop);
+  ADD_TEST(test_steal);
+  ADD_TEST(test_pop_and_steal);
+  ADD_TEST(test_grow);
+  ADD_TEST(test_init);
+  ADD_TEST(test_concurrent);
+  run_tests(/*fail_fast=*/0);
+  return 0;
+}
@@ -0,0 +1,251 @@
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "../graph.h"
+#include "../util.h"
+#include "test_utils.h"
+#include "tp_test_utils.h"
+
+#define NTHREADS 4
+
+// the order in which tasks ran.
+atomic_long next;
+long order[1024];
+
+void *record_order(void *arg) {
+  order[atomic_fetch_add(&next, 1)] = (long)arg;
+  return arg;
+}
+
+threadpool_t make_mode(enum threadpool_mode mode) {
+  return mode == THREADPOOL_MODE_SHARED ? make_with(NTHREADS)
+                                        : make_stealing_with(NTHREADS);
+}
+
+int test_empty() {
+  threadpool_t tp = make_with(NTHREADS);
+  graph_t g = graph_create(tp);
+  graph_run(g);
+  graph_wait(g);
+  graph_free(g);
+  threadpool_destroy(tp);
+  return 0;
+}
+
+int chain(enum threadpool_mode mode) {
+  int n = 200;
+  threadpool_t tp = make_mode(mode);
+  threadpool_start(tp);
+  graph_t g = graph_create(tp);
+  atomic_store(&next, 0);
+  for (int i = 0; i < n; i++) {
+    threadpool_work_t w = {record_order, (void *)(long)i};
+    int dep = i - 1;
+    EXPECT_INT_EQ(i, graph_add(g, w, &dep, i > 0));
+  }
+  graph_run(g);
+  graph_wait(g);
+  EXPECT_LONG_EQ((long)n, atomic_load(&next));
+  for (int i = 0; i < n; i++) {
+    EXPECT_LONG_EQ((long)i, order[i]);
+  }
+  graph_free(g);
+  threadpool_stop(tp, THREADPOOL_STOP_WAIT);
+  threadpool_destroy(tp);
+  return 0;
+}
+
+int test_chain() {
+  // each task runs after the one before it.
+  EXPECT_INT_EQ(0, chain(THREADPOOL_MODE_SHARED));
+  EXPECT_INT_EQ(0, chain(THREADPOOL_MODE_STEALING));
+  return 0;
+}
+
+atomic_long fanned;
+
+void *fan_out(void *unused) {
+  atomic_fetch_add(&fanned, 1);
+  return NULL;
+}
+
+void *fan_in(void *unused) { return (void *)atomic_load(&fanned); }
+
+int test_fan() {
+  // a root with many successors, all of which precede a single sink.
+  int n = 500;
+  threadpool_t tp = make_stealing_with(NTHREADS);
+  threadpool_start(tp);
+  graph_t g = graph_create(tp);
+  atomic_store(&fanned, 0);
+  threadpool_work_t out = {fan_out};
+  int root = graph_add(g, out, NULL, 0);
+  int *mid = malloc(n * sizeof(int));
+  for (int i = 0; i < n; i++) {
+    mid[i] = graph_add(g, out, &root, 1);
+  }
+  threadpool_work_t in = {fan_in};
+  int sink = graph_add(g, in, mid, n);
+  graph_run(g);
+  graph_wait(g);
+  EXPECT_LONG_EQ(n + 1l, (long)graph_result(g, sink));
+  graph_free(g);
+  free(mid);
+  threadpool_stop(tp, THREADPOOL_STOP_WAIT);
+  threadpool_destroy(tp);
+  return 0;
+}
+
+// a task that sums the results of its predecessors.
+struct sum_arg {
+  graph_t g;
+  int deps[2];
+  int n;
+};
+
+void *sum(void *arg) {
+  struct sum_arg *a = arg;
+  long s = a->n ? 0 : 1;
+  for (int i = 0; i < a->n; i++) {
+    s += (long)graph_result(a->g, a->deps[i]);
+  }
+  return (void *)s;
+}
+
+int test_results() {
+  // successors read the results of their predecessors: fibonacci numbers.
+  int n = 40;
+  threadpool_t tp = make_with(NTHREADS);
+  threadpool_start(tp);
+  graph_t g = graph_create(tp);
+  struct sum_arg *args = malloc(n * sizeof(struct sum_arg));
+  for (int i = 0; i < n; i++) {
+    args[i].g = g;
+    args[i].n = min(i, 2);
+    args[i].deps[0] = i - 1;
+    args[i].deps[1] = i - 2;
+    threadpool_work_t w = {sum, &args[i]};
+    graph_add(g, w, args[i].deps, args[i].n);
+  }
+  graph_run(g);
+  graph_wait(g);
+  long a = 1, b = 1;
+  for (int i = 2; i < n; i++) {
+    long c = a + b;
+    a = b;
+    b = c;
+  }
+  EXPECT_LONG_EQ(b, (long)graph_result(g, n - 1));
+  graph_free(g);
+  free(args);
+  threadpool_stop(tp, THREADPOOL_STOP_WAIT);
+  threadpool_destroy(tp);
+  return 0;
+}
+
+atomic_int loaded;
+
+void *load(void *unused) {
+  atomic_store(&loaded, 1);
+  return NULL;
+}
+
+// waits up to a second for the first load to complete.
+void *wait_loaded(void *unused) {
+  for (int i = 0; i < 2000 && !atomic_load(&loaded); i++) {
+    xsleep();
+  }
+  return (void *)(long)atomic_load(&loaded);
+}
+
+int test_overlap() {
+  // a successor runs while other tasks of its predecessor's stage are still
+  // running: the first load completes while the last parse waits for it.
+  int n = 8;
+  threadpool_t tp = make_with(2);
+  threadpool_start(tp);
+  graph_t g = graph_create(tp);
+  atomic_store(&loaded, 0);
+  threadpool_work_t parse = {record_order};
+  threadpool_work_t last = {wait_loaded};
+  threadpool_work_t ld = {load};
+  int first = graph_add(g, parse, NULL, 0);
+  for (int i = 1; i < n - 1; i++) {
+    graph_add(g, parse, NULL, 0);
+  }
+  int wait = graph_add(g, last, NULL, 0);
+  graph_add(g, ld, &first, 1);
+  atomic_store(&next, 0);
+  graph_run(g);
+  graph_wait(g);
+  EXPECT_LONG_EQ(1l, (long)graph_result(g, wait));
+  graph_free(g);
+  threadpool_stop(tp, THREADPOOL_STOP_WAIT);
+  threadpool_destroy(tp);
+  return 0;
+}
+
+int test_stopped() {
+  // a graph run on a stopped pool completes once the pool starts.
+  threadpool_t tp = make_with(NTHREADS);
+  graph_t g = graph_create(tp);
+  atomic_store(&next, 0);
+  threadpool_work_t w = {record_order};
+  int root = graph_add(g, w, NULL, 0);
+  graph_add(g, w, &root, 1);
+  graph_run(g);
+  EXPECT_LONG_EQ(0l, atomic_load(&next));
+  threadpool_start(tp);
+  graph_wait(g);
+  EXPECT_LONG_EQ(2l, atomic_load(&next));
+  graph_free(g);
+  threadpool_stop(tp, THREADPOOL_STOP_WAIT);
+  threadpool_destroy(tp);
+  return 0;
+}
+
+atomic_int called_back;
+
+void set_called_back(void *unused) { atomic_store(&called_back, 1); }
+
+void *get_called_back(void *unused) {
+  return (void *)(long)atomic_load(&called_back);
+}
+
+int test_callback_priority() {
+  // a task completes after its callback, and runs with its own priority.
+  threadpool_t tp = make_with(NTHREADS);
+  threadpool_start(tp);
+  graph_t g = graph_create(tp);
+  atomic_store(&called_back, 0);
+  threadpool_work_t w = {record_order, NULL, set_called_back,
+                         THREADPOOL_PRIORITY_LOW};
+  int root = graph_add(g, w, NULL, 0);
+  threadpool_work_t check = {get_called_back, NULL, NULL,
+                             THREADPOOL_PRIORITY_HIGH};
+  int succ = graph_add(g, check, &root, 1);
+  graph_run(g);
+  graph_wait(g);
+  EXPECT_LONG_EQ(1l, (long)graph_result(g, succ));
+  threadpool_stop(tp, THREADPOOL_STOP_WAIT);
+  threadpool_counters_t c = threadpool_counters(tp);
+  int low = THREADPOOL_PRIORITY_INDEX(THREADPOOL_PRIORITY_LOW);
+  int high = THREADPOOL_PRIORITY_INDEX(THREADPOOL_PRIORITY_HIGH);
+  EXPECT_INT_EQ(1, c.priority[low].completed_work);
+  EXPECT_INT_EQ(1, c.priority[high].completed_work);
+  graph_free(g);
+  threadpool_destroy(tp);
+  return 0;
+}
+
+int main() {
+  ADD_TEST(test_empty);
+  ADD_TEST(test_chain);
+  ADD_TEST(test_fan);
+  ADD_TEST(test_results);
+  ADD_TEST(test_overlap);
+  ADD_TEST(test_stopped);
+  ADD_TEST(test_callback_priority);
+  run_tests(/*fail_fast=*/0);
+  return 0;
+}
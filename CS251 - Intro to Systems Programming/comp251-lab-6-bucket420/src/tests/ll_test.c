@@ -213,6 +213,43 @@ int test_counters_join_left_heavy() {
   return 0;
 }
 
+int test_store_nodes() {
+  struct ll_store s;
+  ll_store_init(&s);
+  ll_store_reserve(&s, 100);
+  struct ll *ll = NULL;
+  for (int i = 1; i <= 100; i++) {
+    ll = ll_add_node(ll, ll_store_get(&s), make(i));
+  }
+  EXPECT_INT_EQ(100, ll_poll(ll));
+  struct ll *node;
+  for (int i = 1; i <= 100; i++) {
+    ll = ll_take_node(ll, &node);
+    EXPECT_NOTNULL(node);
+    EXPECT_LONG_EQ((long)i, is(node->work));
+    ll_store_put(&s, node);
+  }
+  EXPECT_NULL(ll);
+  ll = ll_take_node(ll, &node);
+  EXPECT_NULL(node);
+  ll_store_free(&s);
+  return 0;
+}
+
+int test_store_reuse() {
+  struct ll_store s;
+  ll_store_init(&s);
+  struct ll *a = ll_store_get(&s);
+  ll_store_put(&s, a);
+  // a returned node is handed out again before new memory.
+  EXPECT_TRUE(a == ll_store_get(&s));
+  // nodes still in a list are freed with the store.
+  struct ll *ll = ll_add_node(NULL, a, make(1));
+  ll = ll_add_node(ll, ll_store_get(&s), make(2));
+  ll_store_free(&s);
+  return 0;
+}
+
 int main() {
   ADD_TEST(test_add_take);
   ADD_TEST(test_add_add_take);
@@ -228,5 +265,7 @@ int main() {
   ADD_TEST(test_counters);
   ADD_TEST(test_counters_join_left_heavy);
   ADD_TEST(test_counters_join_right_heavy);
+  ADD_TEST(test_store_nodes);
+  ADD_TEST(test_store_reuse);
   run_tests(/*fail_fast=*/0);
 }
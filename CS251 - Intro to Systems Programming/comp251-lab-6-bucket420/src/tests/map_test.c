@@ -0,0 +1,352 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../map/map.h"
+#include "test_utils.h"
+
+#define NTHREADS 8
+#define NKEYS 4096
+
+// values are small integers; 0 is NULL, so start at 1.
+#define VALUE(i) ((void *)(long)(i))
+#define VAL(x) ((long)(x))
+
+// the i-th test key.
+char *make_key(char *buff, int i) {
+  snprintf(buff, 16, "key%d", i);
+  return buff;
+}
+
+int test_put_get_remove() {
+  map_t *map = map_create(16);
+  char key[16];
+  void *v;
+  EXPECT_FALSE(map_get(map, "a", &v));
+  EXPECT_NULL(v);
+  EXPECT_TRUE(map_put(map, "a", VALUE(1)));
+  EXPECT_FALSE(map_put(map, "a", VALUE(2)));
+  EXPECT_TRUE(map_get(map, "a", &v));
+  EXPECT_LONG_EQ(2l, VAL(v));
+  EXPECT_TRUE(map_get(map, "a", NULL));
+  for (int i = 1; i <= 100; i++) {
+    EXPECT_TRUE(map_put(map, make_key(key, i), VALUE(i)));
+  }
+  EXPECT_TRUE(map_remove(map, "a"));
+  EXPECT_FALSE(map_remove(map, "a"));
+  EXPECT_FALSE(map_get(map, "a", NULL));
+  for (int i = 1; i <= 100; i++) {
+    EXPECT_TRUE(map_get(map, make_key(key, i), &v));
+    EXPECT_LONG_EQ((long)i, VAL(v));
+  }
+  map_metrics_t *m = map_metrics(map);
+  EXPECT_UINT_EQ(100, m->num_entries);
+  map_free(&map);
+  free(m);
+  EXPECT_NULL(map);
+  return 0;
+}
+
+int test_get_or_put() {
+  map_t *map = map_create(16);
+  void *v;
+  EXPECT_INT_EQ(0, map_get_or_put(map, "a", &v, VALUE(1)));
+  EXPECT_LONG_EQ(1l, VAL(v));
+  EXPECT_INT_EQ(1, map_get_or_put(map, "a", &v, VALUE(2)));
+  EXPECT_LONG_EQ(1l, VAL(v));
+  map_free(&map);
+  return 0;
+}
+
+int test_resize() {
+  // a map grows as entries are added, and can be resized either way.
+  map_t *map = map_create(1);
+  char key[16];
+  for (int i = 1; i <= NKEYS; i++) {
+    map_put(map, make_key(key, i), VALUE(i));
+  }
+  map_metrics_t *m = map_metrics(map);
+  EXPECT_UINT_EQ(NKEYS, m->num_entries);
+  EXPECT_UINT_GTE(m->curr_size, NKEYS / 2);
+  free(m);
+  map_resize(map, 7);
+  m = map_metrics(map);
+  EXPECT_UINT_EQ(7, m->curr_size);
+  EXPECT_UINT_EQ(NKEYS, m->num_entries);
+  free(m);
+  void *v;
+  for (int i = 1; i <= NKEYS; i++) {
+    EXPECT_TRUE(map_get(map, make_key(key, i), &v));
+    EXPECT_LONG_EQ((long)i, VAL(v));
+  }
+  map_free(&map);
+  return 0;
+}
+
+void *sum_fn(const char *key, void *value, void *arg) {
+  *(long *)arg += VAL(value);
+  return VALUE(VAL(value) * 2);
+}
+
+int test_apply() {
+  map_t *map = map_create(16);
+  char key[16];
+  for (int i = 1; i <= 100; i++) {
+    map_put(map, make_key(key, i), VALUE(i));
+  }
+  long sum = 0;
+  map_apply_arg(map, sum_fn, &sum);
+  EXPECT_LONG_EQ(5050l, sum);
+  void *v;
+  EXPECT_TRUE(map_get(map, "key7", &v));
+  EXPECT_LONG_EQ(14l, VAL(v));
+  map_free(&map);
+  return 0;
+}
+
+int test_export() {
+  map_t *map = map_create(16);
+  uint32_t n;
+  map_pair_t *pairs = map_export(map, &n, 1);
+  EXPECT_UINT_EQ(0, n);
+  free(pairs);
+  // keys with shared prefixes and of different lengths, some removed.
+  char key[16];
+  for (int i = 0; i < NKEYS; i++) {
+    map_put(map, make_key(key, i), VALUE(i + 1));
+  }
+  for (int i = 0; i < NKEYS; i += 3) {
+    map_remove(map, make_key(key, i));
+  }
+  pairs = map_export(map, &n, 1);
+  EXPECT_UINT_EQ(NKEYS - (NKEYS + 2) / 3, n);
+  int bad = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    bad += i > 0 && strcmp(pairs[i - 1].key, pairs[i].key) >= 0;
+    bad += VAL(pairs[i].value) != atol(pairs[i].key + 3) + 1;
+  }
+  EXPECT_INT_EQ(0, bad);
+  free(pairs);
+  map_free(&map);
+  return 0;
+}
+
+struct thread_arg {
+  map_t *map;
+  int id;
+  long result;
+};
+
+// every thread tries to put each key with its own id.
+void *get_or_put_all(void *arg) {
+  struct thread_arg *ta = arg;
+  char key[16];
+  for (int i = 0; i < NKEYS; i++) {
+    void *v;
+    if (!map_get_or_put(ta->map, make_key(key, i), &v, VALUE(ta->id))) {
+      ta->result++;
+    }
+  }
+  return NULL;
+}
+
+int test_concurrent_get_or_put() {
+  // each key is put exactly once, however many threads race to put it, while
+  // the map grows from a single bucket.
+  map_t *map = map_create(1);
+  pthread_t threads[NTHREADS];
+  struct thread_arg args[NTHREADS];
+  for (int i = 0; i < NTHREADS; i++) {
+    args[i] = (struct thread_arg){map, i + 1, 0};
+    pthread_create(&threads[i], NULL, get_or_put_all, &args[i]);
+  }
+  long puts = 0;
+  for (int i = 0; i < NTHREADS; i++) {
+    pthread_join(threads[i], NULL);
+    puts += args[i].result;
+  }
+  EXPECT_LONG_EQ((long)NKEYS, puts);
+  map_metrics_t *m = map_metrics(map);
+  EXPECT_UINT_EQ(NKEYS, m->num_entries);
+  free(m);
+  map_free(&map);
+  return 0;
+}
+
+atomic_int resizing;
+
+// counts the keys that are not found while another thread resizes the map.
+void *get_all(void *arg) {
+  struct thread_arg *ta = arg;
+  char key[16];
+  while (atomic_load(&resizing)) {
+    for (int i = 0; i < NKEYS; i++) {
+      void *v;
+      if (!map_get(ta->map, make_key(key, i), &v) || VAL(v) != i + 1) {
+        ta->result++;
+      }
+    }
+  }
+  return NULL;
+}
+
+int test_get_during_resize() {
+  // gets find every key, with its value, while the map is resized.
+  map_t *map = map_create(64);
+  char key[16];
+  for (int i = 0; i < NKEYS; i++) {
+    map_put(map, make_key(key, i), VALUE(i + 1));
+  }
+  atomic_store(&resizing, 1);
+  pthread_t threads[NTHREADS];
+  struct thread_arg args[NTHREADS];
+  for (int i = 0; i < NTHREADS; i++) {
+    args[i] = (struct thread_arg){map, i, 0};
+    pthread_create(&threads[i], NULL, get_all, &args[i]);
+  }
+  for (int i = 0; i < 50; i++) {
+    map_resize(map, i % 2 ? 64 : 4096);
+  }
+  atomic_store(&resizing, 0);
+  for (int i = 0; i < NTHREADS; i++) {
+    pthread_join(threads[i], NULL);
+    EXPECT_LONG_EQ(0l, args[i].result);
+  }
+  map_free(&map);
+  return 0;
+}
+
+// puts, then removes, the keys of the thread's own range.
+void *put_remove(void *arg) {
+  struct thread_arg *ta = arg;
+  char key[16];
+  int start = ta->id * NKEYS;
+  for (int i = start; i < start + NKEYS; i++) {
+    ta->result += map_put(ta->map, make_key(key, i), VALUE(i + 1));
+  }
+  for (int i = start; i < start + NKEYS; i += 2) {
+    ta->result -= map_remove(ta->map, make_key(key, i));
+  }
+  return NULL;
+}
+
+int test_concurrent_put_remove() {
+  map_t *map = map_create(1);
+  pthread_t threads[NTHREADS];
+  struct thread_arg args[NTHREADS];
+  for (int i = 0; i < NTHREADS; i++) {
+    args[i] = (struct thread_arg){map, i, 0};
+    pthread_create(&threads[i], NULL, put_remove, &args[i]);
+  }
+  for (int i = 0; i < NTHREADS; i++) {
+    pthread_join(threads[i], NULL);
+    EXPECT_LONG_EQ((long)NKEYS / 2, args[i].result);
+  }
+  map_metrics_t *m = map_metrics(map);
+  EXPECT_UINT_EQ(NTHREADS * NKEYS / 2, m->num_entries);
+  free(m);
+  char key[16];
+  for (int i = 0; i < NTHREADS * NKEYS; i++) {
+    EXPECT_INT_EQ(i % 2, map_get(map, make_key(key, i), NULL));
+  }
+  map_free(&map);
+  return 0;
+}
+
+// churns the keys of the first half: puts and removes them over and over.
+void *churn(void *arg) {
+  struct thread_arg *ta = arg;
+  char key[16];
+  for (int round = 0; round < 20; round++) {
+    for (int i = 0; i < NKEYS / 2; i++) {
+      map_remove(ta->map, make_key(key, i));
+    }
+    for (int i = 0; i < NKEYS / 2; i++) {
+      map_put(ta->map, make_key(key, i), VALUE(i + 1));
+    }
+    map_resize(ta->map, round % 2 ? 64 : 4096);
+  }
+  atomic_store(&resizing, 0);
+  return NULL;
+}
+
+// counts the keys of the second half that are not found.
+void *get_second_half(void *arg) {
+  struct thread_arg *ta = arg;
+  char key[16];
+  while (atomic_load(&resizing)) {
+    for (int i = NKEYS / 2; i < NKEYS; i++) {
+      void *v;
+      if (!map_get(ta->map, make_key(key, i), &v) || VAL(v) != i + 1) {
+        ta->result++;
+      }
+    }
+  }
+  return NULL;
+}
+
+int test_reclaim() {
+  // removed entries and old tables are freed as the map is used, not only by
+  // map_free.
+  map_t *map = map_create(64);
+  char key[16];
+  for (int round = 0; round < 20; round++) {
+    for (int i = 0; i < NKEYS; i++) {
+      map_put(map, make_key(key, i), VALUE(i + 1));
+    }
+    for (int i = 0; i < NKEYS; i++) {
+      map_remove(map, make_key(key, i));
+    }
+    map_resize(map, round % 2 ? 64 : 4096);
+  }
+  map_metrics_t *m = map_metrics(map);
+  EXPECT_UINT_EQ(0, m->num_entries);
+  EXPECT_TRUE(m->num_retired < 128);
+  free(m);
+  map_free(&map);
+
+  // gets still find the untouched keys while the others are churned and the
+  // map resized, freeing what the gets were walking.
+  map = map_create(64);
+  for (int i = 0; i < NKEYS; i++) {
+    map_put(map, make_key(key, i), VALUE(i + 1));
+  }
+  atomic_store(&resizing, 1);
+  pthread_t threads[NTHREADS];
+  struct thread_arg args[NTHREADS];
+  for (int i = 0; i < NTHREADS; i++) {
+    args[i] = (struct thread_arg){map, i, 0};
+    pthread_create(&threads[i], NULL, i ? get_second_half : churn, &args[i]);
+  }
+  for (int i = 0; i < NTHREADS; i++) {
+    pthread_join(threads[i], NULL);
+    EXPECT_LONG_EQ(0l, args[i].result);
+  }
+  // with no get running, a few more removes free the rest.
+  for (int i = 0; i < 4; i++) {
+    map_put(map, "extra", VALUE(1));
+    map_remove(map, "extra");
+  }
+  m = map_metrics(map);
+  EXPECT_UINT_EQ(NKEYS, m->num_entries);
+  EXPECT_TRUE(m->num_retired < 128);
+  free(m);
+  map_free(&map);
+  return 0;
+}
+
+int main() {
+  ADD_TEST(test_put_get_remove);
+  ADD_TEST(test_get_or_put);
+  ADD_TEST(test_resize);
+  ADD_TEST(test_apply);
+  ADD_TEST(test_export);
+  ADD_TEST(test_concurrent_get_or_put);
+  ADD_TEST(test_get_during_resize);
+  ADD_TEST(test_concurrent_put_remove);
+  ADD_TEST(test_reclaim);
+  run_tests(/*fail_fast=*/0);
+  return 0;
+}
@@ -0,0 +1,146 @@
+#include <stdlib.h>
+
+#include "../apps/postings.h"
+#include "test_utils.h"
+
+int test_varint() {
+  uint32_t values[] = {0, 1, 127, 128, 300, 16383, 16384, 1u << 28, 0xffffffff};
+  int lens[] = {1, 1, 1, 2, 2, 2, 3, 5, 5};
+  uint8_t buf[5 * 9];
+  uint8_t *p = buf;
+  for (int i = 0; i < 9; i++) {
+    int len = varint_put(p, values[i]);
+    EXPECT_INT_EQ(lens[i], len);
+    p += len;
+  }
+  const uint8_t *q = buf;
+  for (int i = 0; i < 9; i++) {
+    EXPECT_UINT_EQ(values[i], varint_get(&q));
+  }
+  EXPECT_TRUE(q == p);
+  return 0;
+}
+
+// encodes lines 0, 0, 3, 6, ... (with a repeat, as for a word appearing
+// twice on a line) and checks that they decode the same.
+int encode_decode(int n) {
+  line_list_t l;
+  line_list_init(&l);
+  for (int i = 0; i < n; i++) {
+    line_list_append(&l, i ? (i - 1) * 3 : 0);
+  }
+  EXPECT_INT_EQ(n, l.n);
+  posting_t *p = posting_encode(7, &l);
+  line_list_free(&l);
+  EXPECT_INT_EQ(7, p->file);
+  EXPECT_INT_EQ(n, p->n);
+  // every delta fits in a byte.
+  EXPECT_UINT_EQ(n, p->len);
+  posting_iter_t it;
+  posting_iter_init(&it, p);
+  int line;
+  for (int i = 0; i < n; i++) {
+    EXPECT_TRUE(posting_iter_next(&it, &line));
+    EXPECT_INT_EQ(i ? (i - 1) * 3 : 0, line);
+  }
+  EXPECT_FALSE(posting_iter_next(&it, &line));
+  free(p);
+  return 0;
+}
+
+int test_encode_decode() {
+  // inline lines only, then across several chunks.
+  EXPECT_INT_EQ(0, encode_decode(0));
+  EXPECT_INT_EQ(0, encode_decode(LINE_LIST_INLINE));
+  EXPECT_INT_EQ(0, encode_decode(LINE_LIST_INLINE + 1));
+  EXPECT_INT_EQ(0, encode_decode(40));
+  return 0;
+}
+
+int test_large_delta() {
+  line_list_t l;
+  line_list_init(&l);
+  line_list_append(&l, 5);
+  line_list_append(&l, 1000005);
+  posting_t *p = posting_encode(0, &l);
+  line_list_free(&l);
+  EXPECT_UINT_EQ(1 + 3, p->len);
+  posting_iter_t it;
+  posting_iter_init(&it, p);
+  int line;
+  EXPECT_TRUE(posting_iter_next(&it, &line));
+  EXPECT_INT_EQ(5, line);
+  EXPECT_TRUE(posting_iter_next(&it, &line));
+  EXPECT_INT_EQ(1000005, line);
+  free(p);
+  return 0;
+}
+
+int test_posting_list() {
+  // postings are kept sorted by file, whatever order they are added in.
+  int files[] = {4, 1, 9, 2, 3, 8, 0};
+  posting_list_t pl;
+  posting_list_init(&pl);
+  line_list_t l;
+  line_list_init(&l);
+  line_list_append(&l, 1);
+  size_t size = 0;
+  for (int i = 0; i < 7; i++) {
+    posting_t *p = posting_encode(files[i], &l);
+    size += posting_size(p);
+    posting_list_add(&pl, p);
+  }
+  EXPECT_INT_EQ(7, pl.n);
+  for (int i = 1; i < pl.n; i++) {
+    EXPECT_INT_LT(pl.v[i - 1]->file, pl.v[i]->file);
+  }
+  EXPECT_ULONG_EQ(size + pl.cap * sizeof(posting_t *), posting_list_size(&pl));
+  posting_list_free(&pl);
+  EXPECT_INT_EQ(0, pl.n);
+  return 0;
+}
+
+int test_posting_list_merge() {
+  // interleaved files, with either list running out first, and empty lists.
+  int a[] = {0, 3, 4, 7, 20};
+  int b[] = {1, 2, 5, 6, 8, 9, 10};
+  posting_list_t pa, pb;
+  posting_list_init(&pa);
+  posting_list_init(&pb);
+  line_list_t l;
+  line_list_init(&l);
+  line_list_append(&l, 1);
+  posting_list_merge(&pa, &pb);
+  EXPECT_INT_EQ(0, pa.n);
+  for (int i = 0; i < 5; i++) {
+    posting_list_add(&pa, posting_encode(a[i], &l));
+  }
+  for (int i = 0; i < 7; i++) {
+    posting_list_add(&pb, posting_encode(b[i], &l));
+  }
+  posting_list_merge(&pa, &pb);
+  EXPECT_INT_EQ(12, pa.n);
+  EXPECT_INT_EQ(0, pb.n);
+  EXPECT_NULL(pb.v);
+  for (int i = 1; i < pa.n; i++) {
+    EXPECT_INT_LT(pa.v[i - 1]->file, pa.v[i]->file);
+  }
+  posting_list_add(&pb, posting_encode(30, &l));
+  posting_list_merge(&pb, &pa);
+  EXPECT_INT_EQ(13, pb.n);
+  EXPECT_INT_EQ(0, pb.v[0]->file);
+  EXPECT_INT_EQ(30, pb.v[12]->file);
+  posting_list_free(&pb);
+  line_list_free(&l);
+  return 0;
+}
+
+int main() {
+  ADD_TEST(test_varint);
+  ADD_TEST(test_encode_decode);
+  ADD_TEST(test_large_delta);
+  ADD_TEST(test_posting_list);
+  ADD_TEST(test_posting_list_merge);
+  run_tests(/*fail_fast=*/0);
+  return 0;
+}
@@ -0,0 +1,235 @@
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../apps/query.h"
+#include "test_utils.h"
+
+#define N_FILES 2000
+#define N_WORDS 6
+
+// the test corpus: the files each word appears in, and the lines it appears on
+// in each of them, ending with -1. sparse and even are built by make_corpus.
+struct word {
+  const char *word;
+  int files[8];
+  int lines[8][4];
+} corpus[N_WORDS] = {
+    {"dead", {3, 5, -1}, {{7, -1}, {3, -1}}},
+    {"even", {-1}},
+    {"lock", {1, 3, 5, -1}, {{5, -1}, {7, -1}, {3, -1}}},
+    {"pool", {0, 3, 4, -1}, {{2, 9, -1}, {4, -1}, {1, -1}}},
+    {"sparse", {-1}},
+    {"thread",
+     {0, 1, 3, 5, -1},
+     {{1, 2, -1}, {5, -1}, {1, 1, 7, -1}, {2, -1}}},
+};
+
+const char *words[N_WORDS];
+posting_list_t postings[N_WORDS];
+char names[N_FILES][16];
+
+// Adds the posting of a file with the given lines, ending with -1.
+void add_posting(posting_list_t *pl, int file, const int *lines) {
+  line_list_t l;
+  line_list_init(&l);
+  for (; *lines >= 0; lines++) {
+    line_list_append(&l, *lines);
+  }
+  posting_list_add(pl, posting_encode(file, &l));
+  line_list_free(&l);
+}
+
+// Builds the posting lists of the corpus. even is on line 1 of every even
+// file, and sparse on line 1 of a few, so intersecting them gallops.
+void make_corpus() {
+  int line[] = {1, -1};
+  for (int i = 0; i < N_WORDS; i++) {
+    words[i] = corpus[i].word;
+    posting_list_init(&postings[i]);
+    for (int f = 0; f < 8 && corpus[i].files[f] >= 0; f++) {
+      add_posting(&postings[i], corpus[i].files[f], corpus[i].lines[f]);
+    }
+  }
+  for (int f = 0; f < N_FILES; f += 2) {
+    add_posting(&postings[1], f, line);
+  }
+  int sparse[] = {0, 500, 1000, 1999};
+  for (int f = 0; f < 4; f++) {
+    add_posting(&postings[4], sparse[f], line);
+  }
+  for (int f = 0; f < N_FILES; f++) {
+    snprintf(names[f], 16, "f%d", f);
+  }
+}
+
+// Looks up a word of the corpus.
+int corpus_lookup(void *arg, const char *word, query_list_t *list) {
+  for (int i = 0; i < N_WORDS; i++) {
+    if (strcmp(word, words[i])) {
+      continue;
+    }
+    query_list_init(list, postings[i].n);
+    for (int p = 0; p < postings[i].n; p++) {
+      list->files[p] = postings[i].v[p]->file;
+      list->counts[p] = postings[i].v[p]->n;
+      list->lines[p] = postings[i].v[p]->data;
+    }
+    return 1;
+  }
+  return 0;
+}
+
+// Returns the name of a file of the corpus.
+const char *corpus_file(void *arg, int alias) { return names[alias]; }
+
+query_source_t corpus_source = {corpus_lookup, corpus_file, N_FILES, NULL};
+
+// Runs a query, checking that it matches n files and that the best of them are
+// the files and scores given, ending with -1.
+int expect_query(const query_source_t *src, const char *text, int n,
+                 const int *files, const long *scores) {
+  query_t *q = query_parse(text);
+  EXPECT_NOTNULL(q);
+  query_hit_t top[8];
+  int k = 0;
+  while (files[k] >= 0) {
+    k++;
+  }
+  EXPECT_INT_EQ(n, query_run(q, src, top, k));
+  for (int i = 0; i < k; i++) {
+    EXPECT_INT_EQ(files[i], top[i].file);
+    EXPECT_LONG_EQ(scores[i], top[i].score);
+  }
+  query_free(q);
+  return 0;
+}
+
+#define EXPECT_QUERY(src, text, n, files, ...)                                 \
+  EXPECT_INT_EQ(0, expect_query(src, text, n, (int[])files,                    \
+                                (long[]){__VA_ARGS__}))
+
+#define FILES(...) {__VA_ARGS__, -1}
+
+int test_parse() {
+  const char *invalid[] = {"", "  ", "\"thread pool", "OR", "AND NOT", "!!"};
+  for (int i = 0; i < 6; i++) {
+    EXPECT_NULL(query_parse(invalid[i]));
+  }
+  const char *valid[] = {"thread", "thread OR", "-thread", "\"thread\"",
+                         "Thread!", "a\"b c\"d"};
+  for (int i = 0; i < 6; i++) {
+    query_t *q = query_parse(valid[i]);
+    EXPECT_NOTNULL(q);
+    query_free(q);
+  }
+  return 0;
+}
+
+int test_and() {
+  // ties go to the lower alias; words are normalized as they are indexed.
+  EXPECT_QUERY(&corpus_source, "thread pool", 2, FILES(0, 3), 4, 4);
+  EXPECT_QUERY(&corpus_source, "THREAD AND p-o-o-l", 2, FILES(0, 3), 4, 4);
+  EXPECT_QUERY(&corpus_source, "thread pool dead", 1, FILES(3), 5);
+  EXPECT_QUERY(&corpus_source, "thread missing", 0, FILES(-1), 0);
+  // the intersection of a short list with a long one.
+  EXPECT_QUERY(&corpus_source, "even sparse", 3, FILES(0, 500, 1000), 2, 2,
+               2);
+  EXPECT_QUERY(&corpus_source, "sparse even", 3, FILES(0, 500, 1000), 2, 2,
+               2);
+  return 0;
+}
+
+int test_or() {
+  EXPECT_QUERY(&corpus_source, "pool OR lock", 5, FILES(0, 3, 1, 4, 5), 2, 2,
+               1, 1, 1);
+  EXPECT_QUERY(&corpus_source, "pool OR missing", 3, FILES(0, 3, 4), 2, 1, 1);
+  // a file matching several clauses adds up their scores.
+  EXPECT_QUERY(&corpus_source, "thread pool OR dead", 3, FILES(3, 0, 5), 5, 4,
+               1);
+  return 0;
+}
+
+int test_not() {
+  EXPECT_QUERY(&corpus_source, "thread -lock", 1, FILES(0), 2);
+  EXPECT_QUERY(&corpus_source, "thread NOT lock", 1, FILES(0), 2);
+  EXPECT_QUERY(&corpus_source, "thread -missing", 4, FILES(3, 0), 3, 2);
+  // a clause of negated items matches every other file.
+  EXPECT_QUERY(&corpus_source, "-even -thread -pool", N_FILES / 2 - 3,
+               FILES(7, 9), 0, 0);
+  return 0;
+}
+
+int test_phrase() {
+  // thread and lock share a line in files 1 and 3, but not in file 5.
+  EXPECT_QUERY(&corpus_source, "\"thread lock\"", 2, FILES(1, 3), 1, 1);
+  EXPECT_QUERY(&corpus_source, "\"dead lock thread\"", 1, FILES(3), 1);
+  EXPECT_QUERY(&corpus_source, "\"thread pool\"", 1, FILES(0), 1);
+  EXPECT_QUERY(&corpus_source, "\"thread missing\"", 0, FILES(-1), 0);
+  EXPECT_QUERY(&corpus_source, "thread -\"dead lock\"", 2, FILES(0, 1), 2, 1);
+  EXPECT_QUERY(&corpus_source, "\"even sparse\"", 3, FILES(0, 500, 1000), 1,
+               1, 1);
+  return 0;
+}
+
+int test_top_k() {
+  // the best k files come out sorted, however many files match.
+  EXPECT_QUERY(&corpus_source, "thread", 4, FILES(3, 0, 1, 5), 3, 2, 1, 1);
+  EXPECT_QUERY(&corpus_source, "thread", 4, FILES(3), 3);
+  EXPECT_QUERY(&corpus_source, "thread", 4, FILES(-1), 0);
+  EXPECT_QUERY(&corpus_source, "even OR thread OR pool", N_FILES / 2 + 3,
+               FILES(0, 3, 4, 1, 2), 5, 4, 2, 1, 1);
+  return 0;
+}
+
+int test_shards() {
+  // the same queries find the same files in binary shards.
+  char dir[] = "/tmp/query_testXXXXXX";
+  EXPECT_NOTNULL(mkdtemp(dir));
+  char path[PATH_MAX];
+  snprintf(path, PATH_MAX, "%s/0-1_dead-thread.iib", dir);
+  const posting_list_t *lists[N_WORDS];
+  for (int i = 0; i < N_WORDS; i++) {
+    lists[i] = &postings[i];
+  }
+  EXPECT_INT_EQ(0, shard_write(path, words, lists, N_WORDS));
+  char aliases[PATH_MAX];
+  snprintf(aliases, PATH_MAX, "%s/ii-1.aliases", dir);
+  FILE *f = fopen(aliases, "w");
+  for (int i = 0; i < N_FILES; i++) {
+    fprintf(f, "%s;%d\n", names[i], i);
+  }
+  fclose(f);
+  shard_index_t *idx = shard_index_open(dir);
+  EXPECT_NOTNULL(idx);
+  query_source_t src;
+  query_source_shards(&src, idx);
+  EXPECT_INT_EQ(N_FILES, src.n_files);
+  EXPECT_INT_EQ(0, strcmp("f3", src.file(src.arg, 3)));
+  EXPECT_QUERY(&src, "thread pool", 2, FILES(0, 3), 4, 4);
+  EXPECT_QUERY(&src, "thread -\"dead lock\"", 2, FILES(0, 1), 2, 1);
+  EXPECT_QUERY(&src, "even sparse", 3, FILES(0, 500, 1000), 2, 2, 2);
+  shard_index_close(idx);
+  unlink(path);
+  unlink(aliases);
+  rmdir(dir);
+  return 0;
+}
+
+int main() {
+  make_corpus();
+  ADD_TEST(test_parse);
+  ADD_TEST(test_and);
+  ADD_TEST(test_or);
+  ADD_TEST(test_not);
+  ADD_TEST(test_phrase);
+  ADD_TEST(test_top_k);
+  ADD_TEST(test_shards);
+  run_tests(/*fail_fast=*/0);
+  for (int i = 0; i < N_WORDS; i++) {
+    posting_list_free(&postings[i]);
+  }
+  return 0;
+}
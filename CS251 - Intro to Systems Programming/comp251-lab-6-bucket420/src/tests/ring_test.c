@@ -0,0 +1,147 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../ring.h"
+#include "../thread_pool.h"
+#include "test_utils.h"
+
+threadpool_work_t make(long n) {
+  threadpool_work_t work;
+  memset(&work, 0, sizeof(threadpool_work_t));
+  work.work = (void *)n;
+  return work;
+}
+
+long is(threadpool_work_t work) { return (long)work.work; }
+
+int test_capacity() {
+  struct ring *r = ring_create(5);
+  EXPECT_LONG_EQ(8l, ring_capacity(r));
+  ring_free(r);
+  r = ring_create(8);
+  EXPECT_LONG_EQ(8l, ring_capacity(r));
+  ring_free(r);
+  return 0;
+}
+
+int test_push_pop() {
+  struct ring *r = ring_create(4);
+  threadpool_work_t work;
+  long t;
+  EXPECT_INT_EQ(0, ring_pop(r, &work, &t));
+  for (long i = 1; i <= 4; i++) {
+    EXPECT_INT_EQ(1, ring_push(r, make(i), i));
+  }
+  EXPECT_LONG_EQ(4l, ring_size(r));
+  // full.
+  EXPECT_INT_EQ(0, ring_push(r, make(5), 5));
+  for (long i = 1; i <= 4; i++) {
+    EXPECT_INT_EQ(1, ring_pop(r, &work, &t));
+    EXPECT_LONG_EQ(i, is(work));
+    // the time work was queued comes out with it.
+    EXPECT_LONG_EQ(i, t);
+  }
+  EXPECT_INT_EQ(0, ring_pop(r, &work, &t));
+  EXPECT_LONG_EQ(0l, ring_size(r));
+  ring_free(r);
+  return 0;
+}
+
+int test_wrap() {
+  // go around the ring many times, keeping it partly full.
+  struct ring *r = ring_create(8);
+  threadpool_work_t work;
+  long t;
+  long next = 1;
+  long oldest = 1;
+  for (int round = 0; round < 100; round++) {
+    while (ring_push(r, make(next), next)) {
+      next++;
+    }
+    EXPECT_LONG_EQ(8l, ring_size(r));
+    for (int i = 0; i < 5; i++) {
+      EXPECT_INT_EQ(1, ring_pop(r, &work, &t));
+      EXPECT_LONG_EQ(t, is(work));
+      EXPECT_LONG_EQ(oldest++, is(work));
+    }
+  }
+  while (ring_pop(r, &work, &t)) {
+    EXPECT_LONG_EQ(oldest++, is(work));
+  }
+  EXPECT_LONG_EQ(next, oldest);
+  ring_free(r);
+  return 0;
+}
+
+#define RACE_PER_PRODUCER 100000
+#define RACE_PRODUCERS 3
+#define RACE_CONSUMERS 3
+#define RACE_ELEMS (RACE_PER_PRODUCER * RACE_PRODUCERS)
+
+struct race {
+  struct ring *r;
+  atomic_int next;                  // next producer id
+  atomic_long taken;                // elements taken so far
+  atomic_char seen[RACE_ELEMS + 1]; // times each element was taken
+};
+
+void *producer(void *arg) {
+  struct race *race = arg;
+  long base = race->next++ * RACE_PER_PRODUCER;
+  for (long i = 1; i <= RACE_PER_PRODUCER; i++) {
+    while (!ring_push(race->r, make(base + i), base + i)) {
+    }
+  }
+  return NULL;
+}
+
+void *consumer(void *arg) {
+  struct race *race = arg;
+  threadpool_work_t work;
+  long t;
+  while (race->taken < RACE_ELEMS) {
+    if (ring_pop(race->r, &work, &t)) {
+      // a torn cell would pair work with another push's time.
+      race->seen[is(work)] += t == is(work) ? 1 : 2;
+      race->taken++;
+    }
+  }
+  return NULL;
+}
+
+int test_concurrent() {
+  // producers and consumers share a small ring; every element must be taken
+  // exactly once.
+  struct race *race = calloc(1, sizeof(struct race));
+  race->r = ring_create(64);
+  pthread_t threads[RACE_PRODUCERS + RACE_CONSUMERS];
+  for (int i = 0; i < RACE_PRODUCERS; i++) {
+    pthread_create(&threads[i], NULL, producer, race);
+  }
+  for (int i = 0; i < RACE_CONSUMERS; i++) {
+    pthread_create(&threads[RACE_PRODUCERS + i], NULL, consumer, race);
+  }
+  for (int i = 0; i < RACE_PRODUCERS + RACE_CONSUMERS; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  int bad = 0;
+  for (long i = 1; i <= RACE_ELEMS; i++) {
+    bad += race->seen[i] != 1;
+  }
+  EXPECT_INT_EQ(0, bad);
+  EXPECT_LONG_EQ(0l, ring_size(race->r));
+  ring_free(race->r);
+  free(race);
+  return 0;
+}
+
+int main() {
+  ADD_TEST(test_capacity);
+  ADD_TEST(test_push_pop);
+  ADD_TEST(test_wrap);
+  ADD_TEST(test_concurrent);
+  run_tests(/*fail_fast=*/0);
+  return 0;
+}
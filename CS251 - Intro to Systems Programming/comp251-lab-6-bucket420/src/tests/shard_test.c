@@ -0,0 +1,261 @@
+#include <errno.h>
+#include <linux/limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../apps/shard.h"
+#include "test_utils.h"
+
+// terms of the test shards, in two key ranges; term i appears in files i, 2i
+// and 3i + 1 (once, when they are the same), on lines i, 2i, ..., 5i.
+const char *low_terms[] = {"apple", "banana", "cherry"};
+const char *high_terms[] = {"pear", "plum", "quince", "zucchini"};
+
+char dir[] = "/tmp/shard_testXXXXXX";
+
+// Returns the path of name in the test directory.
+char *test_path(char *buff, const char *name) {
+  snprintf(buff, PATH_MAX, "%s/%s", dir, name);
+  return buff;
+}
+
+// Fills in the posting list of term i.
+void make_postings(posting_list_t *pl, int i) {
+  int files[] = {i, 2 * i, 3 * i + 1};
+  posting_list_init(pl);
+  for (int f = 0; f < 3; f++) {
+    if (f == 1 && !i) {
+      continue;
+    }
+    line_list_t l;
+    line_list_init(&l);
+    for (int line = i; line <= 5 * i; line += i ? i : 1) {
+      line_list_append(&l, line);
+    }
+    posting_list_add(pl, posting_encode(files[f], &l));
+    line_list_free(&l);
+  }
+}
+
+// Writes n terms, numbered from first, as a shard at path.
+int write_shard(const char *path, const char **terms, int first, int n) {
+  posting_list_t *lists = malloc(n * sizeof(posting_list_t));
+  const posting_list_t **postings = malloc(n * sizeof(posting_list_t *));
+  for (int i = 0; i < n; i++) {
+    make_postings(&lists[i], first + i);
+    postings[i] = &lists[i];
+  }
+  int ret = shard_write(path, terms, postings, n);
+  for (int i = 0; i < n; i++) {
+    posting_list_free(&lists[i]);
+  }
+  free(lists);
+  free(postings);
+  return ret;
+}
+
+// Checks that sp decodes the postings of term i.
+int expect_postings(shard_postings_t *sp, int i) {
+  posting_list_t pl;
+  make_postings(&pl, i);
+  EXPECT_INT_EQ(pl.n, sp->left);
+  int file;
+  posting_iter_t lines;
+  for (int f = 0; f < pl.n; f++) {
+    EXPECT_TRUE(shard_postings_next(sp, &file, &lines));
+    EXPECT_INT_EQ(pl.v[f]->file, file);
+    posting_iter_t want;
+    posting_iter_init(&want, pl.v[f]);
+    int line, want_line;
+    while (posting_iter_next(&want, &want_line)) {
+      EXPECT_TRUE(posting_iter_next(&lines, &line));
+      EXPECT_INT_EQ(want_line, line);
+    }
+    EXPECT_FALSE(posting_iter_next(&lines, &line));
+  }
+  EXPECT_FALSE(shard_postings_next(sp, &file, &lines));
+  posting_list_free(&pl);
+  return 0;
+}
+
+int test_shard() {
+  char path[PATH_MAX];
+  EXPECT_INT_EQ(0, write_shard(test_path(path, "s.iib"), high_terms, 0, 4));
+  shard_t *s = shard_open(path);
+  EXPECT_NOTNULL(s);
+  EXPECT_INT_EQ(4, shard_n_terms(s));
+  for (int i = 0; i < 4; i++) {
+    EXPECT_INT_EQ(0, strcmp(high_terms[i], shard_term(s, i)));
+    EXPECT_INT_EQ(i, shard_find(s, high_terms[i]));
+    shard_postings_t sp;
+    shard_postings(s, i, &sp);
+    EXPECT_INT_EQ(0, expect_postings(&sp, i));
+  }
+  // before, between and after the terms.
+  EXPECT_INT_EQ(-1, shard_find(s, "a"));
+  EXPECT_INT_EQ(-1, shard_find(s, "pea"));
+  EXPECT_INT_EQ(-1, shard_find(s, "pears"));
+  EXPECT_INT_EQ(-1, shard_find(s, "zz"));
+  shard_close(s);
+  unlink(path);
+  return 0;
+}
+
+int test_empty_shard() {
+  char path[PATH_MAX];
+  EXPECT_INT_EQ(0, write_shard(test_path(path, "e.iib"), NULL, 0, 0));
+  shard_t *s = shard_open(path);
+  EXPECT_NOTNULL(s);
+  EXPECT_INT_EQ(0, shard_n_terms(s));
+  EXPECT_INT_EQ(-1, shard_find(s, "a"));
+  shard_close(s);
+  unlink(path);
+  return 0;
+}
+
+int test_invalid_shard() {
+  char path[PATH_MAX];
+  test_path(path, "bad.iib");
+  errno = 0;
+  EXPECT_NULL(shard_open(path));
+  EXPECT_INT_EQ(ENOENT, errno);
+  // a shard with another magic, then one cut short.
+  EXPECT_INT_EQ(0, write_shard(path, low_terms, 0, 3));
+  FILE *f = fopen(path, "r+");
+  fputc('X', f);
+  fclose(f);
+  EXPECT_NULL(shard_open(path));
+  EXPECT_INT_EQ(EINVAL, errno);
+  EXPECT_INT_EQ(0, write_shard(path, low_terms, 0, 3));
+  shard_t *s = shard_open(path);
+  EXPECT_NOTNULL(s);
+  shard_close(s);
+  EXPECT_INT_EQ(0, truncate(path, sizeof(struct shard_header) + 8));
+  EXPECT_NULL(shard_open(path));
+  EXPECT_INT_EQ(EINVAL, errno);
+  unlink(path);
+  return 0;
+}
+
+// Overwrites size bytes at offset of the file at path with data.
+void patch(const char *path, long offset, const void *data, size_t size) {
+  FILE *f = fopen(path, "r+");
+  fseek(f, offset, SEEK_SET);
+  fwrite(data, 1, size, f);
+  fclose(f);
+}
+
+int test_corrupt_entry() {
+  char path[PATH_MAX];
+  test_path(path, "corrupt.iib");
+  long entry = sizeof(struct shard_header);
+  struct shard_entry e;
+  // a term outside the strings, then blocks that run backwards and past the
+  // postings, then more files than the block can hold.
+  EXPECT_INT_EQ(0, write_shard(path, low_terms, 0, 3));
+  uint32_t term = 0x7fffffff;
+  patch(path, entry + offsetof(struct shard_entry, term), &term, 4);
+  EXPECT_NULL(shard_open(path));
+  EXPECT_INT_EQ(EINVAL, errno);
+  uint64_t offsets[] = {1000, 1ul << 40};
+  for (int i = 0; i < 2; i++) {
+    EXPECT_INT_EQ(0, write_shard(path, low_terms, 0, 3));
+    patch(path, entry + sizeof(e) + offsetof(struct shard_entry, postings),
+          &offsets[i], 8);
+    EXPECT_NULL(shard_open(path));
+    EXPECT_INT_EQ(EINVAL, errno);
+  }
+  EXPECT_INT_EQ(0, write_shard(path, low_terms, 0, 3));
+  uint32_t n_files = 1000;
+  patch(path, entry + offsetof(struct shard_entry, n_files), &n_files, 4);
+  EXPECT_NULL(shard_open(path));
+  EXPECT_INT_EQ(EINVAL, errno);
+
+  // blocks whose varints run on, hold more lines than bytes, or claim more
+  // bytes than the block has stop decoding instead of reading past it.
+  const uint8_t blocks[][5] = {
+      {0xff, 0xff, 0xff, 0xff, 0xff}, {0, 5, 1, 0, 0}, {0, 1, 0x7f, 0, 0}};
+  for (int i = 0; i < 3; i++) {
+    EXPECT_INT_EQ(0, write_shard(path, low_terms, 0, 3));
+    struct shard_header h;
+    FILE *f = fopen(path, "r");
+    EXPECT_ULONG_EQ(1ul, fread(&h, sizeof(h), 1, f));
+    fclose(f);
+    // term 0 has two postings; corrupt the first.
+    patch(path, h.postings, blocks[i], 5);
+    shard_t *s = shard_open(path);
+    EXPECT_NOTNULL(s);
+    shard_postings_t sp;
+    shard_postings(s, 0, &sp);
+    EXPECT_INT_EQ(2, sp.left);
+    int file;
+    posting_iter_t lines;
+    EXPECT_FALSE(shard_postings_next(&sp, &file, &lines));
+    EXPECT_FALSE(shard_postings_next(&sp, &file, &lines));
+    // the other terms are untouched.
+    shard_postings(s, 1, &sp);
+    EXPECT_INT_EQ(0, expect_postings(&sp, 1));
+    shard_close(s);
+  }
+  unlink(path);
+  return 0;
+}
+
+int test_index() {
+  char path[PATH_MAX];
+  // no shards yet.
+  EXPECT_NULL(shard_index_open(dir));
+  EXPECT_INT_EQ(ENOENT, errno);
+  // shards are found by key range, whatever order they are listed in.
+  EXPECT_INT_EQ(0, write_shard(test_path(path, "1-2_pear-zucchini.iib"),
+                               high_terms, 3, 4));
+  EXPECT_INT_EQ(0, write_shard(test_path(path, "0-2_apple-cherry.iib"),
+                               low_terms, 0, 3));
+  FILE *f = fopen(test_path(path, "ii-2.aliases"), "w");
+  fprintf(f, "in/a.txt;0\nin/b;c.txt;2\n");
+  fclose(f);
+  shard_index_t *idx = shard_index_open(dir);
+  EXPECT_NOTNULL(idx);
+  shard_postings_t sp;
+  for (int i = 0; i < 3; i++) {
+    EXPECT_TRUE(shard_index_lookup(idx, low_terms[i], &sp));
+    EXPECT_INT_EQ(0, expect_postings(&sp, i));
+  }
+  for (int i = 0; i < 4; i++) {
+    EXPECT_TRUE(shard_index_lookup(idx, high_terms[i], &sp));
+    EXPECT_INT_EQ(0, expect_postings(&sp, 3 + i));
+  }
+  // before, inside, between and after the key ranges.
+  EXPECT_FALSE(shard_index_lookup(idx, "a", &sp));
+  EXPECT_FALSE(shard_index_lookup(idx, "avocado", &sp));
+  EXPECT_FALSE(shard_index_lookup(idx, "lemon", &sp));
+  EXPECT_FALSE(shard_index_lookup(idx, "zz", &sp));
+  EXPECT_INT_EQ(0, strcmp("in/a.txt", shard_index_file(idx, 0)));
+  EXPECT_NULL(shard_index_file(idx, 1));
+  EXPECT_INT_EQ(0, strcmp("in/b;c.txt", shard_index_file(idx, 2)));
+  EXPECT_NULL(shard_index_file(idx, 3));
+  EXPECT_NULL(shard_index_file(idx, -1));
+  shard_index_close(idx);
+  unlink(test_path(path, "1-2_pear-zucchini.iib"));
+  unlink(test_path(path, "0-2_apple-cherry.iib"));
+  unlink(test_path(path, "ii-2.aliases"));
+  return 0;
+}
+
+int main() {
+  if (!mkdtemp(dir)) {
+    perror("mkdtemp");
+    return 1;
+  }
+  ADD_TEST(test_shard);
+  ADD_TEST(test_empty_shard);
+  ADD_TEST(test_invalid_shard);
+  ADD_TEST(test_corrupt_entry);
+  ADD_TEST(test_index);
+  run_tests(/*fail_fast=*/0);
+  rmdir(dir);
+  return 0;
+}
@@ -0,0 +1,66 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdlib.h>
+
+#include "../topology.h"
+#include "test_utils.h"
+
+int test_parse() {
+  int cpus[8];
+  EXPECT_INT_EQ(1, topology_parse_cpus("3", cpus, 8));
+  EXPECT_INT_EQ(3, cpus[0]);
+  EXPECT_INT_EQ(7, topology_parse_cpus("0-3,8,10-11\n", cpus, 8));
+  int expected[] = {0, 1, 2, 3, 8, 10, 11};
+  for (int i = 0; i < 7; i++) {
+    EXPECT_INT_EQ(expected[i], cpus[i]);
+  }
+  // an empty list, as for a node without CPUs.
+  EXPECT_INT_EQ(0, topology_parse_cpus("\n", cpus, 8));
+  return 0;
+}
+
+int test_parse_overflow() {
+  // the count includes CPUs past max, which are not stored.
+  int cpus[2] = {-1, -1};
+  EXPECT_INT_EQ(4, topology_parse_cpus("4-7", cpus, 1));
+  EXPECT_INT_EQ(4, cpus[0]);
+  EXPECT_INT_EQ(-1, cpus[1]);
+  return 0;
+}
+
+int test_parse_malformed() {
+  int cpus[8];
+  EXPECT_INT_EQ(-1, topology_parse_cpus("a", cpus, 8));
+  EXPECT_INT_EQ(-1, topology_parse_cpus("1,", cpus, 8));
+  EXPECT_INT_EQ(-1, topology_parse_cpus("3-1", cpus, 8));
+  EXPECT_INT_EQ(-1, topology_parse_cpus("1-", cpus, 8));
+  EXPECT_INT_EQ(-1, topology_parse_cpus("1 2", cpus, 8));
+  EXPECT_INT_EQ(-1, topology_parse_cpus("0-100000", cpus, 8));
+  return 0;
+}
+
+int test_cpus() {
+  // every CPU the process may run on is listed once, in order.
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  EXPECT_INT_EQ(0, sched_getaffinity(0, sizeof(cpu_set_t), &allowed));
+  int n;
+  struct cpu_info *cpus = topology_cpus(&n);
+  EXPECT_INT_EQ(CPU_COUNT(&allowed), n);
+  for (int i = 0; i < n; i++) {
+    EXPECT_TRUE(CPU_ISSET(cpus[i].cpu, &allowed));
+    EXPECT_TRUE(i == 0 || cpus[i - 1].cpu < cpus[i].cpu);
+    EXPECT_TRUE(cpus[i].node >= 0);
+  }
+  free(cpus);
+  return 0;
+}
+
+int main() {
+  ADD_TEST(test_parse);
+  ADD_TEST(test_parse_overflow);
+  ADD_TEST(test_parse_malformed);
+  ADD_TEST(test_cpus);
+  run_tests(/*fail_fast=*/0);
+  return 0;
+}
@@ -0,0 +1,276 @@
+// Thread pool benchmark.
+//
+// Runs the many-threads scenarios from tp_test with trivial work items, so that
+// the time measured is the pool's own overhead. Each scenario is run with both
+// scheduling modes, with and without a ring, adding work one item at a time and
+// as a single batch.
+//
+// It then measures the round trip of threadpool_start and threadpool_stop, with
+// and without persistent workers, for an idle pool and for a pool running a
+// short job of CYCLE_WORK items per cycle.
+//
+// Finally, for each idle policy (see thread_pool.h), it adds work items one at
+// a time to a small running pool, waiting for each to start and then pausing
+// before the next, and reports the distribution of the time from add to start
+// and the context switches of the whole process per item.
+//
+// usage: tests/tp_bench [-t <threads>] [-n <work items>] [-q <ring capacity>]
+//                       [-c <start/stop cycles>] [-w <latency workers>]
+//                       [-l <latency samples>] [-g <gap us>]
+
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../thread_pool.h"
+
+// Work items added in each cycle of the start/stop benchmark's job column.
+#define CYCLE_WORK 10
+
+atomic_long done;
+
+void *noop(void *unused) {
+  done++;
+  return NULL;
+}
+
+double now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+void wait_done(long n) {
+  struct timespec r = {0, 50000};
+  while (done < n) {
+    nanosleep(&r, NULL);
+  }
+}
+
+void add_all(threadpool_t tp, threadpool_work_t *work, int n, int batch) {
+  if (batch) {
+    threadpool_add_batch(tp, work, n);
+  } else {
+    for (int i = 0; i < n; i++) {
+      threadpool_add(tp, work[i]);
+    }
+  }
+}
+
+// Runs one scenario and prints a row. If queue_first is set, all work is added
+// before the pool starts (as in test_many_threads); otherwise it is added to a
+// running pool with idle workers.
+void run(int nthreads, int n, enum threadpool_mode mode, int capacity,
+         int batch, int queue_first) {
+  threadpool_config_t cfg = {nthreads, mode, capacity, THREADPOOL_FULL_SPILL};
+  threadpool_t tp = threadpool_create(cfg);
+  threadpool_work_t *work = malloc(n * sizeof(threadpool_work_t));
+  for (int i = 0; i < n; i++) {
+    work[i] = (threadpool_work_t){noop, NULL, NULL};
+  }
+  done = 0;
+  if (!queue_first) {
+    threadpool_start(tp);
+  }
+  double start = now_ms();
+  add_all(tp, work, n, batch);
+  double added = now_ms();
+  if (queue_first) {
+    threadpool_start(tp);
+  }
+  wait_done(n);
+  double end = now_ms();
+  threadpool_stop(tp, THREADPOOL_STOP_DRAIN);
+  threadpool_destroy(tp);
+  free(work);
+  printf("%-8s %-9s %-5s %-6s %10.2f %10.2f %12.0f\n",
+         queue_first ? "queued" : "running",
+         mode == THREADPOOL_MODE_STEALING ? "stealing" : "shared",
+         capacity ? "ring" : "list", batch ? "batch" : "single", added - start,
+         end - start, n / (end - start) * 1e3);
+}
+
+// Returns the mean time in microseconds of a start/stop cycle, each running
+// work items (possibly none) queued before the start.
+double cycle_us(threadpool_t tp, int cycles, int work) {
+  threadpool_work_t w = {noop, NULL, NULL};
+  double start = now_ms();
+  for (int c = 0; c < cycles; c++) {
+    for (int i = 0; i < work; i++) {
+      threadpool_add(tp, w);
+    }
+    threadpool_start(tp);
+    threadpool_stop(tp, THREADPOOL_STOP_DRAIN);
+  }
+  return (now_ms() - start) * 1e3 / cycles;
+}
+
+// Runs the start/stop benchmark for one kind of pool and prints a row.
+void run_cycles(int nthreads, int cycles, enum threadpool_mode mode,
+                int persistent) {
+  threadpool_config_t cfg = {nthreads, mode, 0, THREADPOOL_FULL_SPILL,
+                             persistent};
+  threadpool_t tp = threadpool_create(cfg);
+  double idle = cycle_us(tp, cycles, 0);
+  double job = cycle_us(tp, cycles, CYCLE_WORK);
+  threadpool_destroy(tp);
+  printf("%-9s %-10s %14.1f %14.1f\n",
+         mode == THREADPOOL_MODE_STEALING ? "stealing" : "shared",
+         persistent ? "persistent" : "per-start", idle, job);
+}
+
+// Idle policies compared by the latency benchmark.
+struct idle_policy {
+  const char *name;
+  unsigned int spins;
+  unsigned int yields;
+} policies[] = {
+    {"sleep", 0, 0},
+    {"yield", 0, 100},
+    {"spin", 20000, 100},
+};
+
+// Add and start times of a latency sample, in ms.
+struct stamp {
+  double added;
+  double started;
+};
+
+atomic_int started;
+
+void *record_start(void *arg) {
+  struct stamp *s = arg;
+  s->started = now_ms();
+  started++;
+  return NULL;
+}
+
+int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// Returns the context switches of the process so far, voluntary or not.
+long context_switches() {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_nvcsw + ru.ru_nivcsw;
+}
+
+// Runs the latency benchmark for one mode and idle policy and prints a row.
+void run_latency(int nthreads, int samples, long gap_us,
+                 enum threadpool_mode mode, struct idle_policy *policy) {
+  threadpool_config_t cfg = {nthreads, mode};
+  cfg.idle_spins = policy->spins;
+  cfg.idle_yields = policy->yields;
+  threadpool_t tp = threadpool_create(cfg);
+  struct stamp *stamps = malloc(samples * sizeof(struct stamp));
+  double *us = malloc(samples * sizeof(double));
+  struct timespec gap = {0, gap_us * 1000};
+  threadpool_start(tp);
+  nanosleep(&gap, NULL);
+  started = 0;
+  long csw = context_switches();
+  for (int i = 0; i < samples; i++) {
+    stamps[i].added = now_ms();
+    threadpool_add(tp, (threadpool_work_t){record_start, &stamps[i], NULL});
+    while (started <= i) {
+      sched_yield();
+    }
+    nanosleep(&gap, NULL);
+  }
+  csw = context_switches() - csw;
+  threadpool_stop(tp, THREADPOOL_STOP_DRAIN);
+  threadpool_destroy(tp);
+  for (int i = 0; i < samples; i++) {
+    us[i] = (stamps[i].started - stamps[i].added) * 1e3;
+  }
+  qsort(us, samples, sizeof(double), cmp_double);
+  printf("%-9s %-6s %9.1f %9.1f %9.1f %9.1f %10.2f\n",
+         mode == THREADPOOL_MODE_STEALING ? "stealing" : "shared",
+         policy->name, us[samples / 2], us[samples * 9 / 10],
+         us[samples * 99 / 100], us[samples - 1], (double)csw / samples);
+  free(stamps);
+  free(us);
+}
+
+int main(int argc, char **argv) {
+  int nthreads = 1000;
+  int n = 100000;
+  int capacity = 1024;
+  int cycles = 100;
+  int latency_threads = 4;
+  int samples = 2000;
+  long gap_us = 100;
+  int opt;
+  while ((opt = getopt(argc, argv, "t:n:q:c:w:l:g:")) != -1) {
+    switch (opt) {
+    case 't':
+      nthreads = atoi(optarg);
+      break;
+    case 'n':
+      n = atoi(optarg);
+      break;
+    case 'q':
+      capacity = atoi(optarg);
+      break;
+    case 'c':
+      cycles = atoi(optarg);
+      break;
+    case 'w':
+      latency_threads = atoi(optarg);
+      break;
+    case 'l':
+      samples = atoi(optarg);
+      break;
+    case 'g':
+      gap_us = atol(optarg);
+      break;
+    default:
+      fprintf(stderr,
+              "usage: %s [-t <threads>] [-n <work items>] "
+              "[-q <ring capacity>] [-c <start/stop cycles>] "
+              "[-w <latency workers>] [-l <latency samples>] [-g <gap us>]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+  printf("%d threads, %d work items, ring capacity %d\n", nthreads, n,
+         capacity);
+  printf("%-8s %-9s %-5s %-6s %10s %10s %12s\n", "start", "mode", "queue",
+         "add", "add ms", "total ms", "work/s");
+  for (int queue_first = 1; queue_first >= 0; queue_first--) {
+    for (int mode = THREADPOOL_MODE_SHARED; mode <= THREADPOOL_MODE_STEALING;
+         mode++) {
+      for (int ring = 0; ring <= 1; ring++) {
+        run(nthreads, n, mode, ring ? capacity : 0, 0, queue_first);
+        run(nthreads, n, mode, ring ? capacity : 0, 1, queue_first);
+      }
+    }
+  }
+  printf("\n%d threads, %d start/stop cycles\n", nthreads, cycles);
+  printf("%-9s %-10s %14s %14s\n", "mode", "workers", "idle us/cycle",
+         "job us/cycle");
+  for (int mode = THREADPOOL_MODE_SHARED; mode <= THREADPOOL_MODE_STEALING;
+       mode++) {
+    for (int persistent = 0; persistent <= 1; persistent++) {
+      run_cycles(nthreads, cycles, mode, persistent);
+    }
+  }
+  printf("\n%d threads, %d samples, %ld us between samples\n",
+         latency_threads, samples, gap_us);
+  printf("%-9s %-6s %9s %9s %9s %9s %10s\n", "mode", "idle", "p50 us",
+         "p90 us", "p99 us", "max us", "csw/item");
+  for (int mode = THREADPOOL_MODE_SHARED; mode <= THREADPOOL_MODE_STEALING;
+       mode++) {
+    for (int p = 0; p < sizeof(policies) / sizeof(policies[0]); p++) {
+      run_latency(latency_threads, samples, gap_us, mode, &policies[p]);
+    }
+  }
+  return 0;
+}
@@ -1,4 +1,7 @@
+#define _GNU_SOURCE
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 
 #include "../thread_pool.h"
@@ -343,6 +346,1132 @@ int test_pause_queue_destroy() {
   return 0;
 }
 
+int test_steal_run_many() {
+  threadpool_t tp = make_stealing_with(5);
+  reset_counter();
+  threadpool_work_t w = {inc, NULL, NULL};
+  threadpool_start(tp);
+  int iters = 1000;
+  for (int i = 0; i < iters; i++) {
+    threadpool_add(tp, w);
+  }
+  wait_for(iters);
+  threadpool_stop(tp, THREADPOOL_STOP_WAIT);
+  threadpool_counters_t counters = threadpool_counters(tp);
+  EXPECT_INT_EQ(iters, counters.completed_work);
+  EXPECT_INT_EQ(0, counters.queued_work);
+  threadpool_destroy(tp);
+  return 0;
+}
+
+threadpool_t spawn_tp;
+// increments the counter and adds two copies of itself, depth levels deep.
+void *spawn(void *depth) {
+  long d = (long)depth;
+  if (d > 0) {
+    threadpool_work_t w = {spawn, (void *)(d - 1), NULL};
+    threadpool_add(spawn_tp, w);
+    threadpool_add(spawn_tp, w);
+  }
+  return inc(NULL);
+}
+
+int test_steal_spawn() {
+  // work added by workers goes to their own deques and must be stolen for the
+  // other workers to help.
+  spawn_tp = make_stealing_with(8);
+  reset_counter();
+  threadpool_work_t w = {spawn, (void *)12l, NULL};
+  int total = (1 << 13) - 1;
+  threadpool_start(spawn_tp);
+  threadpool_add(spawn_tp, w);
+  wait_for(total);
+  threadpool_stop(spawn_tp, THREADPOOL_STOP_DRAIN);
+  threadpool_counters_t counters = threadpool_counters(spawn_tp);
+  EXPECT_INT_EQ(total, counters.completed_work);
+  EXPECT_INT_EQ(0, counters.queued_work);
+  threadpool_destroy(spawn_tp);
+  return 0;
+}
+
+int test_steal_validate_parallelism() {
+  reset_counter();
+  int nthreads = 50;
+  threadpool_work_t w = make_block_at_n(nthreads);
+  threadpool_t tp = make_stealing_with(nthreads);
+  for (int i = 0; i < nthreads; i++) {
+    threadpool_add(tp, w);
+  }
+  threadpool_start(tp);
+  // drain will only complete when all callbacks are called in parallel, which
+  // requires work batched into one worker's deque to be stolen by the others.
+  threadpool_stop(tp, THREADPOOL_STOP_DRAIN);
+  threadpool_destroy(tp);
+  wait_for(nthreads * 2);
+  destroy_block_at_n(w);
+  return 0;
+}
+
+int test_steal_pause_resume() {
+  // work spawned into the deques before a stop is kept and run after restart.
+  spawn_tp = make_stealing_with(4);
+  reset_counter();
+  threadpool_work_t w = {spawn, (void *)14l, NULL};
+  int total = (1 << 15) - 1;
+  threadpool_start(spawn_tp);
+  threadpool_add(spawn_tp, w);
+  threadpool_stop(spawn_tp, THREADPOOL_STOP_WAIT);
+  long mid = get_counter();
+  threadpool_counters_t counters = threadpool_counters(spawn_tp);
+  EXPECT_LONG_EQ(mid, (long)counters.completed_work);
+  // spawned work still queued, plus work spawned while stopping.
+  EXPECT_INT_GT((int)counters.queued_work, 0);
+  threadpool_start(spawn_tp);
+  threadpool_stop(spawn_tp, THREADPOOL_STOP_DRAIN);
+  // drain leaves work spawned while draining for the next start.
+  while (get_counter() < total) {
+    threadpool_start(spawn_tp);
+    threadpool_stop(spawn_tp, THREADPOOL_STOP_DRAIN);
+  }
+  EXPECT_LONG_EQ((long)total, get_counter());
+  counters = threadpool_counters(spawn_tp);
+  EXPECT_INT_EQ(total, counters.completed_work);
+  EXPECT_INT_EQ(0, counters.queued_work);
+  threadpool_destroy(spawn_tp);
+  return 0;
+}
+
+// adds a batch of n copies of spawn at depth - 1.
+void *spawn_batch(void *depth) {
+  long d = (long)depth;
+  if (d > 0) {
+    threadpool_work_t w[3];
+    for (int i = 0; i < 3; i++) {
+      w[i] = (threadpool_work_t){spawn_batch, (void *)(d - 1), NULL};
+    }
+    threadpool_add_batch(spawn_tp, w, 3);
+  }
+  return inc(NULL);
+}
+
+int test_steal_add_batch() {
+  // batches go to the injector from outside the pool and to the worker's deque
+  // from inside.
+  spawn_tp = make_stealing_with(6);
+  reset_counter();
+  threadpool_work_t w[4];
+  for (int i = 0; i < 4; i++) {
+    w[i] = (threadpool_work_t){spawn_batch, (void *)6l, NULL};
+  }
+  int total = 4 * (2187 - 1) / 2; // 4 trees of 1 + 3 + ... + 3^6 nodes
+  threadpool_start(spawn_tp);
+  threadpool_add_batch(spawn_tp, w, 4);
+  wait_for(total);
+  threadpool_stop(spawn_tp, THREADPOOL_STOP_DRAIN);
+  threadpool_counters_t counters = threadpool_counters(spawn_tp);
+  EXPECT_INT_EQ(total, counters.completed_work);
+  EXPECT_INT_EQ(0, counters.queued_work);
+  threadpool_destroy(spawn_tp);
+  return 0;
+}
+
+int test_steal_drain_queue_resume() {
+  int nthreads = 5;
+  int work = nthreads * 100;
+  threadpool_t tp = make_stealing_with(nthreads);
+
+  threadpool_work_t w = {inc, NULL, NULL};
+  struct add_work_arg arg = {w, tp, work};
+
+  // add work, drain and add more while draining.
+  reset_counter();
+  threadpool_start(tp);
+  for (int i = 0; i < work; i++) {
+    threadpool_add(tp, w);
+  }
+  pthread_t tid;
+  pthread_create(&tid, NULL, add_work, &arg); // add work in the background.
+  threadpool_stop(tp, THREADPOOL_STOP_DRAIN);
+  pthread_join(tid, NULL);
+  wait_for_gt(work); // we might have slipped new work in before the drain.
+  threadpool_start(tp);
+  threadpool_stop(tp, THREADPOOL_STOP_DRAIN);
+  wait_for(2 * work);
+
+  threadpool_destroy(tp);
+  return 0;
+}
+
+int test_add_batch() {
+  threadpool_t tp = make_with(5);
+  reset_counter();
+  int iters = 1000;
+  threadpool_work_t *w = malloc(iters * sizeof(threadpool_work_t));
+  for (int i = 0; i < iters; i++) {
+    w[i] = (threadpool_work_t){inc, NULL, NULL};
+  }
+  // a batch added while stopped is queued like single adds.
+  threadpool_add_batch(tp, w, iters / 2);
+  threadpool_counters_t counters = threadpool_counters(tp);
+  EXPECT_INT_EQ(0, counters.completed_work);
+  EXPECT_INT_EQ(iters / 2, counters.queued_work);
+  threadpool_start(tp);
+  threadpool_add_batch(tp, w + iters / 2, iters - iters / 2);
+  wait_for(iters);
+  threadpool_stop(tp, THREADPOOL_STOP_WAIT);
+  counters = threadpool_counters(tp);
+  EXPECT_INT_EQ(iters, counters.completed_work);
+  EXPECT_INT_EQ(0, counters.queued_work);
+  threadpool_destroy(tp);
+  free(w);
+  return 0;
+}
+
+int test_add_batch_parallelism() {
+  // every worker must be woken for a batch that needs all of them at once.
+  reset_counter();
+  int nthreads = 100;
+  threadpool_work_t w = make_block_at_n(nthreads);
+  threadpool_work_t *batch = malloc(nthreads * sizeof(threadpool_work_t));
+  for (int i = 0; i < nthreads; i++) {
+    batch[i] = w;
+  }
+  threadpool_t tp = make_with(nthreads);
+  threadpool_start(tp);
+  xsleep(); // let the workers go idle first.
+  threadpool_add_batch(tp, batch, nthreads);
+  threadpool_stop(tp, THREADPOOL_STOP_DRAIN);
+  threadpool_destroy(tp);
+  wait_for(nthreads * 2);
+  destroy_block_at_n(w);
+  free(batch);
+  return 0;
+}
+
+pthread_mutex_t gate_mu = PTHREAD_MUTEX_INITIALIZER;
+int gate_open; // guarded by gate_mu
+
+void set_gate(int open) {
+  pthread_mutex_lock(&gate_mu);
+  gate_open = open;
+  pthread_mutex_unlock(&gate_mu);
+}
+
+// increments the counter, then blocks until the gate is opened.
+void *gate(void *unused) {
+  inc(NULL);
+  int open = 0;
+  while (!open) {
+    pthread_mutex_lock(&gate_mu);
+    open = gate_open;
+    pthread_mutex_unlock(&gate_mu);
+    xsleep();
+  }
+  return NULL;
+}
+
+int test_ring_run_many() {
+  threadpool_t tp = make_ring_with(5, THREADPOOL_MODE_SHARED, 64,
+                                   THREADPOOL_FULL_SPILL);
+  reset_counter();
+  threadpool_work_t w = {inc, NULL, NULL};
+  threadpool_start(tp);
+  int iters = 10000;
+  for (int i = 0; i < iters; i++) {
+    EXPECT_INT_EQ(0, threadpool_add(tp, w));
+  }
+  wait_for(iters);
+  threadpool_stop(tp, THREADPOOL_STOP_WAIT);
+  threadpool_counters_t counters = threadpool_counters(tp);
+  EXPECT_INT_EQ(iters, counters.completed_work);
+  EXPECT_INT_EQ(0, counters.queued_work);
+  threadpool_destroy(tp);
+  return 0;
+}
+
+int test_ring_queue_work() {
+  // more work is queued while stopped than fits in the ring.
+  threadpool_t tp = make_ring_with(5, THREADPOOL_MODE_SHARED, 16,
+                                   THREADPOOL_FULL_FAIL);
+  reset_counter();
+  threadpool_work_t w = {inc, NULL, NULL};
+  int iters = 1000;
+  for (int i = 0; i < iters; i++) {
+    EXPECT_INT_EQ(0, threadpool_add(tp, w));
+  }
+  threadpool_start(tp);
+  threadpool_stop(tp, THREADPOOL_STOP_DRAIN);
+  EXPECT_LONG_EQ((long)iters, get_counter());
+  threadpool_destroy(tp);
+  return 0;
+}
+
+int test_ring_fail() {
+  threadpool_t tp = make_ring_with(1, THREADPOOL_MODE_SHARED, 4,
+                                   THREADPOOL_FULL_FAIL);
+  reset_counter();
+  set_gate(0);
+  threadpool_work_t g = {gate, NULL, NULL};
+  threadpool_work_t w[4];
+  for (int i = 0; i < 4; i++) {
+    w[i] = g;
+  }
+  threadpool_start(tp);
+  // occupy the only worker, then fill the ring.
+  threadpool_add(tp, g);
+  wait_for(1);
+  EXPECT_INT_EQ(3, threadpool_add_batch(tp, w, 3));
+  EXPECT_INT_EQ(1, threadpool_add_batch(tp, w, 4));
+  EXPECT_INT_EQ(-1, threadpool_add(tp, g));
+  EXPECT_INT_EQ(0, threadpool_add_batch(tp, w, 2));
+  threadpool_counters_t counters = threadpool_counters(tp);
+  EXPECT_INT_EQ(4, counters.queued_work);
+  set_gate(1);
+  threadpool_stop(tp, THREADPOOL_STOP_DRAIN);
+  counters = threadpool_counters(tp);
+  EXPECT_INT_EQ(5, counters.completed_work);
+  EXPECT_INT_EQ(0, counters.queued_work);
+  threadpool_destroy(tp);
+  return 0;
+}
+
+int test_ring_spill() {
+  threadpool_t tp = make_ring_with(1, THREADPOOL_MODE_SHARED, 4,
+                                   THREADPOOL_FULL_SPILL);
+  reset_counter();
+  set_gate(0);
+  threadpool_work_t g = {gate, NULL, NULL};
+  threadpool_start(tp);
+  threadpool_add(tp, g);
+  wait_for(1);
+  for (int i = 0; i < 100; i++) {
+    EXPECT_INT_EQ(0, threadpool_add(tp, g));
+  }
+  threadpool_counters_t counters = threadpool_counters(tp);
+  EXPECT_INT_EQ(100, counters.queued_work);
+  set_gate(1);
+  threadpool_stop(tp, THREADPOOL_STOP_DRAIN);
+  counters = threadpool_counters(tp);
+  EXPECT_INT_EQ(101, counters.completed_work);
+  threadpool_destroy(tp);
+  return 0;
+}
+
+int test_ring_block() {
+  threadpool_t tp = make_ring_with(1, THREADPOOL_MODE_SHARED, 4,
+                                   THREADPOOL_FULL_BLOCK);
+  reset_counter();
+  set_gate(0);
+  threadpool_work_t g = {gate, NULL, NULL};
+  struct add_work_arg arg = {g, tp, 20};
+  threadpool_start(tp);
+  threadpool_add(tp, g);
+  wait_for(1);
+  // the background adds fill the ring and then block.
+  pthread_t tid;
+  pthread_create(&tid, NULL, add_work, &arg);
+  for (int i = 0; i < 10; i++) {
+    xsleep();
+  }
+  threadpool_counters_t counters = threadpool_counters(tp);
+  EXPECT_INT_EQ(4, counters.queued_work);
+  EXPECT_INT_EQ(0, counters.completed_work);
+  set_gate(1);
+  pthread_join(tid, NULL);
+  threadpool_stop(tp, THREADPOOL_STOP_DRAIN);
+  counters = threadpool_counters(tp);
+  EXPECT_INT_EQ(21, counters.completed_work);
+  EXPECT_INT_EQ(0, counters.queued_work);
+  threadpool_destroy(tp);
+  return 0;
+}
+
+int test_ring_steal_spawn() {
+  // a small ring as the injector, with spawned work in the deques.
+  spawn_tp = make_ring_with(4, THREADPOOL_MODE_STEALING, 8,
+                            THREADPOOL_FULL_BLOCK);
+  reset_counter();
+  threadpool_work_t w[16];
+  for (int i = 0; i < 16; i++) {
+    w[i] = (threadpool_work_t){spawn, (void *)8l, NULL};
+  }
+  int total = 16 * ((1 << 9) - 1);
+  threadpool_start(spawn_tp);
+  EXPECT_INT_EQ(16, threadpool_add_batch(spawn_tp, w, 16));
+  wait_for(total);
+  threadpool_stop(spawn_tp, THREADPOOL_STOP_DRAIN);
+  threadpool_counters_t counters = threadpool_counters(spawn_tp);
+  EXPECT_INT_EQ(total, counters.completed_work);
+  EXPECT_INT_EQ(0, counters.queued_work);
+  threadpool_destroy(spawn_tp);
+  return 0;
+}
+
+// increments the counter and returns its argument.
+void *ident(void *arg) {
+  inc(NULL);
+  return arg;
+}
+
+int test_future_wait() {
+  threadpool_t tp = make_with(5);
+  reset_counter();
+  threadpool_start(tp);
+  int iters = 100;
+  threadpool_future_t f[100];
+  for (long i = 0; i < iters; i++) {
+    f[i] = threadpool_submit(tp, (threadpool_work_t){ident, (void *)i, NULL});
+    EXPECT_NOTNULL(f[i]);
+  }
+  for (long i = 0; i < iters; i++) {
+    EXPECT_LONG_EQ(i, (long)threadpool_future_wait(f[i]));
+    threadpool_future_free(f[i]);
+  }
+  // the pool is still running; no stop was needed to wait for the work.
+  EXPECT_LONG_EQ((long)iters, get_counter());
+  threadpool_stop(tp, THREADPOOL_STOP_WAIT);
+  // work is counted as completed only after its future is.
+  EXPECT_INT_EQ(iters, threadpool_counters(tp).completed_work);
+  threadpool_destroy(tp);
+  return 0;
+}
+
+int test_future_try_get() {
+  threadpool_t tp = make_with(1);
+  reset_counter();
+  set_gate(0);
+  threadpool_start(tp);
+  threadpool_future_t f = threadpool_submit(tp, (threadpool_work_t){gate});
+  wait_for(1);
+  void *result = (void *)1l;
+  EXPECT_INT_EQ(0, threadpool_future_try_get(f, &result));
+  EXPECT_LONG_EQ(1l, (long)result);
+  set_gate(1);
+  EXPECT_NULL(threadpool_future_wait(f));
+  EXPECT_INT_EQ(1, threadpool_future_try_get(f, &result));
+  EXPECT_NULL(result);
+  threadpool_future_free(f);
+  threadpool_stop(tp, THREADPOOL_STOP_WAIT);
+  threadpool_destroy(tp);
+  return 0;
+}
+
+int test_future_stopped() {
+  // work submitted to a stopped pool completes once the pool starts.
+  threadpool_t tp = make_with(2);
+  reset_counter();
+  threadpool_future_t f =
+      threadpool_submit(tp, (threadpool_work_t){ident, (void *)7l, NULL});
+  EXPECT_INT_EQ(0, threadpool_future_try_get(f, NULL));
+  EXPECT_INT_EQ(1, threadpool_counters(tp).queued_work);
+  threadpool_start(tp);
+  EXPECT_LONG_EQ(7l, (long)threadpool_future_wait(f));
+  threadpool_future_free(f);
+  threadpool_stop(tp, THREADPOOL_STOP_WAIT);
+  threadpool_destroy(tp);
+  return 0;
+}
+
+atomic_int cb_calls;
+
+void count_cb(void *result) { cb_calls++; }
+
+int test_future_callback() {
+  // the callback has returned by the time the future completes.
+  threadpool_t tp = make_stealing_with(3);
+  reset_counter();
+  cb_calls = 0;
+  threadpool_start(tp);
+  threadpool_future_t f[50];
+  for (long i = 0; i < 50; i++) {
+    f[i] = threadpool_submit(tp, (threadpool_work_t){ident, NULL, count_cb});
+  }
+  threadpool_future_wait_all(f, 50);
+  EXPECT_INT_EQ(50, cb_calls);
+  for (int i = 0; i < 50; i++) {
+    threadpool_future_free(f[i]);
+  }
+  threadpool_stop(tp, THREADPOOL_STOP_WAIT);
+  threadpool_destroy(tp);
+  return 0;
+}
+
+int test_future_wait_any() {
+  threadpool_t tp = make_with(2);
+  reset_counter();
+  set_gate(0);
+  threadpool_start(tp);
+  threadpool_future_t f[2];
+  f[0] = threadpool_submit(tp, (threadpool_work_t){gate});
+  wait_for(1);
+  f[1] = threadpool_submit(tp, (threadpool_work_t){ident, (void *)3l, NULL});
+  // the gated work cannot complete until the gate opens.
+  EXPECT_INT_EQ(1, threadpool_future_wait_any(f, 2));
+  EXPECT_INT_EQ(0, threadpool_future_try_get(f[0], NULL));
+  set_gate(1);
+  threadpool_future_wait_all(f, 2);
+  EXPECT_INT_EQ(0, threadpool_future_wait_any(f, 2));
+  threadpool_future_free(f[0]);
+  threadpool_future_free(f[1]);
+  threadpool_stop(tp, THREADPOOL_STOP_WAIT);
+  threadpool_destroy(tp);
+  return 0;
+}
+
+int test_submit_batch() {
+  // batches waited on one after another, without stopping the pool.
+  int iters = 1000;
+  threadpool_work_t *w = malloc(iters * sizeof(threadpool_work_t));
+  threadpool_future_t *f = malloc(iters * sizeof(threadpool_future_t));
+  for (long i = 0; i < iters; i++) {
+    w[i] = (threadpool_work_t){ident, (void *)i, NULL};
+  }
+  for (int mode = THREADPOOL_MODE_SHARED; mode <= THREADPOOL_MODE_STEALING;
+       mode++) {
+    threadpool_t tp =
+        make_ring_with(5, mode, mode ? 0 : 64, THREADPOOL_FULL_SPILL);
+    reset_counter();
+    threadpool_start(tp);
+    for (int round = 1; round <= 3; round++) {
+      EXPECT_INT_EQ(iters, threadpool_submit_batch(tp, w, iters, f));
+      threadpool_future_wait_all(f, iters);
+      EXPECT_LONG_EQ((long)round * iters, get_counter());
+      for (long i = 0; i < iters; i++) {
+        void *result;
+        EXPECT_INT_EQ(1, threadpool_future_try_get(f[i], &result));
+        EXPECT_LONG_EQ(i, (long)result);
+        threadpool_future_free(f[i]);
+      }
+    }
+    threadpool_stop(tp, THREADPOOL_STOP_WAIT);
+    threadpool_destroy(tp);
+  }
+  free(w);
+  free(f);
+  return 0;
+}
+
+int test_submit_fail() {
+  threadpool_t tp = make_ring_with(1, THREADPOOL_MODE_SHARED, 2,
+                                   THREADPOOL_FULL_FAIL);
+  reset_counter();
+  set_gate(0);
+  threadpool_work_t w[3] = {{gate}, {gate}, {gate}};
+  threadpool_future_t f[3];
+  threadpool_start(tp);
+  // occupy the only worker, then overfill the ring.
+  threadpool_future_t first = threadpool_submit(tp, w[0]);
+  wait_for(1);
+  EXPECT_INT_EQ(2, threadpool_submit_batch(tp, w, 3, f));
+  EXPECT_NULL(f[2]);
+  EXPECT_NULL(threadpool_submit(tp, w[0]));
+  set_gate(1);
+  threadpool_future_wait_all(f, 2);
+  threadpool_future_wait(first);
+  threadpool_future_free(first);
+  threadpool_future_free(f[0]);
+  threadpool_future_free(f[1]);
+  threadpool_stop(tp, THREADPOOL_STOP_WAIT);
+  threadpool_destroy(tp);
+  return 0;
+}
+
+int test_persistent_destroy() {
+  // a pool with persistent workers can be destroyed without being started.
+  threadpool_t tp = make_persistent_with(5, THREADPOOL_MODE_SHARED, 0);
+  threadpool_destroy(tp);
+  tp = make_persistent_with(5, THREADPOOL_MODE_STEALING, 16);
+  threadpool_start(tp);
+  threadpool_stop(tp, THREADPOOL_STOP_WAIT);
+  threadpool_destroy(tp);
+  return 0;
+}
+
+int test_persistent_cycles() {
+  int cycles = 100;
+  int work = 10;
+  threadpool_work_t w = {inc, NULL, NULL};
+  for (int mode = THREADPOOL_MODE_SHARED; mode <= THREADPOOL_MODE_STEALING;
+       mode++) {
+    for (int capacity = 0; capacity <= 8; capacity += 8) {
+      threadpool_t tp = make_persistent_with(3, mode, capacity);
+      reset_counter();
+      for (int c = 1; c <= cycles; c++) {
+        for (int i = 0; i < work; i++) {
+          threadpool_add(tp, w);
+        }
+        threadpool_start(tp);
+        threadpool_stop(tp, THREADPOOL_STOP_DRAIN);
+        EXPECT_LONG_EQ((long)c * work, get_counter());
+      }
+      // stopping with WAIT leaves the rest queued for the next start.
+      for (int i = 0; i < work; i++) {
+        threadpool_add(tp, w);
+      }
+      threadpool_start(tp);
+      threadpool_stop(tp, THREADPOOL_STOP_WAIT);
+      threadpool_counters_t counters = threadpool_counters(tp);
+      EXPECT_INT_EQ((cycles + 1) * work,
+                    counters.completed_work + counters.queued_work);
+      threadpool_start(tp);
+      threadpool_stop(tp, THREADPOOL_STOP_DRAIN);
+      EXPECT_LONG_EQ((long)(cycles + 1) * work, get_counter());
+      threadpool_destroy(tp);
+    }
+  }
+  return 0;
+}
+
+int test_persistent_validate_parallelism() {
+  // every parked worker wakes on each start.
+  int nthreads = 5;
+  threadpool_t tp = make_persistent_with(nthreads, THREADPOOL_MODE_SHARED, 0);
+  for (int c = 0; c < 3; c++) {
+    reset_counter();
+    threadpool_work_t w = make_block_at_n(nthreads);
+    for (int i = 0; i < nthreads; i++) {
+      threadpool_add(tp, w);
+    }
+    threadpool_start(tp);
+    threadpool_stop(tp, THREADPOOL_STOP_DRAIN);
+    wait_for(nthreads * 2);
+    destroy_block_at_n(w);
+  }
+  threadpool_destroy(tp);
+  return 0;
+}
+
+int test_persistent_futures() {
+  // futures complete across stop/start cycles of the same workers.
+  threadpool_t tp = make_persistent_with(2, THREADPOOL_MODE_STEALING, 0);
+  reset_counter();
+  for (long c = 0; c < 10; c++) {
+    threadpool_future_t f =
+        threadpool_submit(tp, (threadpool_work_t){ident, (void *)c, NULL});
+    threadpool_start(tp);
+    EXPECT_LONG_EQ(c, (long)threadpool_future_wait(f));
+    threadpool_future_free(f);
+    threadpool_stop(tp, THREADPOOL_STOP_WAIT);
+  }
+  threadpool_destroy(tp);
+  return 0;
+}
+
+int test_idle_policies() {
+  // spinning and yielding workers pick up work added while they wait.
+  threadpool_work_t w = {inc, NULL, NULL};
+  unsigned int policies[3][2] = {{0, 0}, {0, 100}, {10000, 10}};
+  for (int mode = THREADPOOL_MODE_SHARED; mode <= THREADPOOL_MODE_STEALING;
+       mode++) {
+    for (int p = 0; p < 3; p++) {
+      threadpool_t tp =
+          make_idle_with(3, mode, policies[p][0], policies[p][1]);
+      reset_counter();
+      threadpool_start(tp);
+      for (int i = 1; i <= 100; i++) {
+        threadpool_add(tp, w);
+        wait_for(i);
+      }
+      threadpool_stop(tp, THREADPOOL_STOP_WAIT);
+      EXPECT_INT_EQ(100, threadpool_counters(tp).completed_work);
+      threadpool_destroy(tp);
+    }
+  }
+  return 0;
+}
+
+int test_idle_stop() {
+  // workers that would spin for a long time still stop promptly.
+  threadpool_t tp = make_idle_with(3, THREADPOOL_MODE_SHARED, 1u << 30, 0);
+  reset_counter();
+  threadpool_start(tp);
+  threadpool_add(tp, (threadpool_work_t){inc, NULL, NULL});
+  wait_for(1);
+  threadpool_stop(tp, THREADPOOL_STOP_DRAIN);
+  threadpool_destroy(tp);
+  tp = make_idle_with(3, THREADPOOL_MODE_STEALING, 1u << 30, 0);
+  threadpool_start(tp);
+  threadpool_stop(tp, THREADPOOL_STOP_WAIT);
+  threadpool_destroy(tp);
+  return 0;
+}
+
+int test_idle_wake_batch() {
+  // a batch larger than the sleepers taken at once wakes every worker.
+  int nthreads = 100;
+  threadpool_t tp = make_with(nthreads);
+  reset_counter();
+  threadpool_work_t w = make_block_at_n(nthreads);
+  threadpool_work_t *batch = malloc(nthreads * sizeof(threadpool_work_t));
+  for (int i = 0; i < nthreads; i++) {
+    batch[i] = w;
+  }
+  threadpool_start(tp);
+  // let the workers go to sleep first.
+  for (int i = 0; i < 100; i++) {
+    xsleep();
+  }
+  threadpool_add_batch(tp, batch, nthreads);
+  wait_for(nthreads * 2);
+  threadpool_stop(tp, THREADPOOL_STOP_DRAIN);
+  threadpool_destroy(tp);
+  destroy_block_at_n(w);
+  free(batch);
+  return 0;
+}
+
+// Order in which record_order work ran; each item records its work pointer.
+#define ORDER_MAX 64
+long order[ORDER_MAX];
+atomic_int norder;
+
+void *record_order(void *work) {
+  order[norder++] = (long)work;
+  return NULL;
+}
+
+int test_priority_order() {
+  // a single worker runs queued work by priority. the order within a priority
+  // is not checked, as a stealing worker runs its deque newest first.
+  for (int mode = THREADPOOL_MODE_SHARED; mode <= THREADPOOL_MODE_STEALING;
+       mode++) {
+    threadpool_t tp = make_aging_with(1, mode, 0, 60000);
+    norder = 0;
+    for (long i = 0; i < 9; i++) {
+      // 0-2 low, 3-5 normal, 6-8 high, added interleaved.
+      long id = (i % 3) * 3 + i / 3;
+      threadpool_work_t w = {record_order, (void *)id, NULL,
+                             (enum threadpool_priority)(i % 3 - 1)};
+      threadpool_add(tp, w);
+    }
+    threadpool_counters_t c = threadpool_counters(tp);
+    for (int q = 0; q < THREADPOOL_PRIORITIES; q++) {
+      EXPECT_INT_EQ(3, c.priority[q].queued_work);
+    }
+    threadpool_start(tp);
+    threadpool_stop(tp, THREADPOOL_STOP_DRAIN);
+    EXPECT_INT_EQ(9, norder);
+    for (int i = 0; i < 9; i++) {
+      EXPECT_LONG_EQ(2l - i / 3, order[i] / 3);
+    }
+    c = threadpool_counters(tp);
+    EXPECT_INT_EQ(9, c.completed_work);
+    for (int q = 0; q < THREADPOOL_PRIORITIES; q++) {
+      threadpool_priority_counters_t p = c.priority[q];
+      EXPECT_INT_EQ(3, p.completed_work);
+      EXPECT_INT_EQ(0, p.queued_work);
+      // work a stealing worker moves to its deque is timed when it runs.
+      EXPECT_INT_EQ(3, p.timed_work);
+      EXPECT_TRUE(p.max_wait_ns > 0);
+      EXPECT_TRUE(p.max_wait_ns * p.timed_work >= p.wait_ns);
+    }
+    // low priority work waited for the rest.
+    EXPECT_TRUE(c.priority[0].max_wait_ns >= c.priority[2].max_wait_ns);
+    threadpool_destroy(tp);
+  }
+  return 0;
+}
+
+int test_priority_aging() {
+  // low priority work that has waited out the aging period runs ahead of newer
+  // high priority work.
+  for (int mode = THREADPOOL_MODE_SHARED; mode <= THREADPOOL_MODE_STEALING;
+       mode++) {
+    threadpool_t tp = make_aging_with(1, mode, 0, 1);
+    norder = 0;
+    threadpool_add(tp, (threadpool_work_t){record_order, (void *)0, NULL,
+                                           THREADPOOL_PRIORITY_LOW});
+    for (int i = 0; i < 10; i++) {
+      xsleep();
+    }
+    for (long i = 1; i <= 5; i++) {
+      threadpool_add(tp, (threadpool_work_t){record_order, (void *)i, NULL,
+                                             THREADPOOL_PRIORITY_HIGH});
+    }
+    threadpool_start(tp);
+    threadpool_stop(tp, THREADPOOL_STOP_DRAIN);
+    EXPECT_INT_EQ(6, norder);
+    EXPECT_LONG_EQ(0l, order[0]);
+    threadpool_destroy(tp);
+  }
+  return 0;
+}
+
+int test_priority_running() {
+  // high priority work added to a busy pool runs before the normal and low
+  // priority work queued ahead of it.
+  for (int mode = THREADPOOL_MODE_SHARED; mode <= THREADPOOL_MODE_STEALING;
+       mode++) {
+    for (int capacity = 0; capacity <= 16; capacity += 16) {
+      threadpool_t tp = make_aging_with(1, mode, capacity, 60000);
+      reset_counter();
+      norder = 0;
+      set_gate(0);
+      threadpool_start(tp);
+      // the only worker blocks at the gate while work is queued.
+      threadpool_add(tp, (threadpool_work_t){gate, NULL, NULL});
+      wait_for(1);
+      for (long i = 0; i < 8; i++) {
+        threadpool_add(tp, (threadpool_work_t){record_order, (void *)i, NULL,
+                                               (enum threadpool_priority)(
+                                                   i < 4 ? i % 2 - 1 : 0)});
+      }
+      threadpool_add(tp, (threadpool_work_t){record_order, (void *)8, NULL,
+                                             THREADPOOL_PRIORITY_HIGH});
+      set_gate(1);
+      threadpool_stop(tp, THREADPOOL_STOP_DRAIN);
+      EXPECT_INT_EQ(9, norder);
+      EXPECT_LONG_EQ(8l, order[0]);
+      // low priority work runs last.
+      EXPECT_LONG_EQ(2l, order[8]);
+      EXPECT_LONG_EQ(0l, order[7]);
+      threadpool_counters_t c = threadpool_counters(tp);
+      EXPECT_INT_EQ(1, c.priority[2].completed_work);
+      EXPECT_INT_EQ(7, c.priority[1].completed_work);
+      EXPECT_INT_EQ(2, c.priority[0].completed_work);
+      threadpool_destroy(tp);
+    }
+  }
+  return 0;
+}
+
+int test_priority_mixed_batch() {
+  // batches and futures of mixed priorities on pools with rings and stealing.
+  int n = 3000;
+  threadpool_work_t *w = malloc(n * sizeof(threadpool_work_t));
+  threadpool_future_t *f = malloc(n * sizeof(threadpool_future_t));
+  for (long i = 0; i < n; i++) {
+    w[i] = (threadpool_work_t){ident, (void *)i, NULL,
+                               (enum threadpool_priority)(i % 3 - 1)};
+  }
+  for (int mode = THREADPOOL_MODE_SHARED; mode <= THREADPOOL_MODE_STEALING;
+       mode++) {
+    threadpool_t tp = make_aging_with(4, mode, 64, 1);
+    reset_counter();
+    threadpool_start(tp);
+    EXPECT_INT_EQ(n, threadpool_submit_batch(tp, w, n, f));
+    threadpool_future_wait_all(f, n);
+    EXPECT_LONG_EQ((long)n, get_counter());
+    for (long i = 0; i < n; i++) {
+      EXPECT_LONG_EQ(i, (long)threadpool_future_wait(f[i]));
+      threadpool_future_free(f[i]);
+    }
+    threadpool_stop(tp, THREADPOOL_STOP_DRAIN);
+    threadpool_counters_t c = threadpool_counters(tp);
+    EXPECT_INT_EQ(n, c.completed_work);
+    EXPECT_INT_EQ(0, c.queued_work);
+    for (int q = 0; q < THREADPOOL_PRIORITIES; q++) {
+      EXPECT_INT_EQ(n / 3, c.priority[q].completed_work);
+      EXPECT_INT_EQ(0, c.priority[q].queued_work);
+    }
+    threadpool_destroy(tp);
+  }
+  free(w);
+  free(f);
+  return 0;
+}
+
+// waits until the pool counts n work items as completed.
+void wait_completed(threadpool_t tp, unsigned int n) {
+  while (threadpool_counters(tp).completed_work < n) {
+    xsleep();
+  }
+}
+
+unsigned long hist_total(threadpool_histogram_t *h) {
+  unsigned long total = 0;
+  for (int b = 0; b < THREADPOOL_HIST_BUCKETS; b++) {
+    total += h->count[b];
+  }
+  return total;
+}
+
+int test_stats() {
+  // a snapshot of a running pool adds up the workers' stats.
+  int nthreads = 4;
+  int n = 1000;
+  threadpool_work_t *w = malloc(n * sizeof(threadpool_work_t));
+  for (int i = 0; i < n; i++) {
+    w[i] = (threadpool_work_t){inc, NULL, NULL};
+  }
+  for (int mode = THREADPOOL_MODE_SHARED; mode <= THREADPOOL_MODE_STEALING;
+       mode++) {
+    threadpool_t tp =
+        mode ? make_stealing_with(nthreads) : make_with(nthreads);
+    reset_counter();
+    threadpool_add_batch(tp, w, n);
+    threadpool_start(tp);
+    wait_for(n);
+    wait_completed(tp, n);
+    // let the workers go idle.
+    for (int i = 0; i < 10; i++) {
+      xsleep();
+    }
+    threadpool_stats_t *s = threadpool_stats(tp);
+    EXPECT_INT_EQ(nthreads, s->nthreads);
+    EXPECT_INT_EQ(n, s->counters.completed_work);
+    EXPECT_INT_EQ(0, s->counters.queued_work);
+    EXPECT_LONG_EQ((long)n, (long)s->total.completed_work);
+    long completed = 0;
+    for (int i = 0; i < nthreads; i++) {
+      completed += s->workers[i].completed_work;
+      EXPECT_LONG_EQ((long)s->workers[i].completed_work,
+                     (long)hist_total(&s->workers[i].run));
+    }
+    EXPECT_LONG_EQ((long)n, completed);
+    EXPECT_LONG_EQ((long)n, (long)hist_total(&s->total.run));
+    unsigned long timed = 0;
+    for (int q = 0; q < THREADPOOL_PRIORITIES; q++) {
+      timed += s->counters.priority[q].timed_work;
+    }
+    EXPECT_LONG_EQ((long)timed, (long)hist_total(&s->total.wait));
+    EXPECT_LONG_EQ((long)n, (long)timed);
+    EXPECT_TRUE(s->total.busy_ns > 0);
+    // the current waits of the idle workers count as well.
+    EXPECT_TRUE(s->total.idle_ns >= 10 * SLEEP_NS);
+    unsigned long p50 = threadpool_histogram_quantile(&s->total.run, 0.5);
+    EXPECT_TRUE(p50 > 0);
+    EXPECT_TRUE(p50 <= threadpool_histogram_quantile(&s->total.run, 0.99));
+    threadpool_stats_free(s);
+    threadpool_stop(tp, THREADPOOL_STOP_DRAIN);
+    threadpool_destroy(tp);
+  }
+  free(w);
+  return 0;
+}
+
+// adds 8 inc work items to the worker's own deque, then blocks until other
+// workers have stolen and run them.
+void *spawn_and_wait(void *unused) {
+  threadpool_work_t w = {inc, NULL, NULL};
+  for (int i = 0; i < 8; i++) {
+    threadpool_add(spawn_tp, w);
+  }
+  wait_for(8);
+  return NULL;
+}
+
+int test_stats_steals() {
+  spawn_tp = make_stealing_with(4);
+  reset_counter();
+  threadpool_start(spawn_tp);
+  threadpool_add(spawn_tp, (threadpool_work_t){spawn_and_wait, NULL, NULL});
+  wait_for(8);
+  threadpool_stop(spawn_tp, THREADPOOL_STOP_DRAIN);
+  threadpool_stats_t *s = threadpool_stats(spawn_tp);
+  EXPECT_LONG_EQ(9l, (long)s->total.completed_work);
+  EXPECT_LONG_EQ(8l, (long)s->total.steals);
+  // work pushed straight onto a deque is timed too.
+  EXPECT_LONG_EQ(9l, (long)hist_total(&s->total.wait));
+  threadpool_stats_free(s);
+  threadpool_destroy(spawn_tp);
+  return 0;
+}
+
+int test_stats_ring() {
+  // work that passes through the ring has its queue wait timed.
+  threadpool_t tp = make_ring_with(4, THREADPOOL_MODE_SHARED, 16,
+                                   THREADPOOL_FULL_BLOCK);
+  reset_counter();
+  threadpool_work_t w = {inc, NULL, NULL};
+  threadpool_start(tp);
+  int n = 1000;
+  for (int i = 0; i < n; i++) {
+    EXPECT_INT_EQ(0, threadpool_add(tp, w));
+  }
+  wait_for(n);
+  threadpool_stop(tp, THREADPOOL_STOP_DRAIN);
+  threadpool_stats_t *s = threadpool_stats(tp);
+  int q = THREADPOOL_PRIORITY_INDEX(THREADPOOL_PRIORITY_NORMAL);
+  EXPECT_INT_EQ(n, s->counters.priority[q].timed_work);
+  EXPECT_LONG_EQ((long)n, (long)hist_total(&s->total.wait));
+  EXPECT_TRUE(s->counters.priority[q].max_wait_ns > 0);
+  threadpool_stats_free(s);
+  threadpool_destroy(tp);
+  return 0;
+}
+
+int test_stats_quantile() {
+  threadpool_histogram_t h = {{0}};
+  EXPECT_LONG_EQ(0l, (long)threadpool_histogram_quantile(&h, 0.5));
+  h.count[0] = 1;   // 0-1 ns
+  h.count[3] = 9;   // 8-15 ns
+  h.count[10] = 90; // 1024-2047 ns
+  EXPECT_LONG_EQ(2l, (long)threadpool_histogram_quantile(&h, 0));
+  EXPECT_LONG_EQ(16l, (long)threadpool_histogram_quantile(&h, 0.1));
+  EXPECT_LONG_EQ(2048l, (long)threadpool_histogram_quantile(&h, 0.11));
+  EXPECT_LONG_EQ(2048l, (long)threadpool_histogram_quantile(&h, 1));
+  return 0;
+}
+
+// CPU each record_cpu work item ran on, by its work pointer.
+int ran_on[64];
+
+void *record_cpu(void *i) {
+  ran_on[(long)i] = sched_getcpu();
+  return inc(NULL);
+}
+
+// runs n record_cpu work items, at most 64, on the pool and stops it.
+void run_record_cpu(threadpool_t tp, int n) {
+  reset_counter();
+  threadpool_start(tp);
+  for (long i = 0; i < n; i++) {
+    threadpool_add(tp, (threadpool_work_t){record_cpu, (void *)i, NULL});
+  }
+  wait_for(n);
+  threadpool_stop(tp, THREADPOOL_STOP_DRAIN);
+}
+
+// returns the lowest CPU the process may run on.
+int first_cpu() {
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  sched_getaffinity(0, sizeof(cpu_set_t), &allowed);
+  int cpu = 0;
+  while (!CPU_ISSET(cpu, &allowed)) {
+    cpu++;
+  }
+  return cpu;
+}
+
+int test_affinity_cpus() {
+  // every worker is pinned to the one usable CPU in the list.
+  int cpu = first_cpu();
+  int cpus[] = {-1, cpu, CPU_SETSIZE};
+  for (int mode = THREADPOOL_MODE_SHARED; mode <= THREADPOOL_MODE_STEALING;
+       mode++) {
+    threadpool_t tp =
+        make_placed_with(3, mode, THREADPOOL_AFFINITY_CPUS, cpus, 3, 0);
+    run_record_cpu(tp, 30);
+    for (int i = 0; i < 30; i++) {
+      EXPECT_INT_EQ(cpu, ran_on[i]);
+    }
+    threadpool_stats_t *s = threadpool_stats(tp);
+    for (int i = 0; i < 3; i++) {
+      EXPECT_INT_EQ(cpu, s->workers[i].cpu);
+      EXPECT_INT_EQ(-1, s->workers[i].node);
+    }
+    threadpool_stats_free(s);
+    threadpool_destroy(tp);
+  }
+  return 0;
+}
+
+int test_affinity_cores() {
+  // each worker runs only on the CPU it is pinned to, which is on its node.
+  threadpool_t tp =
+      make_placed_with(4, THREADPOOL_MODE_STEALING, THREADPOOL_AFFINITY_CORES,
+                       NULL, 0, /*numa=*/1);
+  threadpool_stats_t *s = threadpool_stats(tp);
+  int pinned[4];
+  for (int i = 0; i < 4; i++) {
+    pinned[i] = s->workers[i].cpu;
+    EXPECT_TRUE(pinned[i] >= 0);
+    EXPECT_TRUE(s->workers[i].node >= 0);
+  }
+  threadpool_stats_free(s);
+  run_record_cpu(tp, 40);
+  for (int i = 0; i < 40; i++) {
+    int found = 0;
+    for (int j = 0; j < 4; j++) {
+      found |= ran_on[i] == pinned[j];
+    }
+    EXPECT_TRUE(found);
+  }
+  threadpool_destroy(tp);
+  return 0;
+}
+
+int test_affinity_numa() {
+  // workers grouped by node but not pinned to a single CPU, stealing within
+  // and across nodes.
+  spawn_tp = make_placed_with(4, THREADPOOL_MODE_STEALING,
+                              THREADPOOL_AFFINITY_NONE, NULL, 0, /*numa=*/1);
+  threadpool_stats_t *s = threadpool_stats(spawn_tp);
+  for (int i = 0; i < 4; i++) {
+    EXPECT_INT_EQ(-1, s->workers[i].cpu);
+    EXPECT_TRUE(s->workers[i].node >= 0);
+  }
+  threadpool_stats_free(s);
+  reset_counter();
+  int total = (1 << 11) - 1;
+  threadpool_start(spawn_tp);
+  threadpool_add(spawn_tp, (threadpool_work_t){spawn, (void *)10l, NULL});
+  wait_for(total);
+  threadpool_stop(spawn_tp, THREADPOOL_STOP_DRAIN);
+  EXPECT_INT_EQ(total, threadpool_counters(spawn_tp).completed_work);
+  threadpool_destroy(spawn_tp);
+  return 0;
+}
+
+int test_affinity_persistent() {
+  // persistent workers are pinned when they are created.
+  int cpu = first_cpu();
+  threadpool_config_t cfg = {2, THREADPOOL_MODE_SHARED};
+  cfg.persistent = 1;
+  cfg.affinity = THREADPOOL_AFFINITY_CPUS;
+  cfg.cpus = &cpu;
+  cfg.ncpus = 1;
+  threadpool_t tp = threadpool_create(cfg);
+  for (int cycle = 0; cycle < 3; cycle++) {
+    run_record_cpu(tp, 10);
+    for (int i = 0; i < 10; i++) {
+      EXPECT_INT_EQ(cpu, ran_on[i]);
+    }
+  }
+  threadpool_destroy(tp);
+  return 0;
+}
+
+threadpool_t id_tp;
+pthread_barrier_t id_barrier;
+atomic_int seen_ids[8];
+
+// records the id of the worker and waits for the other workers to do the same,
+// so that each worker runs exactly one item.
+void *record_id(void *unused) {
+  int id = threadpool_worker_id(id_tp);
+  if (id >= 0 && id < 8) {
+    atomic_fetch_add(&seen_ids[id], 1);
+  }
+  pthread_barrier_wait(&id_barrier);
+  return NULL;
+}
+
+int worker_ids(threadpool_t tp, int n) {
+  id_tp = tp;
+  for (int i = 0; i < 8; i++) {
+    atomic_store(&seen_ids[i], 0);
+  }
+  pthread_barrier_init(&id_barrier, NULL, n);
+  threadpool_start(tp);
+  for (int i = 0; i < n; i++) {
+    threadpool_add(tp, (threadpool_work_t){record_id});
+  }
+  threadpool_stop(tp, THREADPOOL_STOP_DRAIN);
+  pthread_barrier_destroy(&id_barrier);
+  for (int i = 0; i < n; i++) {
+    EXPECT_INT_EQ(1, atomic_load(&seen_ids[i]));
+  }
+  EXPECT_INT_EQ(-1, threadpool_worker_id(tp));
+  threadpool_destroy(tp);
+  return 0;
+}
+
+int test_worker_id() {
+  // each worker has its own id, and other threads have none.
+  int n = 4;
+  EXPECT_INT_EQ(0, worker_ids(make_with(n), n));
+  EXPECT_INT_EQ(0, worker_ids(make_stealing_with(n), n));
+  threadpool_t ring =
+      make_ring_with(n, THREADPOOL_MODE_SHARED, 16, THREADPOOL_FULL_SPILL);
+  EXPECT_INT_EQ(0, worker_ids(ring, n));
+  threadpool_t persistent = make_persistent_with(n, THREADPOOL_MODE_SHARED, 0);
+  EXPECT_INT_EQ(0, worker_ids(persistent, n));
+  return 0;
+}
+
 int main() {
   ADD_TEST(test_create);
   ADD_TEST(test_run_one);
@@ -361,6 +1490,47 @@ int main() {
   ADD_TEST(test_drain_resume);
   ADD_TEST(test_drain_queue_resume);
   ADD_TEST(test_pause_queue_destroy);
+  ADD_TEST(test_add_batch);
+  ADD_TEST(test_add_batch_parallelism);
+  ADD_TEST(test_steal_run_many);
+  ADD_TEST(test_steal_spawn);
+  ADD_TEST(test_steal_validate_parallelism);
+  ADD_TEST(test_steal_pause_resume);
+  ADD_TEST(test_steal_add_batch);
+  ADD_TEST(test_steal_drain_queue_resume);
+  ADD_TEST(test_ring_run_many);
+  ADD_TEST(test_ring_queue_work);
+  ADD_TEST(test_ring_fail);
+  ADD_TEST(test_ring_spill);
+  ADD_TEST(test_ring_block);
+  ADD_TEST(test_ring_steal_spawn);
+  ADD_TEST(test_future_wait);
+  ADD_TEST(test_future_try_get);
+  ADD_TEST(test_future_stopped);
+  ADD_TEST(test_future_callback);
+  ADD_TEST(test_future_wait_any);
+  ADD_TEST(test_submit_batch);
+  ADD_TEST(test_submit_fail);
+  ADD_TEST(test_persistent_destroy);
+  ADD_TEST(test_persistent_cycles);
+  ADD_TEST(test_persistent_validate_parallelism);
+  ADD_TEST(test_persistent_futures);
+  ADD_TEST(test_idle_policies);
+  ADD_TEST(test_idle_stop);
+  ADD_TEST(test_idle_wake_batch);
+  ADD_TEST(test_priority_order);
+  ADD_TEST(test_priority_aging);
+  ADD_TEST(test_priority_running);
+  ADD_TEST(test_priority_mixed_batch);
+  ADD_TEST(test_stats);
+  ADD_TEST(test_stats_steals);
+  ADD_TEST(test_stats_ring);
+  ADD_TEST(test_stats_quantile);
+  ADD_TEST(test_affinity_cpus);
+  ADD_TEST(test_affinity_cores);
+  ADD_TEST(test_affinity_numa);
+  ADD_TEST(test_affinity_persistent);
+  ADD_TEST(test_worker_id);
   run_tests(/*fail_fast=*/0);
   return 0;
 }
@@ -8,8 +8,50 @@
 #include "../util.h"
 
 threadpool_t make_with(int n) {
-  threadpool_config_t cfg;
-  cfg.nthreads = n;
+  threadpool_config_t cfg = {n, THREADPOOL_MODE_SHARED};
+  return threadpool_create(cfg);
+}
+
+threadpool_t make_stealing_with(int n) {
+  threadpool_config_t cfg = {n, THREADPOOL_MODE_STEALING};
+  return threadpool_create(cfg);
+}
+
+threadpool_t make_ring_with(int n, enum threadpool_mode mode, int capacity,
+                            enum threadpool_full_policy policy) {
+  threadpool_config_t cfg = {n, mode, capacity, policy};
+  return threadpool_create(cfg);
+}
+
+threadpool_t make_persistent_with(int n, enum threadpool_mode mode,
+                                  int capacity) {
+  threadpool_config_t cfg = {n, mode, capacity, THREADPOOL_FULL_SPILL, 1};
+  return threadpool_create(cfg);
+}
+
+threadpool_t make_idle_with(int n, enum threadpool_mode mode,
+                            unsigned int spins, unsigned int yields) {
+  threadpool_config_t cfg = {n, mode};
+  cfg.idle_spins = spins;
+  cfg.idle_yields = yields;
+  return threadpool_create(cfg);
+}
+
+threadpool_t make_aging_with(int n, enum threadpool_mode mode, int capacity,
+                             unsigned int aging_ms) {
+  threadpool_config_t cfg = {n, mode, capacity, THREADPOOL_FULL_SPILL};
+  cfg.aging_ms = aging_ms;
+  return threadpool_create(cfg);
+}
+
+threadpool_t make_placed_with(int n, enum threadpool_mode mode,
+                              enum threadpool_affinity affinity,
+                              const int *cpus, int ncpus, int numa) {
+  threadpool_config_t cfg = {n, mode};
+  cfg.affinity = affinity;
+  cfg.cpus = cpus;
+  cfg.ncpus = ncpus;
+  cfg.numa = numa;
   return threadpool_create(cfg);
 }
 
@@ -10,6 +10,25 @@
 #define SLEEP_NS 500000l
 
 threadpool_t make_with(int n);
+// same, but the pool uses work stealing.
+threadpool_t make_stealing_with(int n);
+// same, but the pool has a ring of the given capacity.
+threadpool_t make_ring_with(int n, enum threadpool_mode mode, int capacity,
+                            enum threadpool_full_policy policy);
+// same, but the pool has persistent workers and, if capacity is nonzero, a
+// ring that spills.
+threadpool_t make_persistent_with(int n, enum threadpool_mode mode,
+                                  int capacity);
+// same, but idle workers spin and yield as given before sleeping.
+threadpool_t make_idle_with(int n, enum threadpool_mode mode,
+                            unsigned int spins, unsigned int yields);
+// same, but queued work ages after aging_ms.
+threadpool_t make_aging_with(int n, enum threadpool_mode mode, int capacity,
+                             unsigned int aging_ms);
+// same, but the workers are placed as given.
+threadpool_t make_placed_with(int n, enum threadpool_mode mode,
+                              enum threadpool_affinity affinity,
+                              const int *cpus, int ncpus, int numa);
 
 // functions that atomically check and reset a counter.
 void reset_counter();
@@ -1,33 +1,267 @@
+#define _GNU_SOURCE
 #include "thread_pool.h"
 
+#include <linux/mempolicy.h>
 #include <pthread.h>
+#include <sched.h>
 #include <semaphore.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
 
+#include "deque.h"
 #include "ll.h"
+#include "ring.h"
+#include "topology.h"
 #include "util.h"
 
+// Initial capacity of worker deques, as a power of two. Deques grow as needed.
+#define DEQUE_LOG_SIZE 6
+// Most work a worker moves from the injector to its deque at once.
+#define INJECT_BATCH 32
+// Most sleeping workers an adder takes from the sleepers stack at once.
+#define WAKE_BATCH 64
+// Aging period used when the config's aging_ms is 0.
+#define DEFAULT_AGING_MS 100
+
+// Index of each priority's list, and of the list for a work item.
+#define Q_LOW THREADPOOL_PRIORITY_INDEX(THREADPOOL_PRIORITY_LOW)
+#define Q_NORMAL THREADPOOL_PRIORITY_INDEX(THREADPOOL_PRIORITY_NORMAL)
+#define Q_HIGH THREADPOOL_PRIORITY_INDEX(THREADPOOL_PRIORITY_HIGH)
+#define Q_OF(work) THREADPOOL_PRIORITY_INDEX((work).priority)
+
+// Hint to the CPU that the thread is spinning.
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define cpu_relax() __asm__ __volatile__("yield")
+#else
+#define cpu_relax()
+#endif
+
+// Counts of work added, by priority. Atomic so that adders can update them
+// without taking the pool's mutex. The workers count the work they take in
+// their stats; the queued work is the difference.
+struct tp_counters {
+  atomic_ulong added[THREADPOOL_PRIORITIES];
+};
+
+// Statistics of one worker, written only by that worker. Each starts on its own
+// cache line, so that workers do not contend for the lines of their counters.
+// Fields are atomic only so that threadpool_stats can read them while workers
+// run.
+struct tp_stats {
+  _Alignas(CACHE_LINE) atomic_ulong taken[THREADPOOL_PRIORITIES];
+  atomic_ulong completed[THREADPOOL_PRIORITIES];
+  atomic_ulong timed[THREADPOOL_PRIORITIES];       // work with its wait timed
+  atomic_ulong wait_ns[THREADPOOL_PRIORITIES];     // total wait of timed work
+  atomic_ulong max_wait_ns[THREADPOOL_PRIORITIES]; // longest wait
+  atomic_ulong steals;
+  atomic_ulong busy_ns;
+  atomic_ulong idle_ns;
+  atomic_long idle_since; // when the current wait for work began, or 0
+  atomic_ulong wait_hist[THREADPOOL_HIST_BUCKETS];
+  atomic_ulong run_hist[THREADPOOL_HIST_BUCKETS];
+};
+
 // Threadpool implementation.
 struct threadpool {
-  enum tp_state state;        // current state
-  threadpool_config_t config; // copy of the thread pool config
-  pthread_mutex_t mu;         // mutex guarding elements
-  pthread_cond_t avail; // condition variable; worker threads wait on this cond
-                        //  until work is available
-  pthread_t *threads;   // pointer to array of worker threads
-  struct targ *targs;   // worker thread arguments
-  threadpool_counters_t counters; // status counters
-  struct ll *queued_work;         // list of queued work
-  struct ll *paused_work;         // list of work added while STOPPING/DRAINING
+  _Atomic(enum tp_state) state; // current state; written with mu held
+  threadpool_config_t config;   // copy of the thread pool config
+  pthread_mutex_t mu;           // mutex guarding elements
+  pthread_t *threads;           // pointer to array of worker threads
+  struct targ *targs;           // worker thread arguments
+  struct tp_counters counters;  // status counters
+  void *stats_mem;              // mapping holding the workers' stats
+  size_t stats_len;             // length of stats_mem
+  void *deques_mem;             // mapping holding the workers' deques
+  size_t deques_len;            // length of deques_mem
+
+  // lists of work, one per priority, indexed by THREADPOOL_PRIORITY_INDEX.
+  struct ll *queued_work[THREADPOOL_PRIORITIES]; // queued work; the injector
+                                                 //  when stealing, the
+                                                 //  overflow list with a ring
+  struct ll *paused_work[THREADPOOL_PRIORITIES]; // work added while
+                                                 //  STOPPING/DRAINING
+  atomic_int queued_len[THREADPOOL_PRIORITIES];  // lengths of queued_work,
+                                                 //  readable without mu
+  atomic_long head_ns[THREADPOOL_PRIORITIES];    // queue time of the oldest
+                                                 //  work in each queued_work
+  long aging_ns;                // wait after which work runs first
+  struct ll_store nodes;        // storage for the nodes of all lists
+  atomic_long ready;            // work in the ring, queued_work and the deques
+  int *sleepers;                // ids of sleeping workers, the most recent
+                                //  last; guarded by mu
+  atomic_int idle;              // number of sleepers, readable without mu
+
+  // pools with a ring only.
+  struct ring *ring;    // bounded queue of work, ahead of queued_work
+  pthread_cond_t space; // producers wait on this cond until the ring has room
+  atomic_int blocked;   // producers waiting on space
+
+  // stealing pools only.
+  struct deque **deques; // per-worker deques of malloc'd threadpool_work_t
+
+  // futures.
+  pthread_mutex_t done_mu; // mutex for done
+  pthread_cond_t done;     // threads waiting on futures wait on this cond
+  atomic_int waiting;      // threads waiting on done
+
+  // pools with persistent workers only.
+  pthread_cond_t unpark; // parked workers wait on this cond for a start
+  pthread_cond_t parked; // threadpool_stop waits on this cond until all
+                         //  workers are parked
+  unsigned long starts;  // number of starts so far; guarded by mu
+  int nparked;           // workers parked since the last start; guarded by mu
+  int exiting;           // set by threadpool_destroy; guarded by mu
+};
+
+// Future implementation.
+struct threadpool_future {
+  threadpool_t pool;      // the pool the work was submitted to
+  threadpool_work_t work; // the submitted work
+  void *result;           // result of work.fn; valid once done is set
+  atomic_int done;        // set once work.fn and work.cb have returned
 };
 
 // Per-worker thread argument.
 struct targ {
-  threadpool_t pool; // the thread pool the worker belongs to
-  int id;            // the worker's id
+  threadpool_t pool;      // the thread pool the worker belongs to
+  int id;                 // the worker's id
+  unsigned int seed;      // random state for choosing steal victims
+  sem_t wake;             // posted once each time the worker is taken from
+                          //  sleepers
+  struct tp_stats *stats; // the worker's stats
+  int pinned;             // whether the worker's thread is pinned to cpus
+  cpu_set_t cpus;         // CPUs the worker runs on, if pinned
+  int cpu;                // the single CPU the worker is pinned to, or -1
+  int node;               // NUMA node of the worker when grouping, or -1
 };
 
+// Returns whether a pool's workers find work without holding the mutex. True
+// for pools that are stealing or have a ring.
+#define USES_READY(pool)                                                       \
+  ((pool)->config.mode == THREADPOOL_MODE_STEALING || (pool)->ring)
+
+// The worker running on the current thread, if any.
+static __thread struct targ *current_worker;
+
+// Returns the current time in ns, for queue waits and aging.
+long now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000l + ts.tv_nsec;
+}
+
+// Returns the total length of the queued_work lists. Does not require pool->mu
+// to be held.
+int lists_len(threadpool_t pool) {
+  int n = 0;
+  for (int q = 0; q < THREADPOOL_PRIORITIES; q++) {
+    n += pool->queued_len[q];
+  }
+  return n;
+}
+
+// Sets head_ns for list q after the list changed. Requires pool->mu.
+void update_head(threadpool_t pool, int q) {
+  struct ll *l = pool->queued_work[q];
+  pool->head_ns[q] = l ? l->tail->queued_ns : 0;
+}
+
+// Queues work on the list for its priority, stamped with time t. Requires
+// pool->mu and a node reserved in pool->nodes. Updates queued_len and head_ns
+// but no other counters.
+void list_put(threadpool_t pool, threadpool_work_t work, long t) {
+  int q = Q_OF(work);
+  struct ll *node = ll_store_get(&pool->nodes);
+  node->queued_ns = t;
+  pool->queued_work[q] = ll_add_node(pool->queued_work[q], node, work);
+  if (pool->queued_len[q]++ == 0) {
+    pool->head_ns[q] = t;
+  }
+}
+
+// Takes the oldest node from list q, which must not be empty. Requires
+// pool->mu. Updates queued_len and head_ns; the caller returns the node to
+// pool->nodes.
+struct ll *list_pop(threadpool_t pool, int q) {
+  struct ll *node;
+  pool->queued_work[q] = ll_take_node(pool->queued_work[q], &node);
+  pool->queued_len[q]--;
+  update_head(pool, q);
+  return node;
+}
+
+// Adds n to a counter in the calling worker's stats. A relaxed load and store
+// rather than an atomic add, since no other thread writes the counter.
+void stat_add(atomic_ulong *c, unsigned long n) {
+  atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n,
+                        memory_order_relaxed);
+}
+
+// Counts a duration in a histogram; see thread_pool.h for the buckets.
+void hist_add(atomic_ulong *hist, unsigned long ns) {
+  int b = ns ? 63 - __builtin_clzl(ns) : 0;
+  stat_add(&hist[min(b, THREADPOOL_HIST_BUCKETS - 1)], 1);
+}
+
+// Counts the queue wait of work of priority q, queued at queued_ns, that the
+// worker took to run.
+void record_wait(struct targ *arg, int q, long queued_ns, long now) {
+  struct tp_stats *s = arg->stats;
+  unsigned long wait = now > queued_ns ? now - queued_ns : 0;
+  stat_add(&s->timed[q], 1);
+  stat_add(&s->wait_ns[q], wait);
+  if (wait > atomic_load_explicit(&s->max_wait_ns[q], memory_order_relaxed)) {
+    atomic_store_explicit(&s->max_wait_ns[q], wait, memory_order_relaxed);
+  }
+  hist_add(s->wait_hist, wait);
+}
+
+// Returns whether the oldest work in any list has waited for the aging period.
+// Does not require pool->mu to be held.
+int lists_aged(threadpool_t pool) {
+  if (!pool->queued_len[Q_LOW] && !pool->queued_len[Q_NORMAL]) {
+    // high priority work runs first anyway.
+    return 0;
+  }
+  long now = now_ns();
+  for (int q = 0; q < Q_HIGH; q++) {
+    if (pool->queued_len[q] && now - pool->head_ns[q] >= pool->aging_ns) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Returns the list to take work from next, or -1 if all are empty: the list
+// whose oldest work has waited longest, if that is at least the aging period,
+// else the highest priority list with work. Requires pool->mu.
+int pick_list(threadpool_t pool, long now) {
+  int oldest = -1;
+  for (int q = 0; q < THREADPOOL_PRIORITIES; q++) {
+    if (pool->queued_len[q] &&
+        (oldest < 0 || pool->head_ns[q] < pool->head_ns[oldest])) {
+      oldest = q;
+    }
+  }
+  if (oldest < 0 || now - pool->head_ns[oldest] >= pool->aging_ns) {
+    return oldest;
+  }
+  for (int q = Q_HIGH; q >= 0; q--) {
+    if (pool->queued_len[q]) {
+      return q;
+    }
+  }
+  return -1;
+}
+
 // Returns whether a thread should halt.
 //
 // The thread should halt when either of the two conditions are met:
@@ -39,8 +273,116 @@ struct targ {
 // state without locking the mutex.
 int is_stop(threadpool_t pool) {
   return pool->state == THREADPOOL_STATE_STOPPING ||
-         (pool->state == THREADPOOL_STATE_DRAINING &&
-          !ll_poll(pool->queued_work));
+         (pool->state == THREADPOOL_STATE_DRAINING && !lists_len(pool));
+}
+
+// Returns whether a worker should halt.
+//
+// Like is_stop, but counts work in the ring and the deques as well as in
+// queued_work. Does not require pool->mu to be held.
+int ready_is_stop(threadpool_t pool) {
+  enum tp_state state = pool->state;
+  return state == THREADPOOL_STATE_STOPPING ||
+         (state == THREADPOOL_STATE_DRAINING && pool->ready == 0);
+}
+
+// Spins and then yields, as configured by idle_spins and idle_yields, until
+// work is ready or the pool stops running. Returns 1 if it returned early, in
+// which case the worker should look for work again instead of sleeping.
+int spin_for_work(threadpool_t pool) {
+  unsigned int spins = pool->config.idle_spins;
+  unsigned int yields = pool->config.idle_yields;
+  for (unsigned int i = 0; i < spins + yields; i++) {
+    if (pool->ready > 0 || pool->state != THREADPOOL_STATE_RUNNING) {
+      return 1;
+    }
+    if (i < spins) {
+      cpu_relax();
+    } else {
+      sched_yield();
+    }
+  }
+  return 0;
+}
+
+// Waits until work may be ready or the worker should halt: spins and yields
+// first (see spin_for_work), then pushes the worker onto the sleepers stack and
+// sleeps until an adder or threadpool_stop takes it off the stack and posts its
+// semaphore.
+//
+// Work may be found to be ready and then lost to another worker, so callers
+// should look for work again after this returns. Must not be called with
+// pool->mu held.
+void wait_for_work(struct targ *arg) {
+  threadpool_t pool = arg->pool;
+  if (spin_for_work(pool)) {
+    return;
+  }
+  pthread_mutex_lock(&pool->mu);
+  // push before checking ready: paired with the ready increment before the
+  // idle check in wake_idle, so that either the adder sees this worker or this
+  // worker sees the work.
+  pool->sleepers[pool->idle] = arg->id;
+  pool->idle++;
+  // only sleep while RUNNING. state cannot change while mu is held, and
+  // threadpool_stop wakes every sleeper when it changes the state.
+  if (pool->state != THREADPOOL_STATE_RUNNING || pool->ready > 0) {
+    // still on top of the stack, since pushes and pops hold mu.
+    pool->idle--;
+    pthread_mutex_unlock(&pool->mu);
+    return;
+  }
+  pthread_mutex_unlock(&pool->mu);
+  while (sem_wait(&arg->wake)) {
+    // interrupted; sleep again.
+  }
+}
+
+// Calls wait_for_work, counting the time as the worker's idle time.
+void idle_wait(struct targ *arg) {
+  struct tp_stats *s = arg->stats;
+  long start = now_ns();
+  atomic_store_explicit(&s->idle_since, start, memory_order_relaxed);
+  wait_for_work(arg);
+  atomic_store_explicit(&s->idle_since, 0, memory_order_relaxed);
+  stat_add(&s->idle_ns, now_ns() - start);
+}
+
+// Takes up to n workers off the sleepers stack, most recently idle first, and
+// copies their ids to ids. Requires pool->mu. Returns the number taken; each
+// must then be woken with post_sleepers.
+int take_sleepers(threadpool_t pool, int n, int *ids) {
+  int k = min(n, pool->idle);
+  for (int i = 0; i < k; i++) {
+    ids[i] = pool->sleepers[pool->idle - 1 - i];
+  }
+  pool->idle -= k;
+  return k;
+}
+
+// Wakes k workers taken with take_sleepers. Called after releasing pool->mu, so
+// that woken workers do not immediately block on the mutex.
+void post_sleepers(threadpool_t pool, const int *ids, int k) {
+  for (int i = 0; i < k; i++) {
+    sem_post(&pool->targs[ids[i]].wake);
+  }
+}
+
+// Wakes up to n sleeping workers, one per item of new work. Callers must
+// increment pool->ready before calling this so that a worker about to sleep
+// either sees the new work or is on the sleepers stack.
+void wake_idle(threadpool_t pool, int n) {
+  int ids[WAKE_BATCH];
+  while (n > 0 && pool->idle > 0) {
+    pthread_mutex_lock(&pool->mu);
+    int k = take_sleepers(pool, min(n, WAKE_BATCH), ids);
+    pthread_mutex_unlock(&pool->mu);
+    if (k == 0) {
+      break;
+    }
+    post_sleepers(pool, ids, k);
+    n -= k;
+  }
 }
 
 // Get a work item.
@@ -55,64 +397,712 @@ int is_stop(threadpool_t pool) {
 //
 // This function should not be called while the pool's mutex is held, as it will
 // acquire the mutex in order to check the state of the work queue, dequeue
-// elements, wait on the avail condition variable, etc.
+// elements, wait for work with idle_wait, etc.
 //
-// Updates the pool's counters.queued_work counter when work is dequeued.
-int get_work(threadpool_t pool, threadpool_work_t *work) {
+// Updates the pool's ready and queued_len counters and the worker's stats when
+// work is dequeued.
+int get_work(struct targ *arg, threadpool_work_t *work) {
+  threadpool_t pool = arg->pool;
   pthread_mutex_lock(&pool->mu);
-  while (!is_stop(pool) && !ll_poll(pool->queued_work)) {
-    pthread_cond_wait(&pool->avail, &pool->mu);
+  while (!is_stop(pool) && !lists_len(pool)) {
+    pthread_mutex_unlock(&pool->mu);
+    idle_wait(arg);
+    pthread_mutex_lock(&pool->mu);
   }
   if (is_stop(pool)) {
     pthread_mutex_unlock(&pool->mu);
     return 0;
   }
-  pool->queued_work = ll_take(pool->queued_work, work);
-  pool->counters.queued_work--;
+  long now = now_ns();
+  int q = pick_list(pool, now);
+  struct ll *node = list_pop(pool, q);
+  record_wait(arg, q, node->queued_ns, now);
+  *work = node->work;
+  ll_store_put(&pool->nodes, node);
+  pool->ready--;
   pthread_mutex_unlock(&pool->mu);
+  stat_add(&arg->stats->taken[q], 1);
   return 1;
 }
 
+// Do the work and call the callback with the returned value (if the callback
+// is non-null), then count the work as completed and its run time as busy.
+void run_work(struct targ *arg, threadpool_work_t w) {
+  struct tp_stats *s = arg->stats;
+  long start = now_ns();
+  void *work_result = w.fn(w.work);
+  if (w.cb) {
+    w.cb(work_result);
+  }
+  unsigned long ran = now_ns() - start;
+  stat_add(&s->completed[Q_OF(w)], 1);
+  stat_add(&s->busy_ns, ran);
+  hist_add(s->run_hist, ran);
+}
+
 void *tp_worker(void *work) {
   struct targ *arg = work;
   threadpool_work_t w;
+  current_worker = arg;
   // Run forever, until get_work returns 0.
   while (1) {
-    if (!get_work(arg->pool, &w)) {
+    if (!get_work(arg, &w)) {
       // When get_work returns 0, the thread pool should halt.
+      current_worker = NULL;
       return NULL;
     }
     // get_work returned 1, so w should be new work.
+    run_work(arg, w);
+  }
+  return NULL;
+}
+
+// Wakes a producer blocked on a full ring, if there is one. Called after work
+// leaves the ring or the overflow list.
+void ring_space(threadpool_t pool) {
+  if (pool->config.full_policy != THREADPOOL_FULL_BLOCK) {
+    return;
+  }
+  // pairs with the fence in wait_for_space: either the producer sees the room
+  // we just made, or we see that it is blocked.
+  atomic_thread_fence(memory_order_seq_cst);
+  if (pool->blocked > 0) {
+    pthread_mutex_lock(&pool->mu);
+    pthread_cond_signal(&pool->space);
+    pthread_mutex_unlock(&pool->mu);
+  }
+}
+
+// A work item on a worker's deque, with the time it was queued.
+struct boxed_work {
+  threadpool_work_t work;
+  long queued_ns;
+};
+
+// Returns a malloc'd copy of work, queued at time t, to push onto a deque.
+struct boxed_work *box(threadpool_work_t work, long t) {
+  struct boxed_work *item = malloc(sizeof(struct boxed_work));
+  assert(item);
+  item->work = work;
+  item->queued_ns = t;
+  return item;
+}
+
+// Copies a work item taken from a deque to w, counts its queue wait, and frees
+// it. Returns 0 if item is NULL.
+int unbox(struct targ *arg, struct boxed_work *item, threadpool_work_t *w) {
+  if (!item) {
+    return 0;
+  }
+  *w = item->work;
+  record_wait(arg, Q_OF(*w), item->queued_ns, now_ns());
+  free(item);
+  return 1;
+}
+
+// Takes work from the pool's lists, picked with pick_list. When stealing and
+// the work is normal priority, a fair share of the rest of the list, up to
+// INJECT_BATCH items, is moved to the worker's deque so that other workers can
+// steal it without going through the mutex.
+//
+// Returns 0 if the lists are empty or the pool is STOPPING.
+int take_listed(struct targ *arg, threadpool_work_t *w) {
+  threadpool_t pool = arg->pool;
+  if (!lists_len(pool)) {
+    return 0;
+  }
+  pthread_mutex_lock(&pool->mu);
+  long now = now_ns();
+  int q = pick_list(pool, now);
+  if (q < 0 || pool->state == THREADPOOL_STATE_STOPPING) {
+    pthread_mutex_unlock(&pool->mu);
+    return 0;
+  }
+  // a fair share, rounded up so that it is at least one and at most n.
+  int n = pool->queued_len[q];
+  int nthreads = pool->config.nthreads;
+  int batch = pool->deques && q == Q_NORMAL
+                  ? min((n + nthreads - 1) / nthreads, INJECT_BATCH)
+                  : 1;
+  for (int i = 0; i < batch; i++) {
+    struct ll *node = list_pop(pool, q);
+    if (i == 0) {
+      record_wait(arg, q, node->queued_ns, now);
+      *w = node->work;
+    } else {
+      // the rest keep their time, so the wait counts from when they were added.
+      deque_push(pool->deques[arg->id], box(node->work, node->queued_ns));
+    }
+    ll_store_put(&pool->nodes, node);
+  }
+  pthread_mutex_unlock(&pool->mu);
+  if (pool->ring) {
+    ring_space(pool);
+  }
+  wake_idle(pool, batch - 1);
+  return 1;
+}
+
+// Takes work from the pool's ring and counts its queue wait. Returns 0 if the
+// ring is empty.
+int take_ring(struct targ *arg, threadpool_work_t *w) {
+  threadpool_t pool = arg->pool;
+  long queued_ns;
+  if (!ring_pop(pool->ring, w, &queued_ns)) {
+    return 0;
+  }
+  record_wait(arg, Q_NORMAL, queued_ns, now_ns());
+  ring_space(pool);
+  return 1;
+}
+
+// Takes one work item from the pool's queue: the ring, if the pool has one,
+// else the lists (see take_listed). The ring only holds normal priority work,
+// so it is skipped while there is high priority work or work that has aged.
+//
+// Returns 0 if the queue is empty, or if only the lists have work and the pool
+// is STOPPING.
+int take_queued(struct targ *arg, threadpool_work_t *w) {
+  threadpool_t pool = arg->pool;
+  int ring_first = pool->ring && !pool->queued_len[Q_HIGH] && !lists_aged(pool);
+  if (ring_first && take_ring(arg, w)) {
+    return 1;
+  }
+  if (take_listed(arg, w)) {
+    return 1;
+  }
+  return pool->ring && !ring_first && take_ring(arg, w);
+}
 
-    // Do the work and call the callback with the returned value (if the
-    // callback is non-null).
-    void *work_result = w.fn(w.work);
-    if (w.cb) {
-      w.cb(work_result);
+// Steals the oldest work item from another worker's deque, visiting every
+// other worker once starting from a random one. Returns 0 if none was found.
+int steal_work(struct targ *arg, threadpool_work_t *w) {
+  threadpool_t pool = arg->pool;
+  int n = pool->config.nthreads;
+  int numa = pool->config.numa;
+  int start = rand_r(&arg->seed) % n;
+  // when grouping by node, the first pass only visits workers on the same
+  // node, and the second the rest.
+  for (int pass = numa ? 0 : 1; pass < 2; pass++) {
+    for (int i = 0; i < n; i++) {
+      int victim = (start + i) % n;
+      int same_node = pool->targs[victim].node == arg->node;
+      if (victim == arg->id || (numa && same_node != (pass == 0))) {
+        continue;
+      }
+      if (unbox(arg, deque_steal(pool->deques[victim]), w)) {
+        stat_add(&arg->stats->steals, 1);
+        return 1;
+      }
     }
-    // update counters; protected by the mutex.
-    pthread_mutex_lock(&arg->pool->mu);
-    arg->pool->counters.completed_work++;
-    pthread_mutex_unlock(&arg->pool->mu);
   }
+  return 0;
+}
+
+// Finds a work item for a worker that tracks ready work: queued high priority
+// work, else the newest item in its own deque, else queued work, else stolen
+// work. Returns 0 if none was found.
+//
+// Updates the pool's ready counter and the worker's stats when work is found.
+int find_work(struct targ *arg, threadpool_work_t *w) {
+  threadpool_t pool = arg->pool;
+  int found = (pool->queued_len[Q_HIGH] && take_listed(arg, w)) ||
+              (pool->deques &&
+               unbox(arg, deque_pop(pool->deques[arg->id]), w)) ||
+              take_queued(arg, w) || (pool->deques && steal_work(arg, w));
+  if (found) {
+    pool->ready--;
+    stat_add(&arg->stats->taken[Q_OF(*w)], 1);
+  }
+  return found;
+}
+
+void *tp_ready_worker(void *work) {
+  struct targ *arg = work;
+  threadpool_t pool = arg->pool;
+  current_worker = arg;
+  threadpool_work_t w;
+  while (pool->state != THREADPOOL_STATE_STOPPING) {
+    if (!find_work(arg, &w)) {
+      if (ready_is_stop(pool)) {
+        break;
+      }
+      idle_wait(arg);
+      continue;
+    }
+    run_work(arg, w);
+  }
+  current_worker = NULL;
   return NULL;
 }
 
+// Worker for pools with persistent workers. Runs the pool's worker loop once
+// for each start, and parks in between, until the pool is destroyed.
+//
+// Each start unparks every worker, and threadpool_stop waits until every worker
+// has run its loop and parked again. A worker that only wakes after the pool
+// began stopping still runs its loop, so that a DRAIN stop runs the queued work
+// even if the pool is stopped right after it is started.
+void *tp_persistent_worker(void *work) {
+  struct targ *arg = work;
+  threadpool_t pool = arg->pool;
+  void *(*worker)(void *) = USES_READY(pool) ? tp_ready_worker : tp_worker;
+  unsigned long starts = 0;
+  pthread_mutex_lock(&pool->mu);
+  while (1) {
+    while (pool->starts == starts && !pool->exiting) {
+      pthread_cond_wait(&pool->unpark, &pool->mu);
+    }
+    if (pool->exiting) {
+      break;
+    }
+    starts = pool->starts;
+    pthread_mutex_unlock(&pool->mu);
+    worker(arg);
+    pthread_mutex_lock(&pool->mu);
+    if (++pool->nparked == pool->config.nthreads) {
+      // the last worker to park lets threadpool_stop finish.
+      pthread_cond_broadcast(&pool->parked);
+    }
+  }
+  pthread_mutex_unlock(&pool->mu);
+  return NULL;
+}
+
+// Returns whether the calling thread is one of tp's workers.
+int is_own_worker(threadpool_t tp) {
+  return current_worker && current_worker->pool == tp;
+}
+
+int threadpool_worker_id(threadpool_t tp) {
+  return is_own_worker(tp) ? current_worker->id : -1;
+}
+
+// Pushes work onto the calling worker's deque if it is a worker of tp and tp is
+// RUNNING. Returns 0 if the work must go through the pool's queue instead.
+int steal_push_local(threadpool_t tp, const threadpool_work_t *work, int n) {
+  if (!is_own_worker(tp) || tp->state != THREADPOOL_STATE_RUNNING) {
+    return 0;
+  }
+  // count the work before it can be taken.
+  tp->counters.added[Q_NORMAL] += n;
+  tp->ready += n;
+  long t = now_ns();
+  for (int i = 0; i < n; i++) {
+    deque_push(tp->deques[current_worker->id], box(work[i], t));
+  }
+  wake_idle(tp, n);
+  return 1;
+}
+
+// Adds work to the queued_work list for its priority, or to paused_work if the
+// pool is not RUNNING, under the pool's mutex. Returns n.
+int list_add(threadpool_t tp, const threadpool_work_t *work, int n) {
+  int ids[WAKE_BATCH];
+  int wake = 0;
+  long t = now_ns();
+  pthread_mutex_lock(&tp->mu);
+  ll_store_reserve(&tp->nodes, n);
+  if (tp->state != THREADPOOL_STATE_RUNNING) {
+    DEBUG_PRINT("queueing work in secondary queue...\n");
+    for (int i = 0; i < n; i++) {
+      struct ll *node = ll_store_get(&tp->nodes);
+      node->queued_ns = t;
+      int q = Q_OF(work[i]);
+      tp->paused_work[q] = ll_add_node(tp->paused_work[q], node, work[i]);
+    }
+  } else {
+    DEBUG_PRINT("adding work...\n");
+    for (int i = 0; i < n; i++) {
+      list_put(tp, work[i], t);
+    }
+    tp->ready += n;
+    // wake one sleeping worker per item; the others keep sleeping.
+    wake = take_sleepers(tp, min(n, WAKE_BATCH), ids);
+  }
+  for (int i = 0; i < n; i++) {
+    tp->counters.added[Q_OF(work[i])]++;
+  }
+  pthread_mutex_unlock(&tp->mu);
+  post_sleepers(tp, ids, wake);
+  if (n > WAKE_BATCH && wake == WAKE_BATCH) {
+    wake_idle(tp, n - wake);
+  }
+  return n;
+}
+
+// Blocks a producer until the ring may have room. Returns 0 if the pool stopped
+// running instead.
+int wait_for_space(threadpool_t tp) {
+  pthread_mutex_lock(&tp->mu);
+  tp->blocked++;
+  // pairs with the fence in ring_space.
+  atomic_thread_fence(memory_order_seq_cst);
+  while (tp->state == THREADPOOL_STATE_RUNNING &&
+         (tp->queued_len[Q_NORMAL] ||
+          ring_size(tp->ring) >= ring_capacity(tp->ring))) {
+    pthread_cond_wait(&tp->space, &tp->mu);
+  }
+  tp->blocked--;
+  int running = tp->state == THREADPOOL_STATE_RUNNING;
+  pthread_mutex_unlock(&tp->mu);
+  return running;
+}
+
+// Adds normal priority work to a RUNNING pool with a ring. Work goes into the
+// ring while it has room and the normal list is empty; after that, the pool's
+// full policy decides. Returns the number of items added.
+int ring_add(threadpool_t tp, const threadpool_work_t *work, int n) {
+  int added = 0;
+  while (added < n) {
+    // count the work before it can be taken, then uncount what did not fit.
+    int left = n - added;
+    tp->counters.added[Q_NORMAL] += left;
+    tp->ready += left;
+    int pushed = 0;
+    long t = now_ns();
+    while (pushed < left && !tp->queued_len[Q_NORMAL] &&
+           ring_push(tp->ring, work[added + pushed], t)) {
+      pushed++;
+    }
+    tp->counters.added[Q_NORMAL] -= left - pushed;
+    tp->ready -= left - pushed;
+    wake_idle(tp, pushed);
+    added += pushed;
+    if (added == n) {
+      break;
+    }
+    // the ring is full.
+    enum threadpool_full_policy policy = tp->config.full_policy;
+    if (policy == THREADPOOL_FULL_FAIL) {
+      break;
+    }
+    if (policy == THREADPOOL_FULL_SPILL || is_own_worker(tp) ||
+        !wait_for_space(tp)) {
+      added += list_add(tp, work + added, n - added);
+    }
+  }
+  return added;
+}
+
+// Runs submitted work, then completes its future and wakes any threads waiting
+// on the pool's futures.
+void *future_run(void *arg) {
+  struct threadpool_future *f = arg;
+  threadpool_t pool = f->pool;
+  void *result = f->work.fn(f->work.work);
+  if (f->work.cb) {
+    f->work.cb(result);
+  }
+  f->result = result;
+  // f may be freed as soon as done is set. Paired with the waiting increment
+  // in future_wait_for: either the waiter sees done, or this sees the waiter.
+  atomic_store(&f->done, 1);
+  if (atomic_load(&pool->waiting)) {
+    pthread_mutex_lock(&pool->done_mu);
+    pthread_cond_broadcast(&pool->done);
+    pthread_mutex_unlock(&pool->done_mu);
+  }
+  return result;
+}
+
+// Returns the index of a completed future among the first n, or -1. If all is
+// set, returns -1 unless every future has completed.
+int future_find_done(threadpool_future_t *futures, int n, int all) {
+  for (int i = 0; i < n; i++) {
+    int done = atomic_load(&futures[i]->done);
+    if (done && !all) {
+      return i;
+    }
+    if (!done && all) {
+      return -1;
+    }
+  }
+  return all && n > 0 ? 0 : -1;
+}
+
+// Blocks until future_find_done(futures, n, all) finds a future, and returns
+// its index.
+int future_wait_for(threadpool_future_t *futures, int n, int all) {
+  int i = future_find_done(futures, n, all);
+  if (i >= 0 || n <= 0) {
+    return i;
+  }
+  threadpool_t pool = futures[0]->pool;
+  for (int j = 1; j < n; j++) {
+    assert(futures[j]->pool == pool);
+  }
+  pthread_mutex_lock(&pool->done_mu);
+  atomic_fetch_add(&pool->waiting, 1);
+  while ((i = future_find_done(futures, n, all)) < 0) {
+    pthread_cond_wait(&pool->done, &pool->done_mu);
+  }
+  atomic_fetch_sub(&pool->waiting, 1);
+  pthread_mutex_unlock(&pool->done_mu);
+  return i;
+}
+
+// Returns the entry for CPU cpu among n, or NULL.
+struct cpu_info *find_cpu(struct cpu_info *cpus, int n, int cpu) {
+  for (int i = 0; i < n; i++) {
+    if (cpus[i].cpu == cpu) {
+      return &cpus[i];
+    }
+  }
+  return NULL;
+}
+
+// Returns whether a CPU on the same physical core as c is among the first n.
+int has_core(struct cpu_info *cpus, int n, struct cpu_info *c) {
+  for (int i = 0; i < n; i++) {
+    if (cpus[i].package == c->package && cpus[i].core == c->core) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Sorts n CPUs by node, keeping the order of CPUs on the same node.
+void sort_by_node(struct cpu_info *cpus, int n) {
+  for (int i = 1; i < n; i++) {
+    struct cpu_info c = cpus[i];
+    int j = i;
+    for (; j > 0 && cpus[j - 1].node > c.node; j--) {
+      cpus[j] = cpus[j - 1];
+    }
+    cpus[j] = c;
+  }
+}
+
+// Decides where each worker runs, as configured by the affinity, cpus and numa
+// fields of the pool's config, setting the pinned, cpus, cpu and node fields of
+// its targ. See thread_pool.h.
+void place_workers(threadpool_t pool) {
+  threadpool_config_t *cfg = &pool->config;
+  for (int i = 0; i < cfg->nthreads; i++) {
+    pool->targs[i].pinned = 0;
+    CPU_ZERO(&pool->targs[i].cpus);
+    pool->targs[i].cpu = -1;
+    pool->targs[i].node = -1;
+  }
+  if (cfg->affinity == THREADPOOL_AFFINITY_NONE && !cfg->numa) {
+    return;
+  }
+  int n;
+  struct cpu_info *all = topology_cpus(&n);
+  // the CPUs to pin workers to, in order.
+  struct cpu_info *pins = malloc(max(n, cfg->ncpus) * sizeof(struct cpu_info));
+  assert(pins);
+  int npins = 0;
+  if (cfg->affinity == THREADPOOL_AFFINITY_CPUS) {
+    for (int i = 0; i < cfg->ncpus; i++) {
+      struct cpu_info *c = find_cpu(all, n, cfg->cpus[i]);
+      if (c) {
+        pins[npins++] = *c;
+      }
+    }
+  } else if (cfg->affinity == THREADPOOL_AFFINITY_CORES) {
+    for (int i = 0; i < n; i++) {
+      if (!has_core(pins, npins, &all[i])) {
+        pins[npins++] = all[i];
+      }
+    }
+  }
+  if (cfg->numa) {
+    sort_by_node(pins, npins);
+    sort_by_node(all, n);
+  }
+  // the distinct nodes, in order, for unpinned pools grouped by node.
+  int *nodes = malloc(n * sizeof(int));
+  assert(nodes);
+  int nnodes = 0;
+  for (int i = 0; i < n; i++) {
+    if (!nnodes || nodes[nnodes - 1] != all[i].node) {
+      nodes[nnodes++] = all[i].node;
+    }
+  }
+  for (int i = 0; i < cfg->nthreads; i++) {
+    struct targ *t = &pool->targs[i];
+    if (npins) {
+      struct cpu_info *c = &pins[i % npins];
+      CPU_SET(c->cpu, &t->cpus);
+      t->pinned = 1;
+      t->cpu = c->cpu;
+      t->node = cfg->numa ? c->node : -1;
+    } else if (cfg->numa && nnodes) {
+      // split the workers evenly across the nodes.
+      t->node = nodes[(long)i * nnodes / cfg->nthreads];
+      for (int j = 0; j < n; j++) {
+        if (all[j].node == t->node) {
+          CPU_SET(all[j].cpu, &t->cpus);
+        }
+      }
+      t->pinned = 1;
+    }
+  }
+  free(nodes);
+  free(pins);
+  free(all);
+}
+
+// Maps zero-filled memory for size bytes per worker, with each node's workers
+// on pages of their own when grouping by node. Sets offset[i] to the offset of
+// worker i's bytes and len to the length of the mapping.
+void *map_by_node(threadpool_t pool, size_t size, size_t *offset,
+                  size_t *len) {
+  int n = pool->config.nthreads;
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t end = 0;
+  int *placed = calloc(n, sizeof(int));
+  assert(placed);
+  for (int i = 0; i < n; i++) {
+    if (placed[i]) {
+      continue;
+    }
+    end = (end + page - 1) / page * page;
+    for (int j = i; j < n; j++) {
+      if (!placed[j] && pool->targs[j].node == pool->targs[i].node) {
+        placed[j] = 1;
+        offset[j] = end;
+        end += size;
+      }
+    }
+  }
+  free(placed);
+  *len = max((end + page - 1) / page * page, page);
+  void *mem = mmap(NULL, *len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  assert(mem != MAP_FAILED);
+  return mem;
+}
+
+// Allocates the workers' stats with map_by_node. The pages are only backed by
+// memory when a worker first writes its stats, so the kernel places them on
+// the node of the worker's CPU.
+void alloc_stats(threadpool_t pool) {
+  int n = pool->config.nthreads;
+  size_t *offset = malloc(n * sizeof(size_t));
+  assert(offset);
+  pool->stats_mem = map_by_node(pool, sizeof(struct tp_stats), offset,
+                                &pool->stats_len);
+  // all-zero is a valid initial state for the stats' atomics.
+  for (int i = 0; i < n; i++) {
+    pool->targs[i].stats = (struct tp_stats *)((char *)pool->stats_mem +
+                                               offset[i]);
+  }
+  free(offset);
+}
+
+// Sets the memory policy of the pages holding [addr, addr + len) to prefer
+// node. Errors are ignored: on a kernel without NUMA support the pages simply
+// stay where the kernel puts them.
+void bind_to_node(void *addr, size_t len, int node) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  uintptr_t start = (uintptr_t)addr / page * page;
+  uintptr_t end = ((uintptr_t)addr + len + page - 1) / page * page;
+  unsigned long mask[node / (8 * sizeof(unsigned long)) + 1];
+  memset(mask, 0, sizeof(mask));
+  mask[node / (8 * sizeof(unsigned long))] |=
+      1ul << (node % (8 * sizeof(unsigned long)));
+  // the kernel reads maxnode - 1 bits of the mask.
+  syscall(SYS_mbind, start, end - start, MPOL_PREFERRED, mask,
+          sizeof(mask) * 8 + 1, 0);
+}
+
+// Allocates the workers' deques with map_by_node. The deques are initialized
+// by the creating thread, so first touch would place them on its node; when
+// grouping by node, each worker's pages are bound to its node first instead.
+void alloc_deques(threadpool_t pool) {
+  int n = pool->config.nthreads;
+  size_t size = deque_bytes(DEQUE_LOG_SIZE);
+  size_t *offset = malloc(n * sizeof(size_t));
+  assert(offset);
+  pool->deques_mem = map_by_node(pool, size, offset, &pool->deques_len);
+  pool->deques = calloc(n, sizeof(struct deque *));
+  assert(pool->deques);
+  for (int i = 0; i < n; i++) {
+    void *mem = (char *)pool->deques_mem + offset[i];
+    if (pool->targs[i].node >= 0) {
+      bind_to_node(mem, size, pool->targs[i].node);
+    }
+    pool->deques[i] = deque_init(mem, DEQUE_LOG_SIZE);
+  }
+  free(offset);
+}
+
+// Creates the thread for worker i, running fn and pinned as decided by
+// place_workers.
+void create_worker(threadpool_t pool, int i, void *(*fn)(void *)) {
+  struct targ *t = &pool->targs[i];
+  pthread_attr_t attr;
+  assertz(pthread_attr_init(&attr));
+  if (t->pinned) {
+    assertz(pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &t->cpus));
+  }
+  assertz(pthread_create(&pool->threads[i], &attr, fn, t));
+  pthread_attr_destroy(&attr);
+}
+
 threadpool_t threadpool_create(threadpool_config_t config) {
   struct threadpool *p = malloc(sizeof(struct threadpool));
   p->config = config;
 
-  // initialize mutex and condition variable.
+  // initialize mutex.
   assertz(pthread_mutex_init(&p->mu, NULL));
-  assertz(pthread_cond_init(&p->avail, NULL));
 
   p->threads = calloc(config.nthreads, sizeof(pthread_t));
   p->targs = calloc(config.nthreads, sizeof(struct targ));
-  p->queued_work = NULL;
-  p->paused_work = NULL;
+  for (int i = 0; i < config.nthreads; i++) {
+    p->targs[i].pool = p;
+    p->targs[i].id = i;
+    p->targs[i].seed = i + 1;
+    assertz(sem_init(&p->targs[i].wake, 0, 0));
+  }
+  p->sleepers = calloc(config.nthreads, sizeof(int));
+  atomic_init(&p->idle, 0);
+  for (int q = 0; q < THREADPOOL_PRIORITIES; q++) {
+    p->queued_work[q] = NULL;
+    p->paused_work[q] = NULL;
+    atomic_init(&p->queued_len[q], 0);
+    atomic_init(&p->head_ns[q], 0);
+  }
+  p->aging_ns =
+      (long)(config.aging_ms ? config.aging_ms : DEFAULT_AGING_MS) * 1000000;
+  ll_store_init(&p->nodes);
   // initial state is stopped.
   p->state = THREADPOOL_STATE_STOPPED;
-  memset(&p->counters, 0, sizeof(threadpool_counters_t));
+  for (int q = 0; q < THREADPOOL_PRIORITIES; q++) {
+    atomic_init(&p->counters.added[q], 0);
+  }
+  place_workers(p);
+  alloc_stats(p);
+
+  p->ring = NULL;
+  if (config.queue_capacity) {
+    p->ring = ring_create(config.queue_capacity);
+  }
+  assertz(pthread_cond_init(&p->space, NULL));
+  atomic_init(&p->blocked, 0);
+
+  p->deques = NULL;
+  p->deques_mem = NULL;
+  atomic_init(&p->ready, 0);
+  assertz(pthread_mutex_init(&p->done_mu, NULL));
+  assertz(pthread_cond_init(&p->done, NULL));
+  atomic_init(&p->waiting, 0);
+  if (config.mode == THREADPOOL_MODE_STEALING) {
+    alloc_deques(p);
+  }
+
+  assertz(pthread_cond_init(&p->unpark, NULL));
+  assertz(pthread_cond_init(&p->parked, NULL));
+  p->starts = 0;
+  p->nparked = config.nthreads; // workers are parked until the first start
+  p->exiting = 0;
+  // persistent workers start now and park until the pool starts.
+  for (int i = 0; config.persistent && i < config.nthreads; i++) {
+    create_worker(p, i, tp_persistent_worker);
+  }
 
   return p;
 }
@@ -126,51 +1116,162 @@ int threadpool_start(threadpool_t tp) {
   }
 
   // join work queues
-  if (tp->paused_work) {
-    tp->queued_work = ll_join(tp->queued_work, tp->paused_work);
-    tp->paused_work = NULL; // clear paused work
+  for (int q = 0; q < THREADPOOL_PRIORITIES; q++) {
+    if (tp->paused_work[q]) {
+      int n = ll_poll(tp->paused_work[q]);
+      tp->ready += n;
+      tp->queued_len[q] += n;
+      tp->queued_work[q] = ll_join(tp->queued_work[q], tp->paused_work[q]);
+      tp->paused_work[q] = NULL; // clear paused work
+      update_head(tp, q);
+    }
+  }
+  // move as much of the normal queue as fits into the ring, oldest first.
+  while (tp->ring && tp->queued_work[Q_NORMAL] &&
+         ring_push(tp->ring, tp->queued_work[Q_NORMAL]->tail->work,
+                   tp->queued_work[Q_NORMAL]->tail->queued_ns)) {
+    ll_store_put(&tp->nodes, list_pop(tp, Q_NORMAL));
   }
 
-  // start worker threads
-  for (int i = 0; i < tp->config.nthreads; i++) {
-    struct targ *arg = &tp->targs[i];
-    arg->pool = tp;
-    arg->id = i;
-    assertz(pthread_create(&tp->threads[i], NULL, tp_worker, arg));
+  tp->state = THREADPOOL_STATE_RUNNING;
+  if (tp->config.persistent) {
+    // wake the parked workers.
+    tp->starts++;
+    tp->nparked = 0;
+    pthread_cond_broadcast(&tp->unpark);
+  } else {
+    // start worker threads
+    void *(*worker)(void *) = USES_READY(tp) ? tp_ready_worker : tp_worker;
+    for (int i = 0; i < tp->config.nthreads; i++) {
+      create_worker(tp, i, worker);
+    }
   }
   DEBUG_PRINT("worker threads started...\n");
 
-  tp->state = THREADPOOL_STATE_RUNNING;
   pthread_mutex_unlock(&tp->mu);
   return THREADPOOL_STATE_RUNNING;
 }
 
-void threadpool_add(threadpool_t tp, threadpool_work_t work) {
-  assert(work.fn);
-  pthread_mutex_lock(&tp->mu);
-  if (tp->state != THREADPOOL_STATE_RUNNING) {
-    DEBUG_PRINT("queueing work in secondary queue...\n");
-    tp->paused_work = ll_add(tp->paused_work, work);
-  } else {
-    DEBUG_PRINT("adding work...\n");
-    tp->queued_work = ll_add(tp->queued_work, work);
+int threadpool_add(threadpool_t tp, threadpool_work_t work) {
+  return threadpool_add_batch(tp, &work, 1) == 1 ? 0 : -1;
+}
+
+int threadpool_add_batch(threadpool_t tp, const threadpool_work_t *work,
+                         int n) {
+  int normal = 1;
+  for (int i = 0; i < n; i++) {
+    assert(work[i].fn);
+    assert(work[i].priority >= THREADPOOL_PRIORITY_LOW &&
+           work[i].priority <= THREADPOOL_PRIORITY_HIGH);
+    normal &= work[i].priority == THREADPOOL_PRIORITY_NORMAL;
   }
-  tp->counters.queued_work++;
-  // if there is any thread waiting, wake them.
-  // TODO: depending on your implementation, this may need to be
-  // pthread_cond_signal or pthread_cond_broadcast
-  pthread_cond_broadcast(&tp->avail);
-  pthread_mutex_unlock(&tp->mu);
+  if (n <= 0) {
+    return 0;
+  }
+  if (!normal) {
+    // only the lists order work by priority.
+    return list_add(tp, work, n);
+  }
+  if (tp->deques && steal_push_local(tp, work, n)) {
+    return n;
+  }
+  if (tp->ring && tp->state == THREADPOOL_STATE_RUNNING) {
+    return ring_add(tp, work, n);
+  }
+  return list_add(tp, work, n);
+}
+
+threadpool_future_t threadpool_submit(threadpool_t tp, threadpool_work_t work) {
+  threadpool_future_t f;
+  threadpool_submit_batch(tp, &work, 1, &f);
+  return f;
+}
+
+int threadpool_submit_batch(threadpool_t tp, const threadpool_work_t *work,
+                            int n, threadpool_future_t *futures) {
+  if (n <= 0) {
+    return 0;
+  }
+  threadpool_work_t *run = malloc(n * sizeof(threadpool_work_t));
+  assert(run);
+  for (int i = 0; i < n; i++) {
+    assert(work[i].fn);
+    futures[i] = malloc(sizeof(struct threadpool_future));
+    assert(futures[i]);
+    futures[i]->pool = tp;
+    futures[i]->work = work[i];
+    futures[i]->result = NULL;
+    atomic_init(&futures[i]->done, 0);
+    run[i] =
+        (threadpool_work_t){future_run, futures[i], NULL, work[i].priority};
+  }
+  int added = threadpool_add_batch(tp, run, n);
+  // work that was not added never runs; its futures are dropped.
+  for (int i = added; i < n; i++) {
+    free(futures[i]);
+    futures[i] = NULL;
+  }
+  free(run);
+  return added;
+}
+
+void *threadpool_future_wait(threadpool_future_t f) {
+  future_wait_for(&f, 1, 0);
+  return f->result;
+}
+
+int threadpool_future_try_get(threadpool_future_t f, void **result) {
+  if (!atomic_load(&f->done)) {
+    return 0;
+  }
+  if (result) {
+    *result = f->result;
+  }
+  return 1;
+}
+
+void threadpool_future_wait_all(threadpool_future_t *futures, int n) {
+  future_wait_for(futures, n, 1);
+}
+
+int threadpool_future_wait_any(threadpool_future_t *futures, int n) {
+  assert(n > 0);
+  return future_wait_for(futures, n, 0);
+}
+
+void threadpool_future_free(threadpool_future_t f) {
+  assert(atomic_load(&f->done));
+  free(f);
 }
 
 void threadpool_destroy(threadpool_t tp) {
   // pool must be stopped and worker threads joined.
   assert(tp->state == THREADPOOL_STATE_STOPPED);
+  if (tp->config.persistent) {
+    pthread_mutex_lock(&tp->mu);
+    tp->exiting = 1;
+    pthread_cond_broadcast(&tp->unpark);
+    pthread_mutex_unlock(&tp->mu);
+    for (int i = 0; i < tp->config.nthreads; i++) {
+      pthread_join(tp->threads[i], NULL);
+    }
+  }
   // free the pool.
-  ll_free(tp->queued_work);
-  ll_free(tp->paused_work);
+  ll_store_free(&tp->nodes);
+  if (tp->ring) {
+    ring_free(tp->ring);
+  }
+  if (tp->deques) {
+    for (int i = 0; i < tp->config.nthreads; i++) {
+      deque_free(tp->deques[i]);
+    }
+    free(tp->deques);
+    munmap(tp->deques_mem, tp->deques_len);
+  }
   free(tp->threads);
   free(tp->targs);
+  free(tp->sleepers);
+  munmap(tp->stats_mem, tp->stats_len);
   free(tp);
 }
 
@@ -187,12 +1288,32 @@ int threadpool_stop(threadpool_t tp, int options) {
     tp->state = THREADPOOL_STATE_DRAINING;
   }
   // wake any waiting threads
-  pthread_cond_broadcast(&tp->avail);
-  pthread_mutex_unlock(&tp->mu);
-  for (int i = 0; i < tp->config.nthreads; i++) {
-    pthread_join(tp->threads[i], NULL);
+  while (tp->idle > 0) {
+    int id = tp->sleepers[--tp->idle];
+    sem_post(&tp->targs[id].wake);
+  }
+  pthread_cond_broadcast(&tp->space);
+  if (tp->config.persistent) {
+    // wait for the workers to finish and park.
+    while (tp->nparked < tp->config.nthreads) {
+      pthread_cond_wait(&tp->parked, &tp->mu);
+    }
+  } else {
+    pthread_mutex_unlock(&tp->mu);
+    for (int i = 0; i < tp->config.nthreads; i++) {
+      pthread_join(tp->threads[i], NULL);
+    }
+    pthread_mutex_lock(&tp->mu);
+  }
+  // move work left in the deques back to the injector, oldest first, so that it
+  // runs after the next start. It keeps the time it was first queued.
+  for (int i = 0; tp->deques && i < tp->config.nthreads; i++) {
+    struct boxed_work *item;
+    while ((item = deque_steal(tp->deques[i]))) {
+      list_put(tp, item->work, item->queued_ns);
+      free(item);
+    }
   }
-  pthread_mutex_lock(&tp->mu);
   DEBUG_PRINT("add threads stopped, state = STOPPED\n");
   tp->state = THREADPOOL_STATE_STOPPED;
   pthread_mutex_unlock(&tp->mu);
@@ -200,9 +1321,99 @@ int threadpool_stop(threadpool_t tp, int options) {
 }
 
 threadpool_counters_t threadpool_counters(threadpool_t tp) {
-  // return the current counters
-  pthread_mutex_lock(&tp->mu);
-  threadpool_counters_t c = tp->counters;
-  pthread_mutex_unlock(&tp->mu);
+  // add up the workers' counters. work is counted as added before it can be
+  // taken, so reading the taken counts first keeps the queued counts from going
+  // negative.
+  threadpool_counters_t c;
+  memset(&c, 0, sizeof(c));
+  unsigned long taken[THREADPOOL_PRIORITIES] = {0};
+  for (int i = 0; i < tp->config.nthreads; i++) {
+    struct tp_stats *s = tp->targs[i].stats;
+    for (int q = 0; q < THREADPOOL_PRIORITIES; q++) {
+      threadpool_priority_counters_t *p = &c.priority[q];
+      taken[q] += s->taken[q];
+      p->completed_work += s->completed[q];
+      p->timed_work += s->timed[q];
+      p->wait_ns += s->wait_ns[q];
+      p->max_wait_ns = max(p->max_wait_ns, (unsigned long)s->max_wait_ns[q]);
+    }
+  }
+  for (int q = 0; q < THREADPOOL_PRIORITIES; q++) {
+    threadpool_priority_counters_t *p = &c.priority[q];
+    p->queued_work = tp->counters.added[q] - taken[q];
+    c.completed_work += p->completed_work;
+    c.queued_work += p->queued_work;
+  }
   return c;
 }
+
+// Adds a worker's stats to out. The idle time includes the worker's current
+// wait for work, if any, up to now.
+void read_stats(struct tp_stats *s, long now, threadpool_worker_stats_t *out) {
+  for (int q = 0; q < THREADPOOL_PRIORITIES; q++) {
+    out->completed_work += s->completed[q];
+  }
+  out->steals += s->steals;
+  out->busy_ns += s->busy_ns;
+  long since = s->idle_since;
+  out->idle_ns += s->idle_ns + (since && now > since ? now - since : 0);
+  for (int b = 0; b < THREADPOOL_HIST_BUCKETS; b++) {
+    out->wait.count[b] += s->wait_hist[b];
+    out->run.count[b] += s->run_hist[b];
+  }
+}
+
+// Adds the stats in w to total.
+void sum_stats(threadpool_worker_stats_t *total,
+               const threadpool_worker_stats_t *w) {
+  total->completed_work += w->completed_work;
+  total->steals += w->steals;
+  total->busy_ns += w->busy_ns;
+  total->idle_ns += w->idle_ns;
+  for (int b = 0; b < THREADPOOL_HIST_BUCKETS; b++) {
+    total->wait.count[b] += w->wait.count[b];
+    total->run.count[b] += w->run.count[b];
+  }
+}
+
+threadpool_stats_t *threadpool_stats(threadpool_t tp) {
+  int n = tp->config.nthreads;
+  threadpool_stats_t *stats = malloc(sizeof(threadpool_stats_t) +
+                                     n * sizeof(threadpool_worker_stats_t));
+  assert(stats);
+  memset(stats, 0, sizeof(threadpool_stats_t) +
+                        n * sizeof(threadpool_worker_stats_t));
+  stats->counters = threadpool_counters(tp);
+  stats->nthreads = n;
+  long now = now_ns();
+  for (int i = 0; i < n; i++) {
+    read_stats(tp->targs[i].stats, now, &stats->workers[i]);
+    sum_stats(&stats->total, &stats->workers[i]);
+    stats->workers[i].cpu = tp->targs[i].cpu;
+    stats->workers[i].node = tp->targs[i].node;
+  }
+  stats->total.cpu = -1;
+  stats->total.node = -1;
+  return stats;
+}
+
+void threadpool_stats_free(threadpool_stats_t *stats) { free(stats); }
+
+unsigned long threadpool_histogram_quantile(const threadpool_histogram_t *h,
+                                            double p) {
+  unsigned long total = 0;
+  for (int b = 0; b < THREADPOOL_HIST_BUCKETS; b++) {
+    total += h->count[b];
+  }
+  if (!total) {
+    return 0;
+  }
+  // the rank of the quantile, from 1 to total.
+  unsigned long rank = max(1ul, (unsigned long)(p * total + 0.5));
+  unsigned long seen = 0;
+  int b = 0;
+  while (b < THREADPOOL_HIST_BUCKETS - 1 && (seen += h->count[b]) < rank) {
+    b++;
+  }
+  return 2ul << b;
+}
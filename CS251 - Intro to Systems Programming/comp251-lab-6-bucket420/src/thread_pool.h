@@ -30,6 +30,12 @@
 //
 //     ...
 //
+//     threadpool_work_t many_work[<n>];
+//     ...
+//     threadpool_add_batch(tp, many_work, <n>);  // adds all n at once
+//
+//     ...
+//
 //     threadpool_stop(tp, THREADPOOL_STOP_WAIT);
 //     threadpool_destroy(tp);
 //
@@ -90,6 +96,175 @@
 //         nothing and accept a single void* parameter. the callback may be
 //         NULL. in most cases the callback is unnecessary and the typical use
 //         case will make cb NULL.
+//
+// - priority: the priority of the work; see below. zero-initialized work is
+//             THREADPOOL_PRIORITY_NORMAL.
+//
+// Priorities
+// ----------
+//
+// Work has one of three priorities: high, normal (the default) and low. Each
+// priority has its own queue, and workers take queued work from the highest
+// priority queue that has any. Within a priority, work runs in the order it was
+// added.
+//
+// To keep a steady stream of high priority work from starving the rest, queued
+// work ages: once the oldest work of any priority has waited aging_ms (see
+// threadpool_config_t), it runs next, ahead of newer higher priority work.
+//
+// Only normal work uses the ring and, when stealing, the workers' deques. High
+// and low priority work always goes to the unbounded per-priority queues, so
+// the full policy never applies to it. Work in a worker's deque runs before
+// queued normal and low priority work, but high priority work runs first.
+//
+// threadpool_counters_t keeps queued and completed counts for each priority,
+// and the time queued work waited before a worker took it, whether from the
+// per-priority queues, the ring or a deque. Work a pool moves between them
+// keeps the time it was first added.
+//
+// Scheduling modes
+// ----------------
+//
+// The mode field of threadpool_config_t selects how work is handed to workers.
+// Configs should be zero-initialized so that unset fields take their defaults.
+//
+// - shared:   (default) all work goes through a single queue guarded by the
+//             pool's mutex. simple and fair, but every add and every dequeue
+//             takes the same lock.
+//
+// - stealing: each worker owns a deque. work added from inside a work
+//             function (i.e. by one of the pool's own workers) is pushed onto
+//             that worker's deque without locking; work added from any other
+//             thread goes to a shared injector queue. workers run their own
+//             newest work first, then take from the injector, and finally
+//             steal the oldest work from randomly chosen workers. suits
+//             fine-grained work and work that spawns more work.
+//
+// Both modes follow the same state machine and keep the same counters. Work
+// that is still in a worker's deque when the pool stops is moved back to the
+// injector and runs after the next start.
+//
+// Bounded queues
+// --------------
+//
+// By default the queue of a running pool (the injector, when stealing) is an
+// unbounded list guarded by the pool's mutex. Setting queue_capacity in
+// threadpool_config_t replaces it with a lock-free ring of that many items
+// (rounded up to a power of two), so that adding and taking work needs neither
+// the mutex nor an allocation. full_policy decides what an add does when the
+// ring is full:
+//
+// - spill: (default) the work goes to an unbounded overflow list. until the
+//          list is empty again, later work also goes to the list, so work still
+//          runs in the order it was added.
+//
+// - block: the add waits until the ring has room, or until the pool stops
+//          running, in which case the work is queued as in the stopped state.
+//          work added by the pool's own workers spills instead, since a worker
+//          waiting on itself would never wake.
+//
+// - fail:  the add returns without adding the work. see threadpool_add.
+//
+// The capacity only bounds the running queue. Work added while the pool is not
+// RUNNING is always queued, and work added by workers in stealing mode goes to
+// their deques as usual. Work queued while stopped that does not fit in the
+// ring when the pool starts is put in the overflow list.
+//
+// Persistent workers
+// ------------------
+//
+// By default threadpool_start creates the worker threads and threadpool_stop
+// joins them, so every start/stop cycle pays for creating nthreads threads.
+// Setting persistent in threadpool_config_t instead creates the workers once,
+// in threadpool_create. While the pool is STOPPED they park on a condition
+// variable, and threadpool_start and threadpool_stop only change the state and
+// wake or wait for the parked workers. The workers exit in threadpool_destroy.
+// The pool behaves the same either way; only the cost of the transitions and
+// the number of idle threads while STOPPED differ.
+//
+// Idle workers
+// ------------
+//
+// A worker that finds no work waits in up to three phases before it looks
+// again:
+//
+// - spin:  check for work idle_spins times, with a CPU pause hint in between.
+// - yield: check for work idle_yields more times, calling sched_yield in
+//          between.
+// - sleep: sleep until work is added or the pool stops.
+//
+// Both counts default to 0, so that idle workers sleep at once and use no CPU.
+// Spinning and yielding let a worker pick up work that arrives shortly after it
+// went idle without a context switch, at the cost of the CPU time spent
+// waiting; they only pay off when there are spare cores.
+//
+// Sleeping workers are kept on a stack, and each has its own wakeup. Adding n
+// items wakes at most n sleepers, the most recently idle first (whose caches
+// are warmest), and never a worker that is already awake.
+//
+// Placement
+// ---------
+//
+// By default workers run wherever the kernel schedules them. The affinity field
+// of threadpool_config_t pins each worker to a single CPU instead:
+//
+// - THREADPOOL_AFFINITY_CPUS pins worker i to cpus[i % ncpus], skipping CPUs
+//   the process may not run on.
+// - THREADPOOL_AFFINITY_CORES pins the workers to one CPU of each physical
+//   core in turn, so that no two share a core until every core has a worker.
+//
+// Setting numa groups the workers by NUMA node. The pinned CPUs are ordered by
+// node, so that consecutive workers share a node; an unpinned pool instead
+// splits the workers evenly across the nodes and pins each to all the CPUs of
+// its node. The per-worker memory of each node's workers (their deques and
+// stats) sits on pages of its own. The deques' pages are bound to the node with
+// mbind before they are initialized; the stats' pages are first written by the
+// worker, so the kernel places them on the worker's node. Deque arrays that
+// grow later are allocated by the owning worker. Idle workers steal from
+// workers on their own node before trying the others.
+//
+// CPU and node topology is read from /sys (see topology.h). The pinning is
+// applied when the worker threads are created: by threadpool_start, or by
+// threadpool_create for persistent workers. threadpool_stats reports the CPU
+// and node of each worker.
+//
+// Futures
+// -------
+//
+// threadpool_submit adds work like threadpool_add and returns a future for it.
+// The future is completed once the work function and the callback (if any)
+// have returned, and holds the work function's return value. Callers can poll a
+// future with threadpool_future_try_get or block on one or more futures with
+// threadpool_future_wait, threadpool_future_wait_all and
+// threadpool_future_wait_any. This lets a caller wait for a batch of work to
+// finish while the pool keeps running, rather than stopping the pool with
+// THREADPOOL_STOP_DRAIN.
+//
+//     threadpool_future_t f = threadpool_submit(tp, my_work);
+//     ...
+//     void *result = threadpool_future_wait(f);
+//     threadpool_future_free(f);
+//
+// Waiting does not start the pool: a future for work queued in a STOPPED pool
+// completes only after threadpool_start. Waiting from inside a work function
+// blocks that worker, so it only makes progress if other workers are free to
+// run the work being waited on. A completed future must be freed with
+// threadpool_future_free.
+//
+// Statistics
+// ----------
+//
+// Each worker keeps its own counters, padded to a cache line so that workers
+// never write to the same line, and threadpool_counters and threadpool_stats
+// add them up when called. Neither takes the pool's mutex or stops the pool;
+// values read while work is running may be slightly behind.
+//
+// Besides the counters, threadpool_stats returns for each worker the work it
+// completed and stole, the time it spent running work (busy) and waiting for
+// work (idle), and histograms of the queue wait and run time of its work, as
+// well as the same summed over all workers. Bucket i of a histogram counts
+// durations of 2^i up to 2^(i+1) ns; the first bucket also counts 0, and the
+// last everything longer.
 
 // Thread pool states. See above.
 enum tp_state {
@@ -99,12 +274,56 @@ enum tp_state {
   THREADPOOL_STATE_RUNNING,
 };
 
+// Work priorities. See above.
+enum threadpool_priority {
+  THREADPOOL_PRIORITY_LOW = -1,
+  THREADPOOL_PRIORITY_NORMAL = 0,
+  THREADPOOL_PRIORITY_HIGH = 1,
+};
+
+// Number of priorities, and the index of priority p in per-priority arrays,
+// from low (0) to high.
+#define THREADPOOL_PRIORITIES 3
+#define THREADPOOL_PRIORITY_INDEX(p) ((p)-THREADPOOL_PRIORITY_LOW)
+
+// Thread pool scheduling modes. See above.
+enum threadpool_mode {
+  THREADPOOL_MODE_SHARED,
+  THREADPOOL_MODE_STEALING,
+};
+
+// Where workers run. See above.
+enum threadpool_affinity {
+  THREADPOOL_AFFINITY_NONE,
+  THREADPOOL_AFFINITY_CPUS,
+  THREADPOOL_AFFINITY_CORES,
+};
+
+// What to do when adding work to a full ring. See above.
+enum threadpool_full_policy {
+  THREADPOOL_FULL_SPILL,
+  THREADPOOL_FULL_BLOCK,
+  THREADPOOL_FULL_FAIL,
+};
+
 // A thread pool.
 typedef struct threadpool *threadpool_t;
 
 // Thread pool construction parameters.
 typedef struct threadpool_config_t {
-  unsigned int nthreads; // number of worker threads to create
+  unsigned int nthreads;                   // number of worker threads
+  enum threadpool_mode mode;               // scheduling mode, default shared
+  unsigned int queue_capacity;             // ring size, 0 for an unbounded list
+  enum threadpool_full_policy full_policy; // what adds do when the ring is full
+  int persistent;                          // keep workers alive while STOPPED
+  unsigned int idle_spins;                 // spins before an idle worker sleeps
+  unsigned int idle_yields;                // yields after spinning, then sleep
+  unsigned int aging_ms;                   // wait before work runs regardless
+                                           //  of priority; 0 for 100 ms
+  enum threadpool_affinity affinity;       // where workers run; default any CPU
+  const int *cpus;                         // CPUs for THREADPOOL_AFFINITY_CPUS
+  int ncpus;                               // number of cpus
+  int numa;                                // group workers by NUMA node
 } threadpool_config_t;
 
 // Work function signature.
@@ -113,17 +332,62 @@ typedef void *(*threadpool_fn)(void *);
 typedef void (*threadpool_cb)(void *);
 
 typedef struct threadpool_work_t {
-  threadpool_fn fn; // work function to be called with work, must not be NULL
-  void *work;       // pointer to work, may be NULL
-  threadpool_cb cb; // callback function, may be NULL
+  threadpool_fn fn;                  // work function to be called with work,
+                                     //  must not be NULL
+  void *work;                        // pointer to work, may be NULL
+  threadpool_cb cb;                  // callback function, may be NULL
+  enum threadpool_priority priority; // priority, default NORMAL
 } threadpool_work_t;
 
+// A handle to the result of submitted work. See above.
+typedef struct threadpool_future *threadpool_future_t;
+
+// Counters for a single priority. See threadpool_counters_t.
+typedef struct threadpool_priority_counters_t {
+  unsigned int completed_work;
+  unsigned int queued_work;
+  unsigned int timed_work;   // work taken from the queue with its wait timed
+  unsigned long wait_ns;     // total wait of the timed work
+  unsigned long max_wait_ns; // longest wait of the timed work
+} threadpool_priority_counters_t;
+
 // Counters for retrieving thread pool stats.
 typedef struct threadpool_counters_t {
   unsigned int completed_work;
   unsigned int queued_work;
+  // the same, by priority; index with THREADPOOL_PRIORITY_INDEX.
+  threadpool_priority_counters_t priority[THREADPOOL_PRIORITIES];
 } threadpool_counters_t;
 
+// Number of buckets in a threadpool_histogram_t.
+#define THREADPOOL_HIST_BUCKETS 32
+
+// A histogram of durations. See above.
+typedef struct threadpool_histogram_t {
+  unsigned long count[THREADPOOL_HIST_BUCKETS];
+} threadpool_histogram_t;
+
+// Statistics of one worker, or of all workers. See above.
+typedef struct threadpool_worker_stats_t {
+  int cpu;                      // CPU the worker is pinned to, or -1
+  int node;                     // NUMA node of the worker when grouping by
+                                //  node, or -1
+  unsigned long completed_work; // work run
+  unsigned long steals;         // work stolen from other workers' deques
+  unsigned long busy_ns;        // time spent running work
+  unsigned long idle_ns;        // time spent waiting for work
+  threadpool_histogram_t wait;  // queue wait of timed work, in ns
+  threadpool_histogram_t run;   // run time of work, in ns
+} threadpool_worker_stats_t;
+
+// A snapshot of a pool's statistics. See above.
+typedef struct threadpool_stats_t {
+  threadpool_counters_t counters;      // as returned by threadpool_counters
+  threadpool_worker_stats_t total;     // summed over all workers
+  int nthreads;                        // number of workers
+  threadpool_worker_stats_t workers[]; // each worker's, by worker id
+} threadpool_stats_t;
+
 // Stop a thread pool by completing all in-flight work.
 #define THREADPOOL_STOP_WAIT 1
 // Stop a thread pool by completing all queued work.
@@ -170,9 +434,76 @@ int threadpool_stop(threadpool_t tp, int options);
 //
 // Work added to a DRAINING or STOPPING thread pool is queued until the
 // thread pool stops and then is later restarted.
-void threadpool_add(threadpool_t tp, threadpool_work_t work);
+//
+// Returns 0 if the work was added, or -1 if the pool has a full ring and its
+// full policy is THREADPOOL_FULL_FAIL.
+int threadpool_add(threadpool_t tp, threadpool_work_t work);
+
+// Add n work items to a thread pool.
+//
+// Equivalent to calling threadpool_add on each item in order, but takes the
+// pool's mutex at most once and wakes at most one idle worker per item.
+//
+// Returns the number of items added. This is less than n only if the pool has
+// a full ring and its full policy is THREADPOOL_FULL_FAIL, in which case the
+// first items up to the returned count were added and the rest were not.
+int threadpool_add_batch(threadpool_t tp, const threadpool_work_t *work,
+                         int n);
+
+// Add work to a thread pool and return a future for its result.
+//
+// The work is added as with threadpool_add. Returns NULL if it was not added,
+// which happens only when threadpool_add would return -1.
+threadpool_future_t threadpool_submit(threadpool_t tp, threadpool_work_t work);
+
+// Add n work items to a thread pool, storing a future for each in futures.
+//
+// The work is added as with threadpool_add_batch, and the return value is the
+// same: the number of items added. futures[i] is set for each added item; the
+// remaining entries are set to NULL.
+int threadpool_submit_batch(threadpool_t tp, const threadpool_work_t *work,
+                            int n, threadpool_future_t *futures);
+
+// Block until the future's work has completed and return its result.
+void *threadpool_future_wait(threadpool_future_t f);
+
+// If the future's work has completed, store its result in *result (when result
+// is not NULL) and return 1. Otherwise return 0 without blocking.
+int threadpool_future_try_get(threadpool_future_t f, void **result);
+
+// Block until the work of all n futures has completed. The futures must belong
+// to the same pool.
+void threadpool_future_wait_all(threadpool_future_t *futures, int n);
+
+// Block until the work of at least one of the n futures has completed and
+// return the index of a completed future. The futures must belong to the same
+// pool, and n must be positive.
+int threadpool_future_wait_any(threadpool_future_t *futures, int n);
+
+// Free a future. Its work must have completed, i.e. a wait on it must have
+// returned or threadpool_future_try_get must have returned 1.
+void threadpool_future_free(threadpool_future_t f);
 
 // Returns a snapshot of the current counter values.
 threadpool_counters_t threadpool_counters(threadpool_t tp);
 
+// Returns a snapshot of the pool's statistics, which must be freed with
+// threadpool_stats_free. The pool may be in any state.
+threadpool_stats_t *threadpool_stats(threadpool_t tp);
+
+// Free a snapshot returned by threadpool_stats.
+void threadpool_stats_free(threadpool_stats_t *stats);
+
+// Returns the id (0 to nthreads - 1) of the calling thread if it is one of tp's
+// workers, or -1 otherwise. Work can use it to keep per-worker state, such as
+// partial results that are combined once all of the work has completed.
+int threadpool_worker_id(threadpool_t tp);
+
+// Returns an upper bound on the p-th quantile (0 <= p <= 1) of the durations
+// in a histogram: the end of the bucket that holds it, taking the end of the
+// last bucket to be 2^THREADPOOL_HIST_BUCKETS ns. Returns 0 if the histogram is
+// empty.
+unsigned long threadpool_histogram_quantile(const threadpool_histogram_t *h,
+                                            double p);
+
 #endif
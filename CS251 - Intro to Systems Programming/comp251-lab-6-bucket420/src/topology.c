@@ -0,0 +1,130 @@
+#define _GNU_SOURCE
+#include "topology.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <linux/limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "util.h"
+
+#define CPU_DIR "/sys/devices/system/cpu"
+#define NODE_DIR "/sys/devices/system/node"
+// Longest cpulist file read.
+#define CPULIST_LEN 4096
+
+// Reads a single integer from a /sys file. Returns def if the file is missing
+// or malformed.
+int read_int(const char *path, int def) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    return def;
+  }
+  int v;
+  if (fscanf(f, "%d", &v) != 1) {
+    v = def;
+  }
+  fclose(f);
+  return v;
+}
+
+int topology_parse_cpus(const char *list, int *cpus, int max) {
+  int n = 0;
+  const char *p = list;
+  while (*p && *p != '\n') {
+    char *end;
+    if (!isdigit(*p)) {
+      return -1;
+    }
+    long lo = strtol(p, &end, 10);
+    long hi = lo;
+    p = end;
+    if (*p == '-') {
+      p++;
+      if (!isdigit(*p)) {
+        return -1;
+      }
+      hi = strtol(p, &end, 10);
+      p = end;
+    }
+    if (hi < lo || hi >= CPU_SETSIZE) {
+      return -1;
+    }
+    for (long c = lo; c <= hi; c++) {
+      if (n < max) {
+        cpus[n] = c;
+      }
+      n++;
+    }
+    if (*p == ',') {
+      p++;
+      if (!isdigit(*p)) {
+        return -1;
+      }
+    } else if (*p && *p != '\n') {
+      return -1;
+    }
+  }
+  return n;
+}
+
+// Sets node[c] for each CPU c listed in the cpulist of a NUMA node in /sys.
+// Entries for CPUs not listed are left unchanged.
+void read_nodes(int *node) {
+  DIR *d = opendir(NODE_DIR);
+  if (!d) {
+    return;
+  }
+  int *cpus = malloc(CPU_SETSIZE * sizeof(int));
+  assert(cpus);
+  struct dirent *ent;
+  while ((ent = readdir(d)) != NULL) {
+    int id;
+    if (sscanf(ent->d_name, "node%d", &id) != 1) {
+      continue;
+    }
+    char path[PATH_MAX];
+    snprintf(path, PATH_MAX, NODE_DIR "/%s/cpulist", ent->d_name);
+    FILE *f = fopen(path, "r");
+    if (!f) {
+      continue;
+    }
+    char list[CPULIST_LEN];
+    if (fgets(list, CPULIST_LEN, f)) {
+      int n = topology_parse_cpus(list, cpus, CPU_SETSIZE);
+      for (int i = 0; i < n; i++) {
+        node[cpus[i]] = id;
+      }
+    }
+    fclose(f);
+  }
+  free(cpus);
+  closedir(d);
+}
+
+struct cpu_info *topology_cpus(int *n) {
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  assertz(sched_getaffinity(0, sizeof(cpu_set_t), &allowed));
+  int *node = calloc(CPU_SETSIZE, sizeof(int));
+  assert(node);
+  read_nodes(node);
+  struct cpu_info *cpus = malloc(CPU_COUNT(&allowed) * sizeof(struct cpu_info));
+  assert(cpus);
+  *n = 0;
+  for (int c = 0; c < CPU_SETSIZE; c++) {
+    if (!CPU_ISSET(c, &allowed)) {
+      continue;
+    }
+    char path[PATH_MAX];
+    snprintf(path, PATH_MAX, CPU_DIR "/cpu%d/topology/physical_package_id", c);
+    int package = read_int(path, 0);
+    snprintf(path, PATH_MAX, CPU_DIR "/cpu%d/topology/core_id", c);
+    int core = read_int(path, c);
+    cpus[(*n)++] = (struct cpu_info){c, package, core, node[c]};
+  }
+  free(node);
+  return cpus;
+}
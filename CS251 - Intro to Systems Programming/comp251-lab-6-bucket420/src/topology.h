@@ -0,0 +1,26 @@
+#ifndef __TOPOLOGY_H__
+#define __TOPOLOGY_H__
+
+// CPU and NUMA topology of the machine, read from /sys.
+//
+// Only CPUs the process may run on (see sched_getaffinity) are listed. If the
+// /sys files are missing, every CPU is taken to be its own core on node 0.
+
+// A CPU and where it sits.
+struct cpu_info {
+  int cpu;     // CPU number, as used by sched_setaffinity
+  int package; // physical package (socket)
+  int core;    // physical core within the package
+  int node;    // NUMA node
+};
+
+// Return the CPUs the process may run on, ordered by CPU number, and set n to
+// their count. The array must be freed by the caller.
+struct cpu_info *topology_cpus(int *n);
+
+// Parse a CPU list such as "0-3,8,10-11", the format of /sys cpulist files,
+// storing up to max CPUs in cpus. Returns the number of CPUs in the list (which
+// may be more than max), or -1 if the list is malformed.
+int topology_parse_cpus(const char *list, int *cpus, int max);
+
+#endif
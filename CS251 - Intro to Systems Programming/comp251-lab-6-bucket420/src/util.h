@@ -9,6 +9,9 @@
 
 #define assertz(expr) assert((expr) == 0)
 
+// Size of a cache line, for keeping data written by different threads apart.
+#define CACHE_LINE 64
+
 #ifdef DEBUG
 
 #include <assert.h>